@@ -0,0 +1,83 @@
+#include "boot_timeline.h"
+
+#include <string.h>
+
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "stdatomic.h"
+
+// When each phase completed, or 0 if it hasn't.
+static int64_t boot_marks[BOOT_PHASE_COUNT] = {0};
+static SemaphoreHandle_t boot_marks_mutex = NULL;
+static StaticSemaphore_t boot_marks_mutex_mem;
+
+// One bit per phase that has been recorded.
+// Lets `boot_timeline_mark()` skip the mutex once a phase is recorded.
+static atomic_uint marked_phases = 0;
+
+_Static_assert(BOOT_PHASE_COUNT <= 32, "marked_phases has too few bits");
+
+esp_err_t boot_timeline_init(void) {
+  boot_marks_mutex = xSemaphoreCreateMutexStatic(&boot_marks_mutex_mem);
+  if (boot_marks_mutex == NULL) {
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
+
+void boot_timeline_mark(boot_phase_t phase) {
+  uint32_t bit = 1U << phase;
+  if (boot_marks_mutex == NULL || (atomic_load(&marked_phases) & bit)) {
+    return;
+  }
+  if (atomic_fetch_or(&marked_phases, bit) & bit) {
+    return;
+  }
+
+  int64_t now = esp_timer_get_time();
+  assert(xSemaphoreTake(boot_marks_mutex, portMAX_DELAY) == pdTRUE);
+  boot_marks[phase] = now;
+  assert(xSemaphoreGive(boot_marks_mutex) == pdTRUE);
+}
+
+esp_err_t boot_timeline_get(int64_t marks_out[BOOT_PHASE_COUNT]) {
+  if (boot_marks_mutex == NULL) {
+    return ESP_FAIL;
+  }
+  assert(xSemaphoreTake(boot_marks_mutex, portMAX_DELAY) == pdTRUE);
+  memcpy(marks_out, boot_marks, sizeof(boot_marks));
+  assert(xSemaphoreGive(boot_marks_mutex) == pdTRUE);
+  return ESP_OK;
+}
+
+const char *boot_timeline_phase_name(boot_phase_t phase) {
+  switch (phase) {
+    case BOOT_PHASE_CAN_STARTED:
+      return "CAN driver started";
+    case BOOT_PHASE_CAN_LISTENER_STARTED:
+      return "CAN listener started";
+    case BOOT_PHASE_FIRST_CAN_FRAME:
+      return "First CAN frame received";
+    case BOOT_PHASE_HTTP_SERVER_STARTED:
+      return "HTTP server started";
+    case BOOT_PHASE_SOCKETCAND_SERVER_STARTED:
+      return "socketcand server started";
+    case BOOT_PHASE_ETH_STARTED:
+      return "Ethernet started";
+    case BOOT_PHASE_ETH_LINK_UP:
+      return "Ethernet link up";
+    case BOOT_PHASE_ETH_GOT_IP:
+      return "Ethernet got IP";
+    case BOOT_PHASE_WIFI_STARTED:
+      return "Wi-Fi started";
+    case BOOT_PHASE_WIFI_CONNECTED:
+      return "Wi-Fi connected";
+    case BOOT_PHASE_WIFI_GOT_IP:
+      return "Wi-Fi got IP";
+    case BOOT_PHASE_FIRST_CLIENT:
+      return "First socketcand client connected";
+    default:
+      return "Unknown";
+  }
+}
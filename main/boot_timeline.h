@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+// Records when each phase of startup first completed,
+// so slow boots can be diagnosed from the status page.
+
+// The startup phases that get recorded.
+typedef enum {
+  BOOT_PHASE_CAN_STARTED,
+  BOOT_PHASE_CAN_LISTENER_STARTED,
+  BOOT_PHASE_FIRST_CAN_FRAME,
+  BOOT_PHASE_HTTP_SERVER_STARTED,
+  BOOT_PHASE_SOCKETCAND_SERVER_STARTED,
+  BOOT_PHASE_ETH_STARTED,
+  BOOT_PHASE_ETH_LINK_UP,
+  BOOT_PHASE_ETH_GOT_IP,
+  BOOT_PHASE_WIFI_STARTED,
+  BOOT_PHASE_WIFI_CONNECTED,
+  BOOT_PHASE_WIFI_GOT_IP,
+  BOOT_PHASE_FIRST_CLIENT,
+
+  // Number of phases. Not a phase.
+  BOOT_PHASE_COUNT,
+} boot_phase_t;
+
+// Creates the mutex guarding the timeline.
+// Must be called first thing in `app_main()`.
+// Marks made before this are ignored.
+esp_err_t boot_timeline_init(void);
+
+// Records that `phase` completed now, unless it was already recorded.
+// Cheap after the first call for each phase.
+void boot_timeline_mark(boot_phase_t phase);
+
+// Fills `marks_out` with the `esp_timer_get_time()` at which each phase
+// completed, in microseconds since boot. Phases that haven't completed
+// yet are 0.
+esp_err_t boot_timeline_get(int64_t marks_out[BOOT_PHASE_COUNT]);
+
+// Returns a human-readable name of `phase`.
+const char* boot_timeline_phase_name(boot_phase_t phase);
@@ -0,0 +1,162 @@
+#include "can_autobaud.h"
+
+#include "can_listener.h"
+#include "driver_setup.h"
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "stdatomic.h"
+
+// How long to listen at each candidate bitrate.
+#define PROBE_WINDOW_MS 250
+
+// How often the frame and error counters are checked while probing.
+#define PROBE_POLL_MS 10
+
+// A candidate is accepted early once this many frames were received.
+#define PROBE_FRAMES_WANTED 3
+
+// Name that will be used for logging
+static const char *TAG = "can_autobaud";
+
+// Bitrates to try, most common first.
+static const enum can_bitrate_setting candidate_bitrates[] = {
+    CAN_KBITS_500, CAN_KBITS_250, CAN_KBITS_125, CAN_KBITS_1000,
+    CAN_KBITS_800, CAN_KBITS_100, CAN_KBITS_50,  CAN_KBITS_25,
+};
+
+// Set while `can_autobaud_run()` is running.
+static atomic_bool autobaud_running = false;
+
+// Listens at `bitrate` in listen-only mode.
+// Sets `detected_out` to true if valid frames were received
+// without any bus errors.
+static esp_err_t probe_bitrate(enum can_bitrate_setting bitrate,
+                               bool *detected_out);
+
+// Returns the number of frames `can_listener` has received so far.
+static uint64_t frames_received(void);
+
+esp_err_t can_autobaud_run(enum can_bitrate_setting *bitrate_out) {
+  if (atomic_exchange(&autobaud_running, true)) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  int64_t start_us = esp_timer_get_time();
+  enum can_bitrate_setting previous_bitrate = persistent_settings->can_bitrate;
+  enum can_bitrate_setting detected_bitrate = previous_bitrate;
+  bool detected = false;
+  esp_err_t err = ESP_OK;
+
+  for (size_t i = 0;
+       i < sizeof(candidate_bitrates) / sizeof(candidate_bitrates[0]); i++) {
+    err = probe_bitrate(candidate_bitrates[i], &detected);
+    if (err != ESP_OK) {
+      break;
+    }
+    if (detected) {
+      detected_bitrate = candidate_bitrates[i];
+      break;
+    }
+  }
+
+  // Go back to normal mode, either at the detected bitrate,
+  // or at the one we started with.
+  twai_timing_config_t timing_config;
+  esp_err_t restore_err =
+      persistent_settings_get_timing_config(detected_bitrate, &timing_config);
+  if (restore_err == ESP_OK) {
+    restore_err =
+        driver_setup_can_reconfigure(&timing_config, TWAI_MODE_NORMAL);
+  }
+  if (restore_err != ESP_OK) {
+    ESP_LOGE(TAG, "Couldn't put CAN driver back in normal mode: %s",
+             esp_err_to_name(restore_err));
+    atomic_store(&autobaud_running, false);
+    return restore_err;
+  }
+
+  if (err != ESP_OK) {
+    atomic_store(&autobaud_running, false);
+    return err;
+  }
+
+  if (!detected) {
+    ESP_LOGW(TAG, "Couldn't detect CAN bitrate. Staying at %d kbit/s.",
+             previous_bitrate);
+    atomic_store(&autobaud_running, false);
+    return ESP_ERR_NOT_FOUND;
+  }
+
+  ESP_LOGI(TAG, "Detected CAN bitrate %d kbit/s in %lld ms.",
+           detected_bitrate, (esp_timer_get_time() - start_us) / 1000);
+
+  // Remember the detected bitrate.
+  if (detected_bitrate != previous_bitrate) {
+    persistent_settings_t new_settings = *persistent_settings;
+    new_settings.can_bitrate = detected_bitrate;
+    err = persistent_settings_save(&new_settings);
+    if (err == ESP_OK) {
+      err = persistent_settings_load();
+    }
+    if (err != ESP_OK) {
+      ESP_LOGE(TAG, "Couldn't save detected CAN bitrate: %s",
+               esp_err_to_name(err));
+    }
+  }
+
+  *bitrate_out = detected_bitrate;
+  atomic_store(&autobaud_running, false);
+  return err;
+}
+
+static esp_err_t probe_bitrate(enum can_bitrate_setting bitrate,
+                               bool *detected_out) {
+  *detected_out = false;
+
+  twai_timing_config_t timing_config;
+  esp_err_t err = persistent_settings_get_timing_config(bitrate, &timing_config);
+  ESP_RETURN_ON_ERROR(err, TAG, "Invalid candidate bitrate.");
+
+  err = driver_setup_can_reconfigure(&timing_config, TWAI_MODE_LISTEN_ONLY);
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't reconfigure CAN driver.");
+
+  // `can_listener` keeps receiving while we probe,
+  // so count the frames it sees.
+  uint64_t frames_before = frames_received();
+  uint64_t frames = 0;
+
+  for (int elapsed_ms = 0; elapsed_ms < PROBE_WINDOW_MS;
+       elapsed_ms += PROBE_POLL_MS) {
+    vTaskDelay(pdMS_TO_TICKS(PROBE_POLL_MS));
+
+    twai_status_info_t status;
+    err = driver_setup_can_get_status_info(&status);
+    ESP_RETURN_ON_ERROR(err, TAG, "Couldn't get CAN status.");
+
+    // A wrong bitrate shows up as bit, stuff or CRC errors
+    // almost immediately, so move on to the next candidate.
+    if (status.bus_error_count > 0) {
+      ESP_LOGD(TAG, "%d kbit/s: bus errors.", bitrate);
+      return ESP_OK;
+    }
+
+    frames = frames_received() - frames_before;
+    if (frames >= PROBE_FRAMES_WANTED) {
+      break;
+    }
+  }
+
+  ESP_LOGD(TAG, "%d kbit/s: %llu frames.", bitrate, frames);
+  *detected_out = frames > 0;
+  return ESP_OK;
+}
+
+static uint64_t frames_received(void) {
+  can_listener_status_t status;
+  if (can_listener_get_status(&status) != ESP_OK) {
+    return 0;
+  }
+  return status.can_bus_frames_received;
+}
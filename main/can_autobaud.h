@@ -0,0 +1,24 @@
+#pragma once
+
+#include "esp_err.h"
+#include "persistent_settings.h"
+
+// Detects the bitrate of the connected CAN bus, without rebooting.
+//
+// Reinstalls the CAN driver in listen-only mode for each bitrate
+// known to `persistent_settings_get_timing_config()`, and picks the
+// first one that receives valid frames without any bus errors.
+// Listen-only mode never acknowledges or transmits, so probing
+// doesn't disturb the bus.
+//
+// On success, switches the CAN driver to normal mode at the detected
+// bitrate, saves it as the `can_bitrate` persistent setting,
+// and sets `bitrate_out` to it.
+// If no bitrate was detected, restores the previous bitrate
+// and returns `ESP_ERR_NOT_FOUND`.
+// If a detection is already running, returns `ESP_ERR_INVALID_STATE`.
+//
+// Blocks for up to about 2 seconds.
+// Must only be called after `driver_setup_can()` and
+// `can_listener_start()`.
+esp_err_t can_autobaud_run(enum can_bitrate_setting* bitrate_out);
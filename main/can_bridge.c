@@ -0,0 +1,535 @@
+#include "can_bridge.h"
+
+#include <string.h>
+
+#include "can_listener.h"
+#include "deferred_log.h"
+#include "driver_setup.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "lwip/sockets.h"
+#include "task_config.h"
+#include "text_parse.h"
+
+#define BRIDGE_VERSION 1
+
+// Types of datagrams.
+#define BRIDGE_TYPE_DATA 0
+#define BRIDGE_TYPE_PING 1
+#define BRIDGE_TYPE_PONG 2
+
+// Size of the header of every datagram: version, type,
+// frame count (uint16), sequence number (uint32), and origin (uint32).
+// All fields are big-endian.
+#define HEADER_LEN 12
+
+// Size of a frame without its data: `can_id` (uint32) and length.
+#define FRAME_HEADER_LEN 5
+
+// Size of the payload of pings and pongs: the sender's time in µs.
+#define PING_LEN 8
+
+// How long a frame from the peer may wait for space in the CAN
+// transmit queue.
+#define CAN_TX_TIMEOUT_MS 10
+
+// How often the peer is pinged,
+// and how long it's up after answering.
+#define PING_INTERVAL_US 1000000
+#define PEER_TIMEOUT_US 3000000
+
+// Name that will be used for logging
+static const char *TAG = "can_bridge";
+
+static int udp_sock = -1;
+static struct sockaddr_in peer_addr;
+static can_bridge_rules_t bridge_rules;
+
+// Tags the datagrams of this adapter. Random, so two adapters
+// practically never share it.
+static uint32_t origin;
+
+// Queue of `can_listener_frame_t` incoming from the CAN bus.
+static QueueHandle_t can_rx_queue = NULL;
+
+static const can_listener_options_t can_rx_queue_options = {
+    .depth = CAN_LISTENER_DEFAULT_DEPTH,
+    .overflow = CAN_LISTENER_OVERFLOW_DROP_OLDEST,
+    .owner = "bridge",
+};
+
+static can_bridge_status_t status = {0};
+static int64_t last_pong_us = 0;
+static SemaphoreHandle_t status_mutex = NULL;
+static StaticSemaphore_t status_mutex_mem;
+
+// Task that batches frames from the CAN bus into datagrams,
+// and pings the peer.
+static void can_bridge_tx_task(void *pvParameters);
+static StackType_t can_bridge_tx_task_stack[4096];
+static StaticTask_t can_bridge_tx_task_mem;
+
+// Task that transmits frames from the peer on the CAN bus,
+// and answers its pings.
+static void can_bridge_rx_task(void *pvParameters);
+static StackType_t can_bridge_rx_task_stack[4096];
+static StaticTask_t can_bridge_rx_task_mem;
+
+// Applies the bridge rules to `msg`, possibly changing its ID.
+// Returns false if it mustn't be forwarded.
+// Sets `rewritten_out` if its ID was changed.
+static bool apply_rules(twai_message_t *msg, bool *rewritten_out);
+
+// Parses the datagram in `buf` from the peer and handles it.
+static void handle_datagram(const uint8_t *buf, size_t len);
+
+// Writes a datagram header to `buf`.
+static void put_header(uint8_t *buf, uint8_t type, uint16_t count,
+                       uint32_t seq);
+
+// Sends `len` bytes of `buf` to the peer.
+// Returns true if it was sent.
+static bool send_to_peer(const uint8_t *buf, size_t len);
+
+// Big-endian helpers.
+static void put_be32(uint8_t *buf, uint32_t value);
+static uint32_t get_be32(const uint8_t *buf);
+
+esp_err_t can_bridge_parse_rules(const char *rules,
+                                 can_bridge_rules_t *rules_out) {
+  char buf[CAN_BRIDGE_RULES_LEN];
+  if (strlen(rules) >= sizeof(buf)) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  strcpy(buf, rules);
+
+  rules_out->count = 0;
+  char *saveptr;
+  for (char *token = strtok_r(buf, " ", &saveptr); token != NULL;
+       token = strtok_r(NULL, " ", &saveptr)) {
+    if (rules_out->count >= CAN_BRIDGE_RULES_MAX) {
+      return ESP_ERR_INVALID_ARG;
+    }
+    can_bridge_rule_t *rule = &rules_out->rules[rules_out->count];
+
+    char *spec = strchr(token, ':');
+    if (spec == NULL) {
+      return ESP_ERR_INVALID_ARG;
+    }
+    *spec = '\0';
+    spec += 1;
+
+    char *second;
+    if (strcmp(token, "allow") == 0 || strcmp(token, "deny") == 0) {
+      rule->kind = token[0] == 'a' ? CAN_BRIDGE_RULE_ALLOW
+                                   : CAN_BRIDGE_RULE_DENY;
+      second = strchr(spec, '-');
+      if (second != NULL) {
+        *second = '\0';
+        second += 1;
+      }
+      if (!text_parse_number(spec, 16, CAN_EFF_MASK, &rule->first) ||
+          (second != NULL &&
+           !text_parse_number(second, 16, CAN_EFF_MASK, &rule->last))) {
+        return ESP_ERR_INVALID_ARG;
+      }
+      if (second == NULL) {
+        rule->last = rule->first;
+      }
+      if (rule->last < rule->first) {
+        return ESP_ERR_INVALID_ARG;
+      }
+      rule->target = 0;
+    } else if (strcmp(token, "map") == 0) {
+      rule->kind = CAN_BRIDGE_RULE_MAP;
+      second = strchr(spec, '=');
+      if (second == NULL) {
+        return ESP_ERR_INVALID_ARG;
+      }
+      *second = '\0';
+      second += 1;
+      if (!text_parse_number(spec, 16, CAN_EFF_MASK, &rule->first) ||
+          !text_parse_number(second, 16, CAN_EFF_MASK, &rule->target)) {
+        return ESP_ERR_INVALID_ARG;
+      }
+      rule->last = rule->first;
+    } else {
+      return ESP_ERR_INVALID_ARG;
+    }
+
+    rules_out->count += 1;
+  }
+
+  return ESP_OK;
+}
+
+esp_err_t can_bridge_start(const esp_ip4_addr_t *peer_ip, uint16_t port,
+                           const can_bridge_rules_t *rules) {
+  if (peer_ip->addr == 0) {
+    ESP_LOGE(TAG, "The bridge needs a peer IP.");
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  udp_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (udp_sock < 0) {
+    ESP_LOGE(TAG, "Unable to create socket: errno %d", errno);
+    return ESP_FAIL;
+  }
+
+  struct sockaddr_in local_addr = {0};
+  local_addr.sin_family = AF_INET;
+  local_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  local_addr.sin_port = htons(port);
+  if (bind(udp_sock, (struct sockaddr *)&local_addr, sizeof(local_addr)) !=
+      0) {
+    ESP_LOGE(TAG, "Socket unable to bind: errno %d", errno);
+    close(udp_sock);
+    udp_sock = -1;
+    return ESP_FAIL;
+  }
+
+  memset(&peer_addr, 0, sizeof(peer_addr));
+  peer_addr.sin_family = AF_INET;
+  peer_addr.sin_addr.s_addr = peer_ip->addr;
+  peer_addr.sin_port = htons(port);
+  bridge_rules = *rules;
+  origin = esp_random();
+
+  esp_err_t err = can_listener_get(&can_rx_queue_options, &can_rx_queue);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Couldn't get CAN receive queue: %s", esp_err_to_name(err));
+    close(udp_sock);
+    udp_sock = -1;
+    return err;
+  }
+
+  status_mutex = xSemaphoreCreateMutexStatic(&status_mutex_mem);
+  if (status_mutex == NULL) {
+    ESP_LOGE(TAG, "Unreachable. Bridge mutex couldn't be created.");
+    return ESP_FAIL;
+  }
+
+  task_config_create_static(TASK_ID_CAN_BRIDGE_TX, can_bridge_tx_task,
+                            sizeof(can_bridge_tx_task_stack), NULL,
+                            can_bridge_tx_task_stack, &can_bridge_tx_task_mem);
+  task_config_create_static(TASK_ID_CAN_BRIDGE_RX, can_bridge_rx_task,
+                            sizeof(can_bridge_rx_task_stack), NULL,
+                            can_bridge_rx_task_stack, &can_bridge_rx_task_mem);
+
+  ESP_LOGI(TAG, "Bridging to " IPSTR ":%d with %d rules.", IP2STR(peer_ip),
+           port, rules->count);
+  return ESP_OK;
+}
+
+esp_err_t can_bridge_get_status(can_bridge_status_t *status_out) {
+  if (status_mutex == NULL) {
+    return ESP_FAIL;
+  }
+
+  assert(xSemaphoreTake(status_mutex, portMAX_DELAY) == pdTRUE);
+  *status_out = status;
+  status_out->peer_up =
+      last_pong_us != 0 &&
+      esp_timer_get_time() - last_pong_us < PEER_TIMEOUT_US;
+  assert(xSemaphoreGive(status_mutex) == pdTRUE);
+
+  return ESP_OK;
+}
+
+static void can_bridge_tx_task(void *pvParameters) {
+  uint8_t datagram[CAN_BRIDGE_MTU];
+  size_t len = HEADER_LEN;
+  uint16_t count = 0;
+  uint32_t seq = 0;
+  int64_t first_frame_us = 0;
+  int64_t wait_sum_us = 0;
+  int64_t next_ping_us = 0;
+
+  while (true) {
+    // Wait for the first frame of a datagram until the next ping,
+    // and for further ones until the batch times out.
+    int64_t deadline_us =
+        count > 0 ? first_frame_us + CAN_BRIDGE_TIMEOUT_US : next_ping_us;
+    can_listener_frame_t rx_frame;
+    bool received =
+        can_listener_receive_until(can_rx_queue, deadline_us, &rx_frame);
+
+    // Error frames report this adapter's controller state,
+    // which means nothing on the peer's bus.
+    bool forward = false;
+    if (received && (rx_frame.msg.identifier & CAN_LISTENER_ERR_FLAG) == 0) {
+      bool rewritten = false;
+      forward = apply_rules(&rx_frame.msg, &rewritten);
+
+      assert(xSemaphoreTake(status_mutex, portMAX_DELAY) == pdTRUE);
+      if (!forward) {
+        status.frames_filtered += 1;
+      } else if (rewritten) {
+        status.frames_rewritten += 1;
+      }
+      assert(xSemaphoreGive(status_mutex) == pdTRUE);
+    }
+
+    // Send the datagram if it timed out, or the frame doesn't fit.
+    // Frames that aren't forwarded mustn't hold it back.
+    int64_t now = esp_timer_get_time();
+    bool timed_out = now - first_frame_us >= CAN_BRIDGE_TIMEOUT_US;
+    if (count > 0 &&
+        (!received || timed_out ||
+         (forward &&
+          len + FRAME_HEADER_LEN + can_listener_data_len(&rx_frame.msg) >
+              CAN_BRIDGE_MTU))) {
+      put_header(datagram, BRIDGE_TYPE_DATA, count, seq);
+      seq += 1;
+      bool sent = send_to_peer(datagram, len);
+
+      now = esp_timer_get_time();
+      int32_t wait_avg_us = (now * count - wait_sum_us) / count;
+      assert(xSemaphoreTake(status_mutex, portMAX_DELAY) == pdTRUE);
+      if (sent) {
+        status.datagrams_sent += 1;
+        status.frames_sent += count;
+      } else {
+        status.send_failed += count;
+      }
+      // Exponential moving average over about 16 datagrams.
+      status.batch_wait_avg_us +=
+          (wait_avg_us - (int32_t)status.batch_wait_avg_us) / 16;
+      assert(xSemaphoreGive(status_mutex) == pdTRUE);
+
+      len = HEADER_LEN;
+      count = 0;
+      wait_sum_us = 0;
+    }
+
+    now = esp_timer_get_time();
+    if (count == 0 && now >= next_ping_us) {
+      uint8_t ping[HEADER_LEN + PING_LEN];
+      put_header(ping, BRIDGE_TYPE_PING, 0, 0);
+      put_be32(&ping[HEADER_LEN], (uint64_t)now >> 32);
+      put_be32(&ping[HEADER_LEN + 4], now & 0xFFFFFFFF);
+      send_to_peer(ping, sizeof(ping));
+      next_ping_us = now + PING_INTERVAL_US;
+    }
+
+    if (!forward) {
+      continue;
+    }
+
+    if (count == 0) {
+      first_frame_us = now;
+    }
+    wait_sum_us += rx_frame.rx_time_us;
+
+    size_t payload_len = can_listener_data_len(&rx_frame.msg);
+    put_be32(&datagram[len], can_listener_socketcan_id(&rx_frame.msg));
+    datagram[len + 4] = payload_len;
+    memcpy(&datagram[len + FRAME_HEADER_LEN], rx_frame.msg.data,
+           payload_len);
+    len += FRAME_HEADER_LEN + payload_len;
+    count += 1;
+  }
+}
+
+static void can_bridge_rx_task(void *pvParameters) {
+  uint8_t datagram[CAN_BRIDGE_MTU];
+
+  while (true) {
+    struct sockaddr_in source_addr;
+    socklen_t addr_len = sizeof(source_addr);
+    int len = recvfrom(udp_sock, datagram, sizeof(datagram), 0,
+                       (struct sockaddr *)&source_addr, &addr_len);
+    if (len < 0) {
+      ESP_LOGE(TAG, "Couldn't receive bridge datagram: errno %d", errno);
+      vTaskDelay(pdMS_TO_TICKS(100));
+      continue;
+    }
+
+    // Only the configured peer may inject frames.
+    if (source_addr.sin_addr.s_addr != peer_addr.sin_addr.s_addr) {
+      continue;
+    }
+
+    handle_datagram(datagram, len);
+  }
+}
+
+static void handle_datagram(const uint8_t *buf, size_t len) {
+  // Sequence number the next data datagram should have, and the origin
+  // of the last one. Datagrams are only counted as lost once one arrived
+  // from the current origin, which changes when the peer restarts.
+  static bool seq_known = false;
+  static uint32_t expected_seq = 0;
+  static uint32_t peer_origin = 0;
+
+  if (len < HEADER_LEN || buf[0] != BRIDGE_VERSION) {
+    return;
+  }
+  uint8_t type = buf[1];
+  uint16_t count = (buf[2] << 8) | buf[3];
+  uint32_t seq = get_be32(&buf[4]);
+
+  // A datagram of our own came back,
+  // for example because the peer IP points at this adapter.
+  uint32_t sender = get_be32(&buf[8]);
+  if (sender == origin) {
+    assert(xSemaphoreTake(status_mutex, portMAX_DELAY) == pdTRUE);
+    status.loops_dropped += 1;
+    assert(xSemaphoreGive(status_mutex) == pdTRUE);
+    return;
+  }
+
+  if (type == BRIDGE_TYPE_PING && len == HEADER_LEN + PING_LEN) {
+    uint8_t pong[HEADER_LEN + PING_LEN];
+    put_header(pong, BRIDGE_TYPE_PONG, 0, 0);
+    memcpy(&pong[HEADER_LEN], &buf[HEADER_LEN], PING_LEN);
+    send_to_peer(pong, sizeof(pong));
+    return;
+  }
+
+  if (type == BRIDGE_TYPE_PONG && len == HEADER_LEN + PING_LEN) {
+    int64_t now = esp_timer_get_time();
+    int64_t sent_us = ((uint64_t)get_be32(&buf[HEADER_LEN]) << 32) |
+                      get_be32(&buf[HEADER_LEN + 4]);
+    uint32_t rtt_us = now - sent_us;
+
+    assert(xSemaphoreTake(status_mutex, portMAX_DELAY) == pdTRUE);
+    status.rtt_last_us = rtt_us;
+    if (status.rtt_min_us == 0 || rtt_us < status.rtt_min_us) {
+      status.rtt_min_us = rtt_us;
+    }
+    if (rtt_us > status.rtt_max_us) {
+      status.rtt_max_us = rtt_us;
+    }
+    last_pong_us = now;
+    assert(xSemaphoreGive(status_mutex) == pdTRUE);
+    return;
+  }
+
+  if (type != BRIDGE_TYPE_DATA) {
+    return;
+  }
+
+  if (!seq_known || sender != peer_origin) {
+    seq_known = true;
+    peer_origin = sender;
+    expected_seq = seq;
+  }
+  // Late datagrams were already counted as lost.
+  uint32_t lost = 0;
+  if ((int32_t)(seq - expected_seq) >= 0) {
+    lost = seq - expected_seq;
+    expected_seq = seq + 1;
+  }
+
+  uint32_t frames_received = 0;
+  uint32_t can_tx_failed = 0;
+  size_t offset = HEADER_LEN;
+  for (uint16_t i = 0; i < count; i++) {
+    if (offset + FRAME_HEADER_LEN > len) {
+      break;
+    }
+    uint32_t can_id = get_be32(&buf[offset]);
+    uint8_t dlc = buf[offset + 4];
+    offset += FRAME_HEADER_LEN;
+
+    twai_message_t msg = {0};
+    msg.extd = (can_id & CAN_EFF_FLAG) != 0;
+    msg.rtr = (can_id & CAN_RTR_FLAG) != 0;
+    msg.identifier = can_id & (msg.extd ? CAN_EFF_MASK : CAN_SFF_MASK);
+    msg.data_length_code = dlc;
+    size_t payload_len = can_listener_data_len(&msg);
+    if (dlc > TWAI_FRAME_MAX_DLC || offset + payload_len > len) {
+      break;
+    }
+    memcpy(msg.data, &buf[offset], payload_len);
+    offset += payload_len;
+    frames_received += 1;
+
+    esp_err_t err =
+        driver_setup_can_transmit(&msg, pdMS_TO_TICKS(CAN_TX_TIMEOUT_MS));
+    if (err != ESP_OK) {
+      deferred_log(DEFERRED_LOG_CAN_TX_FAILED, err);
+      can_tx_failed += 1;
+    }
+
+    // Send the frame to the other listeners, but not back to the peer.
+    // The TWAI controller doesn't receive its own transmissions,
+    // so this is the only way it could return.
+    can_listener_enqueue_msg(&msg, can_rx_queue);
+  }
+
+  assert(xSemaphoreTake(status_mutex, portMAX_DELAY) == pdTRUE);
+  status.datagrams_received += 1;
+  status.datagrams_lost += lost;
+  status.frames_received += frames_received;
+  status.can_tx_failed += can_tx_failed;
+  assert(xSemaphoreGive(status_mutex) == pdTRUE);
+}
+
+static bool apply_rules(twai_message_t *msg, bool *rewritten_out) {
+  uint32_t id = msg->identifier;
+  bool has_allow = false;
+  bool allowed = false;
+  for (int i = 0; i < bridge_rules.count; i++) {
+    const can_bridge_rule_t *rule = &bridge_rules.rules[i];
+    bool match = id >= rule->first && id <= rule->last;
+    if (rule->kind == CAN_BRIDGE_RULE_ALLOW) {
+      has_allow = true;
+      allowed |= match;
+    } else if (rule->kind == CAN_BRIDGE_RULE_DENY && match) {
+      return false;
+    }
+  }
+  if (has_allow && !allowed) {
+    return false;
+  }
+
+  *rewritten_out = false;
+  for (int i = 0; i < bridge_rules.count; i++) {
+    const can_bridge_rule_t *rule = &bridge_rules.rules[i];
+    if (rule->kind != CAN_BRIDGE_RULE_MAP || id != rule->first) {
+      continue;
+    }
+    // A standard frame can't carry an extended ID.
+    if (!msg->extd && rule->target > CAN_SFF_MASK) {
+      return false;
+    }
+    msg->identifier = rule->target;
+    *rewritten_out = true;
+    break;
+  }
+  return true;
+}
+
+static void put_header(uint8_t *buf, uint8_t type, uint16_t count,
+                       uint32_t seq) {
+  buf[0] = BRIDGE_VERSION;
+  buf[1] = type;
+  buf[2] = count >> 8;
+  buf[3] = count & 0xFF;
+  put_be32(&buf[4], seq);
+  put_be32(&buf[8], origin);
+}
+
+static bool send_to_peer(const uint8_t *buf, size_t len) {
+  return sendto(udp_sock, buf, len, 0, (struct sockaddr *)&peer_addr,
+                sizeof(peer_addr)) >= 0;
+}
+
+static void put_be32(uint8_t *buf, uint32_t value) {
+  buf[0] = value >> 24;
+  buf[1] = (value >> 16) & 0xFF;
+  buf[2] = (value >> 8) & 0xFF;
+  buf[3] = value & 0xFF;
+}
+
+static uint32_t get_be32(const uint8_t *buf) {
+  return ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) |
+         ((uint32_t)buf[2] << 8) | buf[3];
+}
+
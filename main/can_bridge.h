@@ -0,0 +1,118 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_netif_types.h"
+
+// Bridges the CAN bus of this adapter to the CAN bus of a peer adapter
+// over UDP, without a PC in between. Both adapters run the bridge,
+// each pointing at the other with the same port.
+//
+// Frames from the local bus that pass the bridge rules are batched into
+// datagrams and sent to the peer, which transmits them on its bus.
+// The rules only apply on the way out, so each adapter decides what
+// leaves its own segment.
+//
+// Loop prevention: every datagram is tagged with the origin ID of the
+// adapter that sent it, and datagrams with this adapter's own origin
+// are dropped. Frames injected on the local bus aren't passed back to
+// the bridge, and the TWAI controller doesn't receive its own frames.
+// Injected frames aren't recognized when another bridge on the bus
+// forwards them back, so bridges mustn't form a cycle.
+
+// Largest datagram, so it fits in one ethernet frame.
+#define CAN_BRIDGE_MTU 1400
+
+// How long a frame waits for others to share its datagram,
+// rounded up to a FreeRTOS tick.
+#define CAN_BRIDGE_TIMEOUT_US 1000
+
+// Maximum number of rules, of all kinds together.
+#define CAN_BRIDGE_RULES_MAX 16
+
+// Maximum length of the textual rules, including the terminator.
+#define CAN_BRIDGE_RULES_LEN 128
+
+typedef enum {
+  // Only frames matching an allow rule are forwarded,
+  // if there is at least one.
+  CAN_BRIDGE_RULE_ALLOW,
+
+  // Frames matching a deny rule aren't forwarded.
+  CAN_BRIDGE_RULE_DENY,
+
+  // Frames with ID `first` are forwarded with ID `target`.
+  CAN_BRIDGE_RULE_MAP,
+} can_bridge_rule_kind_t;
+
+// A rule matches frames whose ID is between `first` and `last`.
+typedef struct {
+  can_bridge_rule_kind_t kind;
+  uint32_t first;
+  uint32_t last;
+  uint32_t target;
+} can_bridge_rule_t;
+
+typedef struct {
+  can_bridge_rule_t rules[CAN_BRIDGE_RULES_MAX];
+  uint8_t count;
+} can_bridge_rules_t;
+
+// The status of the bridge.
+// Get the current status using `can_bridge_get_status()`.
+typedef struct {
+  // Whether the peer answered a ping in the last 3 seconds.
+  bool peer_up;
+
+  uint64_t datagrams_sent;
+  uint64_t frames_sent;
+  uint64_t datagrams_received;
+  uint64_t frames_received;
+
+  // Datagrams from the peer missing from the sequence.
+  uint64_t datagrams_lost;
+
+  // Frames from the local bus that the rules didn't let through,
+  // and that were forwarded with another ID.
+  uint64_t frames_filtered;
+  uint64_t frames_rewritten;
+
+  // Datagrams with this adapter's origin.
+  uint64_t loops_dropped;
+
+  // Frames from the peer that couldn't be queued for CAN transmission.
+  uint64_t can_tx_failed;
+
+  // Frames that couldn't be sent to the peer.
+  uint64_t send_failed;
+
+  // Round trip time to the peer and back, measured with pings.
+  // 0 until the first answer.
+  uint32_t rtt_last_us;
+  uint32_t rtt_min_us;
+  uint32_t rtt_max_us;
+
+  // Average time frames waited for their datagram to be sent.
+  uint32_t batch_wait_avg_us;
+} can_bridge_status_t;
+
+// Parses the textual `rules` into `rules_out`.
+// Rules are separated by spaces, and IDs are hex:
+//   allow:100-1FF  forward only IDs 0x100 to 0x1FF (and other allowed ones)
+//   deny:7DF       don't forward ID 0x7DF
+//   map:123=323    forward ID 0x123 as 0x323
+// Returns `ESP_ERR_INVALID_ARG` if `rules` are invalid.
+esp_err_t can_bridge_parse_rules(const char* rules,
+                                 can_bridge_rules_t* rules_out);
+
+// Starts bridging to the adapter at `peer_ip`, over UDP `port`,
+// forwarding the frames that pass `rules`.
+// Must only be called once, after `can_listener_start()`.
+esp_err_t can_bridge_start(const esp_ip4_addr_t* peer_ip, uint16_t port,
+                           const can_bridge_rules_t* rules);
+
+// Fills `status_out` with the current `can_bridge_status_t`.
+// Returns an error if the bridge isn't running.
+esp_err_t can_bridge_get_status(can_bridge_status_t* status_out);
@@ -0,0 +1,313 @@
+#include "can_gateway.h"
+
+#include <string.h>
+
+#include "can_listener.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "id_match_table.h"
+#include "stdatomic.h"
+#include "text_parse.h"
+
+_Static_assert(CAN_GATEWAY_RULES_MAX <= ID_MATCH_TABLE_ENTRIES_MAX,
+               "Every rule needs an entry in the match table");
+
+// A compiled set of rules.
+typedef struct {
+  can_gateway_rules_t rules;
+  id_match_table_t table;
+  atomic_uint hits[CAN_GATEWAY_RULES_MAX];
+} rule_set_t;
+
+// Name that will be used for logging
+static const char *TAG = "can_gateway";
+
+// The active set is one of these, and the other is filled by
+// `can_gateway_configure()`. NULL if no rules are active.
+static rule_set_t rule_sets[2];
+static _Atomic(rule_set_t *) active_set = NULL;
+
+// Number of `can_gateway_route()` calls using `active_set`.
+static atomic_int routing = 0;
+
+// Serializes `can_gateway_configure()`.
+// NULL until rules were configured for the first time.
+static SemaphoreHandle_t configure_mutex = NULL;
+static StaticSemaphore_t configure_mutex_mem;
+
+// Parses one rule from `text` into `rule_out`.
+static bool parse_rule(char *text, can_gateway_rule_t *rule_out);
+
+// Parses one ID operation from `text` into `rule`.
+static bool parse_op(const char *text, can_gateway_rule_t *rule);
+
+// Applies the ID operations of `rule` to `msg`.
+static void rewrite(const can_gateway_rule_t *rule, twai_message_t *msg);
+
+esp_err_t can_gateway_parse(const char *spec, can_gateway_rules_t *rules_out) {
+  char buf[CAN_GATEWAY_SPEC_LEN];
+  if (strlen(spec) >= sizeof(buf)) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  strcpy(buf, spec);
+
+  rules_out->count = 0;
+  char *saveptr;
+  for (char *token = strtok_r(buf, " ", &saveptr); token != NULL;
+       token = strtok_r(NULL, " ", &saveptr)) {
+    if (rules_out->count >= CAN_GATEWAY_RULES_MAX ||
+        !parse_rule(token, &rules_out->rules[rules_out->count])) {
+      return ESP_ERR_INVALID_ARG;
+    }
+    rules_out->count += 1;
+  }
+
+  return ESP_OK;
+}
+
+esp_err_t can_gateway_configure(const can_gateway_rules_t *rules) {
+  if (configure_mutex == NULL) {
+    configure_mutex = xSemaphoreCreateMutexStatic(&configure_mutex_mem);
+    if (configure_mutex == NULL) {
+      ESP_LOGE(TAG, "Unreachable. Gateway mutex couldn't be created.");
+      return ESP_FAIL;
+    }
+  }
+  assert(xSemaphoreTake(configure_mutex, portMAX_DELAY) == pdTRUE);
+
+  // The last call waited until nobody used the inactive set.
+  rule_set_t *current = atomic_load(&active_set);
+  rule_set_t *next = current == &rule_sets[0] ? &rule_sets[1] : &rule_sets[0];
+  next->rules = *rules;
+  id_match_table_init(&next->table);
+  for (uint8_t i = 0; i < rules->count; i++) {
+    atomic_store(&next->hits[i], 0);
+    // Keyed like frames in `can_gateway_route()`.
+    const can_gateway_rule_t *rule = &rules->rules[i];
+    uint32_t format = rule->extd ? CAN_EFF_FLAG : 0;
+    esp_err_t err = id_match_table_add(&next->table, rule->id | format,
+                                       rule->mask | CAN_EFF_FLAG, i);
+    if (err != ESP_OK) {
+      ESP_LOGE(TAG, "Too many distinct gateway rule masks.");
+      assert(xSemaphoreGive(configure_mutex) == pdTRUE);
+      return err;
+    }
+  }
+  id_match_table_compile(&next->table);
+
+  atomic_store(&active_set, rules->count > 0 ? next : NULL);
+
+  // Wait until no frame uses the old set, so the next call may fill it.
+  while (atomic_load(&routing) > 0) {
+    vTaskDelay(1);
+  }
+
+  assert(xSemaphoreGive(configure_mutex) == pdTRUE);
+  ESP_LOGI(TAG, "Configured %d gateway rules.", rules->count);
+  return ESP_OK;
+}
+
+uint8_t can_gateway_route(can_gateway_direction_t direction,
+                          const twai_message_t *msg,
+                          twai_message_t *msgs_out) {
+  msgs_out[0] = *msg;
+  // Error frames don't carry an ID to rewrite.
+  if ((msg->identifier & CAN_LISTENER_ERR_FLAG) ||
+      atomic_load_explicit(&active_set, memory_order_relaxed) == NULL) {
+    return 1;
+  }
+
+  atomic_fetch_add(&routing, 1);
+  rule_set_t *set = atomic_load(&active_set);
+
+  uint16_t matches[CAN_GATEWAY_RULES_MAX];
+  uint16_t match_count = 0;
+  if (set != NULL) {
+    uint32_t key = msg->identifier & CAN_EFF_MASK;
+    if (msg->extd) {
+      key |= CAN_EFF_FLAG;
+    }
+    match_count = id_match_table_lookup(&set->table, key, matches,
+                                        CAN_GATEWAY_RULES_MAX);
+  }
+
+  // Lookups return matches in no particular order,
+  // and the first rule of the direction wins.
+  const can_gateway_rule_t *rule = NULL;
+  uint16_t first = CAN_GATEWAY_RULES_MAX;
+  for (uint16_t i = 0; i < match_count; i++) {
+    if (matches[i] < first &&
+        set->rules.rules[matches[i]].direction == direction) {
+      first = matches[i];
+    }
+  }
+
+  uint8_t count = 1;
+  if (first < CAN_GATEWAY_RULES_MAX) {
+    rule = &set->rules.rules[first];
+    atomic_fetch_add_explicit(&set->hits[first], 1, memory_order_relaxed);
+    if (rule->drop) {
+      count = 0;
+    } else if (rule->duplicate) {
+      msgs_out[1] = *msg;
+      rewrite(rule, &msgs_out[1]);
+      count = 2;
+    } else {
+      rewrite(rule, &msgs_out[0]);
+    }
+  }
+
+  atomic_fetch_sub(&routing, 1);
+  return count;
+}
+
+esp_err_t can_gateway_get_status(can_gateway_status_t *status_out) {
+  if (configure_mutex == NULL) {
+    return ESP_FAIL;
+  }
+
+  // Keep the active set from being refilled while copying its counters.
+  assert(xSemaphoreTake(configure_mutex, portMAX_DELAY) == pdTRUE);
+  rule_set_t *set = atomic_load(&active_set);
+  *status_out = (can_gateway_status_t){0};
+  if (set != NULL) {
+    status_out->count = set->rules.count;
+    for (uint8_t i = 0; i < set->rules.count; i++) {
+      status_out->hits[i] = atomic_load(&set->hits[i]);
+    }
+  }
+  assert(xSemaphoreGive(configure_mutex) == pdTRUE);
+
+  return ESP_OK;
+}
+
+static void rewrite(const can_gateway_rule_t *rule, twai_message_t *msg) {
+  uint32_t id = msg->identifier;
+  for (uint8_t i = 0; i < rule->op_count; i++) {
+    const can_gateway_op_t *op = &rule->ops[i];
+    switch (op->kind) {
+      case CAN_GATEWAY_OP_SET:
+        id = op->value;
+        break;
+      case CAN_GATEWAY_OP_ADD:
+        id += op->value;
+        break;
+      case CAN_GATEWAY_OP_AND:
+        id &= op->value;
+        break;
+      case CAN_GATEWAY_OP_OR:
+        id |= op->value;
+        break;
+      case CAN_GATEWAY_OP_STANDARD:
+        msg->extd = 0;
+        break;
+      case CAN_GATEWAY_OP_EXTENDED:
+        msg->extd = 1;
+        break;
+    }
+  }
+  msg->identifier = id & (msg->extd ? CAN_EFF_MASK : CAN_SFF_MASK);
+}
+
+static bool parse_rule(char *text, can_gateway_rule_t *rule_out) {
+  memset(rule_out, 0, sizeof(*rule_out));
+
+  // Split into the direction, the match and the action.
+  char *match = strchr(text, ':');
+  if (match == NULL) {
+    return false;
+  }
+  *match = '\0';
+  match += 1;
+  char *action = strchr(match, '>');
+  if (action == NULL) {
+    return false;
+  }
+  *action = '\0';
+  action += 1;
+  char *mask = strchr(match, '/');
+  if (mask != NULL) {
+    *mask = '\0';
+    mask += 1;
+  }
+
+  if (strcmp(text, "rx") == 0) {
+    rule_out->direction = CAN_GATEWAY_RX;
+  } else if (strcmp(text, "tx") == 0) {
+    rule_out->direction = CAN_GATEWAY_TX;
+  } else {
+    return false;
+  }
+
+  rule_out->extd = strlen(match) == 8;
+  uint32_t id_mask = rule_out->extd ? CAN_EFF_MASK : CAN_SFF_MASK;
+  rule_out->mask = id_mask;
+  if (!text_parse_number(match, 16, id_mask, &rule_out->id) ||
+      (mask != NULL &&
+       !text_parse_number(mask, 16, CAN_EFF_MASK, &rule_out->mask))) {
+    return false;
+  }
+  rule_out->mask &= id_mask;
+
+  if (strcmp(action, "drop") == 0) {
+    rule_out->drop = true;
+    return true;
+  }
+
+  char *saveptr;
+  for (char *op = strtok_r(action, ",", &saveptr); op != NULL;
+       op = strtok_r(NULL, ",", &saveptr)) {
+    if (strcmp(op, "dup") == 0 && rule_out->op_count == 0 &&
+        !rule_out->duplicate) {
+      rule_out->duplicate = true;
+      continue;
+    }
+    if (rule_out->op_count >= CAN_GATEWAY_OPS_MAX ||
+        !parse_op(op, rule_out)) {
+      return false;
+    }
+    rule_out->op_count += 1;
+  }
+
+  // A rule has to do something.
+  return rule_out->duplicate || rule_out->op_count > 0;
+}
+
+static bool parse_op(const char *text, can_gateway_rule_t *rule) {
+  can_gateway_op_t *op = &rule->ops[rule->op_count];
+
+  if (strcmp(text, "std") == 0) {
+    *op = (can_gateway_op_t){.kind = CAN_GATEWAY_OP_STANDARD};
+    return true;
+  }
+  if (strcmp(text, "ext") == 0) {
+    *op = (can_gateway_op_t){.kind = CAN_GATEWAY_OP_EXTENDED};
+    return true;
+  }
+
+  uint32_t value;
+  if (!text_parse_number(text + 1, 16, CAN_EFF_MASK, &value)) {
+    return false;
+  }
+  switch (text[0]) {
+    case '=':
+      *op = (can_gateway_op_t){.kind = CAN_GATEWAY_OP_SET, .value = value};
+      return true;
+    case '+':
+      *op = (can_gateway_op_t){.kind = CAN_GATEWAY_OP_ADD, .value = value};
+      return true;
+    case '-':
+      *op = (can_gateway_op_t){.kind = CAN_GATEWAY_OP_ADD, .value = -value};
+      return true;
+    case '&':
+      *op = (can_gateway_op_t){.kind = CAN_GATEWAY_OP_AND, .value = value};
+      return true;
+    case '|':
+      *op = (can_gateway_op_t){.kind = CAN_GATEWAY_OP_OR, .value = value};
+      return true;
+    default:
+      return false;
+  }
+}
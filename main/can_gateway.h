@@ -0,0 +1,128 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "driver/twai.h"
+#include "esp_err.h"
+
+// Rewrites, drops or duplicates frames between socketcand clients and
+// the bus, so tools that expect other IDs than the bus uses don't each
+// have to remap them, and pay for the round trip.
+//
+// Rules apply either to frames from the bus to clients, or to frames
+// from clients to the bus. They're looked up in an `id_match_table_t`
+// for every frame, and the first matching rule in the order they were
+// written applies. Frames that match no rule pass unchanged.
+
+// Maximum length of the textual rules, including the terminator.
+#define CAN_GATEWAY_SPEC_LEN 256
+
+// Maximum number of rules.
+#define CAN_GATEWAY_RULES_MAX 16
+
+// Maximum number of ID operations of a rule.
+#define CAN_GATEWAY_OPS_MAX 4
+
+// Most frames a rule turns one frame into.
+#define CAN_GATEWAY_OUTPUTS_MAX 2
+
+typedef enum {
+  // Frames from the bus, and from other clients, to a client.
+  CAN_GATEWAY_RX,
+
+  // Frames from a client to the bus.
+  CAN_GATEWAY_TX,
+} can_gateway_direction_t;
+
+typedef enum {
+  // The ID becomes `value`.
+  CAN_GATEWAY_OP_SET,
+
+  // `value` is added to the ID. Subtractions add its negation.
+  CAN_GATEWAY_OP_ADD,
+
+  // The ID is ANDed with `value`.
+  CAN_GATEWAY_OP_AND,
+
+  // The ID is ORed with `value`.
+  CAN_GATEWAY_OP_OR,
+
+  // The frame becomes a standard frame.
+  CAN_GATEWAY_OP_STANDARD,
+
+  // The frame becomes an extended frame.
+  CAN_GATEWAY_OP_EXTENDED,
+} can_gateway_op_kind_t;
+
+typedef struct {
+  can_gateway_op_kind_t kind;
+  uint32_t value;
+} can_gateway_op_t;
+
+typedef struct {
+  can_gateway_direction_t direction;
+
+  // Matches frames of the format `extd` whose ID equals `id`
+  // in the bits set in `mask`.
+  bool extd;
+  uint32_t id;
+  uint32_t mask;
+
+  // Matching frames are dropped.
+  bool drop;
+
+  // Matching frames pass unchanged too, before the rewritten one.
+  bool duplicate;
+
+  // Applied to the ID in order. The result is truncated to 11 bits
+  // for standard frames, and to 29 bits for extended ones.
+  can_gateway_op_t ops[CAN_GATEWAY_OPS_MAX];
+  uint8_t op_count;
+} can_gateway_rule_t;
+
+typedef struct {
+  can_gateway_rule_t rules[CAN_GATEWAY_RULES_MAX];
+  uint8_t count;
+} can_gateway_rules_t;
+
+// The status of the rules.
+// Get the current status using `can_gateway_get_status()`.
+typedef struct {
+  uint8_t count;
+
+  // Number of frames each rule applied to since it was configured.
+  // Frames from the bus count once for every client that isn't on the
+  // fast path, and once for all that are.
+  uint32_t hits[CAN_GATEWAY_RULES_MAX];
+} can_gateway_status_t;
+
+// Parses the textual `spec` into `rules_out`.
+// Rules are separated by spaces. Each is `rx` or `tx`, `:`, a hex ID
+// with an optional `/` and hex mask, `>`, and either `drop`, or the
+// operations on the ID, separated by commas. Operations are `=ID`,
+// `+N`, `-N`, `&MASK` and `|BITS` in hex, and `std` and `ext` to change
+// the frame format. The ID is extended if it has 8 digits, as in
+// candump, and only matches frames of its format. A leading `dup`
+// passes the original frame too:
+//   rx:7E8>=18DAF110,ext tx:18DAF110>=7E0,std rx:7DF>drop
+//   tx:100/700>dup,+400
+// Returns `ESP_ERR_INVALID_ARG` if `spec` is invalid.
+esp_err_t can_gateway_parse(const char* spec, can_gateway_rules_t* rules_out);
+
+// Replaces the active rules with `rules`, and resets their counters.
+// Safe to call while frames are being routed.
+// Returns `ESP_ERR_NO_MEM` if the rules have too many distinct masks.
+esp_err_t can_gateway_configure(const can_gateway_rules_t* rules);
+
+// Routes `msg` in `direction`, writing the resulting frames to
+// `msgs_out`, which must hold `CAN_GATEWAY_OUTPUTS_MAX`.
+// Returns the number of frames written, 0 if `msg` was dropped.
+// Error frames always pass unchanged.
+// Cheap enough to call for every frame, from any task.
+uint8_t can_gateway_route(can_gateway_direction_t direction,
+                          const twai_message_t* msg, twai_message_t* msgs_out);
+
+// Fills `status_out` with the current `can_gateway_status_t`.
+// Returns an error if no rules were ever configured.
+esp_err_t can_gateway_get_status(can_gateway_status_t* status_out);
@@ -1,12 +1,21 @@
 #include "can_listener.h"
 
+#include <string.h>
+
+#include "boot_timeline.h"
+#include "capture_ring.h"
+#include "capture_trigger.h"
 #include "driver/twai.h"
+#include "deferred_log.h"
+#include "driver_setup.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "freertos/queue.h"
+#include "overload_control.h"
+#include "reflex_rules.h"
 #include "stdatomic.h"
-
-// The capacity of each CAN receive queue
-#define CAN_RX_QUEUE_LEN 32
+#include "task_config.h"
+#include "trace_buffer.h"
 
 // The stack size of the can listener task.
 #define STACK_SIZE 4096
@@ -17,21 +26,56 @@ static const char *TAG = "can_listener";
 // A struct that holds a CAN receiver queue that can be loaned
 // with `can_listener_get()`.
 typedef struct {
-  // The `can_listener_task` pushes `twai_message_t`s
+  // The `can_listener_task` pushes `can_listener_frame_t`s
   // from the CAN bus onto all `rx_queue`s that are `in_use`.
+  // It's created on `q_buf` every time the receiver is loaned,
+  // so its handle never changes.
   QueueHandle_t rx_queue;
 
-  // The storage that `rx_queue` uses.
-  uint8_t q_storage[CAN_RX_QUEUE_LEN * sizeof(twai_message_t)];
-
   // The data structure that `rx_queue` uses.
   StaticQueue_t q_buf;
 
+  // The frames of `frame_pool` that `rx_queue` stores its items in,
+  // while `in_use`.
+  size_t pool_offset;
+  size_t depth;
+
+  // What happens to frames that don't fit in `rx_queue`.
+  can_listener_overflow_t overflow;
+
+  // Who loaned the queue. Only used for the status.
+  const char *owner;
+
+  // Largest number of frames that were waiting in `rx_queue`.
+  atomic_uint high_water;
+
+  // Number of frames that didn't fit in `rx_queue`
+  // and were dropped according to `overflow`.
+  atomic_uint frames_dropped;
+
+  // Number of frames not pushed to `rx_queue`
+  // because `overload_control` shed the class of the owner.
+  atomic_uint frames_shed;
+
+  // True once a frame didn't fit, with `CAN_LISTENER_OVERFLOW_DISCONNECT`.
+  atomic_bool overflowed;
+
   // True if this `rx_queue` has been loaned out with
   // `can_listener_get()`. The `can_listener_task` only pushes
   // messages to `can_receiver_t`s that are `in_use`.
   atomic_bool in_use;
 
+  // True if the owner gets frames through the hook,
+  // so the `can_listener_task` doesn't push to `rx_queue`.
+  atomic_bool bypass;
+
+  // True while the owner stopped reading `rx_queue` on purpose,
+  // so its fill doesn't count towards overload.
+  atomic_bool paused;
+
+  // The `can_listener_class_t` of the owner.
+  atomic_int listener_class;
+
 } can_receiver_t;
 
 // All the `can_receiver_t` that can be loaned out with `can_listener_get()`.
@@ -48,6 +92,36 @@ static uint8_t unused_can_receiver_queue_storage[CAN_LISTENERS_MAX *
                                                  sizeof(can_receiver_t *)];
 static StaticQueue_t unused_can_receiver_queue_buf;
 
+// Storage shared by all receive queues.
+// Each loaned queue takes `depth` contiguous frames of it.
+static uint8_t frame_pool[CAN_LISTENER_FRAME_BUDGET *
+                          sizeof(can_listener_frame_t)];
+
+// Taken while loaning and freeing queues, which allocate `frame_pool`.
+static SemaphoreHandle_t pool_mutex = NULL;
+static StaticSemaphore_t pool_mutex_mem;
+
+// Number of `can_listener_enqueue_msg()` calls in progress.
+// A freed queue's frames are only reused once this drops to zero,
+// so nobody is still pushing to it.
+static atomic_int enqueue_users = 0;
+
+// Finds `depth` contiguous frames of `frame_pool` that aren't used
+// by any loaned queue. Returns false if there aren't any.
+// Must be called with `pool_mutex` taken.
+static bool allocate_from_pool(size_t depth, size_t *offset_out);
+
+// Pushes `frame` to the queue of `can_receiver` according to
+// its `overflow` policy. `index` identifies the queue in logs.
+static void push_frame(can_receiver_t *can_receiver, int index,
+                       const can_listener_frame_t *frame);
+
+// Hook installed with `can_listener_set_hook()`, or NULL.
+static _Atomic(can_listener_hook_t) hook = NULL;
+
+// Returns the `can_receiver_t` that owns `can_rx`, or NULL.
+static can_receiver_t *find_receiver(const QueueHandle_t can_rx);
+
 // Task that continuously pushes messages from the CAN bus
 // onto all the active `rx_queue`s in `can_receivers`.
 static void can_listener_task(void *pvParameters);
@@ -88,14 +162,14 @@ esp_err_t can_listener_start() {
   for (size_t i = 0; i < CAN_LISTENERS_MAX; i++) {
     // Initialize the `can_receiver_t`.
     atomic_store(&can_receivers[i].in_use, false);
-    can_receivers[i].rx_queue =
-        xQueueCreateStatic(CAN_RX_QUEUE_LEN, sizeof(twai_message_t),
-                           can_receivers[i].q_storage, &can_receivers[i].q_buf);
+    atomic_store(&can_receivers[i].bypass, false);
+    atomic_store(&can_receivers[i].paused, false);
+    atomic_store(&can_receivers[i].listener_class, CAN_LISTENER_CLASS_NORMAL);
 
-    if (can_receivers[i].rx_queue == NULL) {
-      ESP_LOGE(TAG, "Error initializing queue in can_listener.");
-      return ESP_FAIL;
-    }
+    // The queue is created when it's loaned, but its handle is
+    // always the address of `q_buf`. Set it now, so it can be compared
+    // with the `skip_queue` of `can_listener_enqueue_msg()`.
+    can_receivers[i].rx_queue = (QueueHandle_t)&can_receivers[i].q_buf;
 
     // Add this `can_receiver_t` to the `unused_can_receivers_queue`.
     can_receiver_t *can_receiver_ptr = &can_receivers[i];
@@ -107,6 +181,12 @@ esp_err_t can_listener_start() {
     }
   }
 
+  pool_mutex = xSemaphoreCreateMutexStatic(&pool_mutex_mem);
+  if (pool_mutex == NULL) {
+    ESP_LOGE(TAG, "Unreachable. pool_mutex couldn't be created.");
+    return ESP_FAIL;
+  }
+
   // Initialize the mutex for accessing the `can_listener_status` struct.
   can_listener_status_mutex =
       xSemaphoreCreateMutexStatic(&can_listener_status_mutex_mem);
@@ -119,14 +199,21 @@ esp_err_t can_listener_start() {
 
   // Spawn the task that will insert incoming CAN messages
   // to active queues in `can_receivers`.
-  xTaskCreateStatic(can_listener_task, "can_listener",
-                    sizeof(can_listener_task_stack), NULL, 14,
-                    can_listener_task_stack, &can_listener_task_mem);
+  task_config_create_static(TASK_ID_CAN_LISTENER, can_listener_task,
+                            sizeof(can_listener_task_stack), NULL,
+                            can_listener_task_stack, &can_listener_task_mem);
 
   return ESP_OK;
 }
 
-esp_err_t can_listener_get(QueueHandle_t *can_rx_out) {
+esp_err_t can_listener_get(const can_listener_options_t *options,
+                           QueueHandle_t *can_rx_out) {
+  if (options->depth < CAN_LISTENER_MIN_DEPTH ||
+      options->depth > CAN_LISTENER_FRAME_BUDGET ||
+      options->overflow >= CAN_LISTENER_OVERFLOW_COUNT) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
   // Get an unused `can_receiver_t`.
   can_receiver_t *can_receiver;
   BaseType_t res = xQueueReceive(unused_can_receivers_queue, &can_receiver, 0);
@@ -136,21 +223,87 @@ esp_err_t can_listener_get(QueueHandle_t *can_rx_out) {
     return ESP_ERR_NO_MEM;
   }
 
-  xQueueReset(can_receiver->rx_queue);
+  // Take the queue's frames from the shared budget.
+  assert(xSemaphoreTake(pool_mutex, portMAX_DELAY) == pdTRUE);
+  size_t offset;
+  if (!allocate_from_pool(options->depth, &offset)) {
+    assert(xSemaphoreGive(pool_mutex) == pdTRUE);
+    assert(xQueueSend(unused_can_receivers_queue, &can_receiver, 0) == pdTRUE);
+    ESP_LOGW(TAG, "Not enough of the frame budget left for a queue of %d.",
+             options->depth);
+    return ESP_ERR_NO_MEM;
+  }
+  can_receiver->pool_offset = offset;
+  can_receiver->depth = options->depth;
+  QueueHandle_t queue = xQueueCreateStatic(
+      options->depth, sizeof(can_listener_frame_t),
+      &frame_pool[offset * sizeof(can_listener_frame_t)],
+      &can_receiver->q_buf);
+  assert(queue == can_receiver->rx_queue);
+
+  can_receiver->overflow = options->overflow;
+  can_receiver->owner = options->owner;
+  atomic_store(&can_receiver->high_water, 0);
+  atomic_store(&can_receiver->frames_dropped, 0);
+  atomic_store(&can_receiver->frames_shed, 0);
+  atomic_store(&can_receiver->overflowed, false);
+  atomic_store(&can_receiver->bypass, false);
+  atomic_store(&can_receiver->paused, false);
+  atomic_store(&can_receiver->listener_class, CAN_LISTENER_CLASS_NORMAL);
   *can_rx_out = can_receiver->rx_queue;
+
+  // Mark it used before giving `pool_mutex`,
+  // so no other queue is allocated the same frames.
   atomic_store(&can_receiver->in_use, true);
+  assert(xSemaphoreGive(pool_mutex) == pdTRUE);
   return ESP_OK;
 }
 
-esp_err_t can_listener_free(const QueueHandle_t can_rx) {
-  // Find `can_rx` in `can_receivers`.
-  can_receiver_t *can_receiver = NULL;
+static bool allocate_from_pool(size_t depth, size_t *offset_out) {
+  // First fit. There are only a few queues,
+  // so try the start of the pool and the end of every loaned queue.
+  for (int candidate = -1; candidate < CAN_LISTENERS_MAX; candidate++) {
+    size_t start = 0;
+    if (candidate >= 0) {
+      if (!atomic_load(&can_receivers[candidate].in_use)) {
+        continue;
+      }
+      start = can_receivers[candidate].pool_offset +
+              can_receivers[candidate].depth;
+    }
+    if (start + depth > CAN_LISTENER_FRAME_BUDGET) {
+      continue;
+    }
+
+    bool overlaps = false;
+    for (int i = 0; i < CAN_LISTENERS_MAX; i++) {
+      if (atomic_load(&can_receivers[i].in_use) &&
+          start < can_receivers[i].pool_offset + can_receivers[i].depth &&
+          can_receivers[i].pool_offset < start + depth) {
+        overlaps = true;
+        break;
+      }
+    }
+    if (!overlaps) {
+      *offset_out = start;
+      return true;
+    }
+  }
+  return false;
+}
+
+static can_receiver_t *find_receiver(const QueueHandle_t can_rx) {
   for (size_t i = 0; i < CAN_LISTENERS_MAX; i++) {
     if (can_rx == can_receivers[i].rx_queue) {
-      can_receiver = &can_receivers[i];
-      break;
+      return &can_receivers[i];
     }
   }
+  return NULL;
+}
+
+esp_err_t can_listener_free(const QueueHandle_t can_rx) {
+  // Find `can_rx` in `can_receivers`.
+  can_receiver_t *can_receiver = find_receiver(can_rx);
 
   // If the given `can_rx` isn't in our list of all `can_receivers`,
   // return an error.
@@ -158,8 +311,15 @@ esp_err_t can_listener_free(const QueueHandle_t can_rx) {
     return ESP_ERR_INVALID_ARG;
   }
 
-  // Mark the `can_receiver` as unused.
+  // Mark the `can_receiver` as unused,
+  // and wait until nobody is pushing to its queue anymore.
+  assert(xSemaphoreTake(pool_mutex, portMAX_DELAY) == pdTRUE);
   atomic_store(&can_receiver->in_use, false);
+  while (atomic_load(&enqueue_users) != 0) {
+    vTaskDelay(1);
+  }
+  vQueueDelete(can_receiver->rx_queue);
+  assert(xSemaphoreGive(pool_mutex) == pdTRUE);
 
   // Add the unused `can_receiver` to the `unused_can_receivers_queue`.
   BaseType_t res = xQueueSend(unused_can_receivers_queue, &can_receiver, 0);
@@ -171,39 +331,300 @@ esp_err_t can_listener_free(const QueueHandle_t can_rx) {
   return ESP_OK;
 }
 
+void can_listener_set_hook(can_listener_hook_t new_hook) {
+  atomic_store(&hook, new_hook);
+}
+
+esp_err_t can_listener_set_bypass(const QueueHandle_t can_rx, bool bypass) {
+  can_receiver_t *can_receiver = find_receiver(can_rx);
+  if (can_receiver == NULL) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  atomic_store(&can_receiver->bypass, bypass);
+  return ESP_OK;
+}
+
+esp_err_t can_listener_set_paused(const QueueHandle_t can_rx, bool paused) {
+  can_receiver_t *can_receiver = find_receiver(can_rx);
+  if (can_receiver == NULL) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  atomic_store(&can_receiver->paused, paused);
+  return ESP_OK;
+}
+
+esp_err_t can_listener_set_class(const QueueHandle_t can_rx,
+                                 can_listener_class_t listener_class) {
+  can_receiver_t *can_receiver = find_receiver(can_rx);
+  if (can_receiver == NULL || listener_class >= CAN_LISTENER_CLASS_COUNT) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  atomic_store(&can_receiver->listener_class, listener_class);
+  return ESP_OK;
+}
+
+can_listener_class_t can_listener_get_class(const QueueHandle_t can_rx) {
+  can_receiver_t *can_receiver = find_receiver(can_rx);
+  if (can_receiver == NULL) {
+    return CAN_LISTENER_CLASS_NORMAL;
+  }
+  return atomic_load(&can_receiver->listener_class);
+}
+
+const char *can_listener_class_name(can_listener_class_t listener_class) {
+  switch (listener_class) {
+    case CAN_LISTENER_CLASS_CRITICAL:
+      return "critical";
+    case CAN_LISTENER_CLASS_NORMAL:
+      return "normal";
+    case CAN_LISTENER_CLASS_BEST_EFFORT:
+      return "best_effort";
+    default:
+      return "unknown";
+  }
+}
+
+uint8_t can_listener_max_fill_percent(void) {
+  uint8_t max_percent = 0;
+  atomic_fetch_add(&enqueue_users, 1);
+  for (int i = 0; i < CAN_LISTENERS_MAX; i++) {
+    if (atomic_load(&can_receivers[i].in_use) &&
+        !atomic_load(&can_receivers[i].bypass) &&
+        !atomic_load(&can_receivers[i].paused)) {
+      uint8_t percent = uxQueueMessagesWaiting(can_receivers[i].rx_queue) *
+                        100 / can_receivers[i].depth;
+      if (percent > max_percent) {
+        max_percent = percent;
+      }
+    }
+  }
+  atomic_fetch_sub(&enqueue_users, 1);
+  return max_percent;
+}
+
+bool can_listener_overflowed(const QueueHandle_t can_rx) {
+  can_receiver_t *can_receiver = find_receiver(can_rx);
+  return can_receiver != NULL && atomic_load(&can_receiver->overflowed);
+}
+
+uint32_t can_listener_frames_dropped(const QueueHandle_t can_rx) {
+  can_receiver_t *can_receiver = find_receiver(can_rx);
+  if (can_receiver == NULL) {
+    return 0;
+  }
+  return atomic_load(&can_receiver->frames_dropped);
+}
+
+uint32_t can_listener_frames_shed(const QueueHandle_t can_rx) {
+  can_receiver_t *can_receiver = find_receiver(can_rx);
+  if (can_receiver == NULL) {
+    return 0;
+  }
+  return atomic_load(&can_receiver->frames_shed);
+}
+
+esp_err_t can_listener_get_queue_status(
+    size_t index, can_listener_queue_status_t *status_out) {
+  if (index >= CAN_LISTENERS_MAX) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  const can_receiver_t *can_receiver = &can_receivers[index];
+  if (!atomic_load(&can_receiver->in_use)) {
+    return ESP_ERR_NOT_FOUND;
+  }
+
+  *status_out = (can_listener_queue_status_t){
+      .owner = can_receiver->owner,
+      .depth = can_receiver->depth,
+      .overflow = can_receiver->overflow,
+      .listener_class = atomic_load(&can_receiver->listener_class),
+      .bypassed = atomic_load(&can_receiver->bypass),
+      .high_water = atomic_load(&can_receiver->high_water),
+      .frames_dropped = atomic_load(&can_receiver->frames_dropped),
+  };
+  return ESP_OK;
+}
+
+const char *can_listener_overflow_name(can_listener_overflow_t overflow) {
+  switch (overflow) {
+    case CAN_LISTENER_OVERFLOW_DROP_NEWEST:
+      return "drop_newest";
+    case CAN_LISTENER_OVERFLOW_DROP_OLDEST:
+      return "drop_oldest";
+    case CAN_LISTENER_OVERFLOW_DISCONNECT:
+      return "disconnect";
+    default:
+      return "unknown";
+  }
+}
+
+esp_err_t can_listener_overflow_from_name(const char *name,
+                                          can_listener_overflow_t *overflow_out) {
+  for (can_listener_overflow_t overflow = 0;
+       overflow < CAN_LISTENER_OVERFLOW_COUNT; overflow++) {
+    if (strcmp(name, can_listener_overflow_name(overflow)) == 0) {
+      *overflow_out = overflow;
+      return ESP_OK;
+    }
+  }
+  return ESP_FAIL;
+}
+
 void can_listener_enqueue_msg(const twai_message_t *message,
                               const QueueHandle_t skip_queue) {
+  can_listener_frame_t frame = {
+      .msg = *message,
+      .rx_time_us = esp_timer_get_time(),
+  };
+
+  // Capture every frame, even those no listener gets,
+  // and check whether it starts a snapshot.
+  uint32_t seq = capture_ring_record(&frame);
+  capture_trigger_check(&frame, seq);
+
+  // Decide once which classes get this frame,
+  // so every listener sees the same decision.
+  uint8_t admitted_classes = overload_control_admit(message);
+
+  can_listener_hook_t current_hook = atomic_load(&hook);
+  if (current_hook != NULL) {
+    current_hook(&frame, skip_queue, admitted_classes);
+  }
+
+  atomic_fetch_add(&enqueue_users, 1);
+
   // send the message to all `can_receivers` that are `in_use`.
   for (int i = 0; i < CAN_LISTENERS_MAX; i++) {
-    if (atomic_load(&can_receivers[i].in_use) &&
-        can_receivers[i].rx_queue != skip_queue) {
-      // append the message to the queue
-      if (xQueueSend(can_receivers[i].rx_queue, message, 0) != pdTRUE) {
-        ESP_LOGE(TAG, "CAN bus task receive queue %d full. Dropping message.",
-                 i);
-        // Increment the status dropped frame counter
-        assert(xSemaphoreTake(can_listener_status_mutex, portMAX_DELAY) ==
-               pdTRUE);
-        can_listener_status.can_bus_incoming_frames_dropped += 1;
-        assert(xSemaphoreGive(can_listener_status_mutex) == pdTRUE);
+    if (!atomic_load(&can_receivers[i].in_use) ||
+        atomic_load(&can_receivers[i].bypass) ||
+        can_receivers[i].rx_queue == skip_queue) {
+      continue;
+    }
+    if (admitted_classes &
+        (1U << atomic_load(&can_receivers[i].listener_class))) {
+      push_frame(&can_receivers[i], i, &frame);
+    } else {
+      atomic_fetch_add_explicit(&can_receivers[i].frames_shed, 1,
+                                memory_order_relaxed);
+    }
+  }
+
+  atomic_fetch_sub(&enqueue_users, 1);
+}
+
+bool can_listener_receive_until(const QueueHandle_t can_rx,
+                                int64_t deadline_us,
+                                can_listener_frame_t *frame_out) {
+  TickType_t wait = portMAX_DELAY;
+  if (deadline_us != INT64_MAX) {
+    const int64_t tick_us = portTICK_PERIOD_MS * 1000;
+    int64_t remaining_us = deadline_us - esp_timer_get_time();
+    wait = remaining_us > 0 ? (remaining_us + tick_us - 1) / tick_us : 0;
+  }
+  return xQueueReceive(can_rx, frame_out, wait) == pdTRUE;
+}
+
+uint32_t can_listener_socketcan_id(const twai_message_t *message) {
+  uint32_t can_id = message->identifier;
+  if (message->extd) {
+    can_id |= CAN_EFF_FLAG;
+  }
+  if (message->rtr) {
+    can_id |= CAN_RTR_FLAG;
+  }
+  return can_id;
+}
+
+size_t can_listener_data_len(const twai_message_t *message) {
+  if (message->rtr) {
+    return 0;
+  }
+  return message->data_length_code > TWAI_FRAME_MAX_DLC
+             ? TWAI_FRAME_MAX_DLC
+             : message->data_length_code;
+}
+
+static void push_frame(can_receiver_t *can_receiver, int index,
+                       const can_listener_frame_t *frame) {
+  // The frame that didn't fit, if any.
+  const can_listener_frame_t *dropped = NULL;
+  can_listener_frame_t oldest;
+
+  if (xQueueSend(can_receiver->rx_queue, frame, 0) != pdTRUE) {
+    dropped = frame;
+    if (can_receiver->overflow == CAN_LISTENER_OVERFLOW_DROP_OLDEST) {
+      // Make room by dropping the oldest frame.
+      // If the owner took one in the meantime, nothing is dropped.
+      bool took_oldest =
+          xQueueReceive(can_receiver->rx_queue, &oldest, 0) == pdTRUE;
+      if (xQueueSend(can_receiver->rx_queue, frame, 0) == pdTRUE) {
+        dropped = took_oldest ? &oldest : NULL;
       }
+    } else if (can_receiver->overflow == CAN_LISTENER_OVERFLOW_DISCONNECT) {
+      atomic_store(&can_receiver->overflowed, true);
     }
   }
+
+  if (dropped != NULL) {
+    deferred_log(DEFERRED_LOG_RX_QUEUE_FULL, index);
+    trace_buffer_record(TRACE_EVENT_RX_QUEUE_FULL, index, 0,
+                        dropped->msg.identifier, 0);
+    atomic_fetch_add_explicit(&can_receiver->frames_dropped, 1,
+                              memory_order_relaxed);
+    // Increment the status dropped frame counter
+    assert(xSemaphoreTake(can_listener_status_mutex, portMAX_DELAY) == pdTRUE);
+    can_listener_status.can_bus_incoming_frames_dropped += 1;
+    assert(xSemaphoreGive(can_listener_status_mutex) == pdTRUE);
+  }
+
+  // Track the high-water mark.
+  unsigned int waiting = uxQueueMessagesWaiting(can_receiver->rx_queue);
+  unsigned int high_water =
+      atomic_load_explicit(&can_receiver->high_water, memory_order_relaxed);
+  while (waiting > high_water &&
+         !atomic_compare_exchange_weak(&can_receiver->high_water, &high_water,
+                                       waiting)) {
+  }
 }
 
+// Responses that `reflex_rules_check()` transmitted.
+// Only used by the `can_listener_task`.
+static twai_message_t reflex_responses[REFLEX_RULES_MAX];
+
 static void can_listener_task(void *pvParameters) {
   while (true) {
     // receive a message from the CAN bus
+    // Don't block for long, so that `driver_setup_can_reconfigure()`
+    // can swap the driver under us.
     twai_message_t received_msg = {0};
-    esp_err_t res = twai_receive(&received_msg, portMAX_DELAY);
+    esp_err_t res = driver_setup_can_receive(&received_msg, pdMS_TO_TICKS(100));
+    if (res == ESP_ERR_TIMEOUT) {
+      continue;
+    }
+    if (res == ESP_ERR_INVALID_STATE) {
+      // The driver is being reconfigured.
+      vTaskDelay(1);
+      continue;
+    }
     if (res != ESP_OK) {
       ESP_LOGE(TAG, "Error receiving message from CAN bus: %s",
                esp_err_to_name(res));
       continue;
     }
 
+    // Answer requests first, as some ECUs expect a response within
+    // milliseconds.
+    uint8_t response_count = reflex_rules_check(
+        &received_msg, esp_timer_get_time(), reflex_responses);
+
     // send the message to the queues
     can_listener_enqueue_msg(&received_msg, NULL);
+    boot_timeline_mark(BOOT_PHASE_FIRST_CAN_FRAME);
+
+    // Then let clients see the responses after their requests.
+    for (uint8_t i = 0; i < response_count; i++) {
+      can_listener_enqueue_msg(&reflex_responses[i], NULL);
+    }
 
     // Increment the status can bus counter
     assert(xSemaphoreTake(can_listener_status_mutex, portMAX_DELAY) == pdTRUE);
@@ -2,13 +2,133 @@
 
 #include "driver/twai.h"
 #include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
 
 // The maximum number of CAN receive queues
 // that may be loaned with `can_listener_get()`
 // at any time.
 // The socketcand_server will use up to 4 of these,
-// and the OpenCyphal node may use 1.
-#define CAN_LISTENERS_MAX 5
+// and the OpenCyphal node, cannelloni, the multicast publisher
+// and the bridge may use 1 each.
+#define CAN_LISTENERS_MAX 8
+
+// Total number of frames that all loaned queues can hold together.
+// Each queue takes its depth from this budget when it's loaned.
+#define CAN_LISTENER_FRAME_BUDGET 256
+
+// Queue depth used unless a listener asks for another one.
+#define CAN_LISTENER_DEFAULT_DEPTH 32
+
+// Smallest queue depth that can be loaned.
+#define CAN_LISTENER_MIN_DEPTH 4
+
+// Frames with this bit set in their `identifier` aren't CAN bus frames.
+// They're SocketCAN-style error frames (see linux/can/error.h)
+// that report CAN controller state changes to listeners,
+// and must never be transmitted.
+#define CAN_LISTENER_ERR_FLAG 0x20000000U
+
+// The other flags and masks of a SocketCAN `can_id`,
+// for the transports and tables that use its format.
+#define CAN_EFF_FLAG 0x80000000U
+#define CAN_RTR_FLAG 0x40000000U
+#define CAN_EFF_MASK 0x1FFFFFFFU
+#define CAN_SFF_MASK 0x7FFU
+
+// How important it is that a listener gets every frame.
+// When the adapter is overloaded, `overload_control` stops delivering
+// frames to less important listeners first.
+// The values are also bit positions in the masks that
+// `overload_control_admit()` returns.
+typedef enum {
+  // Never shed. Gets every frame that fits in its queue.
+  CAN_LISTENER_CLASS_CRITICAL = 0,
+
+  // Shed by the low-priority ID and throttle policies.
+  // The class of every listener until it's changed.
+  CAN_LISTENER_CLASS_NORMAL = 1,
+
+  // Shed first.
+  CAN_LISTENER_CLASS_BEST_EFFORT = 2,
+
+  // Number of classes. Not a class.
+  CAN_LISTENER_CLASS_COUNT,
+} can_listener_class_t;
+
+// A mask with the bits of all `can_listener_class_t`s set.
+#define CAN_LISTENER_CLASS_ALL ((1U << CAN_LISTENER_CLASS_COUNT) - 1)
+
+// An item of the queues loaned with `can_listener_get()`.
+typedef struct {
+  twai_message_t msg;
+
+  // `esp_timer_get_time()` when the frame was received from the CAN bus,
+  // or when it was enqueued with `can_listener_enqueue_msg()`.
+  int64_t rx_time_us;
+} can_listener_frame_t;
+
+// Called by `can_listener_enqueue_msg()` with every frame,
+// before it's pushed to the receive queues.
+// `skip_queue` is the queue the frame must not be echoed to, or NULL.
+// `admitted_classes` has a bit set for every `can_listener_class_t`
+// that the frame may be delivered to.
+// Runs on the task that enqueued the frame, so it must not block.
+typedef void (*can_listener_hook_t)(const can_listener_frame_t* frame,
+                                    QueueHandle_t skip_queue,
+                                    uint8_t admitted_classes);
+
+// What happens when a frame doesn't fit in a listener's queue.
+// Stored in the `client_overflow` persistent setting,
+// so only ever append new ones.
+typedef enum {
+  // The new frame is dropped. For listeners that want
+  // an unbroken sequence up to the first loss.
+  CAN_LISTENER_OVERFLOW_DROP_NEWEST = 0,
+
+  // The oldest queued frame is dropped to make room.
+  // For live views that want the freshest frames.
+  CAN_LISTENER_OVERFLOW_DROP_OLDEST = 1,
+
+  // The new frame is dropped, and `can_listener_overflowed()`
+  // returns true, so the owner can disconnect.
+  // For loggers that must either be lossless or fail loudly.
+  CAN_LISTENER_OVERFLOW_DISCONNECT = 2,
+
+  // Number of policies. Not a policy.
+  CAN_LISTENER_OVERFLOW_COUNT,
+} can_listener_overflow_t;
+
+// How a queue loaned with `can_listener_get()` behaves.
+typedef struct {
+  // Number of frames the queue holds, between `CAN_LISTENER_MIN_DEPTH`
+  // and `CAN_LISTENER_FRAME_BUDGET`.
+  uint16_t depth;
+
+  can_listener_overflow_t overflow;
+
+  // Who loans the queue, such as "socketcand". Shown in the status.
+  // Must stay valid while the queue is loaned.
+  const char* owner;
+} can_listener_options_t;
+
+// Status of one loaned queue.
+// Get it using `can_listener_get_queue_status()`.
+typedef struct {
+  const char* owner;
+  uint16_t depth;
+  can_listener_overflow_t overflow;
+  can_listener_class_t listener_class;
+
+  // True if the owner gets frames through the hook instead.
+  bool bypassed;
+
+  // Largest number of frames that were waiting in the queue.
+  uint32_t high_water;
+
+  // Number of frames dropped because the queue was full.
+  uint32_t frames_dropped;
+} can_listener_queue_status_t;
 
 // The status of the CAN listener.
 // Get the current status using `can_listener_get_status()`.
@@ -27,20 +147,104 @@ esp_err_t can_listener_start(void);
 // Returns an error if the CAN listener hasn't been started yet.
 esp_err_t can_listener_get_status(can_listener_status_t* status_out);
 
-// Fills `can_rx_queue` with a `QueueHandle_t`.
-// The CAN listener task will send CAN frames to the queue
+// Fills `can_rx_queue` with a `QueueHandle_t` that behaves as `options`.
+// The CAN listener task will send `can_listener_frame_t`s to the queue
 // as they are received.
 // Up to `CAN_LISTENERS_MAX` queues can be active at any time.
-// Returns `ESP_ERR_NO_MEM` if there are already `CAN_LISTENERS_MAX` loaned.
+// Returns `ESP_ERR_NO_MEM` if there are already `CAN_LISTENERS_MAX` loaned,
+// or if less than `options->depth` is left of `CAN_LISTENER_FRAME_BUDGET`.
+// Returns `ESP_ERR_INVALID_ARG` if `options` are invalid.
 // Call `can_listener_free()` to return your queue.
-esp_err_t can_listener_get(QueueHandle_t* can_rx_queue);
+esp_err_t can_listener_get(const can_listener_options_t* options,
+                           QueueHandle_t* can_rx_queue);
 
 // Frees the `QueueHandle_t` loaned by `can_listener_get()`.
 // It can't be used after this.
 esp_err_t can_listener_free(const QueueHandle_t can_rx_queue);
 
-// Pushes `message` to all the receiving queues except for `skip_queue`.
+// Installs `hook`, replacing the previous one. NULL removes it.
+// Lets a consumer get frames without a queue hop.
+void can_listener_set_hook(can_listener_hook_t hook);
+
+// If `bypass`, frames are no longer pushed to `can_rx_queue`,
+// because its owner gets them through the hook instead.
+// The queue still identifies the owner as a `skip_queue`.
+// Loaned queues start out not bypassed.
+esp_err_t can_listener_set_bypass(const QueueHandle_t can_rx_queue,
+                                  bool bypass);
+
+// If `paused`, the owner of `can_rx_queue` stopped reading it on
+// purpose, such as a client that is out of credits. Frames are still
+// pushed to it, but it's left out of `can_listener_max_fill_percent()`,
+// so a queue that fills while paused doesn't make `overload_control`
+// shed the other listeners.
+// Loaned queues start out not paused.
+esp_err_t can_listener_set_paused(const QueueHandle_t can_rx_queue,
+                                  bool paused);
+
+// Sets the `can_listener_class_t` of `can_rx_queue`.
+// Loaned queues start out as `CAN_LISTENER_CLASS_NORMAL`.
+esp_err_t can_listener_set_class(const QueueHandle_t can_rx_queue,
+                                 can_listener_class_t listener_class);
+
+// Returns the `can_listener_class_t` of `can_rx_queue`.
+can_listener_class_t can_listener_get_class(const QueueHandle_t can_rx_queue);
+
+// Returns a human-readable name of `listener_class`.
+const char* can_listener_class_name(can_listener_class_t listener_class);
+
+// Returns how full the fullest loaned queue is, in percent.
+// Bypassed and paused queues are left out.
+uint8_t can_listener_max_fill_percent(void);
+
+// Returns true if a frame didn't fit in `can_rx_queue`,
+// and it was loaned with `CAN_LISTENER_OVERFLOW_DISCONNECT`.
+bool can_listener_overflowed(const QueueHandle_t can_rx_queue);
+
+// Returns the number of frames that didn't fit in `can_rx_queue`
+// since it was loaned.
+uint32_t can_listener_frames_dropped(const QueueHandle_t can_rx_queue);
+
+// Returns the number of frames that `overload_control` shed
+// from `can_rx_queue` since it was loaned.
+uint32_t can_listener_frames_shed(const QueueHandle_t can_rx_queue);
+
+// Fills `status_out` with the status of the queue at `index`,
+// between 0 and `CAN_LISTENERS_MAX`.
+// Returns `ESP_ERR_NOT_FOUND` if that queue isn't loaned.
+esp_err_t can_listener_get_queue_status(
+    size_t index, can_listener_queue_status_t* status_out);
+
+// Returns a human-readable name of `overflow`.
+const char* can_listener_overflow_name(can_listener_overflow_t overflow);
+
+// Sets `overflow_out` to the policy named `name`.
+// Returns `ESP_FAIL` if there is no such policy.
+esp_err_t can_listener_overflow_from_name(
+    const char* name, can_listener_overflow_t* overflow_out);
+
+// Passes `message` to the hook, and pushes it to all the receiving queues
+// except for `skip_queue`, timestamped with the current time.
+// Queues whose class `overload_control` currently sheds are skipped.
 // This function is used to simulate receiving a CAN message.
 // Set `skip_queue` to NULL to not skip any queues.
 void can_listener_enqueue_msg(const twai_message_t* message,
-                              const QueueHandle_t skip_queue);
\ No newline at end of file
+                              const QueueHandle_t skip_queue);
+
+// Receives the next frame from `can_rx_queue` into `frame_out`,
+// waiting until `esp_timer_get_time()` reaches `deadline_us`,
+// rounded up to a FreeRTOS tick, so short waits don't spin.
+// Waits forever if `deadline_us` is `INT64_MAX`.
+// Returns false if no frame arrived in time.
+bool can_listener_receive_until(const QueueHandle_t can_rx_queue,
+                                int64_t deadline_us,
+                                can_listener_frame_t* frame_out);
+
+// Returns the SocketCAN `can_id` of `message`, with `CAN_EFF_FLAG` and
+// `CAN_RTR_FLAG` set as needed. Error frames from the CAN listener
+// already carry `CAN_LISTENER_ERR_FLAG` in their `identifier`.
+uint32_t can_listener_socketcan_id(const twai_message_t* message);
+
+// Returns the number of data bytes of `message` on the wire:
+// none for remote frames, and 8 for non-compliant DLCs above 8.
+size_t can_listener_data_len(const twai_message_t* message);
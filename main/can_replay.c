@@ -0,0 +1,542 @@
+#include "can_replay.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "can_listener.h"
+#include "deferred_log.h"
+#include "driver_setup.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "id_match_table.h"
+#include "precise_wait.h"
+#include "stdatomic.h"
+#include "task_config.h"
+
+// Size of a binary frame without its data bytes.
+#define BINARY_HEADER_LEN 9
+
+// Longest candump line, including the newline.
+#define LINE_MAX_LEN 96
+
+// A frame in the replay buffer. Exactly 20 bytes.
+typedef struct {
+  // Offset from the first frame of the log.
+  uint32_t offset_us;
+
+  // The CAN ID with SocketCAN's EFF and RTR flags.
+  uint32_t can_id;
+
+  uint8_t len;
+  uint8_t reserved[3];
+  uint8_t data[8];
+} replay_frame_t;
+
+_Static_assert(sizeof(replay_frame_t) == 20, "replay_frame_t must be packed");
+
+// Name that will be used for logging
+static const char *TAG = "can_replay";
+
+// Allocated once by `can_replay_start()`, never freed.
+static replay_frame_t *frames = NULL;
+static uint32_t capacity = 0;
+
+// Only changed while not playing.
+static uint32_t frame_count = 0;
+
+// The log being loaded. Only used by the HTTP server.
+static can_replay_format_t load_format;
+static int64_t load_first_us;
+static char carry[LINE_MAX_LEN];
+static size_t carry_len = 0;
+
+// Set while the replay task plays, and to make it stop.
+static atomic_bool playing = false;
+static atomic_bool stop_requested = false;
+
+// The IDs to play, when `filter_enabled`.
+static id_match_table_t filter_table;
+static bool filter_enabled = false;
+
+static can_replay_status_t status = {0};
+static SemaphoreHandle_t status_mutex = NULL;
+static StaticSemaphore_t status_mutex_mem;
+
+// Task that plays the log onto the bus.
+static void can_replay_task(void *pvParameters);
+static StackType_t can_replay_task_stack[3072];
+static StaticTask_t can_replay_task_mem;
+static TaskHandle_t can_replay_task_handle = NULL;
+
+// Wakes the replay task when the next frame is nearly due.
+static precise_wait_t wait;
+
+// Plays the log once per loop, until done or stopped.
+static void play(const can_replay_options_t *options);
+
+// Parses one candump line, appending its frame to the buffer.
+static esp_err_t parse_line(char *line);
+
+// Appends a frame received at `time_us` to the buffer.
+static esp_err_t append_frame(int64_t time_us, uint32_t can_id, uint8_t len,
+                              const uint8_t *data);
+
+// Parses `filter` into `table_out`, if not NULL.
+// Returns the number of IDs in it, or -1 if it's invalid.
+static int parse_filter(const char *filter, id_match_table_t *table_out);
+
+// Returns the value of the hex digit `c`, or -1.
+static int hex_value(char c);
+
+esp_err_t can_replay_start(uint32_t buffer_kb) {
+  if (buffer_kb == 0 || buffer_kb > CAN_REPLAY_BUFFER_KB_MAX) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  capacity = buffer_kb * 1024 / sizeof(replay_frame_t);
+  frames = heap_caps_malloc(capacity * sizeof(replay_frame_t),
+                            MALLOC_CAP_8BIT);
+  if (frames == NULL) {
+    ESP_LOGE(TAG, "Couldn't allocate %lu KiB replay buffer.", buffer_kb);
+    capacity = 0;
+    return ESP_ERR_NO_MEM;
+  }
+
+  esp_err_t err = precise_wait_init(&wait, "can_replay",
+                                    &can_replay_task_handle,
+                                    PRECISE_WAIT_SPIN_US);
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  status_mutex = xSemaphoreCreateMutexStatic(&status_mutex_mem);
+  if (status_mutex == NULL) {
+    ESP_LOGE(TAG, "Unreachable. Replay mutex couldn't be created.");
+    return ESP_FAIL;
+  }
+  status.capacity = capacity;
+
+  can_replay_task_handle = task_config_create_static(
+      TASK_ID_CAN_REPLAY, can_replay_task, sizeof(can_replay_task_stack), NULL,
+      can_replay_task_stack, &can_replay_task_mem);
+
+  ESP_LOGI(TAG, "Replay buffer holds %lu frames.", capacity);
+  return ESP_OK;
+}
+
+esp_err_t can_replay_load_begin(can_replay_format_t format) {
+  if (frames == NULL) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  esp_err_t err = can_replay_stop();
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  load_format = format;
+  load_first_us = 0;
+  carry_len = 0;
+
+  assert(xSemaphoreTake(status_mutex, portMAX_DELAY) == pdTRUE);
+  frame_count = 0;
+  status.frames_loaded = 0;
+  status.duration_ms = 0;
+  assert(xSemaphoreGive(status_mutex) == pdTRUE);
+  return ESP_OK;
+}
+
+esp_err_t can_replay_load_data(const char *data, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    if (load_format == CAN_REPLAY_FORMAT_CANDUMP) {
+      if (data[i] == '\n') {
+        carry[carry_len] = '\0';
+        carry_len = 0;
+        esp_err_t err = parse_line(carry);
+        if (err != ESP_OK) {
+          return err;
+        }
+      } else if (carry_len + 1 < sizeof(carry)) {
+        carry[carry_len] = data[i];
+        carry_len += 1;
+      } else {
+        return ESP_ERR_INVALID_ARG;
+      }
+      continue;
+    }
+
+    carry[carry_len] = data[i];
+    carry_len += 1;
+    if (carry_len < BINARY_HEADER_LEN) {
+      continue;
+    }
+    uint8_t frame_len = carry[8];
+    if (frame_len > TWAI_FRAME_MAX_DLC) {
+      return ESP_ERR_INVALID_ARG;
+    }
+    if (carry_len < BINARY_HEADER_LEN + frame_len) {
+      continue;
+    }
+
+    const uint8_t *bytes = (const uint8_t *)carry;
+    uint32_t offset_us =
+        bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+    uint32_t can_id =
+        bytes[4] | bytes[5] << 8 | bytes[6] << 16 | (uint32_t)bytes[7] << 24;
+    carry_len = 0;
+    esp_err_t err = append_frame(offset_us, can_id, frame_len,
+                                 &bytes[BINARY_HEADER_LEN]);
+    if (err != ESP_OK) {
+      return err;
+    }
+  }
+  return ESP_OK;
+}
+
+esp_err_t can_replay_load_end(void) {
+  if (load_format == CAN_REPLAY_FORMAT_CANDUMP && carry_len > 0) {
+    // The last line may lack its newline.
+    carry[carry_len] = '\0';
+    carry_len = 0;
+    return parse_line(carry);
+  }
+  return carry_len == 0 ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t can_replay_check_filter(const char *filter) {
+  return parse_filter(filter, NULL) < 0 ? ESP_ERR_INVALID_ARG : ESP_OK;
+}
+
+esp_err_t can_replay_play(const can_replay_options_t *options) {
+  if (frames == NULL) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  if (options->speed_permille < CAN_REPLAY_SPEED_MIN ||
+      options->speed_permille > CAN_REPLAY_SPEED_MAX) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  esp_err_t err = can_replay_stop();
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  // The task isn't playing, so the filter is ours.
+  int ids = parse_filter(options->filter, &filter_table);
+  if (ids < 0) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  filter_enabled = ids > 0;
+
+  assert(xSemaphoreTake(status_mutex, portMAX_DELAY) == pdTRUE);
+  status.options = *options;
+  status.loops_done = 0;
+  status.frames_filtered = 0;
+  status.tx_failed = 0;
+  status.errors = (precise_wait_errors_t){
+      .bounds_us = {50, 200, 1000},
+  };
+  assert(xSemaphoreGive(status_mutex) == pdTRUE);
+
+  atomic_store(&stop_requested, false);
+  atomic_store(&playing, true);
+  xTaskNotifyGive(can_replay_task_handle);
+  return ESP_OK;
+}
+
+esp_err_t can_replay_stop(void) {
+  if (frames == NULL) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  atomic_store(&stop_requested, true);
+  while (atomic_load(&playing)) {
+    xTaskNotifyGive(can_replay_task_handle);
+    vTaskDelay(1);
+  }
+  return ESP_OK;
+}
+
+esp_err_t can_replay_get_status(can_replay_status_t *status_out) {
+  if (status_mutex == NULL) {
+    return ESP_FAIL;
+  }
+
+  assert(xSemaphoreTake(status_mutex, portMAX_DELAY) == pdTRUE);
+  *status_out = status;
+  status_out->playing = atomic_load(&playing);
+  assert(xSemaphoreGive(status_mutex) == pdTRUE);
+
+  return ESP_OK;
+}
+
+static void can_replay_task(void *pvParameters) {
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    if (!atomic_load(&playing)) {
+      // A late wake-up from the last playback.
+      continue;
+    }
+
+    assert(xSemaphoreTake(status_mutex, portMAX_DELAY) == pdTRUE);
+    can_replay_options_t options = status.options;
+    assert(xSemaphoreGive(status_mutex) == pdTRUE);
+
+    ESP_LOGI(TAG, "Playing %lu frames at %lu permille speed.", frame_count,
+             options.speed_permille);
+    play(&options);
+    precise_wait_stop(&wait);
+    atomic_store(&playing, false);
+    ESP_LOGI(TAG, "Playback ended.");
+  }
+}
+
+static void play(const can_replay_options_t *options) {
+  if (frame_count == 0) {
+    return;
+  }
+
+  // When the first frame of the current loop is due.
+  int64_t loop_start_us = esp_timer_get_time() + PRECISE_WAIT_SPIN_US;
+
+  for (uint32_t loop = 0; options->loops == 0 || loop < options->loops;
+       loop++) {
+    for (uint32_t i = 0; i < frame_count; i++) {
+      const replay_frame_t *frame = &frames[i];
+
+      uint16_t match;
+      if (filter_enabled &&
+          id_match_table_lookup(&filter_table, frame->can_id & CAN_EFF_MASK,
+                                &match, 1) == 0) {
+        assert(xSemaphoreTake(status_mutex, portMAX_DELAY) == pdTRUE);
+        status.frames_filtered += 1;
+        assert(xSemaphoreGive(status_mutex) == pdTRUE);
+        continue;
+      }
+
+      int64_t target_us = loop_start_us + (int64_t)frame->offset_us * 1000 /
+                                              options->speed_permille;
+      if (!precise_wait_until(&wait, target_us, &stop_requested)) {
+        return;
+      }
+
+      twai_message_t msg = {0};
+      msg.identifier = frame->can_id & CAN_EFF_MASK;
+      msg.extd = (frame->can_id & CAN_EFF_FLAG) != 0;
+      msg.rtr = (frame->can_id & CAN_RTR_FLAG) != 0;
+      msg.data_length_code = frame->len;
+      memcpy(msg.data, frame->data, sizeof(msg.data));
+
+      esp_err_t err = driver_setup_can_transmit(
+          &msg, pdMS_TO_TICKS(PRECISE_WAIT_TX_TIMEOUT_MS));
+      if (err != ESP_OK) {
+        deferred_log(DEFERRED_LOG_CAN_TX_FAILED, err);
+        assert(xSemaphoreTake(status_mutex, portMAX_DELAY) == pdTRUE);
+        status.tx_failed += 1;
+        assert(xSemaphoreGive(status_mutex) == pdTRUE);
+        continue;
+      }
+      int64_t error_us = esp_timer_get_time() - target_us;
+      assert(xSemaphoreTake(status_mutex, portMAX_DELAY) == pdTRUE);
+      precise_wait_count_error(&status.errors, error_us);
+      assert(xSemaphoreGive(status_mutex) == pdTRUE);
+
+      // Let clients see the replayed frames too.
+      can_listener_enqueue_msg(&msg, NULL);
+    }
+
+    // The next loop follows right after the last frame.
+    loop_start_us += (int64_t)frames[frame_count - 1].offset_us * 1000 /
+                     options->speed_permille;
+
+    assert(xSemaphoreTake(status_mutex, portMAX_DELAY) == pdTRUE);
+    status.loops_done += 1;
+    assert(xSemaphoreGive(status_mutex) == pdTRUE);
+  }
+}
+
+static esp_err_t parse_line(char *line) {
+  // Skip blank lines.
+  while (isspace((unsigned char)*line)) {
+    line++;
+  }
+  if (*line == '\0') {
+    return ESP_OK;
+  }
+
+  // `(seconds.microseconds)`
+  char *end;
+  if (*line != '(') {
+    return ESP_ERR_INVALID_ARG;
+  }
+  int64_t seconds = strtoll(line + 1, &end, 10);
+  if (*end != '.') {
+    return ESP_ERR_INVALID_ARG;
+  }
+  char *fraction = end + 1;
+  int64_t micros = strtoll(fraction, &end, 10);
+  if (end - fraction != 6 || *end != ')') {
+    return ESP_ERR_INVALID_ARG;
+  }
+  int64_t time_us = seconds * 1000000 + micros;
+
+  // Skip the interface name.
+  line = end + 1;
+  while (*line == ' ') {
+    line++;
+  }
+  while (*line != ' ' && *line != '\0') {
+    line++;
+  }
+  while (*line == ' ') {
+    line++;
+  }
+
+  // `ID#DATA`, with 3 digits for standard IDs and 8 for extended ones.
+  char *id = line;
+  uint32_t can_id = 0;
+  while (hex_value(*line) >= 0) {
+    can_id = can_id << 4 | hex_value(*line);
+    line++;
+  }
+  if (*line != '#' || (line - id != 3 && line - id != 8)) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (line - id == 3) {
+    if (can_id > CAN_SFF_MASK) {
+      return ESP_ERR_INVALID_ARG;
+    }
+  } else if (can_id & CAN_LISTENER_ERR_FLAG) {
+    // Error frames can't be replayed.
+    return ESP_OK;
+  } else if (can_id > CAN_EFF_MASK) {
+    // Flags in the ID, like RTR, are written differently.
+    return ESP_ERR_INVALID_ARG;
+  } else {
+    can_id |= CAN_EFF_FLAG;
+  }
+  line++;
+  if (*line == '#') {
+    // CAN FD frames neither.
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  uint8_t data[8] = {0};
+  uint8_t len = 0;
+  if (*line == 'R') {
+    // `R`, optionally followed by the DLC.
+    can_id |= CAN_RTR_FLAG;
+    line++;
+    if (*line >= '0' && *line <= '8') {
+      len = *line - '0';
+      line++;
+    }
+  } else {
+    while (hex_value(line[0]) >= 0 && hex_value(line[1]) >= 0) {
+      if (len >= sizeof(data)) {
+        return ESP_ERR_INVALID_ARG;
+      }
+      data[len] = hex_value(line[0]) << 4 | hex_value(line[1]);
+      len++;
+      line += 2;
+    }
+  }
+
+  // Only whitespace may follow, not an odd hex digit or anything else.
+  while (isspace((unsigned char)*line)) {
+    line++;
+  }
+  if (*line != '\0') {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  return append_frame(time_us, can_id, len, data);
+}
+
+static esp_err_t append_frame(int64_t time_us, uint32_t can_id, uint8_t len,
+                              const uint8_t *data) {
+  if (frame_count >= capacity) {
+    return ESP_ERR_NO_MEM;
+  }
+  if (frame_count == 0) {
+    load_first_us = time_us;
+  }
+
+  // Frames must be in order, within 71 minutes of the first one.
+  int64_t offset_us = time_us - load_first_us;
+  if (offset_us < 0 || offset_us > UINT32_MAX ||
+      (frame_count > 0 && offset_us < frames[frame_count - 1].offset_us)) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  replay_frame_t *frame = &frames[frame_count];
+  frame->offset_us = offset_us;
+  frame->can_id = can_id;
+  // RTR frames keep their DLC, but have no data.
+  frame->len = len;
+  memset(frame->data, 0, sizeof(frame->data));
+  if (!(can_id & CAN_RTR_FLAG)) {
+    memcpy(frame->data, data, len);
+  }
+
+  assert(xSemaphoreTake(status_mutex, portMAX_DELAY) == pdTRUE);
+  frame_count += 1;
+  status.frames_loaded = frame_count;
+  status.duration_ms = offset_us / 1000;
+  assert(xSemaphoreGive(status_mutex) == pdTRUE);
+  return ESP_OK;
+}
+
+static int parse_filter(const char *filter, id_match_table_t *table_out) {
+  char buf[CAN_REPLAY_FILTER_LEN];
+  if (strlen(filter) >= sizeof(buf)) {
+    return -1;
+  }
+  strcpy(buf, filter);
+
+  id_match_table_t table;
+  id_match_table_init(&table);
+  int count = 0;
+  char *saveptr;
+  for (char *token = strtok_r(buf, ", ", &saveptr); token != NULL;
+       token = strtok_r(NULL, ", ", &saveptr)) {
+    char *end;
+    uint32_t id = strtoul(token, &end, 16);
+    uint32_t mask = CAN_EFF_MASK;
+    if (*end == '/') {
+      char *mask_text = end + 1;
+      mask = strtoul(mask_text, &end, 16);
+      if (end == mask_text) {
+        return -1;
+      }
+    }
+    if (end == token || *end != '\0' || id > CAN_EFF_MASK ||
+        mask > CAN_EFF_MASK ||
+        id_match_table_add(&table, id, mask, 0) != ESP_OK) {
+      return -1;
+    }
+    count++;
+  }
+
+  id_match_table_compile(&table);
+  if (table_out != NULL) {
+    *table_out = table;
+  }
+  return count;
+}
+
+static int hex_value(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  return -1;
+}
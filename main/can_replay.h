@@ -0,0 +1,110 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "precise_wait.h"
+
+// Plays a CAN log, uploaded over HTTP into a RAM buffer, onto the bus
+// with its original inter-frame timing, so field issues can be
+// reproduced on the bench without TCP and host scheduling jitter.
+//
+// Each frame is scheduled with a `precise_wait_t`, which wakes the
+// replay task shortly before the frame is due. The task spins for the
+// rest, so frames leave with an error of a few tens of microseconds.
+// The scheduling error of every frame is reported in the status.
+
+// Largest replay buffer, in KiB. Each frame takes 20 bytes.
+#define CAN_REPLAY_BUFFER_KB_MAX 128
+
+// Slowest and fastest speeds, in thousandths of the original speed.
+#define CAN_REPLAY_SPEED_MIN 10
+#define CAN_REPLAY_SPEED_MAX 100000
+
+// Maximum length of the textual ID filter, including the terminator.
+#define CAN_REPLAY_FILTER_LEN 128
+
+typedef enum {
+  // Lines of `candump -l`, like `(1634567890.123456) can0 123#DEADBEEF`.
+  CAN_REPLAY_FORMAT_CANDUMP,
+
+  // Frames of 9 to 17 bytes, all little-endian:
+  // the offset from the first frame in µs (uint32),
+  // the ID with SocketCAN's EFF and RTR flags (uint32),
+  // the number of data bytes (uint8), and the data bytes.
+  CAN_REPLAY_FORMAT_BINARY,
+} can_replay_format_t;
+
+// How to play the loaded log.
+typedef struct {
+  // In thousandths of the original speed. 2000 plays twice as fast.
+  uint32_t speed_permille;
+
+  // How many times to play the log. 0 plays it until stopped.
+  uint32_t loops;
+
+  // Only frames with these IDs are played. Empty plays all.
+  // IDs are hex, with an optional mask, separated by commas or spaces,
+  // like `7E8,700/700`.
+  char filter[CAN_REPLAY_FILTER_LEN];
+} can_replay_options_t;
+
+// The status of the replay.
+// Get the current status using `can_replay_get_status()`.
+typedef struct {
+  bool playing;
+
+  // Size of the buffer, in frames, and the frames loaded into it.
+  uint32_t capacity;
+  uint32_t frames_loaded;
+
+  // Offset of the last frame loaded from the first one.
+  uint32_t duration_ms;
+
+  // Options of the current or last playback.
+  can_replay_options_t options;
+
+  // Counters of the current or last playback.
+  uint32_t loops_done;
+  uint64_t frames_filtered;
+  uint64_t tx_failed;
+
+  // The frames sent, and how much later than scheduled they were
+  // queued for transmission, within 50 µs, 200 µs, 1 ms or later.
+  precise_wait_errors_t errors;
+} can_replay_status_t;
+
+// Allocates a replay buffer of `buffer_kb` KiB, and starts the replay task.
+// Must only be called once, before `capture_ring_start()`.
+esp_err_t can_replay_start(uint32_t buffer_kb);
+
+// Stops playback, and empties the buffer for a log in `format`.
+// Returns an error if there's no replay buffer.
+esp_err_t can_replay_load_begin(can_replay_format_t format);
+
+// Appends the next `len` bytes of the log to the buffer.
+// The log may be split anywhere.
+// Returns `ESP_ERR_NO_MEM` if the buffer is full,
+// and `ESP_ERR_INVALID_ARG` if the log is malformed.
+esp_err_t can_replay_load_data(const char* data, size_t len);
+
+// Finishes loading the log.
+// Returns `ESP_ERR_INVALID_ARG` if it ended in the middle of a frame.
+esp_err_t can_replay_load_end(void);
+
+// Parses the textual `filter` of `can_replay_options_t`.
+// Returns `ESP_ERR_INVALID_ARG` if it's invalid.
+esp_err_t can_replay_check_filter(const char* filter);
+
+// Starts playing the loaded log with `options`,
+// stopping any playback first.
+esp_err_t can_replay_play(const can_replay_options_t* options);
+
+// Stops playback, and waits until it has stopped.
+esp_err_t can_replay_stop(void);
+
+// Fills `status_out` with the current `can_replay_status_t`.
+// Returns an error if there's no replay buffer.
+esp_err_t can_replay_get_status(can_replay_status_t* status_out);
@@ -0,0 +1,362 @@
+#include "cannelloni.h"
+
+#include <string.h>
+
+#include "can_listener.h"
+#include "deferred_log.h"
+#include "driver_setup.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "lwip/sockets.h"
+#include "task_config.h"
+
+// Values of the header of every cannelloni datagram.
+#define CANNELLONI_VERSION 2
+#define CANNELLONI_OP_DATA 0
+
+// Size of the header: version, op code, sequence number,
+// and the number of frames as a big-endian uint16.
+#define HEADER_LEN 5
+
+// Set in the length byte of CAN FD frames, which are followed by
+// a flags byte. This adapter only does classic CAN.
+#define CANFD_FRAME 0x80
+
+// How long a frame from the peer may wait for space in the CAN
+// transmit queue. Short, because late frames are worse than lost ones
+// for the real-time tools this transport is for.
+#define CAN_TX_TIMEOUT_MS 10
+
+// Name that will be used for logging
+static const char *TAG = "cannelloni";
+
+static int udp_sock = -1;
+
+// Where frames from the CAN bus are sent. An address of 0 means
+// no peer is known yet. Written by the `cannelloni_rx_task`
+// when the peer is learned, so guarded by `peer_lock`.
+static uint32_t peer_addr = 0;
+static uint16_t peer_port;
+static portMUX_TYPE peer_lock = portMUX_INITIALIZER_UNLOCKED;
+static bool learn_peer;
+
+static uint32_t batch_timeout_us;
+static uint16_t batch_mtu;
+
+// Queue of `can_listener_frame_t` incoming from the CAN bus.
+static QueueHandle_t can_rx_queue = NULL;
+
+static const can_listener_options_t can_rx_queue_options = {
+    .depth = CAN_LISTENER_DEFAULT_DEPTH,
+    .overflow = CAN_LISTENER_OVERFLOW_DROP_OLDEST,
+    .owner = "cannelloni",
+};
+
+static cannelloni_status_t status = {0};
+static SemaphoreHandle_t status_mutex = NULL;
+static StaticSemaphore_t status_mutex_mem;
+
+// Task that batches frames from the CAN bus into datagrams.
+static void cannelloni_tx_task(void *pvParameters);
+static StackType_t cannelloni_tx_task_stack[4096];
+static StaticTask_t cannelloni_tx_task_mem;
+
+// Task that transmits frames from datagrams on the CAN bus.
+static void cannelloni_rx_task(void *pvParameters);
+static StackType_t cannelloni_rx_task_stack[4096];
+static StaticTask_t cannelloni_rx_task_mem;
+
+// Appends `frame` to `buf` in cannelloni format.
+// Returns the number of bytes written.
+static size_t encode_frame(uint8_t *buf, const twai_message_t *frame);
+
+// Returns the number of bytes `encode_frame()` writes for `frame`.
+static size_t encoded_len(const twai_message_t *frame);
+
+// Sends frames from the CAN bus to the sender of a datagram
+// from now on, with `source_addr` its address and port.
+static void learn_peer_addr(const struct sockaddr_in *source_addr);
+
+// Parses the datagram in `buf` and transmits its frames.
+static void handle_datagram(const uint8_t *buf, size_t len);
+
+esp_err_t cannelloni_start(const esp_ip4_addr_t *peer_ip, uint16_t port,
+                           uint32_t timeout_us, uint16_t mtu) {
+  if (mtu < CANNELLONI_MTU_MIN || mtu > CANNELLONI_MTU_MAX) {
+    ESP_LOGE(TAG, "Invalid cannelloni MTU %d.", mtu);
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  udp_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (udp_sock < 0) {
+    ESP_LOGE(TAG, "Unable to create socket: errno %d", errno);
+    return ESP_FAIL;
+  }
+
+  struct sockaddr_in local_addr = {0};
+  local_addr.sin_family = AF_INET;
+  local_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  local_addr.sin_port = htons(port);
+  if (bind(udp_sock, (struct sockaddr *)&local_addr, sizeof(local_addr)) !=
+      0) {
+    ESP_LOGE(TAG, "Socket unable to bind: errno %d", errno);
+    close(udp_sock);
+    udp_sock = -1;
+    return ESP_FAIL;
+  }
+
+  peer_addr = peer_ip->addr;
+  peer_port = port;
+  learn_peer = peer_ip->addr == 0;
+  batch_timeout_us = timeout_us;
+  batch_mtu = mtu;
+
+  esp_err_t err = can_listener_get(&can_rx_queue_options, &can_rx_queue);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Couldn't get CAN receive queue: %s", esp_err_to_name(err));
+    close(udp_sock);
+    udp_sock = -1;
+    return err;
+  }
+
+  status_mutex = xSemaphoreCreateMutexStatic(&status_mutex_mem);
+  if (status_mutex == NULL) {
+    ESP_LOGE(TAG, "Unreachable. status_mutex couldn't be created.");
+    return ESP_FAIL;
+  }
+
+  task_config_create_static(TASK_ID_CANNELLONI_TX, cannelloni_tx_task,
+                            sizeof(cannelloni_tx_task_stack), NULL,
+                            cannelloni_tx_task_stack, &cannelloni_tx_task_mem);
+  task_config_create_static(TASK_ID_CANNELLONI_RX, cannelloni_rx_task,
+                            sizeof(cannelloni_rx_task_stack), NULL,
+                            cannelloni_rx_task_stack, &cannelloni_rx_task_mem);
+
+  ESP_LOGI(TAG, "Listening for cannelloni on UDP port %d.", port);
+  return ESP_OK;
+}
+
+esp_err_t cannelloni_get_status(cannelloni_status_t *status_out) {
+  if (status_mutex == NULL) {
+    return ESP_FAIL;
+  }
+
+  assert(xSemaphoreTake(status_mutex, portMAX_DELAY) == pdTRUE);
+  *status_out = status;
+  assert(xSemaphoreGive(status_mutex) == pdTRUE);
+
+  return ESP_OK;
+}
+
+static void cannelloni_tx_task(void *pvParameters) {
+  uint8_t datagram[CANNELLONI_MTU_MAX];
+  size_t len = HEADER_LEN;
+  uint16_t count = 0;
+  uint8_t seq = 0;
+  int64_t first_frame_us = 0;
+
+  while (true) {
+    // Wait for the first frame of a datagram as long as it takes,
+    // and for further ones until the batch times out.
+    int64_t deadline_us =
+        count > 0 ? first_frame_us + batch_timeout_us : INT64_MAX;
+    can_listener_frame_t rx_frame;
+    bool received =
+        can_listener_receive_until(can_rx_queue, deadline_us, &rx_frame);
+
+    // Send the datagram if it timed out, or the frame doesn't fit.
+    if (count > 0 &&
+        (!received || len + encoded_len(&rx_frame.msg) > batch_mtu)) {
+      datagram[0] = CANNELLONI_VERSION;
+      datagram[1] = CANNELLONI_OP_DATA;
+      datagram[2] = seq;
+      datagram[3] = count >> 8;
+      datagram[4] = count & 0xFF;
+
+      taskENTER_CRITICAL(&peer_lock);
+      uint32_t addr = peer_addr;
+      uint16_t port = peer_port;
+      taskEXIT_CRITICAL(&peer_lock);
+
+      bool sent = false;
+      if (addr != 0) {
+        struct sockaddr_in dest_addr = {0};
+        dest_addr.sin_family = AF_INET;
+        dest_addr.sin_addr.s_addr = addr;
+        dest_addr.sin_port = htons(port);
+        sent = sendto(udp_sock, datagram, len, 0,
+                      (struct sockaddr *)&dest_addr, sizeof(dest_addr)) >= 0;
+        seq += 1;
+      }
+
+      assert(xSemaphoreTake(status_mutex, portMAX_DELAY) == pdTRUE);
+      if (sent) {
+        status.datagrams_sent += 1;
+        status.frames_sent += count;
+      } else {
+        status.frames_without_peer += count;
+      }
+      assert(xSemaphoreGive(status_mutex) == pdTRUE);
+
+      len = HEADER_LEN;
+      count = 0;
+    }
+
+    if (!received) {
+      continue;
+    }
+
+    if (count == 0) {
+      first_frame_us = esp_timer_get_time();
+    }
+    len += encode_frame(&datagram[len], &rx_frame.msg);
+    count += 1;
+  }
+}
+
+static void cannelloni_rx_task(void *pvParameters) {
+  uint8_t datagram[CANNELLONI_MTU_MAX];
+
+  while (true) {
+    struct sockaddr_in source_addr;
+    socklen_t addr_len = sizeof(source_addr);
+    int len = recvfrom(udp_sock, datagram, sizeof(datagram), 0,
+                       (struct sockaddr *)&source_addr, &addr_len);
+    if (len < 0) {
+      ESP_LOGE(TAG, "Couldn't receive cannelloni datagram: errno %d", errno);
+      vTaskDelay(pdMS_TO_TICKS(100));
+      continue;
+    }
+
+    if (learn_peer) {
+      learn_peer_addr(&source_addr);
+    }
+
+    handle_datagram(datagram, len);
+  }
+}
+
+static void learn_peer_addr(const struct sockaddr_in *source_addr) {
+  uint32_t addr = source_addr->sin_addr.s_addr;
+  uint16_t port = ntohs(source_addr->sin_port);
+
+  taskENTER_CRITICAL(&peer_lock);
+  bool changed = addr != peer_addr || port != peer_port;
+  peer_addr = addr;
+  peer_port = port;
+  taskEXIT_CRITICAL(&peer_lock);
+
+  if (changed) {
+    ESP_LOGI(TAG, "Sending cannelloni frames to %s:%u.",
+             inet_ntoa(source_addr->sin_addr), port);
+  }
+}
+
+static void handle_datagram(const uint8_t *buf, size_t len) {
+  // Sequence number the next datagram should have.
+  // Datagrams are only counted as lost once one arrived.
+  static bool seq_known = false;
+  static uint8_t expected_seq = 0;
+
+  if (len < HEADER_LEN || buf[0] != CANNELLONI_VERSION ||
+      buf[1] != CANNELLONI_OP_DATA) {
+    assert(xSemaphoreTake(status_mutex, portMAX_DELAY) == pdTRUE);
+    status.invalid_datagrams += 1;
+    assert(xSemaphoreGive(status_mutex) == pdTRUE);
+    return;
+  }
+
+  uint8_t seq = buf[2];
+  uint16_t count = (buf[3] << 8) | buf[4];
+  uint8_t lost = seq_known ? (uint8_t)(seq - expected_seq) : 0;
+  seq_known = true;
+  expected_seq = seq + 1;
+
+  uint32_t frames_received = 0;
+  uint32_t invalid_frames = 0;
+  uint32_t can_tx_failed = 0;
+  bool truncated = false;
+
+  size_t offset = HEADER_LEN;
+  for (uint16_t i = 0; i < count; i++) {
+    if (offset + 5 > len) {
+      truncated = true;
+      break;
+    }
+    uint32_t can_id = ((uint32_t)buf[offset] << 24) |
+                      ((uint32_t)buf[offset + 1] << 16) |
+                      ((uint32_t)buf[offset + 2] << 8) | buf[offset + 3];
+    uint8_t dlc = buf[offset + 4];
+    offset += 5;
+
+    bool fd = dlc & CANFD_FRAME;
+    if (fd) {
+      // Skip the flags byte.
+      dlc &= ~CANFD_FRAME;
+      offset += 1;
+    }
+    bool rtr = can_id & CAN_RTR_FLAG;
+    size_t payload_len = rtr ? 0 : dlc;
+    if (offset + payload_len > len) {
+      truncated = true;
+      break;
+    }
+
+    // Skip CAN FD frames, and error frames, which can't be transmitted.
+    if (fd || dlc > TWAI_FRAME_MAX_DLC || (can_id & CAN_LISTENER_ERR_FLAG)) {
+      invalid_frames += 1;
+      offset += payload_len;
+      continue;
+    }
+
+    twai_message_t msg = {0};
+    msg.extd = (can_id & CAN_EFF_FLAG) != 0;
+    msg.rtr = rtr;
+    msg.identifier = can_id & CAN_EFF_MASK;
+    msg.data_length_code = dlc;
+    memcpy(msg.data, &buf[offset], payload_len);
+    offset += payload_len;
+    frames_received += 1;
+
+    esp_err_t err =
+        driver_setup_can_transmit(&msg, pdMS_TO_TICKS(CAN_TX_TIMEOUT_MS));
+    if (err != ESP_OK) {
+      deferred_log(DEFERRED_LOG_CAN_TX_FAILED, err);
+      can_tx_failed += 1;
+    }
+
+    // Send the frame to the other listeners.
+    can_listener_enqueue_msg(&msg, can_rx_queue);
+  }
+
+  assert(xSemaphoreTake(status_mutex, portMAX_DELAY) == pdTRUE);
+  status.datagrams_received += 1;
+  status.datagrams_lost += lost;
+  status.frames_received += frames_received;
+  status.invalid_frames += invalid_frames;
+  status.can_tx_failed += can_tx_failed;
+  if (truncated) {
+    status.invalid_datagrams += 1;
+  }
+  assert(xSemaphoreGive(status_mutex) == pdTRUE);
+}
+
+static size_t encoded_len(const twai_message_t *frame) {
+  return 5 + can_listener_data_len(frame);
+}
+
+static size_t encode_frame(uint8_t *buf, const twai_message_t *frame) {
+  uint32_t can_id = can_listener_socketcan_id(frame);
+
+  buf[0] = can_id >> 24;
+  buf[1] = (can_id >> 16) & 0xFF;
+  buf[2] = (can_id >> 8) & 0xFF;
+  buf[3] = can_id & 0xFF;
+  // RTR frames keep their DLC, but have no data bytes.
+  buf[4] = frame->data_length_code;
+  memcpy(&buf[5], frame->data, can_listener_data_len(frame));
+  return encoded_len(frame);
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_netif_types.h"
+
+// A UDP transport that speaks the binary protocol of cannelloni
+// (https://github.com/mguentner/cannelloni), so a Linux host can
+// bridge the adapter to a vcan interface with
+// `cannelloni -I vcan0 -R <adapter ip> -r <port> -l <port>`.
+//
+// Frames from the CAN bus are packed into datagrams of up to `mtu` bytes.
+// A datagram is sent when the next frame wouldn't fit, or `timeout_us`
+// after its first frame was added, rounded up to a FreeRTOS tick.
+// Each datagram carries a sequence number, which is used to count
+// datagrams lost on the way in.
+// Frames from the peer are transmitted on the CAN bus and passed to the
+// other listeners, like frames from socketcand clients.
+
+// Largest datagram, so it fits in one ethernet frame.
+#define CANNELLONI_MTU_MAX 1472
+
+// Smallest datagram that still fits a header and a full frame.
+#define CANNELLONI_MTU_MIN 64
+
+// The status of the cannelloni transport.
+// Get the current status using `cannelloni_get_status()`.
+typedef struct {
+  uint64_t datagrams_sent;
+  uint64_t frames_sent;
+  uint64_t datagrams_received;
+  uint64_t frames_received;
+
+  // Datagrams from the peer missing from the sequence.
+  uint64_t datagrams_lost;
+
+  // Datagrams and frames from the peer that couldn't be parsed,
+  // or that used features this adapter doesn't have, such as CAN FD.
+  uint64_t invalid_datagrams;
+  uint64_t invalid_frames;
+
+  // Frames from the peer that couldn't be queued for CAN transmission.
+  uint64_t can_tx_failed;
+
+  // Frames from the CAN bus that weren't sent,
+  // because no peer is known yet or sending failed.
+  uint64_t frames_without_peer;
+} cannelloni_status_t;
+
+// Starts listening for cannelloni datagrams on UDP `port`,
+// and sending CAN frames to `peer_ip:port`.
+// If `peer_ip` is 0.0.0.0, frames are sent to the address and port
+// the last datagram came from, and nothing is sent until one arrives.
+// Must only be called once, after `can_listener_start()`.
+esp_err_t cannelloni_start(const esp_ip4_addr_t* peer_ip, uint16_t port,
+                           uint32_t timeout_us, uint16_t mtu);
+
+// Fills `status_out` with the current `cannelloni_status_t`.
+// Returns an error if the transport hasn't been started.
+esp_err_t cannelloni_get_status(cannelloni_status_t* status_out);
@@ -0,0 +1,472 @@
+#include "capture_ring.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "stdatomic.h"
+
+_Static_assert(sizeof(capture_record_t) == 24,
+               "capture_record_t must be packed");
+_Static_assert((CAPTURE_RING_BLOCK_LEN & (CAPTURE_RING_BLOCK_LEN - 1)) == 0,
+               "CAPTURE_RING_BLOCK_LEN must be a power of two");
+_Static_assert(CAPTURE_RING_MIN_RECORDS % CAPTURE_RING_BLOCK_LEN == 0,
+               "CAPTURE_RING_MIN_RECORDS must be a multiple of blocks");
+
+// LINKTYPE_CAN_SOCKETCAN, with frames laid out as `struct can_frame`.
+#define PCAP_LINKTYPE_CAN_SOCKETCAN 227
+
+// Size of `struct can_frame`.
+#define SOCKETCAN_FRAME_LEN 16
+
+// Name that will be used for logging
+static const char *TAG = "capture_ring";
+
+// A slot in the ring. Works like a `trace_buffer` slot.
+typedef struct {
+  // `seq + 1` of the frame in this slot once it's completely written.
+  // Zero while a writer is filling the slot.
+  atomic_uint stamp;
+
+  // The frame. Only valid while `stamp` is unchanged.
+  capture_record_t record;
+} capture_slot_t;
+
+// What a block of `CAPTURE_RING_BLOCK_LEN` frames holds.
+// Error frames only count towards the timestamps.
+typedef struct {
+  int64_t min_us;
+  int64_t max_us;
+
+  // Bits set in all IDs, and bits set in any ID.
+  uint32_t id_and;
+  uint32_t id_or;
+
+  // Bloom filter of the IDs, with two bits per ID.
+  uint32_t id_bloom[4];
+} capture_summary_t;
+
+// The summary of the frames `gen * CAPTURE_RING_BLOCK_LEN` up to
+// `(gen + 1) * CAPTURE_RING_BLOCK_LEN`. Works like a slot.
+typedef struct {
+  // `gen + 1` of the frames summarized, or zero while being updated.
+  atomic_uint stamp;
+
+  // Only valid while `stamp` is unchanged.
+  capture_summary_t summary;
+} capture_block_t;
+
+// `capture_ring_query_t` prepared for matching.
+typedef struct {
+  const capture_ring_query_t *query;
+
+  // The bits of the ID that must be 1, and that must be 0.
+  uint32_t ones;
+  uint32_t zeros;
+
+  // Whether error frames match.
+  bool any;
+
+  // Whether the query is for one ID, so the bloom filter applies.
+  bool exact;
+} capture_match_t;
+
+// Allocated once by `capture_ring_start()`, never freed.
+// `slot_count` is a multiple of `CAPTURE_RING_BLOCK_LEN`.
+static capture_slot_t *slots = NULL;
+static capture_block_t *blocks = NULL;
+static uint32_t slot_count = 0;
+static uint32_t block_count = 0;
+
+// Sequence number that the next captured frame will get.
+// Only advanced once that frame is written, so readers
+// never wait for frames before it.
+// It wraps after 2^32 frames, which misplaces one slot's worth
+// of frames in the ring, once.
+static atomic_uint next_seq = 0;
+
+// Serializes writers, so a frame and its block summary
+// are updated together.
+static portMUX_TYPE write_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Adds the frame `seq` to the summary of its block.
+static void summarize(uint32_t seq, const capture_record_t *record);
+
+// Returns false if the block of frames `gen * CAPTURE_RING_BLOCK_LEN`
+// onwards, captured before `end`, can't hold frames matching `match`.
+static bool block_may_match(const capture_match_t *match, uint32_t gen,
+                            uint32_t end);
+
+static bool record_matches(const capture_match_t *match,
+                           const capture_record_t *record);
+
+// Returns the bits of the block bloom filter for `id`.
+static void bloom_bits(uint32_t id, uint32_t *bit_a, uint32_t *bit_b);
+
+// Writes `value` in little-endian byte order, as pcap headers use
+// the byte order of the host that wrote them.
+static void put_le32(uint8_t *buf, uint32_t value);
+
+esp_err_t capture_ring_start(void) {
+  size_t largest = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+  size_t free_size = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+
+  // Leave the reserve, even if the largest block is all there is.
+  size_t spare = free_size > CAPTURE_RING_HEAP_RESERVE
+                     ? free_size - CAPTURE_RING_HEAP_RESERVE
+                     : 0;
+  if (spare > largest) {
+    spare = largest;
+  }
+
+  // Whole blocks, each with its summary after all the slots.
+  size_t block_size = CAPTURE_RING_BLOCK_LEN * sizeof(capture_slot_t) +
+                      sizeof(capture_block_t);
+  uint32_t count = spare / block_size * CAPTURE_RING_BLOCK_LEN;
+  if (count < CAPTURE_RING_MIN_RECORDS) {
+    ESP_LOGW(TAG, "Only %u bytes of spare heap. Not capturing.", spare);
+    return ESP_ERR_NO_MEM;
+  }
+  uint32_t count_blocks = count / CAPTURE_RING_BLOCK_LEN;
+  size_t size = count_blocks * block_size;
+
+  capture_slot_t *allocated = heap_caps_malloc(size, MALLOC_CAP_8BIT);
+  if (allocated == NULL) {
+    ESP_LOGE(TAG, "Couldn't allocate %lu capture slots.", count);
+    return ESP_ERR_NO_MEM;
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    atomic_init(&allocated[i].stamp, 0);
+  }
+  capture_block_t *allocated_blocks = (capture_block_t *)&allocated[count];
+  for (uint32_t i = 0; i < count_blocks; i++) {
+    atomic_init(&allocated_blocks[i].stamp, 0);
+  }
+
+  slot_count = count;
+  block_count = count_blocks;
+  blocks = allocated_blocks;
+  atomic_thread_fence(memory_order_release);
+  slots = allocated;
+
+  ESP_LOGI(TAG, "Capturing the last %lu frames in %u bytes.", count, size);
+  return ESP_OK;
+}
+
+uint32_t capture_ring_record(const can_listener_frame_t *frame) {
+  capture_slot_t *ring = slots;
+  if (ring == NULL) {
+    return 0;
+  }
+
+  capture_record_t record = {
+      .timestamp_us = frame->rx_time_us,
+      .can_id = can_listener_socketcan_id(&frame->msg),
+      .len = can_listener_data_len(&frame->msg),
+  };
+  memcpy(record.data, frame->msg.data, sizeof(record.data));
+
+  portENTER_CRITICAL(&write_lock);
+
+  uint32_t seq = atomic_load_explicit(&next_seq, memory_order_relaxed);
+  capture_slot_t *slot = &ring[seq % slot_count];
+
+  // Mark the slot as being written, so readers discard it.
+  atomic_store_explicit(&slot->stamp, 0, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  slot->record = record;
+  atomic_store_explicit(&slot->stamp, seq + 1, memory_order_release);
+
+  summarize(seq, &record);
+
+  // Publish the frame.
+  atomic_store_explicit(&next_seq, seq + 1, memory_order_release);
+
+  portEXIT_CRITICAL(&write_lock);
+  return seq;
+}
+
+void capture_ring_range(uint32_t *first_out, uint32_t *end_out) {
+  uint32_t end = atomic_load_explicit(&next_seq, memory_order_acquire);
+  *end_out = end;
+  *first_out = end > slot_count ? end - slot_count : 0;
+}
+
+bool capture_ring_read(uint32_t seq, capture_record_t *record_out) {
+  if (slots == NULL) {
+    return false;
+  }
+  const capture_slot_t *slot = &slots[seq % slot_count];
+
+  uint32_t stamp_before =
+      atomic_load_explicit(&slot->stamp, memory_order_acquire);
+  if (stamp_before != seq + 1) {
+    return false;
+  }
+
+  *record_out = slot->record;
+
+  // If a writer claimed the slot while we were copying, the copy is torn.
+  atomic_thread_fence(memory_order_acquire);
+  uint32_t stamp_after =
+      atomic_load_explicit(&slot->stamp, memory_order_relaxed);
+  return stamp_after == stamp_before;
+}
+
+bool capture_ring_find(const capture_ring_query_t *query, uint32_t *seq_inout,
+                       uint32_t end, capture_record_t *record_out) {
+  if (slots == NULL) {
+    return false;
+  }
+
+  uint32_t mask = query->mask & CAN_EFF_MASK;
+  capture_match_t match = {
+      .query = query,
+      .ones = query->id & mask,
+      .zeros = ~query->id & mask,
+      .any = mask == 0,
+      .exact = mask == CAN_EFF_MASK,
+  };
+
+  uint32_t seq = *seq_inout;
+  while (seq != end) {
+    // Frames left in the block of `seq`, up to `end`.
+    uint32_t count = CAPTURE_RING_BLOCK_LEN - seq % CAPTURE_RING_BLOCK_LEN;
+    if (end - seq < count) {
+      count = end - seq;
+    }
+
+    if (!block_may_match(&match, seq / CAPTURE_RING_BLOCK_LEN, end)) {
+      seq += count;
+      continue;
+    }
+
+    for (; count > 0; count--, seq++) {
+      if (capture_ring_read(seq, record_out) &&
+          record_matches(&match, record_out)) {
+        *seq_inout = seq;
+        return true;
+      }
+    }
+  }
+
+  *seq_inout = end;
+  return false;
+}
+
+void capture_ring_format_pcap_header(uint8_t *buf) {
+  // Magic number for microsecond timestamps, and version 2.4.
+  put_le32(&buf[0], 0xA1B2C3D4);
+  buf[4] = 2;
+  buf[5] = 0;
+  buf[6] = 4;
+  buf[7] = 0;
+
+  // Time zone, timestamp accuracy, snapshot length and link type.
+  put_le32(&buf[8], 0);
+  put_le32(&buf[12], 0);
+  put_le32(&buf[16], SOCKETCAN_FRAME_LEN);
+  put_le32(&buf[20], PCAP_LINKTYPE_CAN_SOCKETCAN);
+}
+
+void capture_ring_format_pcap(const capture_record_t *record, uint8_t *buf) {
+  // Timestamps are the adapter's uptime, as it has no wall clock.
+  put_le32(&buf[0], record->timestamp_us / 1000000);
+  put_le32(&buf[4], record->timestamp_us % 1000000);
+  put_le32(&buf[8], SOCKETCAN_FRAME_LEN);
+  put_le32(&buf[12], SOCKETCAN_FRAME_LEN);
+
+  // `struct can_frame`, with `can_id` in network byte order
+  // as LINKTYPE_CAN_SOCKETCAN requires.
+  uint8_t *frame = &buf[16];
+  frame[0] = record->can_id >> 24;
+  frame[1] = (record->can_id >> 16) & 0xFF;
+  frame[2] = (record->can_id >> 8) & 0xFF;
+  frame[3] = record->can_id & 0xFF;
+  frame[4] = record->len;
+  frame[5] = 0;
+  frame[6] = 0;
+  frame[7] = 0;
+  memset(&frame[8], 0, 8);
+  memcpy(&frame[8], record->data, record->len);
+}
+
+size_t capture_ring_format_candump(const capture_record_t *record, char *buf,
+                                   size_t buflen) {
+  int written;
+  if (record->can_id & (CAN_EFF_FLAG | CAN_LISTENER_ERR_FLAG)) {
+    // Error frames are printed with their flag, like candump does.
+    written = snprintf(buf, buflen, "(%lld.%06lld) can0 %08lX#",
+                       record->timestamp_us / 1000000,
+                       record->timestamp_us % 1000000,
+                       record->can_id & (CAN_EFF_MASK | CAN_LISTENER_ERR_FLAG));
+  } else {
+    written = snprintf(buf, buflen, "(%lld.%06lld) can0 %03lX#",
+                       record->timestamp_us / 1000000,
+                       record->timestamp_us % 1000000,
+                       record->can_id & CAN_EFF_MASK);
+  }
+  if (written < 0 || written >= buflen) {
+    return 0;
+  }
+
+  if (record->can_id & CAN_RTR_FLAG) {
+    written += snprintf(buf + written, buflen - written, "R");
+  } else {
+    for (uint8_t i = 0; i < record->len; i++) {
+      written +=
+          snprintf(buf + written, buflen - written, "%02X", record->data[i]);
+    }
+  }
+  written += snprintf(buf + written, buflen - written, "\n");
+  return written;
+}
+
+esp_err_t capture_ring_get_status(capture_ring_status_t *status_out) {
+  if (slots == NULL) {
+    return ESP_FAIL;
+  }
+
+  uint32_t first;
+  uint32_t end;
+  capture_ring_range(&first, &end);
+
+  status_out->capacity = slot_count;
+  status_out->size_bytes = slot_count * sizeof(capture_slot_t) +
+                           block_count * sizeof(capture_block_t);
+  status_out->held = end - first;
+  status_out->total = end;
+  status_out->oldest_age_ms = 0;
+
+  // The oldest slot may be being overwritten. Try the next ones.
+  capture_record_t oldest;
+  for (uint32_t seq = first; seq != end; seq++) {
+    if (capture_ring_read(seq, &oldest)) {
+      status_out->oldest_age_ms =
+          (esp_timer_get_time() - oldest.timestamp_us) / 1000;
+      break;
+    }
+  }
+  return ESP_OK;
+}
+
+static void summarize(uint32_t seq, const capture_record_t *record) {
+  uint32_t gen = seq / CAPTURE_RING_BLOCK_LEN;
+  capture_block_t *block = &blocks[gen % block_count];
+  capture_summary_t *summary = &block->summary;
+
+  atomic_store_explicit(&block->stamp, 0, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  // The first frame of a block replaces the summary of the block
+  // it overwrites.
+  if (seq % CAPTURE_RING_BLOCK_LEN == 0) {
+    summary->min_us = record->timestamp_us;
+    summary->max_us = record->timestamp_us;
+    summary->id_and = CAN_EFF_MASK;
+    summary->id_or = 0;
+    memset(summary->id_bloom, 0, sizeof(summary->id_bloom));
+  } else if (record->timestamp_us < summary->min_us) {
+    summary->min_us = record->timestamp_us;
+  } else if (record->timestamp_us > summary->max_us) {
+    summary->max_us = record->timestamp_us;
+  }
+
+  if (!(record->can_id & CAN_LISTENER_ERR_FLAG)) {
+    uint32_t id = record->can_id & CAN_EFF_MASK;
+    summary->id_and &= id;
+    summary->id_or |= id;
+
+    uint32_t bit_a;
+    uint32_t bit_b;
+    bloom_bits(id, &bit_a, &bit_b);
+    summary->id_bloom[bit_a / 32] |= 1U << (bit_a % 32);
+    summary->id_bloom[bit_b / 32] |= 1U << (bit_b % 32);
+  }
+
+  atomic_store_explicit(&block->stamp, gen + 1, memory_order_release);
+}
+
+static bool block_may_match(const capture_match_t *match, uint32_t gen,
+                            uint32_t end) {
+  // Only the summary of a complete block covers all its frames.
+  if (end - gen * CAPTURE_RING_BLOCK_LEN < CAPTURE_RING_BLOCK_LEN) {
+    return true;
+  }
+
+  const capture_block_t *block = &blocks[gen % block_count];
+  uint32_t stamp_before =
+      atomic_load_explicit(&block->stamp, memory_order_acquire);
+  if (stamp_before != gen + 1) {
+    // Overwritten, so reading its frames fails quickly anyway.
+    return true;
+  }
+
+  capture_summary_t summary = block->summary;
+
+  atomic_thread_fence(memory_order_acquire);
+  if (atomic_load_explicit(&block->stamp, memory_order_relaxed) !=
+      stamp_before) {
+    return true;
+  }
+
+  const capture_ring_query_t *query = match->query;
+  if (summary.max_us < query->from_us || summary.min_us > query->to_us) {
+    return false;
+  }
+  if (match->any) {
+    return true;
+  }
+
+  // Some frame must have each bit that must be 1,
+  // and some frame must lack each bit that must be 0.
+  if ((summary.id_or & match->ones) != match->ones ||
+      (summary.id_and & match->zeros) != 0) {
+    return false;
+  }
+
+  if (match->exact) {
+    uint32_t bit_a;
+    uint32_t bit_b;
+    bloom_bits(match->ones, &bit_a, &bit_b);
+    if (!(summary.id_bloom[bit_a / 32] & (1U << (bit_a % 32))) ||
+        !(summary.id_bloom[bit_b / 32] & (1U << (bit_b % 32)))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool record_matches(const capture_match_t *match,
+                           const capture_record_t *record) {
+  const capture_ring_query_t *query = match->query;
+  if (record->timestamp_us < query->from_us ||
+      record->timestamp_us > query->to_us) {
+    return false;
+  }
+  if (match->any) {
+    return true;
+  }
+  if (record->can_id & CAN_LISTENER_ERR_FLAG) {
+    return false;
+  }
+  uint32_t id = record->can_id & CAN_EFF_MASK;
+  return (id & match->ones) == match->ones && (id & match->zeros) == 0;
+}
+
+static void bloom_bits(uint32_t id, uint32_t *bit_a, uint32_t *bit_b) {
+  // Fibonacci hashing spreads nearby IDs over the whole filter.
+  uint32_t hash = id * 0x9E3779B1U;
+  *bit_a = hash >> 25;
+  *bit_b = (hash >> 18) & 0x7F;
+}
+
+static void put_le32(uint8_t *buf, uint32_t value) {
+  buf[0] = value & 0xFF;
+  buf[1] = (value >> 8) & 0xFF;
+  buf[2] = (value >> 16) & 0xFF;
+  buf[3] = value >> 24;
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "can_listener.h"
+#include "esp_err.h"
+
+// A ring of every CAN frame that passes through the `can_listener`,
+// so the last seconds of bus traffic can be downloaded from
+// `/api/capture` after an intermittent fault, without a client
+// having been connected when it happened.
+//
+// The ring takes all heap that's left at boot, minus
+// `CAPTURE_RING_HEAP_RESERVE` for the network stack and HTTP server.
+//
+// Frames are stored in blocks of `CAPTURE_RING_BLOCK_LEN`. Each block
+// keeps the range of its timestamps, the AND and OR of its IDs, and a
+// bloom filter of its IDs, so `capture_ring_find()` skips blocks that
+// can't hold matches, and `/api/history` queries cost about as much
+// as the frames they return. Writers hold a short spinlock, readers
+// never block writers.
+
+// Heap left for everything else after the ring is allocated.
+#define CAPTURE_RING_HEAP_RESERVE (80 * 1024)
+
+// Smallest useful ring. If less heap is spare, there's no ring.
+#define CAPTURE_RING_MIN_RECORDS 256
+
+// Number of frames per block. A power of two.
+#define CAPTURE_RING_BLOCK_LEN 64
+
+// One captured frame. Exactly 24 bytes.
+typedef struct {
+  // `can_listener_frame_t.rx_time_us`.
+  int64_t timestamp_us;
+
+  // The CAN ID with SocketCAN's EFF, RTR and ERR flags.
+  uint32_t can_id;
+
+  // The number of data bytes.
+  uint8_t len;
+  uint8_t reserved[3];
+
+  uint8_t data[8];
+} capture_record_t;
+
+// Selects frames for `capture_ring_find()`.
+typedef struct {
+  // Frames whose ID, without flags, matches `id` in the bits set in
+  // `mask`. A `mask` of 0 matches every frame, even error frames,
+  // which other masks never match.
+  uint32_t id;
+  uint32_t mask;
+
+  // Frames with `from_us <= timestamp_us <= to_us`.
+  int64_t from_us;
+  int64_t to_us;
+} capture_ring_query_t;
+
+// Sizes of what `capture_ring_format_pcap_header()` and
+// `capture_ring_format_pcap()` write.
+#define CAPTURE_RING_PCAP_HEADER_LEN 24
+#define CAPTURE_RING_PCAP_RECORD_LEN 32
+
+// Longest line `capture_ring_format_candump()` writes,
+// including the terminator.
+#define CAPTURE_RING_CANDUMP_MAX_LEN 64
+
+// The status of the capture ring.
+// Get the current status using `capture_ring_get_status()`.
+typedef struct {
+  // Number of frames the ring can hold, and its size in bytes.
+  uint32_t capacity;
+  uint32_t size_bytes;
+
+  // Number of frames currently held.
+  uint32_t held;
+
+  // Number of frames captured since boot.
+  uint32_t total;
+
+  // Age of the oldest frame held, or 0 if the ring is empty.
+  uint32_t oldest_age_ms;
+} capture_ring_status_t;
+
+// Allocates the ring from spare heap.
+// Must only be called once, after everything else that allocates at boot.
+// Returns `ESP_ERR_NO_MEM` if less than `CAPTURE_RING_MIN_RECORDS` fit.
+esp_err_t capture_ring_start(void);
+
+// Captures `frame`, overwriting the oldest one.
+// Safe to call from any task. Does nothing before `capture_ring_start()`.
+// Returns the sequence number of `frame` in the ring.
+uint32_t capture_ring_record(const can_listener_frame_t* frame);
+
+// Returns the sequence numbers of the oldest and one-past-the-newest
+// frames currently held in the ring. Frames before `end_out`
+// are completely written.
+void capture_ring_range(uint32_t* first_out, uint32_t* end_out);
+
+// Copies the frame with sequence number `seq` to `record_out`.
+// Returns false if that frame was overwritten, or is still being written.
+bool capture_ring_read(uint32_t seq, capture_record_t* record_out);
+
+// Finds the first frame at or after `*seq_inout`, and before `end`,
+// that matches `query`. Skips blocks that can't hold a match.
+// Returns false if there's none. Otherwise copies it to `record_out`
+// and sets `*seq_inout` to its sequence number.
+bool capture_ring_find(const capture_ring_query_t* query, uint32_t* seq_inout,
+                       uint32_t end, capture_record_t* record_out);
+
+// Writes the global header of a pcap file with the SocketCAN link type
+// to `buf`, which must hold `CAPTURE_RING_PCAP_HEADER_LEN` bytes.
+void capture_ring_format_pcap_header(uint8_t* buf);
+
+// Writes `record` as a pcap packet to `buf`,
+// which must hold `CAPTURE_RING_PCAP_RECORD_LEN` bytes.
+void capture_ring_format_pcap(const capture_record_t* record, uint8_t* buf);
+
+// Writes `record` as a line of a candump log to `buf`.
+// Returns the length of the line.
+size_t capture_ring_format_candump(const capture_record_t* record, char* buf,
+                                   size_t buflen);
+
+// Fills `status_out` with the current `capture_ring_status_t`.
+// Returns an error if there's no ring.
+esp_err_t capture_ring_get_status(capture_ring_status_t* status_out);
@@ -0,0 +1,431 @@
+#include "capture_trigger.h"
+
+#include <string.h>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "id_match_table.h"
+#include "stdatomic.h"
+#include "task_config.h"
+#include "text_parse.h"
+
+_Static_assert(CAPTURE_TRIGGERS_MAX <= ID_MATCH_TABLE_ENTRIES_MAX,
+               "Every trigger needs an entry in the match table");
+
+// Frames per snapshot: before, the one that matched, and after.
+#define SNAPSHOT_FRAMES \
+  (CAPTURE_TRIGGER_PRE_FRAMES + 1 + CAPTURE_TRIGGER_POST_FRAMES)
+
+// How often the frames after the one that matched are collected.
+#define POST_POLL_MS 10
+
+// Name that will be used for logging
+static const char *TAG = "capture_trigger";
+
+static capture_triggers_t armed_triggers;
+static id_match_table_t trigger_table;
+
+// Set once the triggers are armed.
+static atomic_bool started = false;
+
+// Set by `capture_trigger_check()` while a snapshot is being taken.
+static atomic_bool taking = false;
+
+// The match that started the snapshot being taken.
+static uint8_t match_trigger;
+static uint32_t match_seq;
+static int64_t match_time_us;
+
+// Snapshots, and their frames, allocated by `capture_trigger_start()`.
+// Snapshot `number` is in slot `(number - 1) % CAPTURE_TRIGGER_SNAPSHOTS`.
+// Its frames are only written beyond `frame_count`,
+// so readers holding the mutex may copy those before it.
+static capture_trigger_snapshot_t snapshots[CAPTURE_TRIGGER_SNAPSHOTS];
+static capture_record_t *snapshot_frames = NULL;
+
+static capture_trigger_status_t status = {0};
+static SemaphoreHandle_t status_mutex = NULL;
+static StaticSemaphore_t status_mutex_mem;
+
+// Task that copies the frames of a snapshot out of the capture ring.
+static void capture_trigger_task(void *pvParameters);
+static StackType_t capture_trigger_task_stack[3072];
+static StaticTask_t capture_trigger_task_mem;
+static TaskHandle_t capture_trigger_task_handle = NULL;
+
+// Parses one payload comparison from `text` into `trigger`.
+static bool parse_comparison(char *text, capture_trigger_t *trigger);
+
+// Copies frame `seq` from the capture ring to the next frame
+// of `snapshot`, or counts it as missed.
+static void copy_frame(capture_trigger_snapshot_t *snapshot,
+                       capture_record_t *frames, uint32_t seq);
+
+esp_err_t capture_trigger_parse(const char *spec,
+                                capture_triggers_t *triggers_out) {
+  char buf[CAPTURE_TRIGGER_SPEC_LEN];
+  if (strlen(spec) >= sizeof(buf)) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  strcpy(buf, spec);
+
+  triggers_out->count = 0;
+  char *saveptr;
+  for (char *token = strtok_r(buf, " ", &saveptr); token != NULL;
+       token = strtok_r(NULL, " ", &saveptr)) {
+    if (triggers_out->count >= CAPTURE_TRIGGERS_MAX ||
+        !capture_trigger_parse_one(
+            token, &triggers_out->triggers[triggers_out->count])) {
+      return ESP_ERR_INVALID_ARG;
+    }
+    triggers_out->count += 1;
+  }
+
+  return ESP_OK;
+}
+
+esp_err_t capture_trigger_start(const capture_triggers_t *triggers) {
+  armed_triggers = *triggers;
+  id_match_table_init(&trigger_table);
+  for (uint8_t i = 0; i < triggers->count; i++) {
+    esp_err_t err =
+        id_match_table_add(&trigger_table, triggers->triggers[i].id,
+                           triggers->triggers[i].mask, i);
+    if (err != ESP_OK) {
+      ESP_LOGE(TAG, "Too many distinct trigger masks.");
+      return err;
+    }
+  }
+  id_match_table_compile(&trigger_table);
+
+  snapshot_frames = heap_caps_malloc(CAPTURE_TRIGGER_SNAPSHOTS *
+                                         SNAPSHOT_FRAMES *
+                                         sizeof(capture_record_t),
+                                     MALLOC_CAP_8BIT);
+  if (snapshot_frames == NULL) {
+    ESP_LOGE(TAG, "Couldn't allocate snapshots.");
+    return ESP_ERR_NO_MEM;
+  }
+
+  status_mutex = xSemaphoreCreateMutexStatic(&status_mutex_mem);
+  if (status_mutex == NULL) {
+    ESP_LOGE(TAG, "Unreachable. Trigger mutex couldn't be created.");
+    return ESP_FAIL;
+  }
+  status.armed = triggers->count;
+
+  capture_trigger_task_handle = task_config_create_static(
+      TASK_ID_CAPTURE_TRIGGER, capture_trigger_task,
+      sizeof(capture_trigger_task_stack), NULL, capture_trigger_task_stack,
+      &capture_trigger_task_mem);
+
+  atomic_store(&started, true);
+
+  ESP_LOGI(TAG, "Armed %d triggers.", triggers->count);
+  return ESP_OK;
+}
+
+void capture_trigger_check(const can_listener_frame_t *frame, uint32_t seq) {
+  if (!atomic_load_explicit(&started, memory_order_acquire) ||
+      (frame->msg.identifier & CAN_LISTENER_ERR_FLAG)) {
+    return;
+  }
+
+  uint16_t matches[CAPTURE_TRIGGERS_MAX];
+  uint32_t id = frame->msg.identifier & CAN_EFF_MASK;
+  uint16_t match_count = id_match_table_lookup(&trigger_table, id, matches,
+                                               CAPTURE_TRIGGERS_MAX);
+
+  for (uint16_t i = 0; i < match_count; i++) {
+    if (!capture_trigger_payload_matches(&armed_triggers.triggers[matches[i]],
+                                         &frame->msg)) {
+      continue;
+    }
+
+    if (atomic_exchange(&taking, true)) {
+      assert(xSemaphoreTake(status_mutex, portMAX_DELAY) == pdTRUE);
+      status.held_off += 1;
+      assert(xSemaphoreGive(status_mutex) == pdTRUE);
+      return;
+    }
+
+    // Only one match at a time gets here, until the task is done.
+    match_trigger = matches[i];
+    match_seq = seq;
+    match_time_us = frame->rx_time_us;
+    xTaskNotifyGive(capture_trigger_task_handle);
+    return;
+  }
+}
+
+uint8_t capture_trigger_list(capture_trigger_snapshot_t *snapshots_out) {
+  if (status_mutex == NULL) {
+    return 0;
+  }
+
+  assert(xSemaphoreTake(status_mutex, portMAX_DELAY) == pdTRUE);
+  uint8_t count = 0;
+  uint32_t last = status.last_number;
+  uint32_t first = last > CAPTURE_TRIGGER_SNAPSHOTS
+                       ? last - CAPTURE_TRIGGER_SNAPSHOTS + 1
+                       : 1;
+  for (uint32_t number = first; number <= last; number++) {
+    snapshots_out[count] =
+        snapshots[(number - 1) % CAPTURE_TRIGGER_SNAPSHOTS];
+    count++;
+  }
+  assert(xSemaphoreGive(status_mutex) == pdTRUE);
+
+  return count;
+}
+
+esp_err_t capture_trigger_read(uint32_t number, uint16_t index,
+                               capture_record_t *record_out) {
+  if (status_mutex == NULL || number == 0) {
+    return ESP_ERR_NOT_FOUND;
+  }
+
+  esp_err_t err = ESP_ERR_NOT_FOUND;
+  uint32_t slot = (number - 1) % CAPTURE_TRIGGER_SNAPSHOTS;
+  assert(xSemaphoreTake(status_mutex, portMAX_DELAY) == pdTRUE);
+  if (snapshots[slot].number == number &&
+      index < snapshots[slot].frame_count) {
+    *record_out = snapshot_frames[slot * SNAPSHOT_FRAMES + index];
+    err = ESP_OK;
+  }
+  assert(xSemaphoreGive(status_mutex) == pdTRUE);
+
+  return err;
+}
+
+esp_err_t capture_trigger_get_status(capture_trigger_status_t *status_out) {
+  if (status_mutex == NULL) {
+    return ESP_FAIL;
+  }
+
+  assert(xSemaphoreTake(status_mutex, portMAX_DELAY) == pdTRUE);
+  *status_out = status;
+  assert(xSemaphoreGive(status_mutex) == pdTRUE);
+
+  return ESP_OK;
+}
+
+static void capture_trigger_task(void *pvParameters) {
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    // Start the next snapshot, replacing the oldest.
+    assert(xSemaphoreTake(status_mutex, portMAX_DELAY) == pdTRUE);
+    status.fired += 1;
+    status.last_number += 1;
+    uint32_t slot = (status.last_number - 1) % CAPTURE_TRIGGER_SNAPSHOTS;
+    capture_trigger_snapshot_t *snapshot = &snapshots[slot];
+    *snapshot = (capture_trigger_snapshot_t){
+        .number = status.last_number,
+        .trigger = match_trigger,
+        .trigger_time_us = match_time_us,
+        .frame_count = 0,
+        .trigger_frame = 0,
+        .frames_missed = 0,
+        .complete = false,
+    };
+    assert(xSemaphoreGive(status_mutex) == pdTRUE);
+    capture_record_t *frames = &snapshot_frames[slot * SNAPSHOT_FRAMES];
+
+    ESP_LOGI(TAG, "Trigger %d matched. Taking snapshot %lu.", match_trigger,
+             snapshot->number);
+
+    // Freeze the frames before the match first,
+    // as the capture ring overwrites them first.
+    uint32_t first;
+    uint32_t end;
+    capture_ring_range(&first, &end);
+    uint32_t seq = match_seq - first > CAPTURE_TRIGGER_PRE_FRAMES
+                       ? match_seq - CAPTURE_TRIGGER_PRE_FRAMES
+                       : first;
+    for (; seq != match_seq; seq++) {
+      copy_frame(snapshot, frames, seq);
+    }
+    snapshot->trigger_frame = snapshot->frame_count;
+    copy_frame(snapshot, frames, match_seq);
+
+    // Then collect the frames after it as they arrive.
+    int64_t deadline_us =
+        esp_timer_get_time() + CAPTURE_TRIGGER_POST_TIMEOUT_MS * 1000;
+    uint32_t post_end = match_seq + 1 + CAPTURE_TRIGGER_POST_FRAMES;
+    seq = match_seq + 1;
+    while (seq != post_end && esp_timer_get_time() < deadline_us) {
+      capture_ring_range(&first, &end);
+      for (; seq != post_end && seq != end; seq++) {
+        copy_frame(snapshot, frames, seq);
+      }
+      if (seq != post_end) {
+        vTaskDelay(pdMS_TO_TICKS(POST_POLL_MS));
+      }
+    }
+
+    assert(xSemaphoreTake(status_mutex, portMAX_DELAY) == pdTRUE);
+    snapshot->complete = seq == post_end;
+    assert(xSemaphoreGive(status_mutex) == pdTRUE);
+
+    ESP_LOGI(TAG, "Snapshot %lu has %d frames, %d missed.", snapshot->number,
+             snapshot->frame_count, snapshot->frames_missed);
+
+    // Re-arm.
+    atomic_store(&taking, false);
+  }
+}
+
+static void copy_frame(capture_trigger_snapshot_t *snapshot,
+                       capture_record_t *frames, uint32_t seq) {
+  bool copied = capture_ring_read(seq, &frames[snapshot->frame_count]);
+
+  assert(xSemaphoreTake(status_mutex, portMAX_DELAY) == pdTRUE);
+  if (copied) {
+    snapshot->frame_count += 1;
+  } else {
+    snapshot->frames_missed += 1;
+  }
+  assert(xSemaphoreGive(status_mutex) == pdTRUE);
+}
+
+bool capture_trigger_payload_matches(const capture_trigger_t *trigger,
+                                     const twai_message_t *msg) {
+  if (trigger->min_len == 0) {
+    return true;
+  }
+  if (msg->rtr || msg->data_length_code < trigger->min_len) {
+    return false;
+  }
+
+  // The ESP32 is little-endian, so byte `i` is bits `8 * i` onwards.
+  uint64_t data;
+  memcpy(&data, msg->data, sizeof(data));
+  if ((data & trigger->equal_mask) != trigger->equal_value) {
+    return false;
+  }
+
+  for (uint8_t i = 0; i < trigger->comparison_count; i++) {
+    const capture_trigger_comparison_t *comparison = &trigger->comparisons[i];
+    uint8_t value = msg->data[comparison->byte] & comparison->mask;
+    if ((comparison->op == CAPTURE_TRIGGER_OP_NE &&
+         value == comparison->value) ||
+        (comparison->op == CAPTURE_TRIGGER_OP_LT &&
+         value >= comparison->value) ||
+        (comparison->op == CAPTURE_TRIGGER_OP_GT &&
+         value <= comparison->value)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool capture_trigger_parse_one(char *text, capture_trigger_t *trigger_out) {
+  *trigger_out = (capture_trigger_t){
+      .id = 0,
+      .mask = CAN_EFF_MASK,
+      .equal_mask = 0,
+      .equal_value = 0,
+      .min_len = 0,
+      .comparison_count = 0,
+  };
+
+  char *comparisons = strchr(text, ':');
+  if (comparisons != NULL) {
+    *comparisons = '\0';
+    comparisons += 1;
+  }
+  char *mask = strchr(text, '/');
+  if (mask != NULL) {
+    *mask = '\0';
+    mask += 1;
+  }
+
+  if (!text_parse_number(text, 16, CAN_EFF_MASK, &trigger_out->id) ||
+      (mask != NULL &&
+       !text_parse_number(mask, 16, CAN_EFF_MASK, &trigger_out->mask))) {
+    return false;
+  }
+  trigger_out->id &= trigger_out->mask;
+
+  if (comparisons == NULL) {
+    return true;
+  }
+  char *saveptr;
+  for (char *comparison = strtok_r(comparisons, ",", &saveptr);
+       comparison != NULL; comparison = strtok_r(NULL, ",", &saveptr)) {
+    if (!parse_comparison(comparison, trigger_out)) {
+      return false;
+    }
+  }
+  return trigger_out->min_len > 0;
+}
+
+static bool parse_comparison(char *text, capture_trigger_t *trigger) {
+  // The byte index, a single digit.
+  if (text[0] < '0' || text[0] > '7') {
+    return false;
+  }
+  uint8_t byte = text[0] - '0';
+  text += 1;
+
+  // The operator, and the optional mask before it.
+  char *op = strpbrk(text, "=!<>");
+  if (op == NULL) {
+    return false;
+  }
+  char op_char = *op;
+  char *value = op + (op_char == '!' ? 2 : 1);
+  if (op_char == '!' && op[1] != '=') {
+    return false;
+  }
+  *op = '\0';
+
+  uint32_t mask = 0xFF;
+  if (text[0] == '&') {
+    if (!text_parse_number(text + 1, 16, 0xFF, &mask)) {
+      return false;
+    }
+  } else if (text[0] != '\0') {
+    return false;
+  }
+  uint32_t expected;
+  if (!text_parse_number(value, 16, 0xFF, &expected)) {
+    return false;
+  }
+
+  if (op_char == '=') {
+    uint64_t byte_mask = (uint64_t)mask << (8 * byte);
+    uint64_t byte_value = (uint64_t)(expected & mask) << (8 * byte);
+    // Two `=` on the same bits must agree.
+    if ((trigger->equal_value & byte_mask) !=
+        (byte_value & trigger->equal_mask)) {
+      return false;
+    }
+    trigger->equal_mask |= byte_mask;
+    trigger->equal_value |= byte_value;
+  } else {
+    if (trigger->comparison_count >= CAPTURE_TRIGGER_COMPARISONS_MAX) {
+      return false;
+    }
+    trigger->comparisons[trigger->comparison_count] =
+        (capture_trigger_comparison_t){
+            .byte = byte,
+            .mask = mask,
+            .value = expected,
+            .op = op_char == '!'   ? CAPTURE_TRIGGER_OP_NE
+                  : op_char == '<' ? CAPTURE_TRIGGER_OP_LT
+                                   : CAPTURE_TRIGGER_OP_GT,
+        };
+    trigger->comparison_count += 1;
+  }
+
+  if (byte + 1 > trigger->min_len) {
+    trigger->min_len = byte + 1;
+  }
+  return true;
+}
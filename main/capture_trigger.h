@@ -0,0 +1,159 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "can_listener.h"
+#include "capture_ring.h"
+#include "esp_err.h"
+
+// Keeps the traffic around specific frames, like a DTC broadcast,
+// as numbered snapshots that can be downloaded from `/api/snapshot`
+// long after the capture ring has moved on.
+//
+// When a frame matches a trigger, the `CAPTURE_TRIGGER_PRE_FRAMES`
+// before it are copied out of the capture ring right away, and the
+// `CAPTURE_TRIGGER_POST_FRAMES` after it as they arrive. Triggers are
+// looked up in an `id_match_table_t`, so checking a frame costs a few
+// cycles however many triggers are armed. While a snapshot is being
+// taken, further matches are only counted.
+
+// Maximum length of the textual triggers, including the terminator.
+#define CAPTURE_TRIGGER_SPEC_LEN 128
+
+// Maximum number of triggers.
+#define CAPTURE_TRIGGERS_MAX 16
+
+// Maximum number of payload comparisons per trigger, other than `=`.
+#define CAPTURE_TRIGGER_COMPARISONS_MAX 4
+
+// Frames kept before and after the one that matched.
+#define CAPTURE_TRIGGER_PRE_FRAMES 256
+#define CAPTURE_TRIGGER_POST_FRAMES 128
+
+// How long to wait for the frames after the one that matched,
+// in case the bus goes quiet.
+#define CAPTURE_TRIGGER_POST_TIMEOUT_MS 5000
+
+// Number of snapshots kept. Newer ones replace the oldest.
+#define CAPTURE_TRIGGER_SNAPSHOTS 4
+
+typedef enum {
+  CAPTURE_TRIGGER_OP_NE,
+  CAPTURE_TRIGGER_OP_LT,
+  CAPTURE_TRIGGER_OP_GT,
+} capture_trigger_op_t;
+
+// Compares data byte `byte`, masked with `mask`, to `value`.
+typedef struct {
+  uint8_t byte;
+  uint8_t mask;
+  uint8_t value;
+  capture_trigger_op_t op;
+} capture_trigger_comparison_t;
+
+// A trigger matches frames whose ID, without flags, equals `id`
+// in the bits set in `mask`, and whose payload passes all comparisons.
+typedef struct {
+  uint32_t id;
+  uint32_t mask;
+
+  // All `=` comparisons, folded into one. The payload matches if
+  // its bytes, read as a little-endian integer, and'ed with
+  // `equal_mask` are `equal_value`.
+  uint64_t equal_mask;
+  uint64_t equal_value;
+
+  // Frames with fewer data bytes don't match.
+  uint8_t min_len;
+
+  capture_trigger_comparison_t comparisons[CAPTURE_TRIGGER_COMPARISONS_MAX];
+  uint8_t comparison_count;
+} capture_trigger_t;
+
+typedef struct {
+  capture_trigger_t triggers[CAPTURE_TRIGGERS_MAX];
+  uint8_t count;
+} capture_triggers_t;
+
+// A snapshot of the frames around a trigger.
+typedef struct {
+  // Numbered from 1 since boot.
+  uint32_t number;
+
+  // Index of the trigger that matched, and when.
+  uint8_t trigger;
+  int64_t trigger_time_us;
+
+  // Number of frames held, and the index of the one that matched.
+  uint16_t frame_count;
+  uint16_t trigger_frame;
+
+  // Frames that were overwritten in the capture ring
+  // before they could be copied.
+  uint16_t frames_missed;
+
+  // Whether all frames after the trigger were copied.
+  bool complete;
+} capture_trigger_snapshot_t;
+
+// The status of the triggers.
+// Get the current status using `capture_trigger_get_status()`.
+typedef struct {
+  uint8_t armed;
+
+  // Snapshots taken since boot, and the number of the last one.
+  uint32_t fired;
+  uint32_t last_number;
+
+  // Matches while a snapshot was being taken.
+  uint32_t held_off;
+} capture_trigger_status_t;
+
+// Parses the textual `spec` into `triggers_out`.
+// Triggers are separated by spaces, and are an ID with an optional
+// mask and payload comparisons, all in hex except byte indices:
+//   7E8             frames with ID 0x7E8
+//   18FECA00/1FFFFF00  any source address of J1939 PGN 0xFECA
+//   7E8:0=03,1=7F   ID 0x7E8 with data bytes 0 and 1 being 0x03 and 0x7F
+//   123:2&F0!=00,3>80  ID 0x123 with a high nibble in byte 2, byte 3 > 0x80
+// The operators are `=`, `!=`, `<` and `>`.
+// Returns `ESP_ERR_INVALID_ARG` if `spec` is invalid.
+esp_err_t capture_trigger_parse(const char* spec,
+                                capture_triggers_t* triggers_out);
+
+// Parses one trigger of a `capture_trigger_parse()` spec from `text`,
+// which is modified, into `trigger_out`.
+// Other modules use it to match frames the same way.
+// Returns false if `text` is invalid.
+bool capture_trigger_parse_one(char* text, capture_trigger_t* trigger_out);
+
+// Returns true if the payload of `msg` passes the comparisons of `trigger`.
+// Doesn't check the ID.
+bool capture_trigger_payload_matches(const capture_trigger_t* trigger,
+                                     const twai_message_t* msg);
+
+// Arms `triggers`, and allocates the snapshots.
+// Must only be called once, before `capture_ring_start()`.
+esp_err_t capture_trigger_start(const capture_triggers_t* triggers);
+
+// Checks whether `frame`, captured with sequence number `seq`,
+// matches a trigger, and if so starts a snapshot.
+// Called by the `can_listener` for every frame. Does nothing
+// before `capture_trigger_start()`.
+void capture_trigger_check(const can_listener_frame_t* frame, uint32_t seq);
+
+// Fills `snapshots_out`, which must hold `CAPTURE_TRIGGER_SNAPSHOTS`,
+// with the snapshots held, oldest first.
+// Returns the number of snapshots.
+uint8_t capture_trigger_list(capture_trigger_snapshot_t* snapshots_out);
+
+// Copies frame `index` of snapshot `number` to `record_out`.
+// Returns `ESP_ERR_NOT_FOUND` if there's no such frame,
+// for example because the snapshot was replaced.
+esp_err_t capture_trigger_read(uint32_t number, uint16_t index,
+                               capture_record_t* record_out);
+
+// Fills `status_out` with the current `capture_trigger_status_t`.
+// Returns an error if no triggers are armed.
+esp_err_t capture_trigger_get_status(capture_trigger_status_t* status_out);
@@ -2,11 +2,14 @@
 
 #include "can_listener.h"
 #include "canard.h"
+#include "driver_setup.h"
 #include "esp_check.h"
 #include "esp_log.h"
 #include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
 #include "o1heap.h"
+#include "stdatomic.h"
+#include "task_config.h"
 #include "uavcan/node/Health_1_0.h"
 #include "uavcan/node/Heartbeat_1_0.h"
 #include "uavcan/node/Mode_1_0.h"
@@ -23,10 +26,26 @@ static uint8_t o1_heap_mem[HEAP_MEM_SIZE]
     __attribute__((aligned(O1HEAP_ALIGNMENT)));
 
 // Queue with stream of incoming CAN frames.
-static QueueHandle_t can_rx_queue;
+// NULL while the node is stopped.
+// Guarded by `can_rx_queue_mutex`, so that `cyphal_node_stop()`
+// can't free it while `cyphal_listener_task` is reading from it.
+static QueueHandle_t can_rx_queue = NULL;
+static SemaphoreHandle_t can_rx_queue_mutex = NULL;
+static StaticSemaphore_t can_rx_queue_mutex_mem;
+
+// True while the node is started. Heartbeats are only sent while true.
+static atomic_bool cyphal_node_enabled = false;
+
+// Node ID used for sent heartbeats.
+// Can be changed at runtime by calling `cyphal_node_start()` again.
+static atomic_uint cyphal_node_id = 0;
 
 // Canard instance for sending and receiving OpenCyphal messages.
+// Guarded by `canard_mutex`, together with the O1 heap it allocates
+// from, since both tasks use it.
 static CanardInstance canard_instance;
+static SemaphoreHandle_t canard_mutex = NULL;
+static StaticSemaphore_t canard_mutex_mem;
 
 // Queue for sending OpenCyphal messages.
 static CanardTxQueue canard_tx_queue;
@@ -76,7 +95,32 @@ static void free_mem(CanardInstance* ins, void* pointer) {
   o1heapFree(o1_heap_instance, pointer);
 }
 
+// How the CAN receive queue of the node behaves.
+static const can_listener_options_t can_rx_queue_options = {
+    .depth = CAN_LISTENER_DEFAULT_DEPTH,
+    .overflow = CAN_LISTENER_OVERFLOW_DROP_NEWEST,
+    .owner = "cyphal",
+};
+
 esp_err_t cyphal_node_start(uint8_t node_id) {
+  atomic_store(&cyphal_node_id, node_id);
+
+  // If the tasks are already running, just resume the node.
+  if (can_rx_queue_mutex != NULL) {
+    assert(xSemaphoreTake(can_rx_queue_mutex, portMAX_DELAY) == pdTRUE);
+    esp_err_t err = ESP_OK;
+    if (can_rx_queue == NULL) {
+      err = can_listener_get(&can_rx_queue_options, &can_rx_queue);
+    }
+    assert(xSemaphoreGive(can_rx_queue_mutex) == pdTRUE);
+    ESP_RETURN_ON_ERROR(err, TAG,
+                        "OpenCyphal node couldn't get CAN receive queue.");
+
+    atomic_store(&cyphal_node_enabled, true);
+    ESP_LOGI(TAG, "OpenCyphal node running with node ID %d.", node_id);
+    return ESP_OK;
+  }
+
   cyphal_node_status_mutex =
       xSemaphoreCreateMutexStatic(&cyphal_node_status_mutex_mem);
   if (cyphal_node_status_mutex == NULL) {
@@ -84,6 +128,12 @@ esp_err_t cyphal_node_start(uint8_t node_id) {
     return ESP_FAIL;
   }
 
+  canard_mutex = xSemaphoreCreateMutexStatic(&canard_mutex_mem);
+  if (canard_mutex == NULL) {
+    ESP_LOGE(TAG, "Unreachable. canard_mutex couldn't be created.");
+    return ESP_FAIL;
+  }
+
   // Initialize the O1 heap
   o1_heap_instance = o1heapInit((void*)o1_heap_mem, sizeof(o1_heap_mem));
   if (o1_heap_instance == NULL) {
@@ -92,7 +142,7 @@ esp_err_t cyphal_node_start(uint8_t node_id) {
   }
 
   // Get a CAN receive queue
-  esp_err_t err = can_listener_get(&can_rx_queue);
+  esp_err_t err = can_listener_get(&can_rx_queue_options, &can_rx_queue);
   ESP_RETURN_ON_ERROR(err, TAG,
                       "OpenCyphal node couldn't get CAN receive queue.");
 
@@ -117,36 +167,91 @@ esp_err_t cyphal_node_start(uint8_t node_id) {
     return ESP_FAIL;
   }
 
+  can_rx_queue_mutex = xSemaphoreCreateMutexStatic(&can_rx_queue_mutex_mem);
+  if (can_rx_queue_mutex == NULL) {
+    ESP_LOGE(TAG, "Unreachable. can_rx_queue_mutex couldn't be created.");
+    return ESP_FAIL;
+  }
+  atomic_store(&cyphal_node_enabled, true);
+
   // Spawn the OpenCyphal listener task
-  xTaskCreateStatic(cyphal_listener_task, "cyphal_listener_task",
-                    sizeof(cyphal_listener_task_stack), NULL, 3,
-                    cyphal_listener_task_stack, &cyphal_listener_task_mem);
+  task_config_create_static(TASK_ID_CYPHAL_LISTENER, cyphal_listener_task,
+                            sizeof(cyphal_listener_task_stack), NULL,
+                            cyphal_listener_task_stack,
+                            &cyphal_listener_task_mem);
 
   // Spawn the OpenCyphal node task
-  xTaskCreateStatic(cyphal_heartbeat_task, "cyphal_heartbeat_task",
-                    sizeof(cyphal_heartbeat_task_stack), NULL, 3,
-                    cyphal_heartbeat_task_stack, &cyphal_heartbeat_task_mem);
+  task_config_create_static(TASK_ID_CYPHAL_HEARTBEAT, cyphal_heartbeat_task,
+                            sizeof(cyphal_heartbeat_task_stack), NULL,
+                            cyphal_heartbeat_task_stack,
+                            &cyphal_heartbeat_task_mem);
 
   return ESP_OK;
 }
 
+esp_err_t cyphal_node_stop(void) {
+  if (can_rx_queue_mutex == NULL) {
+    return ESP_OK;
+  }
+
+  atomic_store(&cyphal_node_enabled, false);
+
+  // Return the CAN receive queue, so it doesn't fill up while stopped.
+  assert(xSemaphoreTake(can_rx_queue_mutex, portMAX_DELAY) == pdTRUE);
+  esp_err_t err = ESP_OK;
+  if (can_rx_queue != NULL) {
+    err = can_listener_free(can_rx_queue);
+    can_rx_queue = NULL;
+  }
+  assert(xSemaphoreGive(can_rx_queue_mutex) == pdTRUE);
+
+  ESP_LOGI(TAG, "OpenCyphal node stopped.");
+  return err;
+}
+
 static void cyphal_listener_task(void* pvParameters) {
   while (true) {
     // Receive the next frame from the CAN bus.
-    twai_message_t can_frame = {0};
-    xQueueReceive(can_rx_queue, &can_frame, portMAX_DELAY);
+    // Don't wait long while holding `can_rx_queue_mutex`,
+    // so that `cyphal_node_stop()` doesn't have to either.
+    can_listener_frame_t rx_frame = {0};
+    assert(xSemaphoreTake(can_rx_queue_mutex, portMAX_DELAY) == pdTRUE);
+    BaseType_t received = pdFALSE;
+    if (can_rx_queue != NULL) {
+      received = xQueueReceive(can_rx_queue, &rx_frame, pdMS_TO_TICKS(100));
+    }
+    assert(xSemaphoreGive(can_rx_queue_mutex) == pdTRUE);
+
+    if (received != pdTRUE) {
+      if (!atomic_load(&cyphal_node_enabled)) {
+        vTaskDelay(pdMS_TO_TICKS(100));
+      }
+      continue;
+    }
+
+    const twai_message_t* can_frame = &rx_frame.msg;
+
+    // Skip CAN controller state notifications.
+    if (can_frame->identifier & CAN_LISTENER_ERR_FLAG) {
+      continue;
+    }
 
-    CanardMicrosecond micros = esp_timer_get_time();
+    CanardMicrosecond micros = rx_frame.rx_time_us;
 
     CanardFrame canard_frame;
-    canard_frame.extended_can_id = can_frame.identifier;
-    canard_frame.payload = (void*)can_frame.data;
-    canard_frame.payload_size = (size_t)can_frame.data_length_code;
+    canard_frame.extended_can_id = can_frame->identifier;
+    canard_frame.payload = (void*)can_frame->data;
+    canard_frame.payload_size = (size_t)can_frame->data_length_code;
 
     // Have OpenCyphal process the received frame
     CanardRxTransfer received_cyphal_msg;
+    assert(xSemaphoreTake(canard_mutex, portMAX_DELAY) == pdTRUE);
     int8_t res = canardRxAccept(&canard_instance, micros, &canard_frame, 0,
                                 &received_cyphal_msg, NULL);
+    if (res == 1) {
+      free_mem(&canard_instance, received_cyphal_msg.payload);
+    }
+    assert(xSemaphoreGive(canard_mutex) == pdTRUE);
 
     if (res < 0) {
       // Error occured
@@ -161,8 +266,6 @@ static void cyphal_listener_task(void* pvParameters) {
       assert(xSemaphoreTake(cyphal_node_status_mutex, portMAX_DELAY) == pdTRUE);
       cyphal_node_status.heartbeats_received += 1;
       assert(xSemaphoreGive(cyphal_node_status_mutex) == pdTRUE);
-
-      free_mem(&canard_instance, received_cyphal_msg.payload);
     }
   }
 }
@@ -172,6 +275,10 @@ static void cyphal_heartbeat_task(void* pvParameters) {
     // Send a heartbeat every second
     vTaskDelay(pdMS_TO_TICKS(1000));
 
+    if (!atomic_load(&cyphal_node_enabled)) {
+      continue;
+    }
+
     // Create a heartbeat message
     CanardTransferMetadata transfer_metadata = {
         .priority = CanardPriorityNominal,
@@ -199,10 +306,13 @@ static void cyphal_heartbeat_task(void* pvParameters) {
       continue;
     }
 
-    // Enqueue the heartbeat message.
+    // Enqueue the heartbeat message, from the node ID that is current.
+    assert(xSemaphoreTake(canard_mutex, portMAX_DELAY) == pdTRUE);
+    canard_instance.node_id = (CanardNodeID)atomic_load(&cyphal_node_id);
     int32_t result =
         canardTxPush(&canard_tx_queue, &canard_instance, 0, &transfer_metadata,
                      heartbeat_buf_size, (void*)heartbeat_buf);
+    assert(xSemaphoreGive(canard_mutex) == pdTRUE);
     if (result < 1) {
       ESP_LOGE(TAG,
                "Canard error queueing heartbeat frame for transmission: %ld",
@@ -210,6 +320,12 @@ static void cyphal_heartbeat_task(void* pvParameters) {
       continue;
     }
 
+    // Echo our own frames to all other listeners,
+    // but not to our own `cyphal_listener_task`.
+    assert(xSemaphoreTake(can_rx_queue_mutex, portMAX_DELAY) == pdTRUE);
+    QueueHandle_t skip_queue = can_rx_queue;
+    assert(xSemaphoreGive(can_rx_queue_mutex) == pdTRUE);
+
     // Transmit all the CAN frames in the queue.
     const CanardTxQueueItem* tx_item = NULL;
     while ((tx_item = canardTxPeek(&canard_tx_queue)) != NULL) {
@@ -220,16 +336,23 @@ static void cyphal_heartbeat_task(void* pvParameters) {
       memcpy(tx_frame.data, tx_item->frame.payload,
              tx_item->frame.payload_size);
 
-      esp_err_t err = twai_transmit(&tx_frame, pdMS_TO_TICKS(portMAX_DELAY));
+      // Keep the timeout short, so that
+      // `driver_setup_can_reconfigure()` doesn't wait for us.
+      esp_err_t err = driver_setup_can_transmit(&tx_frame, pdMS_TO_TICKS(100));
       while (err != ESP_OK) {
-        ESP_LOGE(TAG, "Couldn't transmit OpenCyphal frame: %s",
-                 esp_err_to_name(err));
-        err = twai_transmit(&tx_frame, pdMS_TO_TICKS(portMAX_DELAY));
+        if (err != ESP_ERR_TIMEOUT && err != ESP_ERR_INVALID_STATE) {
+          ESP_LOGE(TAG, "Couldn't transmit OpenCyphal frame: %s",
+                   esp_err_to_name(err));
+        }
+        vTaskDelay(pdMS_TO_TICKS(10));
+        err = driver_setup_can_transmit(&tx_frame, pdMS_TO_TICKS(100));
       }
       
-      can_listener_enqueue_msg(&tx_frame, can_rx_queue);
+      can_listener_enqueue_msg(&tx_frame, skip_queue);
 
+      assert(xSemaphoreTake(canard_mutex, portMAX_DELAY) == pdTRUE);
       free_mem(&canard_instance, canardTxPop(&canard_tx_queue, tx_item));
+      assert(xSemaphoreGive(canard_mutex) == pdTRUE);
     }
 
     // Finished sending heartbeat, so let's increment the counter.
@@ -11,10 +11,16 @@ typedef struct {
 
 // Starts an OpenCyphal node with `node_id` that sends
 // a heartbeat every second.
+// If the node was stopped with `cyphal_node_stop()`, resumes it.
+// If the node is running, changes its node ID to `node_id`.
 // This function must be called only after
 // `can_listener` has been started.
 esp_err_t cyphal_node_start(uint8_t node_id);
 
+// Stops sending heartbeats and returns the node's CAN receive queue.
+// Does nothing if the node isn't running.
+esp_err_t cyphal_node_stop(void);
+
 // Fills `status_out` with the current `cyphal_node_status_t`.
 // Returns an error if the OpenCyphal node hasn't been started yet.
 esp_err_t cyphal_node_get_status(cyphal_node_status_t *status_out);
\ No newline at end of file
@@ -0,0 +1,294 @@
+#include "deferred_log.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "lwip/sockets.h"
+#include "stdatomic.h"
+#include "task_config.h"
+
+// Number of `deferred_log()` events that can be pending
+// before the oldest ones are overwritten. Must be a power of two.
+#define EVENT_RING_LEN 256
+
+// Maximum number of distinct (event, argument) pairs
+// summarized per period. Further pairs are counted as "other".
+#define MAX_SUMMARIES 16
+
+// How often summaries are emitted.
+#define SUMMARY_PERIOD_MS 1000
+
+// Number of formatted log lines that can wait to be sent to the
+// UDP sink, and the maximum length of each. Longer lines take up
+// several entries.
+#define LINE_QUEUE_LEN 16
+#define LINE_MAX_LEN 128
+
+// Name that will be used for logging
+static const char *TAG = "deferred_log";
+
+// A slot in `event_ring`.
+typedef struct {
+  // `seq + 1` once the slot is completely written. Zero while writing.
+  atomic_uint stamp;
+  uint8_t event;
+  uint32_t arg;
+} event_slot_t;
+
+static event_slot_t event_ring[EVENT_RING_LEN];
+
+// Sequence number of the next event written by `deferred_log()`.
+static atomic_uint next_write_seq = 0;
+
+// Sequence number of the next event read by `deferred_log_task`.
+static uint32_t next_read_seq = 0;
+
+// One coalesced (event, argument) pair.
+typedef struct {
+  uint8_t event;
+  uint32_t arg;
+  uint32_t count;
+} summary_t;
+
+// A formatted log line waiting to be sent to the UDP sink.
+typedef struct {
+  char text[LINE_MAX_LEN];
+} log_line_t;
+
+// Queue of `log_line_t` filled by `log_vprintf()`.
+// NULL unless a UDP sink is configured.
+static QueueHandle_t line_queue = NULL;
+static StaticQueue_t line_queue_mem;
+static uint8_t line_queue_storage[LINE_QUEUE_LEN * sizeof(log_line_t)];
+
+// Number of log lines that didn't fit in `line_queue`.
+static atomic_uint lines_dropped = 0;
+
+// UDP socket and destination of the log sink.
+static int sink_sock = -1;
+static struct sockaddr_in sink_addr;
+
+// The `vprintf`-like function that was installed before `log_vprintf()`,
+// which writes to UART.
+static vprintf_like_t previous_vprintf = NULL;
+
+// Task that emits summaries and drains `line_queue`.
+static void deferred_log_task(void *pvParameters);
+static StackType_t deferred_log_task_stack[4096];
+static StaticTask_t deferred_log_task_mem;
+
+// `vprintf`-like function installed with `esp_log_set_vprintf()`
+// when a UDP sink is configured. Passes the line on to
+// `previous_vprintf`, and queues it without blocking.
+static int log_vprintf(const char *format, va_list args);
+
+// Queues `line` for the UDP sink, or counts it as dropped.
+static void queue_line(const log_line_t *line);
+
+// Drains `event_ring`, and logs one line per distinct
+// (event, argument) pair seen since the last call.
+static void emit_summaries(uint32_t period_s);
+
+void deferred_log(deferred_log_event_t event, uint32_t arg) {
+  uint32_t seq =
+      atomic_fetch_add_explicit(&next_write_seq, 1, memory_order_relaxed);
+  event_slot_t *slot = &event_ring[seq & (EVENT_RING_LEN - 1)];
+
+  atomic_store_explicit(&slot->stamp, 0, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  slot->event = event;
+  slot->arg = arg;
+  atomic_store_explicit(&slot->stamp, seq + 1, memory_order_release);
+}
+
+esp_err_t deferred_log_start(const esp_ip4_addr_t *sink_ip,
+                             uint16_t sink_port) {
+  if (sink_port != 0) {
+    sink_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sink_sock < 0) {
+      ESP_LOGE(TAG, "Unable to create log sink socket: errno %d", errno);
+      return ESP_FAIL;
+    }
+
+    sink_addr.sin_family = AF_INET;
+    sink_addr.sin_addr.s_addr = sink_ip->addr;
+    sink_addr.sin_port = htons(sink_port);
+
+    line_queue = xQueueCreateStatic(LINE_QUEUE_LEN, sizeof(log_line_t),
+                                    line_queue_storage, &line_queue_mem);
+    if (line_queue == NULL) {
+      ESP_LOGE(TAG, "Unreachable. line_queue couldn't be created.");
+      return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "Sending logs to UDP " IPSTR ":%d as well.",
+             IP2STR(sink_ip), sink_port);
+    previous_vprintf = esp_log_set_vprintf(log_vprintf);
+  }
+
+  task_config_create_static(TASK_ID_DEFERRED_LOG, deferred_log_task,
+                            sizeof(deferred_log_task_stack), NULL,
+                            deferred_log_task_stack, &deferred_log_task_mem);
+
+  return ESP_OK;
+}
+
+static int log_vprintf(const char *format, va_list args) {
+  va_list uart_args;
+  va_copy(uart_args, args);
+  previous_vprintf(format, uart_args);
+  va_end(uart_args);
+
+  log_line_t line;
+  va_list line_args;
+  va_copy(line_args, args);
+  int len = vsnprintf(line.text, sizeof(line.text), format, line_args);
+  va_end(line_args);
+  if (len < 0) {
+    return len;
+  }
+
+  if ((size_t)len < sizeof(line.text)) {
+    queue_line(&line);
+    return len;
+  }
+
+  // Too long for one datagram. Format it again in full, and split it.
+  char *text = malloc(len + 1);
+  if (text == NULL) {
+    queue_line(&line);
+    return len;
+  }
+  vsnprintf(text, len + 1, format, args);
+  for (int offset = 0; offset < len; offset += sizeof(line.text)) {
+    // Not null-terminated if it fills `line.text`. It's sent with
+    // `strnlen()`.
+    strncpy(line.text, &text[offset], sizeof(line.text));
+    queue_line(&line);
+  }
+  free(text);
+  return len;
+}
+
+static void queue_line(const log_line_t *line) {
+  if (xQueueSend(line_queue, line, 0) != pdTRUE) {
+    atomic_fetch_add_explicit(&lines_dropped, 1, memory_order_relaxed);
+  }
+}
+
+static void deferred_log_task(void *pvParameters) {
+  TickType_t last_summary = xTaskGetTickCount();
+
+  while (true) {
+    TickType_t elapsed = xTaskGetTickCount() - last_summary;
+    TickType_t period = pdMS_TO_TICKS(SUMMARY_PERIOD_MS);
+
+    if (elapsed >= period) {
+      emit_summaries(elapsed / configTICK_RATE_HZ);
+      last_summary += elapsed;
+      continue;
+    }
+
+    if (line_queue == NULL) {
+      vTaskDelay(period - elapsed);
+      continue;
+    }
+
+    // Send queued lines to the UDP sink until it's time for a summary.
+    log_line_t line;
+    if (xQueueReceive(line_queue, &line, period - elapsed) == pdTRUE) {
+      sendto(sink_sock, line.text, strnlen(line.text, sizeof(line.text)), 0,
+             (struct sockaddr *)&sink_addr, sizeof(sink_addr));
+    }
+  }
+}
+
+static void emit_summaries(uint32_t period_s) {
+  summary_t summaries[MAX_SUMMARIES];
+  size_t summary_count = 0;
+  uint32_t events_other = 0;
+  uint32_t events_lost = 0;
+
+  uint32_t write_seq =
+      atomic_load_explicit(&next_write_seq, memory_order_acquire);
+
+  // If writers lapped the ring, skip to the oldest event still in it.
+  if (write_seq - next_read_seq > EVENT_RING_LEN) {
+    events_lost += write_seq - next_read_seq - EVENT_RING_LEN;
+    next_read_seq = write_seq - EVENT_RING_LEN;
+  }
+
+  for (; next_read_seq != write_seq; next_read_seq++) {
+    event_slot_t *slot = &event_ring[next_read_seq & (EVENT_RING_LEN - 1)];
+    uint32_t stamp = atomic_load_explicit(&slot->stamp, memory_order_acquire);
+    if (stamp == 0 || (int32_t)(stamp - (next_read_seq + 1)) < 0) {
+      // A writer claimed this slot but hasn't finished writing it.
+      // Pick it up during the next period.
+      break;
+    }
+    if (stamp != next_read_seq + 1) {
+      // Overwritten by a writer that lapped the ring.
+      events_lost += 1;
+      continue;
+    }
+    uint8_t event = slot->event;
+    uint32_t arg = slot->arg;
+
+    // Coalesce with an earlier identical event.
+    size_t i = 0;
+    while (i < summary_count &&
+           (summaries[i].event != event || summaries[i].arg != arg)) {
+      i++;
+    }
+    if (i < summary_count) {
+      summaries[i].count += 1;
+    } else if (summary_count < MAX_SUMMARIES) {
+      summaries[summary_count] =
+          (summary_t){.event = event, .arg = arg, .count = 1};
+      summary_count += 1;
+    } else {
+      events_other += 1;
+    }
+  }
+
+  for (size_t i = 0; i < summary_count; i++) {
+    switch ((deferred_log_event_t)summaries[i].event) {
+      case DEFERRED_LOG_RX_QUEUE_FULL:
+        ESP_LOGE(TAG,
+                 "Dropped %lu frames on CAN receive queue %lu in the last "
+                 "%lu s.",
+                 summaries[i].count, summaries[i].arg, period_s);
+        break;
+      case DEFERRED_LOG_CAN_TX_FAILED:
+        ESP_LOGE(TAG,
+                 "Couldn't transmit %lu frames to CAN in the last %lu s: %s",
+                 summaries[i].count, period_s,
+                 esp_err_to_name(summaries[i].arg));
+        break;
+      default:
+        ESP_LOGE(TAG, "Unreachable. Unknown deferred log event %d.",
+                 summaries[i].event);
+        break;
+    }
+  }
+
+  if (events_other > 0) {
+    ESP_LOGE(TAG, "%lu other hot-path errors in the last %lu s.",
+             events_other, period_s);
+  }
+
+  if (events_lost > 0) {
+    ESP_LOGW(TAG, "%lu hot-path log events were lost in the last %lu s.",
+             events_lost, period_s);
+  }
+
+  uint32_t dropped =
+      atomic_exchange_explicit(&lines_dropped, 0, memory_order_relaxed);
+  if (dropped > 0) {
+    ESP_LOGW(TAG, "%lu log lines were dropped in the last %lu s.", dropped,
+             period_s);
+  }
+}
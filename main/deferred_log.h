@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_netif_types.h"
+
+// Hot-path events that are logged through `deferred_log()`
+// instead of `ESP_LOGx()`.
+typedef enum {
+  // A frame was dropped because a CAN receive queue was full.
+  // The argument is the queue index.
+  DEFERRED_LOG_RX_QUEUE_FULL,
+
+  // A frame from a socketcand client couldn't be queued for CAN
+  // transmission. The argument is the `esp_err_t`.
+  DEFERRED_LOG_CAN_TX_FAILED,
+
+  // Number of event kinds. Not an event.
+  DEFERRED_LOG_EVENT_COUNT,
+} deferred_log_event_t;
+
+// Records that `event` happened with `arg`.
+// Lock-free, non-blocking and cheap enough to call for every frame.
+// A low-priority task periodically coalesces repeated events into
+// one summary log line, such as
+// "Dropped 1342 frames on CAN receive queue 2 in the last 1 s."
+void deferred_log(deferred_log_event_t event, uint32_t arg);
+
+// Starts the low-priority task that emits `deferred_log()` summaries.
+//
+// If `sink_port` isn't 0, all log output, including `ESP_LOGx()`,
+// is also sent as UDP datagrams to `sink_ip:sink_port`.
+// Log lines are queued and sent by the low-priority task,
+// so logging never blocks on the network. Lines longer than
+// one datagram are split into several.
+//
+// Must only be called once, after `esp_netif_init()`.
+esp_err_t deferred_log_start(const esp_ip4_addr_t* sink_ip,
+                             uint16_t sink_port);
@@ -3,6 +3,8 @@
 #include "driver_setup.h"
 #include "esp_log.h"
 #include "lwip/sockets.h"
+#include "multicast_publisher.h"
+#include "task_config.h"
 
 // Name that will be used for logging
 static const char* TAG = "discovery_beacon";
@@ -35,9 +37,9 @@ esp_err_t discovery_beacon_start() {
     return ESP_FAIL;
   }
 
-  xTaskCreateStatic(discovery_beacon_task, "discovery_beacon",
-                    sizeof(task_stack), (void*)server_sock, 2, task_stack,
-                    &task_mem);
+  task_config_create_static(TASK_ID_DISCOVERY_BEACON, discovery_beacon_task,
+                            sizeof(task_stack), (void*)server_sock,
+                            task_stack, &task_mem);
   return ESP_OK;
 }
 
@@ -103,6 +105,22 @@ static void discovery_beacon_task(void* pvParameters) {
       }
     }
 
+    // Announce the multicast stream in its own element,
+    // which socketcand clients ignore.
+    esp_ip4_addr_t group;
+    uint16_t port;
+    if (multicast_publisher_get_address(&group, &port) == ESP_OK) {
+      res = snprintf(msg_buf + bytes_printed, sizeof(msg_buf) - bytes_printed,
+                     "<Multicast url='udp://" IPSTR
+                     ":%d' version='%d'/>\n",
+                     IP2STR(&group), port, MULTICAST_PUBLISHER_VERSION);
+      bytes_printed += res;
+      if (res < 0 || bytes_printed >= sizeof(msg_buf)) {
+        ESP_LOGE(TAG, "Couldn't snprintf CAN beacon message.");
+        continue;
+      }
+    }
+
     res = snprintf(msg_buf + bytes_printed, sizeof(msg_buf) - bytes_printed,
                    "<Bus name='vcan0'/>\n"
                    "</CANBeacon>\n");
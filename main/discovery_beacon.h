@@ -4,5 +4,6 @@
 
 // Starts a task that broadcasts a socketcand CANBeacon
 // over UDP to port 42000 every 2 seconds.
+// It also announces the `multicast_publisher`'s group, if it's running.
 // Must only be called one time.
 esp_err_t discovery_beacon_start();
@@ -1,39 +1,62 @@
 #include "driver_setup.h"
 
+#include "boot_timeline.h"
+#include "can_listener.h"
 #include "driver/gpio.h"
 #include "driver/twai.h"
 #include "esp_check.h"
 #include "esp_eth.h"
 #include "esp_event.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "esp_wifi.h"
+#include "freertos/event_groups.h"
 #include "memory.h"
+#include "stdatomic.h"
+#include "task_config.h"
+#include "trace_buffer.h"
 
 esp_netif_t *driver_setup_eth_netif = NULL;
 esp_netif_t *driver_setup_wifi_netif = NULL;
 
-// Semaphore that gets set by an event handler
-// when the internet driver is fully running
-static SemaphoreHandle_t internet_ready = NULL;
-static StaticSemaphore_t internet_ready_mem;
+// Event group with bits that get set by event handlers
+// as the network drivers come up.
+// Unlike a binary semaphore, setting a bit twice is harmless,
+// which matters because Wi-Fi may be stopped and started at runtime.
+static EventGroupHandle_t driver_events = NULL;
+static StaticEventGroup_t driver_events_mem;
+#define GOT_IP_BIT (1 << 0)
+
+// Creates `driver_events` if it doesn't exist yet.
+static esp_err_t init_driver_events(void);
+
+// False while Wi-Fi is disabled by `driver_setup_wifi_reconfigure()`,
+// so that `wifi_recovery_task` doesn't reconnect.
+static atomic_bool wifi_wanted = false;
 
 // Name that will be used for logging
 static const char *TAG = "driver_setup";
 
-// Ethernet event handler. Sets `internet_ready` when the driver has
-// been started.
+// Ethernet event handler. Records boot phases.
 static void ethernet_event_handler(void *arg, esp_event_base_t event_base,
                                    int32_t event_id, void *event_data);
 
-// Ethernet event handler. Sets `internet_ready` when the driver has
-// been started.
+// Wi-Fi event handler. Connects when the station has been started,
+// and records boot phases.
 static void wifi_event_handler(void *arg, esp_event_base_t event_base,
                                int32_t event_id, void *event_data);
 
-// Logs information whenever acquired IP.
+// Logs information whenever acquired IP, and sets `GOT_IP_BIT`.
 static void ip_event_handler(void *arg, esp_event_base_t event_base,
                              int32_t event_id, void *event_data);
 
+// Configures and starts the Wi-Fi driver on `esp_netif`.
+// Leaves the cleanup on failure to `driver_setup_wifi()`.
+static esp_err_t start_wifi(esp_netif_t *esp_netif,
+                            const esp_netif_ip_info_t *ip_info,
+                            const char *hostname, const char ssid[32],
+                            const char password[64]);
+
 // A FreeRTOS task that gets spawned by `driver_setup_can()`.
 // It tries reconnecting to Wi-Fi every 30 seconds if
 // Wi-Fi is disconnected.
@@ -42,11 +65,70 @@ static StackType_t wifi_recovery_task_stack[4096];
 static StaticTask_t wifi_recovery_task_mem;
 
 // A FreeRTOS task that gets spawned by `driver_setup_can()`.
-// It initiates CAN recovery mode whenever
-// the bus is disconnected due to excessive error count.
+// It waits for TWAI alerts, initiates CAN recovery mode whenever
+// the bus is disconnected due to excessive error count,
+// and restarts the driver once recovery completes.
+// It also installs the driver for `install_can_driver_on_can_core()`.
 static void can_recovery_task(void *pvParameters);
 static StackType_t can_recovery_task_stack[4096];
 static StaticTask_t can_recovery_task_mem;
+static TaskHandle_t can_recovery_task_handle = NULL;
+
+// The TWAI interrupt is allocated on the core that installs the driver.
+// To keep it on `TASK_CONFIG_CAN_CORE`, the driver is always installed by
+// `can_recovery_task`, which is pinned there. This asks it to, and waits.
+// `can_driver_reconfiguring` must be set while calling this.
+static esp_err_t install_can_driver_on_can_core(
+    const twai_timing_config_t *timing_config, twai_mode_t mode);
+
+// The pending request of `install_can_driver_on_can_core()`.
+static twai_timing_config_t install_request_timing_config;
+static twai_mode_t install_request_mode;
+static esp_err_t install_request_result;
+static SemaphoreHandle_t install_request_done = NULL;
+static StaticSemaphore_t install_request_done_mem;
+
+// Installs and starts the TWAI driver with `timing_config` in `mode`.
+static esp_err_t install_can_driver(const twai_timing_config_t *timing_config,
+                                    twai_mode_t mode);
+
+// Number of tasks currently inside a TWAI driver call
+// made through `can_driver_enter()`.
+static atomic_int can_driver_users = 0;
+
+// True while `driver_setup_can_reconfigure()` is reinstalling the driver.
+static atomic_bool can_driver_reconfiguring = false;
+
+// Must be called before calling into the TWAI driver.
+// Returns false if the driver is being reconfigured and mustn't be used.
+// Call `can_driver_exit()` after the driver call if it returned true.
+static bool can_driver_enter(void);
+static void can_driver_exit(void);
+
+// TWAI alerts that wake up `can_recovery_task`.
+#define CAN_RECOVERY_ALERTS                                             \
+  (TWAI_ALERT_BUS_OFF | TWAI_ALERT_BUS_RECOVERED | TWAI_ALERT_ERR_PASS | \
+   TWAI_ALERT_ERR_ACTIVE)
+
+// Error classes and controller status bits of SocketCAN error frames.
+// See linux/can/error.h.
+#define CAN_ERR_CRTL 0x00000004U
+#define CAN_ERR_BUSOFF 0x00000040U
+#define CAN_ERR_RESTARTED 0x00000100U
+#define CAN_ERR_CRTL_RX_PASSIVE 0x10
+#define CAN_ERR_CRTL_TX_PASSIVE 0x20
+#define CAN_ERR_CRTL_ACTIVE 0x40
+
+// Sends a SocketCAN-style error frame with `err_class` to all
+// `can_listener` clients, so they know the bus state changed.
+// `ctrl_status` is a `CAN_ERR_CRTL_*` value, or zero.
+static void notify_can_state(uint32_t err_class, uint8_t ctrl_status,
+                             const twai_status_info_t *status);
+
+// Purely informational CAN recovery statistics.
+static driver_setup_can_recovery_status_t can_recovery_status = {0};
+static SemaphoreHandle_t can_recovery_status_mutex = NULL;
+static StaticSemaphore_t can_recovery_status_mutex_mem;
 
 esp_err_t driver_setup_ethernet(const esp_netif_ip_info_t *ip_info,
                                 const char *hostname) {
@@ -67,6 +149,10 @@ esp_err_t driver_setup_ethernet(const esp_netif_ip_info_t *ip_info,
   esp32_emac_config.smi_mdc_gpio_num = 23;
   // 18 based on ESP32-EVB schematic
   esp32_emac_config.smi_mdio_gpio_num = 18;
+  // Keep the ethernet receive task on the network core.
+  // It's pinned to the core that calls this function,
+  // which is `app_main()`'s core, `TASK_CONFIG_NETWORK_CORE`.
+  mac_config.flags |= ETH_MAC_FLAG_PIN_TO_CORE;
   esp_eth_mac_t *mac = esp_eth_mac_new_esp32(&esp32_emac_config, &mac_config);
   if (mac == NULL) {
     ESP_LOGE(TAG, "Couldn't create Ethernet MAC object.");
@@ -111,7 +197,8 @@ esp_err_t driver_setup_ethernet(const esp_netif_ip_info_t *ip_info,
     ESP_RETURN_ON_ERROR(err, TAG, "Couldn't set ethernet IP info.");
   }
 
-  internet_ready = xSemaphoreCreateBinaryStatic(&internet_ready_mem);
+  err = init_driver_events();
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't create driver event group.");
 
   // Register event handlers for debugging purposes
   err = esp_event_handler_register(ETH_EVENT, ESP_EVENT_ANY_ID,
@@ -135,17 +222,11 @@ esp_err_t driver_setup_ethernet(const esp_netif_ip_info_t *ip_info,
   ESP_RETURN_ON_ERROR(err, TAG, "Couldn't attach ethernet to ESP netif.");
 
   //// Start ethernet ////
+  // Don't wait for the link or an IP address.
+  // `ip_event_handler()` sets `GOT_IP_BIT` once it's usable.
   err = esp_eth_start(eth_handle);
   ESP_RETURN_ON_ERROR(err, TAG, "Couldn't start ethernet.");
 
-  /// Wait for internet to actually work ////
-  if (xSemaphoreTake(internet_ready, pdMS_TO_TICKS(10000)) != pdTRUE) {
-    vSemaphoreDelete(internet_ready);
-    ESP_LOGE(TAG, "Couldn't start ethernet driver in 10 seconds.");
-    return ESP_FAIL;
-  }
-  vSemaphoreDelete(internet_ready);
-
   driver_setup_eth_netif = esp_netif;
   return ESP_OK;
 }
@@ -153,7 +234,6 @@ esp_err_t driver_setup_ethernet(const esp_netif_ip_info_t *ip_info,
 esp_err_t driver_setup_wifi(const esp_netif_ip_info_t *ip_info,
                             const char *hostname, const char ssid[32],
                             const char password[64]) {
-  esp_err_t err;
   // Check if the ethernet driver has already been started
   if (driver_setup_wifi_netif != NULL) {
     ESP_LOGE(TAG, "Can only call driver_setup_wifi() one time.");
@@ -167,6 +247,264 @@ esp_err_t driver_setup_wifi(const esp_netif_ip_info_t *ip_info,
     return ESP_FAIL;
   }
 
+  esp_err_t err = start_wifi(esp_netif, ip_info, hostname, ssid, password);
+  if (err != ESP_OK) {
+    // Undo what was set up, so that a later call starts from scratch
+    // instead of creating a second netif.
+    atomic_store(&wifi_wanted, false);
+    esp_event_handler_unregister(WIFI_EVENT, ESP_EVENT_ANY_ID,
+                                 &wifi_event_handler);
+    esp_event_handler_unregister(IP_EVENT, IP_EVENT_STA_GOT_IP,
+                                 &ip_event_handler);
+    esp_wifi_stop();
+    esp_wifi_deinit();
+    esp_netif_destroy_default_wifi(esp_netif);
+    return err;
+  }
+
+  // Spawn a task that will reconnect to Wi-Fi if it disconnects.
+  task_config_create_static(TASK_ID_WIFI_RECOVERY, wifi_recovery_task,
+                            sizeof(wifi_recovery_task_stack), NULL,
+                            wifi_recovery_task_stack, &wifi_recovery_task_mem);
+
+  driver_setup_wifi_netif = esp_netif;
+  return ESP_OK;
+}
+
+esp_err_t driver_setup_wifi_reconfigure(bool enabled,
+                                        const esp_netif_ip_info_t *ip_info,
+                                        const char *hostname,
+                                        const char ssid[32],
+                                        const char password[64]) {
+  esp_err_t err;
+
+  // Wi-Fi was never started, so start it from scratch.
+  if (driver_setup_wifi_netif == NULL) {
+    if (!enabled) {
+      return ESP_OK;
+    }
+    return driver_setup_wifi(ip_info, hostname, ssid, password);
+  }
+
+  if (!enabled) {
+    ESP_LOGI(TAG, "Stopping Wi-Fi.");
+    atomic_store(&wifi_wanted, false);
+    esp_wifi_disconnect();
+    err = esp_wifi_stop();
+    ESP_RETURN_ON_ERROR(err, TAG, "Couldn't stop Wi-Fi.");
+    return ESP_OK;
+  }
+
+  ESP_LOGI(TAG, "Reconnecting Wi-Fi with new settings.");
+  esp_wifi_disconnect();
+
+  //// Switch between DHCP and static IP ////
+  if (ip_info != NULL) {
+    err = esp_netif_dhcpc_stop(driver_setup_wifi_netif);
+    if (err != ESP_OK && err != ESP_ERR_ESP_NETIF_DHCP_ALREADY_STOPPED) {
+      ESP_LOGE(TAG, "Couldn't stop Wi-Fi DHCP to set up static IP.");
+      return err;
+    }
+    err = esp_netif_set_ip_info(driver_setup_wifi_netif, ip_info);
+    ESP_RETURN_ON_ERROR(err, TAG, "Couldn't set IP info for Wi-Fi.");
+  } else {
+    err = esp_netif_dhcpc_start(driver_setup_wifi_netif);
+    if (err != ESP_OK && err != ESP_ERR_ESP_NETIF_DHCP_ALREADY_STARTED) {
+      ESP_LOGE(TAG, "Couldn't start Wi-Fi DHCP.");
+      return err;
+    }
+  }
+
+  wifi_config_t wifi_config = {0};
+  memcpy(wifi_config.sta.ssid, ssid, 32);
+  memcpy(wifi_config.sta.password, password, 64);
+  wifi_config.sta.failure_retry_cnt = 3;
+  err = esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't configure WIFI.");
+
+  // Starting an already started driver is harmless.
+  // If it was stopped, `wifi_event_handler()` connects on `STA_START`.
+  atomic_store(&wifi_wanted, true);
+  err = esp_wifi_start();
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't start Wi-Fi.");
+  err = esp_wifi_connect();
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't connect to Wi-Fi.");
+
+  return ESP_OK;
+}
+
+bool driver_setup_wait_for_ip(TickType_t ticks_to_wait) {
+  if (init_driver_events() != ESP_OK) {
+    return false;
+  }
+  EventBits_t bits = xEventGroupWaitBits(driver_events, GOT_IP_BIT, pdFALSE,
+                                         pdTRUE, ticks_to_wait);
+  return (bits & GOT_IP_BIT) != 0;
+}
+
+esp_err_t driver_setup_can(const twai_timing_config_t *timing_config) {
+  can_recovery_status_mutex =
+      xSemaphoreCreateMutexStatic(&can_recovery_status_mutex_mem);
+  if (can_recovery_status_mutex == NULL) {
+    ESP_LOGE(TAG,
+             "Unreachable. can_recovery_status_mutex couldn't be created.");
+    return ESP_FAIL;
+  }
+
+  install_request_done =
+      xSemaphoreCreateBinaryStatic(&install_request_done_mem);
+  if (install_request_done == NULL) {
+    ESP_LOGE(TAG, "Unreachable. install_request_done couldn't be created.");
+    return ESP_FAIL;
+  }
+
+  // Spawn a task that will put CAN in recovery mode
+  // whenever it enters BUS_OFF state.
+  // It also installs the driver, so keep it out of the driver until then.
+  atomic_store(&can_driver_reconfiguring, true);
+  can_recovery_task_handle = task_config_create_static(
+      TASK_ID_CAN_RECOVERY, can_recovery_task,
+      sizeof(can_recovery_task_stack), NULL, can_recovery_task_stack,
+      &can_recovery_task_mem);
+
+  esp_err_t err =
+      install_can_driver_on_can_core(timing_config, TWAI_MODE_NORMAL);
+  atomic_store(&can_driver_reconfiguring, false);
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't start CAN driver.");
+
+  return ESP_OK;
+}
+
+esp_err_t driver_setup_can_reconfigure(
+    const twai_timing_config_t *timing_config, twai_mode_t mode) {
+  // Keep new callers out, and wait for current ones to leave.
+  atomic_store(&can_driver_reconfiguring, true);
+  int64_t wait_start = esp_timer_get_time();
+  while (atomic_load(&can_driver_users) > 0) {
+    if (esp_timer_get_time() - wait_start > 5000000) {
+      atomic_store(&can_driver_reconfiguring, false);
+      ESP_LOGE(TAG, "Timed out waiting for CAN driver users to finish.");
+      return ESP_ERR_TIMEOUT;
+    }
+    vTaskDelay(pdMS_TO_TICKS(1));
+  }
+
+  // The driver can't be stopped while it's bus-off,
+  // but it can be uninstalled.
+  esp_err_t err = twai_stop();
+  if (err != ESP_OK) {
+    ESP_LOGW(TAG, "Couldn't stop CAN driver: %s", esp_err_to_name(err));
+  }
+
+  err = twai_driver_uninstall();
+  if (err == ESP_OK) {
+    err = install_can_driver_on_can_core(timing_config, mode);
+  } else {
+    ESP_LOGE(TAG, "Couldn't uninstall CAN driver: %s", esp_err_to_name(err));
+  }
+
+  atomic_store(&can_driver_reconfiguring, false);
+  return err;
+}
+
+esp_err_t driver_setup_can_transmit(const twai_message_t *message,
+                                    TickType_t ticks_to_wait) {
+  // Error frames only report the controller state to listeners.
+  if (message->identifier & CAN_LISTENER_ERR_FLAG) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (!can_driver_enter()) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  esp_err_t err = twai_transmit(message, ticks_to_wait);
+  can_driver_exit();
+  return err;
+}
+
+esp_err_t driver_setup_can_receive(twai_message_t *message,
+                                   TickType_t ticks_to_wait) {
+  if (!can_driver_enter()) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  esp_err_t err = twai_receive(message, ticks_to_wait);
+  can_driver_exit();
+  return err;
+}
+
+esp_err_t driver_setup_can_get_status_info(twai_status_info_t *status_out) {
+  if (!can_driver_enter()) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  esp_err_t err = twai_get_status_info(status_out);
+  can_driver_exit();
+  return err;
+}
+
+static bool can_driver_enter(void) {
+  atomic_fetch_add(&can_driver_users, 1);
+  if (atomic_load(&can_driver_reconfiguring)) {
+    atomic_fetch_sub(&can_driver_users, 1);
+    return false;
+  }
+  return true;
+}
+
+static void can_driver_exit(void) { atomic_fetch_sub(&can_driver_users, 1); }
+
+static esp_err_t install_can_driver_on_can_core(
+    const twai_timing_config_t *timing_config, twai_mode_t mode) {
+  install_request_timing_config = *timing_config;
+  install_request_mode = mode;
+  xTaskNotifyGive(can_recovery_task_handle);
+  assert(xSemaphoreTake(install_request_done, portMAX_DELAY) == pdTRUE);
+  return install_request_result;
+}
+
+static esp_err_t install_can_driver(const twai_timing_config_t *timing_config,
+                                    twai_mode_t mode) {
+  esp_err_t err;
+
+  twai_general_config_t g_config =
+      TWAI_GENERAL_CONFIG_DEFAULT(GPIO_NUM_5, GPIO_NUM_35, mode);
+
+  // Sdkconfig configuration is set to put TWAI ISR into IRAM
+  // because this may reduce cache misses.
+  // This flag is required for that configuration.
+  g_config.intr_flags = ESP_INTR_FLAG_IRAM;
+  // Only `TWAI_ALERT_AND_LOG` is unavailable when the TWAI ISR is in IRAM.
+  // Reading alerts with `twai_read_alerts()` still works.
+  g_config.alerts_enabled = CAN_RECOVERY_ALERTS;
+  g_config.tx_queue_len = 32;
+  g_config.rx_queue_len = DRIVER_SETUP_CAN_RX_QUEUE_LEN;
+  twai_filter_config_t f_config = TWAI_FILTER_CONFIG_ACCEPT_ALL();
+
+  // Install TWAI driver
+  err = twai_driver_install(&g_config, timing_config, &f_config);
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't install CAN driver.");
+
+  // Start TWAI driver
+  err = twai_start();
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't start CAN driver.");
+
+  return ESP_OK;
+}
+
+esp_err_t driver_setup_get_can_recovery_status(
+    driver_setup_can_recovery_status_t *status_out) {
+  if (can_recovery_status_mutex == NULL) {
+    return ESP_FAIL;
+  }
+  assert(xSemaphoreTake(can_recovery_status_mutex, portMAX_DELAY) == pdTRUE);
+  *status_out = can_recovery_status;
+  assert(xSemaphoreGive(can_recovery_status_mutex) == pdTRUE);
+  return ESP_OK;
+}
+
+static esp_err_t start_wifi(esp_netif_t *esp_netif,
+                             const esp_netif_ip_info_t *ip_info,
+                             const char *hostname, const char ssid[32],
+                             const char password[64]) {
+  esp_err_t err;
   //// Set the device hostname ////
   err = esp_netif_set_hostname(esp_netif, hostname);
   ESP_RETURN_ON_ERROR(err, TAG, "Couldn't set Wi-Fi hostname.");
@@ -196,7 +534,9 @@ esp_err_t driver_setup_wifi(const esp_netif_ip_info_t *ip_info,
   err = esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
   ESP_RETURN_ON_ERROR(err, TAG, "Couldn't configure WIFI.");
 
-  internet_ready = xSemaphoreCreateBinaryStatic(&internet_ready_mem);
+  err = init_driver_events();
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't create driver event group.");
+  atomic_store(&wifi_wanted, true);
 
   // Register event handlers for debugging purposes
   err = esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID,
@@ -213,60 +553,19 @@ esp_err_t driver_setup_wifi(const esp_netif_ip_info_t *ip_info,
   // Note: This will NOT return an error if WIFI can't connect.
   // All reconnection logic is instead handled by
   // `wifi_recovery_task()`.
+  // Don't wait for the connection or an IP address.
+  // `ip_event_handler()` sets `GOT_IP_BIT` once it's usable.
   err = esp_wifi_connect();
   ESP_RETURN_ON_ERROR(err, TAG, "Couldn't connect to Wi-Fi.");
 
-  //// Wait for internet to actually work ////
-  if (xSemaphoreTake(internet_ready, pdMS_TO_TICKS(10000)) != pdTRUE) {
-    vSemaphoreDelete(internet_ready);
-    ESP_LOGE(TAG, "Couldn't start WIFI driver in 10 seconds.");
-    return ESP_FAIL;
-  }
-  vSemaphoreDelete(internet_ready);
-
-  // Spawn a task that will reconnect to Wi-Fi if it disconnects.
-  xTaskCreateStatic(wifi_recovery_task, "wifi_recovery",
-                    sizeof(wifi_recovery_task_stack), NULL, 7,
-                    wifi_recovery_task_stack, &wifi_recovery_task_mem);
-
-  driver_setup_wifi_netif = esp_netif;
   return ESP_OK;
 }
 
-esp_err_t driver_setup_can(const twai_timing_config_t *timing_config) {
-  esp_err_t err;
-
-  twai_general_config_t g_config =
-      TWAI_GENERAL_CONFIG_DEFAULT(GPIO_NUM_5, GPIO_NUM_35, TWAI_MODE_NORMAL);
-
-  // Sdkconfig configuration is set to put TWAI ISR into IRAM
-  // because this may reduce cache misses.
-  // This flag is required for that configuration.
-  g_config.intr_flags = ESP_INTR_FLAG_IRAM;
-  // Logging alerts doesn't work when TWAI ISR is in IRAM.
-  // To log alerts, change configuration to move it out of IRAM,
-  // and uncoment the lines below:
-  // g_config.alerts_enabled = TWAI_ALERT_AND_LOG | TWAI_ALERT_ABOVE_ERR_WARN |
-  //                           TWAI_ALERT_BUS_OFF | TWAI_ALERT_BUS_RECOVERED;
-  g_config.tx_queue_len = 32;
-  g_config.rx_queue_len = 32;
-  twai_filter_config_t f_config = TWAI_FILTER_CONFIG_ACCEPT_ALL();
-
-  // Install TWAI driver
-  err = twai_driver_install(&g_config, timing_config, &f_config);
-  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't install CAN driver.");
-
-  // Start TWAI driver
-  err = twai_start();
-  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't start CAN driver.");
-
-  // Spawn a task that will put CAN in recovery mode
-  // whenever it enters BUS_OFF state.
-  xTaskCreateStatic(can_recovery_task, "can_recovery",
-                    sizeof(can_recovery_task_stack), NULL, 7,
-                    can_recovery_task_stack, &can_recovery_task_mem);
-
-  return ESP_OK;
+static esp_err_t init_driver_events(void) {
+  if (driver_events == NULL) {
+    driver_events = xEventGroupCreateStatic(&driver_events_mem);
+  }
+  return driver_events == NULL ? ESP_FAIL : ESP_OK;
 }
 
 static void ethernet_event_handler(void *arg, esp_event_base_t event_base,
@@ -277,6 +576,7 @@ static void ethernet_event_handler(void *arg, esp_event_base_t event_base,
       uint8_t mac_addr[6] = {0};
       esp_eth_ioctl(*eth_handle, ETH_CMD_G_MAC_ADDR, mac_addr);
       ESP_LOGD(TAG, "Ethernet Connected");
+      boot_timeline_mark(BOOT_PHASE_ETH_LINK_UP);
       ESP_LOGD(TAG, "Ethernet HW Addr %2x:%2x:%2x:%2x:%2x:%2x", mac_addr[0],
                mac_addr[1], mac_addr[2], mac_addr[3], mac_addr[4], mac_addr[5]);
       break;
@@ -285,7 +585,7 @@ static void ethernet_event_handler(void *arg, esp_event_base_t event_base,
       break;
     case ETHERNET_EVENT_START:
       ESP_LOGD(TAG, "Ethernet Started");
-      assert(xSemaphoreGive(internet_ready) == pdTRUE);
+      boot_timeline_mark(BOOT_PHASE_ETH_STARTED);
       break;
     case ETHERNET_EVENT_STOP:
       ESP_LOGE(TAG, "Ethernet Stopped");
@@ -302,10 +602,11 @@ static void wifi_event_handler(void *arg, esp_event_base_t event_base,
     case WIFI_EVENT_STA_START:
       ESP_LOGD(TAG, "WIFI station started. Connecting...");
       esp_wifi_connect();
-      assert(xSemaphoreGive(internet_ready) == pdTRUE);
+      boot_timeline_mark(BOOT_PHASE_WIFI_STARTED);
       break;
     case WIFI_EVENT_STA_CONNECTED:
       ESP_LOGD(TAG, "WIFI station connected.");
+      boot_timeline_mark(BOOT_PHASE_WIFI_CONNECTED);
       break;
     case WIFI_EVENT_STA_DISCONNECTED:
       ESP_LOGE(TAG, "WIFI station disconnected.");
@@ -333,6 +634,13 @@ static void ip_event_handler(void *arg, esp_event_base_t event_base,
   ESP_LOGI(TAG, "Net mask: " IPSTR, IP2STR(&ip_info->netmask));
   ESP_LOGI(TAG, "Gateway:  " IPSTR, IP2STR(&ip_info->gw));
   ESP_LOGI(TAG, "--------------------------");
+
+  if (event_id == IP_EVENT_ETH_GOT_IP) {
+    boot_timeline_mark(BOOT_PHASE_ETH_GOT_IP);
+  } else if (event_id == IP_EVENT_STA_GOT_IP) {
+    boot_timeline_mark(BOOT_PHASE_WIFI_GOT_IP);
+  }
+  xEventGroupSetBits(driver_events, GOT_IP_BIT);
 }
 
 static void wifi_recovery_task(void *pvParameters) {
@@ -340,7 +648,8 @@ static void wifi_recovery_task(void *pvParameters) {
   while (true) {
     // Check Wi-Fi status every 10 seconds
     vTaskDelay(pdMS_TO_TICKS(10000));
-    if (!esp_netif_is_netif_up(driver_setup_wifi_netif)) {
+    if (atomic_load(&wifi_wanted) &&
+        !esp_netif_is_netif_up(driver_setup_wifi_netif)) {
       ESP_LOGE(TAG, "Retrying connecting to Wi-Fi.");
       esp_err_t err = esp_wifi_connect();
       if (err != ESP_OK) {
@@ -354,35 +663,139 @@ static void wifi_recovery_task(void *pvParameters) {
 }
 
 static void can_recovery_task(void *pvParameters) {
-  // Constantly initiate recovery if needed.
+  // The state seen during the previous check.
+  // Used to detect state transitions.
+  twai_state_t last_state = TWAI_STATE_RUNNING;
+
+  // When the bus went off, or zero if it isn't off.
+  int64_t bus_off_since = 0;
+
   while (true) {
-    // Check CAN status every 5 seconds
-    vTaskDelay(pdMS_TO_TICKS(5000));
+    // Sleep until the TWAI driver raises an alert.
+    // Also wake up regularly, in case an alert was missed,
+    // and so that `driver_setup_can_reconfigure()` never waits long.
+    if (!can_driver_enter()) {
+      // The driver is being (re)installed.
+      // Install it here if `install_can_driver_on_can_core()` asks us to.
+      if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(10)) > 0) {
+        install_request_result = install_can_driver(
+            &install_request_timing_config, install_request_mode);
+        last_state = TWAI_STATE_RUNNING;
+        bus_off_since = 0;
+        assert(xSemaphoreGive(install_request_done) == pdTRUE);
+      }
+      continue;
+    }
+    uint32_t alerts = 0;
+    esp_err_t err = twai_read_alerts(&alerts, pdMS_TO_TICKS(100));
+    if (err != ESP_OK && err != ESP_ERR_TIMEOUT) {
+      can_driver_exit();
+      ESP_LOGE(TAG, "Couldn't read CAN alerts: %s", esp_err_to_name(err));
+      vTaskDelay(pdMS_TO_TICKS(1000));
+      continue;
+    }
+
     twai_status_info_t status;
-    esp_err_t err = twai_get_status_info(&status);
+    err = twai_get_status_info(&status);
     if (err != ESP_OK) {
+      can_driver_exit();
       ESP_LOGE(TAG, "Couldn't get CAN status.");
       continue;
     }
 
+    if (status.state != last_state) {
+      trace_buffer_record(TRACE_EVENT_CAN_STATE, status.state, 0,
+                          status.tx_error_counter, status.rx_error_counter);
+      last_state = status.state;
+    }
+
+    if (alerts & TWAI_ALERT_ERR_PASS) {
+      ESP_LOGW(TAG, "CAN controller is error passive.");
+      uint8_t ctrl_status = 0;
+      if (status.tx_error_counter >= 128) {
+        ctrl_status |= CAN_ERR_CRTL_TX_PASSIVE;
+      }
+      if (status.rx_error_counter >= 128) {
+        ctrl_status |= CAN_ERR_CRTL_RX_PASSIVE;
+      }
+      notify_can_state(CAN_ERR_CRTL, ctrl_status, &status);
+
+      assert(xSemaphoreTake(can_recovery_status_mutex, portMAX_DELAY) ==
+             pdTRUE);
+      can_recovery_status.error_passive_count += 1;
+      assert(xSemaphoreGive(can_recovery_status_mutex) == pdTRUE);
+    }
+
+    if (alerts & TWAI_ALERT_ERR_ACTIVE) {
+      notify_can_state(CAN_ERR_CRTL, CAN_ERR_CRTL_ACTIVE, &status);
+    }
+
     if (status.state == TWAI_STATE_BUS_OFF) {
+      if (bus_off_since == 0) {
+        bus_off_since = esp_timer_get_time();
+        notify_can_state(CAN_ERR_BUSOFF, 0, &status);
+
+        assert(xSemaphoreTake(can_recovery_status_mutex, portMAX_DELAY) ==
+               pdTRUE);
+        can_recovery_status.bus_off_count += 1;
+        assert(xSemaphoreGive(can_recovery_status_mutex) == pdTRUE);
+      }
+
       err = twai_initiate_recovery();
       if (err == ESP_OK) {
         ESP_LOGE(TAG, "Initiated CAN recovery.");
+        trace_buffer_record(TRACE_EVENT_CAN_RECOVERY_STARTED, 0, 0, 0, 0);
       } else {
         ESP_LOGE(TAG, "Couldn't initiate CAN recovery: %s",
                  esp_err_to_name(err));
       }
     }
 
+    // After `TWAI_ALERT_BUS_RECOVERED` the driver is stopped.
     if (status.state == TWAI_STATE_STOPPED) {
       err = twai_start();
       if (err == ESP_OK) {
         ESP_LOGE(TAG, "Restarted CAN driver.");
+        trace_buffer_record(TRACE_EVENT_CAN_RESTARTED, 0, 0, 0, 0);
+        notify_can_state(CAN_ERR_RESTARTED, 0, &status);
+
+        if (bus_off_since != 0) {
+          int64_t recovery_us = esp_timer_get_time() - bus_off_since;
+          bus_off_since = 0;
+
+          assert(xSemaphoreTake(can_recovery_status_mutex, portMAX_DELAY) ==
+                 pdTRUE);
+          can_recovery_status.recoveries_completed += 1;
+          can_recovery_status.last_recovery_us = recovery_us;
+          can_recovery_status.total_recovery_us += recovery_us;
+          if (recovery_us > can_recovery_status.max_recovery_us) {
+            can_recovery_status.max_recovery_us = recovery_us;
+          }
+          assert(xSemaphoreGive(can_recovery_status_mutex) == pdTRUE);
+        }
       } else {
         ESP_LOGE(TAG, "Couldn't restart the CAN driver: %s",
                  esp_err_to_name(err));
       }
     }
+
+    can_driver_exit();
   }
 }
+
+static void notify_can_state(uint32_t err_class, uint8_t ctrl_status,
+                             const twai_status_info_t *status) {
+  // SocketCAN error frames always have a DLC of 8,
+  // and carry the error counters in the last two bytes.
+  twai_message_t err_frame = {0};
+  err_frame.identifier = CAN_LISTENER_ERR_FLAG | err_class;
+  err_frame.data_length_code = 8;
+  err_frame.data[1] = ctrl_status;
+  err_frame.data[6] = status->tx_error_counter > 255
+                          ? 255
+                          : (uint8_t)status->tx_error_counter;
+  err_frame.data[7] = status->rx_error_counter > 255
+                          ? 255
+                          : (uint8_t)status->rx_error_counter;
+  can_listener_enqueue_msg(&err_frame, NULL);
+}
@@ -14,6 +14,7 @@ extern esp_netif_t* driver_setup_eth_netif;
 extern esp_netif_t* driver_setup_wifi_netif;
 
 // Starts the ESP32-EVB ethernet driver and populates `driver_setup_eth_netif`.
+// Doesn't wait for the link to come up. Use `driver_setup_wait_for_ip()`.
 // `ip_info` specifies the static IP address config.
 // Uses DHCP if `ip_info` is NULL.
 // `hostname` must be a valid hostname C-string.
@@ -21,6 +22,7 @@ esp_err_t driver_setup_ethernet(const esp_netif_ip_info_t* ip_info,
                                 const char* hostname);
 
 // Starts the ESP32-EVB wifi driver and populates `driver_setup_wifi_netif`.
+// Doesn't wait for the connection. Use `driver_setup_wait_for_ip()`.
 // `ip_info` specifies the static IP address config.
 // Uses DHCP if `ip_info` is NULL.
 // `hostname` must be a valid hostname C-string.
@@ -28,5 +30,76 @@ esp_err_t driver_setup_wifi(const esp_netif_ip_info_t* ip_info,
                             const char* hostname, const char ssid[32],
                             const char password[64]);
 
+// Waits until any network interface has an IP address.
+// Returns false if none got one within `ticks_to_wait`.
+bool driver_setup_wait_for_ip(TickType_t ticks_to_wait);
+
+// Applies new Wi-Fi settings at runtime, without touching ethernet.
+// Stops Wi-Fi if `enabled` is false. Otherwise starts Wi-Fi if it
+// was never started, or reconnects it with the new `ip_info`,
+// `ssid` and `password`. Doesn't wait for the connection to come up.
+// `hostname` is only used if Wi-Fi was never started.
+esp_err_t driver_setup_wifi_reconfigure(bool enabled,
+                                        const esp_netif_ip_info_t* ip_info,
+                                        const char* hostname,
+                                        const char ssid[32],
+                                        const char password[64]);
+
+// Bus-off recovery statistics of the CAN driver.
+// Get the current statistics using `driver_setup_get_can_recovery_status()`.
+typedef struct {
+  // Number of times the controller went bus-off.
+  uint32_t bus_off_count;
+
+  // Number of times the controller became error passive.
+  uint32_t error_passive_count;
+
+  // Number of bus-off events that were recovered from.
+  uint32_t recoveries_completed;
+
+  // Time from going bus-off to running again, in microseconds.
+  int64_t last_recovery_us;
+  int64_t max_recovery_us;
+  int64_t total_recovery_us;
+} driver_setup_can_recovery_status_t;
+
+// Number of received frames the TWAI driver can hold
+// until `driver_setup_can_receive()` picks them up.
+#define DRIVER_SETUP_CAN_RX_QUEUE_LEN 32
+
 // Starts the ESP32-EVB CAN driver with the given `timing_config`.
+// Also starts a task that reacts to TWAI alerts: it initiates
+// recovery as soon as the bus goes off, restarts the driver as soon as
+// recovery completes, and notifies `can_listener` clients of
+// state changes with SocketCAN-style error frames.
 esp_err_t driver_setup_can(const twai_timing_config_t* timing_config);
+
+// Stops and reinstalls the CAN driver with a new `timing_config` and `mode`,
+// without restarting the tasks that use it.
+// While the driver is reinstalled, `driver_setup_can_transmit()` and
+// `driver_setup_can_receive()` return `ESP_ERR_INVALID_STATE`.
+// Must only be called after `driver_setup_can()`, and not concurrently.
+esp_err_t driver_setup_can_reconfigure(
+    const twai_timing_config_t* timing_config, twai_mode_t mode);
+
+// Same as `twai_transmit()`, but safe to call while
+// `driver_setup_can_reconfigure()` runs.
+// All tasks must transmit through this function instead of `twai_transmit()`.
+esp_err_t driver_setup_can_transmit(const twai_message_t* message,
+                                    TickType_t ticks_to_wait);
+
+// Same as `twai_receive()`, but safe to call while
+// `driver_setup_can_reconfigure()` runs.
+// Keep `ticks_to_wait` short, because reconfiguration waits for it.
+esp_err_t driver_setup_can_receive(twai_message_t* message,
+                                   TickType_t ticks_to_wait);
+
+// Same as `twai_get_status_info()`, but safe to call while
+// `driver_setup_can_reconfigure()` runs.
+// Returns `ESP_ERR_INVALID_STATE` while the driver is reinstalled.
+esp_err_t driver_setup_can_get_status_info(twai_status_info_t* status_out);
+
+// Fills `status_out` with the current CAN recovery statistics.
+// Returns an error if the CAN driver hasn't been started.
+esp_err_t driver_setup_get_can_recovery_status(
+    driver_setup_can_recovery_status_t* status_out);
@@ -1,10 +1,32 @@
 #include "http_server.h"
 
+#include <ctype.h>
+#include <math.h>
+
+#include "can_autobaud.h"
+#include "can_bridge.h"
+#include "can_gateway.h"
+#include "can_replay.h"
+#include "cannelloni.h"
+#include "capture_ring.h"
+#include "capture_trigger.h"
 #include "driver_setup.h"
 #include "esp_check.h"
 #include "esp_http_server.h"
+#include "esp_timer.h"
+#include "lwip/sockets.h"
+#include "overload_control.h"
 #include "persistent_settings.h"
+#include "reflex_rules.h"
+#include "settings_apply.h"
+#include "signal_decoder.h"
 #include "status_report.h"
+#include "stdatomic.h"
+#include "task_config.h"
+#include "text_parse.h"
+#include "trace_buffer.h"
+#include "traffic_gen.h"
+#include "tx_rate_limit.h"
 
 // Name that will be used for logging
 #define TAG "http_server"
@@ -81,6 +103,95 @@ static const httpd_uri_t get_api_status_handler = {
     .method = HTTP_GET,
     .user_ctx = NULL};
 
+// GET /api/trace
+static esp_err_t serve_get_api_trace(httpd_req_t *req);
+static const httpd_uri_t get_api_trace_handler = {
+    .uri = "/api/trace",
+    .handler = serve_get_api_trace,
+    .method = HTTP_GET,
+    .user_ctx = NULL};
+
+// GET /api/capture
+static esp_err_t serve_get_api_capture(httpd_req_t *req);
+static const httpd_uri_t get_api_capture_handler = {
+    .uri = "/api/capture",
+    .handler = serve_get_api_capture,
+    .method = HTTP_GET,
+    .user_ctx = NULL};
+
+// GET /api/history
+static esp_err_t serve_get_api_history(httpd_req_t *req);
+static const httpd_uri_t get_api_history_handler = {
+    .uri = "/api/history",
+    .handler = serve_get_api_history,
+    .method = HTTP_GET,
+    .user_ctx = NULL};
+
+// GET /api/snapshots
+static esp_err_t serve_get_api_snapshots(httpd_req_t *req);
+static const httpd_uri_t get_api_snapshots_handler = {
+    .uri = "/api/snapshots",
+    .handler = serve_get_api_snapshots,
+    .method = HTTP_GET,
+    .user_ctx = NULL};
+
+// GET /api/snapshot
+static esp_err_t serve_get_api_snapshot(httpd_req_t *req);
+static const httpd_uri_t get_api_snapshot_handler = {
+    .uri = "/api/snapshot",
+    .handler = serve_get_api_snapshot,
+    .method = HTTP_GET,
+    .user_ctx = NULL};
+
+// POST /api/replay
+static esp_err_t serve_post_api_replay(httpd_req_t *req);
+static const httpd_uri_t post_api_replay_handler = {
+    .uri = "/api/replay",
+    .handler = serve_post_api_replay,
+    .method = HTTP_POST,
+    .user_ctx = NULL};
+
+// POST /api/replay/control
+static esp_err_t serve_post_api_replay_control(httpd_req_t *req);
+static const httpd_uri_t post_api_replay_control_handler = {
+    .uri = "/api/replay/control",
+    .handler = serve_post_api_replay_control,
+    .method = HTTP_POST,
+    .user_ctx = NULL};
+
+// POST /api/generator
+static esp_err_t serve_post_api_generator(httpd_req_t *req);
+static const httpd_uri_t post_api_generator_handler = {
+    .uri = "/api/generator",
+    .handler = serve_post_api_generator,
+    .method = HTTP_POST,
+    .user_ctx = NULL};
+
+// GET /api/signals
+static esp_err_t serve_get_api_signals(httpd_req_t *req);
+static const httpd_uri_t get_api_signals_handler = {
+    .uri = "/api/signals",
+    .handler = serve_get_api_signals,
+    .method = HTTP_GET,
+    .user_ctx = NULL};
+
+// POST /api/signals
+static esp_err_t serve_post_api_signals(httpd_req_t *req);
+static const httpd_uri_t post_api_signals_handler = {
+    .uri = "/api/signals",
+    .handler = serve_post_api_signals,
+    .method = HTTP_POST,
+    .user_ctx = NULL};
+
+// GET /api/signals/ws
+static esp_err_t serve_api_signals_ws(httpd_req_t *req);
+static const httpd_uri_t api_signals_ws_handler = {
+    .uri = "/api/signals/ws",
+    .handler = serve_api_signals_ws,
+    .method = HTTP_GET,
+    .user_ctx = NULL,
+    .is_websocket = true};
+
 // POST /api/config
 static esp_err_t serve_post_api_config(httpd_req_t *req);
 static const httpd_uri_t post_api_config_handler = {
@@ -89,15 +200,83 @@ static const httpd_uri_t post_api_config_handler = {
     .method = HTTP_POST,
     .user_ctx = NULL};
 
+// POST /api/autobaud
+static esp_err_t serve_post_api_autobaud(httpd_req_t *req);
+static const httpd_uri_t post_api_autobaud_handler = {
+    .uri = "/api/autobaud",
+    .handler = serve_post_api_autobaud,
+    .method = HTTP_POST,
+    .user_ctx = NULL};
+
 // Updates `settings_to_update` with any updated values from `json`.
 // On success, `settings_to_update` will hold the updated settings.
 // On failure, returns an error.
 static esp_err_t update_persistent_settings_from_json(
     const char *json, persistent_settings_t *settings_to_update);
 
+// Decodes the form-encoded `text` in place,
+// turning `+` into spaces and `%XX` into bytes.
+// Returns an error if an escape is malformed.
+static esp_err_t form_decode(char *text);
+
+// Maximum number of WebSocket clients of `/api/signals/ws`.
+#define SIGNAL_WS_CLIENTS_MAX 4
+
+// How long sending an update may block the HTTP server task for one
+// WebSocket client. Clients that take longer are disconnected.
+#define SIGNAL_WS_SEND_TIMEOUT_MS 50
+
+// The running server, for sending to WebSocket clients.
+static httpd_handle_t server = NULL;
+
+// Sockets of the WebSocket clients of `/api/signals/ws`, or -1.
+// Only used by the HTTP server task.
+static int signal_ws_fds[SIGNAL_WS_CLIENTS_MAX] = {-1, -1, -1, -1};
+static atomic_int signal_ws_client_count = 0;
+
+// The signal update waiting to be sent to the WebSocket clients.
+// Set while an update is waiting.
+static char signal_update[SIGNAL_DECODER_UPDATE_LEN];
+static atomic_bool signal_update_pending = false;
+
+// Queues the signal `update` for sending to the WebSocket clients.
+// The hook of the signal decoder.
+static esp_err_t publish_signal_update(const char *update);
+
+// Sends `signal_update` to the WebSocket clients, forgetting those that
+// are gone. Runs on the HTTP server task.
+static void send_signal_update(void *arg);
+
+// Streams the captured frames matching `query` as a pcap file,
+// or as a candump log, named `name`.
+static esp_err_t send_captured_frames(httpd_req_t *req,
+                                      const capture_ring_query_t *query,
+                                      bool pcap, const char *name);
+
+// A response of captured frames, as a pcap file or a candump log.
+typedef struct {
+  httpd_req_t *req;
+  bool pcap;
+
+  // Bytes waiting to be sent.
+  size_t chunk_len;
+} frame_stream_t;
+
+// Starts `stream` as the response to `req`, for a file named `name`.
+static esp_err_t frame_stream_begin(frame_stream_t *stream, httpd_req_t *req,
+                                    bool pcap, const char *name);
+
+// Adds `record` to `stream`, sending what's buffered when needed.
+static esp_err_t frame_stream_add(frame_stream_t *stream,
+                                  const capture_record_t *record);
+
+// Sends the rest of `stream`, and ends the response.
+static esp_err_t frame_stream_end(frame_stream_t *stream);
+
 esp_err_t start_http_server(void) {
   httpd_config_t config = HTTPD_DEFAULT_CONFIG();
-  httpd_handle_t server = NULL;
+  config.max_uri_handlers = 24;
+  config.core_id = TASK_CONFIG_NETWORK_CORE;
   esp_err_t err;
 
   err = httpd_start(&server, &config);
@@ -121,9 +300,47 @@ esp_err_t start_http_server(void) {
   err = httpd_register_uri_handler(server, &get_api_status_handler);
   ESP_RETURN_ON_ERROR(err, TAG, "Couldn't register HTTP URI handler.");
 
+  err = httpd_register_uri_handler(server, &get_api_trace_handler);
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't register HTTP URI handler.");
+
+  err = httpd_register_uri_handler(server, &get_api_capture_handler);
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't register HTTP URI handler.");
+
+  err = httpd_register_uri_handler(server, &get_api_history_handler);
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't register HTTP URI handler.");
+
+  err = httpd_register_uri_handler(server, &get_api_snapshots_handler);
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't register HTTP URI handler.");
+
+  err = httpd_register_uri_handler(server, &get_api_snapshot_handler);
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't register HTTP URI handler.");
+
+  err = httpd_register_uri_handler(server, &post_api_replay_handler);
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't register HTTP URI handler.");
+
+  err = httpd_register_uri_handler(server, &post_api_replay_control_handler);
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't register HTTP URI handler.");
+
+  err = httpd_register_uri_handler(server, &post_api_generator_handler);
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't register HTTP URI handler.");
+
+  err = httpd_register_uri_handler(server, &get_api_signals_handler);
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't register HTTP URI handler.");
+
+  err = httpd_register_uri_handler(server, &post_api_signals_handler);
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't register HTTP URI handler.");
+
+  err = httpd_register_uri_handler(server, &api_signals_ws_handler);
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't register HTTP URI handler.");
+
   err = httpd_register_uri_handler(server, &post_api_config_handler);
   ESP_RETURN_ON_ERROR(err, TAG, "Couldn't register HTTP URI handler.");
 
+  err = httpd_register_uri_handler(server, &post_api_autobaud_handler);
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't register HTTP URI handler.");
+
+  signal_decoder_set_hook(publish_signal_update);
+
   return ESP_OK;
 }
 
@@ -151,6 +368,681 @@ static esp_err_t serve_get_api_status(httpd_req_t *req) {
   return http_err;
 }
 
+static esp_err_t serve_get_api_trace(httpd_req_t *req) {
+  esp_err_t err = httpd_resp_set_type(req, "application/octet-stream");
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't set response type.");
+  err = httpd_resp_set_hdr(req, "Content-Disposition",
+                           "attachment; filename=\"trace.bin\"");
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't set response header.");
+
+  uint32_t first;
+  uint32_t end;
+  trace_buffer_range(&first, &end);
+
+  trace_buffer_header_t header = {
+      .magic = TRACE_BUFFER_MAGIC,
+      .version = TRACE_BUFFER_FORMAT_VERSION,
+      .record_size = sizeof(trace_record_t),
+      .total_recorded = end,
+      .record_count = end - first,
+      .now_us = esp_timer_get_time(),
+  };
+
+  // Events that get overwritten while streaming are replaced by
+  // records with `event` set to zero, so `record_count` stays exact.
+  // The host decoder skips those.
+  trace_record_t chunk[16];
+  size_t chunk_len = 0;
+
+  err = httpd_resp_send_chunk(req, (const char *)&header, sizeof(header));
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't send trace header.");
+
+  for (uint32_t seq = first; seq != end; seq++) {
+    if (!trace_buffer_read(seq, &chunk[chunk_len])) {
+      chunk[chunk_len] = (trace_record_t){.seq = seq};
+    }
+    chunk_len += 1;
+
+    if (chunk_len == sizeof(chunk) / sizeof(chunk[0]) || seq + 1 == end) {
+      err = httpd_resp_send_chunk(req, (const char *)chunk,
+                                  chunk_len * sizeof(trace_record_t));
+      ESP_RETURN_ON_ERROR(err, TAG, "Couldn't send trace records.");
+      chunk_len = 0;
+    }
+  }
+
+  return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+static esp_err_t serve_get_api_capture(httpd_req_t *req) {
+  // Read the `format` and `seconds` query parameters.
+  char query[64] = "";
+  char format[16] = "pcap";
+  char seconds_buf[16] = "";
+  if (httpd_req_get_url_query_len(req) < sizeof(query) &&
+      httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+    httpd_query_key_value(query, "format", format, sizeof(format));
+    httpd_query_key_value(query, "seconds", seconds_buf, sizeof(seconds_buf));
+  }
+
+  bool pcap = strcmp(format, "pcap") == 0;
+  if (!pcap && strcmp(format, "candump") != 0) {
+    return httpd_resp_send_err(req, 400, "format must be pcap or candump.");
+  }
+
+  // Only frames younger than `seconds` are sent. By default, all of them.
+  capture_ring_query_t capture_query = {
+      .id = 0, .mask = 0, .from_us = INT64_MIN, .to_us = INT64_MAX};
+  if (seconds_buf[0] != '\0') {
+    capture_query.from_us =
+        esp_timer_get_time() - strtoll(seconds_buf, NULL, 10) * 1000000;
+  }
+
+  return send_captured_frames(req, &capture_query, pcap, "capture");
+}
+
+static esp_err_t serve_get_api_history(httpd_req_t *req) {
+  // Read the query parameters.
+  char query[128] = "";
+  char id_buf[16] = "";
+  char mask_buf[16] = "";
+  char from_buf[24] = "";
+  char to_buf[24] = "";
+  char format[16] = "candump";
+  if (httpd_req_get_url_query_len(req) < sizeof(query) &&
+      httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+    httpd_query_key_value(query, "id", id_buf, sizeof(id_buf));
+    httpd_query_key_value(query, "mask", mask_buf, sizeof(mask_buf));
+    httpd_query_key_value(query, "from", from_buf, sizeof(from_buf));
+    httpd_query_key_value(query, "to", to_buf, sizeof(to_buf));
+    httpd_query_key_value(query, "format", format, sizeof(format));
+  }
+
+  bool pcap = strcmp(format, "pcap") == 0;
+  if (!pcap && strcmp(format, "candump") != 0) {
+    return httpd_resp_send_err(req, 400, "format must be pcap or candump.");
+  }
+
+  // Without an `id`, all IDs match. With one, only that ID,
+  // unless `mask` says which of its bits matter.
+  capture_ring_query_t history_query = {
+      .id = 0, .mask = 0, .from_us = INT64_MIN, .to_us = INT64_MAX};
+  char *parse_end;
+  if (id_buf[0] != '\0') {
+    history_query.id = strtoul(id_buf, &parse_end, 16);
+    if (*parse_end != '\0' || history_query.id > 0x1FFFFFFF) {
+      return httpd_resp_send_err(req, 400, "id must be a hex CAN ID.");
+    }
+    history_query.mask = 0x1FFFFFFF;
+  }
+  if (mask_buf[0] != '\0') {
+    history_query.mask = strtoul(mask_buf, &parse_end, 16);
+    if (*parse_end != '\0' || history_query.mask > 0x1FFFFFFF) {
+      return httpd_resp_send_err(req, 400, "mask must be a hex CAN ID mask.");
+    }
+  }
+
+  // Times are seconds of uptime, or seconds before now if negative.
+  int64_t now_us = esp_timer_get_time();
+  if (from_buf[0] != '\0') {
+    double from = strtod(from_buf, &parse_end);
+    if (*parse_end != '\0') {
+      return httpd_resp_send_err(req, 400, "from must be in seconds.");
+    }
+    history_query.from_us = from * 1000000 + (from < 0 ? now_us : 0);
+  }
+  if (to_buf[0] != '\0') {
+    double to = strtod(to_buf, &parse_end);
+    if (*parse_end != '\0') {
+      return httpd_resp_send_err(req, 400, "to must be in seconds.");
+    }
+    history_query.to_us = to * 1000000 + (to < 0 ? now_us : 0);
+  }
+
+  return send_captured_frames(req, &history_query, pcap, "history");
+}
+
+static esp_err_t serve_get_api_snapshots(httpd_req_t *req) {
+  capture_trigger_snapshot_t snapshots[CAPTURE_TRIGGER_SNAPSHOTS];
+  uint8_t count = capture_trigger_list(snapshots);
+
+  // Static, because the HTTP server handles one request at a time
+  // and its stack is small.
+  static char json[CAPTURE_TRIGGER_SNAPSHOTS * 192 + 8];
+  size_t written = snprintf(json, sizeof(json), "[");
+  for (uint8_t i = 0; i < count; i++) {
+    int res = snprintf(
+        json + written, sizeof(json) - written,
+        "%s\n{\"number\": %lu, \"trigger\": %d, \"trigger_time_us\": %lld, "
+        "\"frames\": %d, \"trigger_frame\": %d, \"frames_missed\": %d, "
+        "\"complete\": %s}",
+        i > 0 ? "," : "", snapshots[i].number, snapshots[i].trigger,
+        snapshots[i].trigger_time_us, snapshots[i].frame_count,
+        snapshots[i].trigger_frame, snapshots[i].frames_missed,
+        snapshots[i].complete ? "true" : "false");
+    written += res;
+    if (res < 0 || written >= sizeof(json)) {
+      ESP_LOGE(TAG, "Snapshot list buffer too small.");
+      return httpd_resp_send_err(req, 500, "Couldn't list snapshots.");
+    }
+  }
+  snprintf(json + written, sizeof(json) - written, "\n]\n");
+
+  esp_err_t err = httpd_resp_set_type(req, "application/json");
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't set response type.");
+  return httpd_resp_send(req, json, HTTPD_RESP_USE_STRLEN);
+}
+
+static esp_err_t serve_get_api_snapshot(httpd_req_t *req) {
+  // Read the `number` and `format` query parameters.
+  char query[64] = "";
+  char number_buf[16] = "";
+  char format[16] = "pcap";
+  if (httpd_req_get_url_query_len(req) < sizeof(query) &&
+      httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+    httpd_query_key_value(query, "number", number_buf, sizeof(number_buf));
+    httpd_query_key_value(query, "format", format, sizeof(format));
+  }
+
+  bool pcap = strcmp(format, "pcap") == 0;
+  if (!pcap && strcmp(format, "candump") != 0) {
+    return httpd_resp_send_err(req, 400, "format must be pcap or candump.");
+  }
+
+  uint32_t number = strtoul(number_buf, NULL, 10);
+  capture_record_t record;
+  if (capture_trigger_read(number, 0, &record) != ESP_OK) {
+    return httpd_resp_send_err(req, 404, "No such snapshot.");
+  }
+
+  char name[24];
+  snprintf(name, sizeof(name), "snapshot-%lu", number);
+  frame_stream_t stream;
+  esp_err_t err = frame_stream_begin(&stream, req, pcap, name);
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't start snapshot.");
+
+  // Stops early if the snapshot gets replaced while streaming.
+  for (uint16_t index = 0;
+       capture_trigger_read(number, index, &record) == ESP_OK; index++) {
+    err = frame_stream_add(&stream, &record);
+    ESP_RETURN_ON_ERROR(err, TAG, "Couldn't send snapshot.");
+  }
+  return frame_stream_end(&stream);
+}
+
+static esp_err_t send_captured_frames(httpd_req_t *req,
+                                      const capture_ring_query_t *query,
+                                      bool pcap, const char *name) {
+  frame_stream_t stream;
+  esp_err_t err = frame_stream_begin(&stream, req, pcap, name);
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't start capture.");
+
+  uint32_t seq;
+  uint32_t end;
+  capture_ring_range(&seq, &end);
+
+  // Frames that get overwritten while streaming are skipped.
+  capture_record_t record;
+  for (; capture_ring_find(query, &seq, end, &record); seq++) {
+    err = frame_stream_add(&stream, &record);
+    ESP_RETURN_ON_ERROR(err, TAG, "Couldn't send captured frames.");
+  }
+  return frame_stream_end(&stream);
+}
+
+// Frames are formatted into this chunk before they are sent.
+// Static, because the HTTP server handles one request at a time
+// and its stack is small.
+static char frame_stream_chunk[1024];
+
+static esp_err_t frame_stream_begin(frame_stream_t *stream, httpd_req_t *req,
+                                    bool pcap, const char *name) {
+  stream->req = req;
+  stream->pcap = pcap;
+  stream->chunk_len = 0;
+
+  char disposition[64];
+  esp_err_t err;
+  if (pcap) {
+    err = httpd_resp_set_type(req, "application/vnd.tcpdump.pcap");
+    ESP_RETURN_ON_ERROR(err, TAG, "Couldn't set response type.");
+    snprintf(disposition, sizeof(disposition),
+             "attachment; filename=\"%s.pcap\"", name);
+  } else {
+    err = httpd_resp_set_type(req, "text/plain");
+    ESP_RETURN_ON_ERROR(err, TAG, "Couldn't set response type.");
+    snprintf(disposition, sizeof(disposition),
+             "attachment; filename=\"%s.log\"", name);
+  }
+  err = httpd_resp_set_hdr(req, "Content-Disposition", disposition);
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't set response header.");
+
+  if (pcap) {
+    capture_ring_format_pcap_header((uint8_t *)frame_stream_chunk);
+    stream->chunk_len = CAPTURE_RING_PCAP_HEADER_LEN;
+  }
+  return ESP_OK;
+}
+
+static esp_err_t frame_stream_add(frame_stream_t *stream,
+                                  const capture_record_t *record) {
+  char *chunk = frame_stream_chunk;
+  if (stream->pcap) {
+    capture_ring_format_pcap(record, (uint8_t *)&chunk[stream->chunk_len]);
+    stream->chunk_len += CAPTURE_RING_PCAP_RECORD_LEN;
+  } else {
+    stream->chunk_len += capture_ring_format_candump(
+        record, &chunk[stream->chunk_len],
+        sizeof(frame_stream_chunk) - stream->chunk_len);
+  }
+
+  // Send the chunk once the longest record of either format
+  // might not fit anymore.
+  if (sizeof(frame_stream_chunk) - stream->chunk_len <
+      CAPTURE_RING_CANDUMP_MAX_LEN) {
+    esp_err_t err =
+        httpd_resp_send_chunk(stream->req, chunk, stream->chunk_len);
+    ESP_RETURN_ON_ERROR(err, TAG, "Couldn't send frames.");
+    stream->chunk_len = 0;
+  }
+  return ESP_OK;
+}
+
+static esp_err_t frame_stream_end(frame_stream_t *stream) {
+  if (stream->chunk_len > 0) {
+    esp_err_t err = httpd_resp_send_chunk(stream->req, frame_stream_chunk,
+                                          stream->chunk_len);
+    ESP_RETURN_ON_ERROR(err, TAG, "Couldn't send frames.");
+  }
+  return httpd_resp_send_chunk(stream->req, NULL, 0);
+}
+
+static esp_err_t serve_post_api_replay(httpd_req_t *req) {
+  // Read the `format` query parameter.
+  char query[32] = "";
+  char format[16] = "candump";
+  if (httpd_req_get_url_query_len(req) < sizeof(query) &&
+      httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+    httpd_query_key_value(query, "format", format, sizeof(format));
+  }
+
+  can_replay_format_t replay_format;
+  if (strcmp(format, "candump") == 0) {
+    replay_format = CAN_REPLAY_FORMAT_CANDUMP;
+  } else if (strcmp(format, "binary") == 0) {
+    replay_format = CAN_REPLAY_FORMAT_BINARY;
+  } else {
+    return httpd_resp_send_err(req, 400, "format must be candump or binary.");
+  }
+
+  esp_err_t err = can_replay_load_begin(replay_format);
+  if (err != ESP_OK) {
+    return httpd_resp_send_err(req, 400, "Replay is disabled.");
+  }
+
+  // The log is parsed as it arrives, as it may be larger than any buffer.
+  char buf[512];
+  size_t remaining = req->content_len;
+  while (remaining > 0 && err == ESP_OK) {
+    size_t len = remaining < sizeof(buf) ? remaining : sizeof(buf);
+    int received = httpd_req_recv(req, buf, len);
+    if (received == HTTPD_SOCK_ERR_TIMEOUT) {
+      continue;
+    }
+    if (received <= 0) {
+      ESP_LOGE(TAG, "Couldn't receive replay log.");
+      return ESP_FAIL;
+    }
+    remaining -= received;
+    err = can_replay_load_data(buf, received);
+  }
+  if (err == ESP_OK) {
+    err = can_replay_load_end();
+  }
+
+  if (err == ESP_ERR_NO_MEM) {
+    return httpd_resp_send_err(req, 400, "The log doesn't fit the buffer.");
+  }
+  if (err != ESP_OK) {
+    return httpd_resp_send_err(req, 400, "The log is malformed.");
+  }
+
+  can_replay_status_t replay_status;
+  err = can_replay_get_status(&replay_status);
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't get replay status.");
+
+  err = httpd_resp_set_type(req, "application/json");
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't set response type.");
+  char response[96];
+  snprintf(response, sizeof(response),
+           "{\"frames\": %lu, \"duration_ms\": %lu}",
+           replay_status.frames_loaded, replay_status.duration_ms);
+  return httpd_resp_send(req, response, HTTPD_RESP_USE_STRLEN);
+}
+
+static esp_err_t serve_post_api_replay_control(httpd_req_t *req) {
+  // Read the query parameters.
+  char query[256] = "";
+  char action[16] = "";
+  char speed_buf[16] = "";
+  char loops_buf[16] = "";
+  can_replay_options_t options = {
+      .speed_permille = 1000,
+      .loops = 1,
+      .filter = "",
+  };
+  if (httpd_req_get_url_query_len(req) < sizeof(query) &&
+      httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+    httpd_query_key_value(query, "action", action, sizeof(action));
+    httpd_query_key_value(query, "speed", speed_buf, sizeof(speed_buf));
+    httpd_query_key_value(query, "loops", loops_buf, sizeof(loops_buf));
+    httpd_query_key_value(query, "filter", options.filter,
+                          sizeof(options.filter));
+  }
+
+  esp_err_t err;
+  if (strcmp(action, "stop") == 0) {
+    err = can_replay_stop();
+  } else if (strcmp(action, "start") == 0) {
+    // `speed` is a factor of the original speed, like 0.5 or 2.
+    // Check it before converting, since NaN and values out of range
+    // can't be converted to an integer.
+    if (speed_buf[0] != '\0') {
+      char *end;
+      double speed = strtod(speed_buf, &end);
+      if (end == speed_buf || *end != '\0' || !isfinite(speed) ||
+          speed * 1000 < CAN_REPLAY_SPEED_MIN ||
+          speed * 1000 > CAN_REPLAY_SPEED_MAX) {
+        return httpd_resp_send_err(req, 400, "speed is out of range.");
+      }
+      options.speed_permille = speed * 1000;
+    }
+    if (loops_buf[0] != '\0' &&
+        !text_parse_number(loops_buf, 10, UINT32_MAX, &options.loops)) {
+      return httpd_resp_send_err(req, 400, "loops must be a number.");
+    }
+    if (form_decode(options.filter) != ESP_OK ||
+        can_replay_check_filter(options.filter) != ESP_OK) {
+      return httpd_resp_send_err(req, 400, "filter must be hex IDs.");
+    }
+    err = can_replay_play(&options);
+  } else {
+    return httpd_resp_send_err(req, 400, "action must be start or stop.");
+  }
+
+  if (err == ESP_ERR_INVALID_STATE) {
+    return httpd_resp_send_err(req, 400, "Replay is disabled.");
+  }
+  if (err != ESP_OK) {
+    return httpd_resp_send_err(req, 400, "speed is out of range.");
+  }
+  return httpd_resp_send(req, "OK", HTTPD_RESP_USE_STRLEN);
+}
+
+static esp_err_t serve_post_api_generator(httpd_req_t *req) {
+  // Read the query parameters.
+  char query[256] = "";
+  char action[16] = "";
+  char rate_buf[16] = "";
+  char count_buf[16] = "";
+  char ids_buf[16] = "increment";
+  char id_buf[24] = "";
+  char extended_buf[8] = "";
+  char dlc_buf[8] = "";
+  char data_buf[16] = "counter";
+  if (httpd_req_get_url_query_len(req) < sizeof(query) &&
+      httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+    httpd_query_key_value(query, "action", action, sizeof(action));
+    httpd_query_key_value(query, "rate", rate_buf, sizeof(rate_buf));
+    httpd_query_key_value(query, "count", count_buf, sizeof(count_buf));
+    httpd_query_key_value(query, "ids", ids_buf, sizeof(ids_buf));
+    httpd_query_key_value(query, "id", id_buf, sizeof(id_buf));
+    httpd_query_key_value(query, "extended", extended_buf,
+                          sizeof(extended_buf));
+    httpd_query_key_value(query, "dlc", dlc_buf, sizeof(dlc_buf));
+    httpd_query_key_value(query, "data", data_buf, sizeof(data_buf));
+  }
+
+  if (strcmp(action, "stop") == 0) {
+    traffic_gen_stop();
+    return httpd_resp_send(req, "OK", HTTPD_RESP_USE_STRLEN);
+  } else if (strcmp(action, "start") != 0) {
+    return httpd_resp_send_err(req, 400, "action must be start or stop.");
+  }
+
+  // By default, as fast as possible, with all standard IDs,
+  // 8 data bytes and a counter in them.
+  traffic_gen_options_t options = {
+      .rate = strtoul(rate_buf, NULL, 10),
+      .count = strtoul(count_buf, NULL, 10),
+      .id_min = 0,
+      .id_max = 0x7FF,
+      .extd = strcmp(extended_buf, "1") == 0 ||
+              strcasecmp(extended_buf, "true") == 0,
+      .dlc = 8,
+      .random_dlc = false,
+  };
+  if (traffic_gen_ids_from_name(ids_buf, &options.ids) != ESP_OK) {
+    return httpd_resp_send_err(req, 400,
+                               "ids must be fixed, increment or random.");
+  }
+  if (traffic_gen_data_from_name(data_buf, &options.data) != ESP_OK) {
+    return httpd_resp_send_err(req, 400,
+                               "data must be zero, counter or random.");
+  }
+  if (options.extd) {
+    options.id_max = 0x1FFFFFFF;
+  }
+
+  // `id` is a hex ID, or a range like `100-1FF`.
+  if (id_buf[0] != '\0') {
+    char *end;
+    options.id_min = strtoul(id_buf, &end, 16);
+    options.id_max = options.id_min;
+    if (*end == '-') {
+      options.id_max = strtoul(end + 1, &end, 16);
+    }
+    if (*end != '\0') {
+      return httpd_resp_send_err(req, 400, "id must be hex, or a range.");
+    }
+  }
+
+  if (strcmp(dlc_buf, "random") == 0) {
+    options.random_dlc = true;
+  } else if (dlc_buf[0] != '\0') {
+    options.dlc = strtoul(dlc_buf, NULL, 10);
+  }
+
+  esp_err_t err = traffic_gen_run(&options);
+  if (err == ESP_ERR_INVALID_ARG) {
+    return httpd_resp_send_err(req, 400, "Invalid rate, id or dlc.");
+  }
+  if (err != ESP_OK) {
+    return httpd_resp_send_err(req, 500, "Generator isn't running.");
+  }
+  return httpd_resp_send(req, "OK", HTTPD_RESP_USE_STRLEN);
+}
+
+static esp_err_t serve_get_api_signals(httpd_req_t *req) {
+  static char json[SIGNAL_DECODER_VALUES_LEN];
+  esp_err_t err = signal_decoder_values_json(json, sizeof(json));
+  if (err != ESP_OK) {
+    return httpd_resp_send_err(req, 500, "Couldn't get signal values.");
+  }
+
+  err = httpd_resp_set_type(req, "application/json");
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't set response type.");
+  return httpd_resp_send(req, json, HTTPD_RESP_USE_STRLEN);
+}
+
+static esp_err_t serve_post_api_signals(httpd_req_t *req) {
+  esp_err_t err = signal_decoder_load_begin();
+  if (err != ESP_OK) {
+    return httpd_resp_send_err(req, 500, "Signal decoder isn't running.");
+  }
+
+  char buf[512];
+  size_t remaining = req->content_len;
+  while (remaining > 0 && err == ESP_OK) {
+    size_t len = remaining < sizeof(buf) ? remaining : sizeof(buf);
+    int received = httpd_req_recv(req, buf, len);
+    if (received == HTTPD_SOCK_ERR_TIMEOUT) {
+      continue;
+    }
+    if (received <= 0) {
+      ESP_LOGE(TAG, "Couldn't receive signal table.");
+      return ESP_FAIL;
+    }
+    remaining -= received;
+    err = signal_decoder_load_data(buf, received);
+  }
+  if (err == ESP_OK) {
+    err = signal_decoder_load_end();
+  }
+
+  if (err == ESP_ERR_NO_MEM) {
+    return httpd_resp_send_err(req, 400, "Too many signals or messages.");
+  }
+  if (err != ESP_OK) {
+    return httpd_resp_send_err(req, 400, "The signal table is malformed.");
+  }
+
+  signal_decoder_status_t decoder_status;
+  err = signal_decoder_get_status(&decoder_status);
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't get signal decoder status.");
+
+  err = httpd_resp_set_type(req, "application/json");
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't set response type.");
+  char response[64];
+  snprintf(response, sizeof(response), "{\"signals\": %d, \"messages\": %d}",
+           decoder_status.signals, decoder_status.messages);
+  return httpd_resp_send(req, response, HTTPD_RESP_USE_STRLEN);
+}
+
+static esp_err_t serve_api_signals_ws(httpd_req_t *req) {
+  if (req->method == HTTP_GET) {
+    // The handshake is done. Forget clients that are gone, whose
+    // socket may be this one, and take a free slot.
+    int fd = httpd_req_to_sockfd(req);
+
+    // Updates are sent from the HTTP server task, so a client that
+    // stops reading mustn't stall it for the server's usual timeout.
+    struct timeval send_timeout = {
+        .tv_sec = 0,
+        .tv_usec = SIGNAL_WS_SEND_TIMEOUT_MS * 1000,
+    };
+    if (setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &send_timeout,
+                   sizeof(send_timeout)) != 0) {
+      ESP_LOGE(TAG, "Unable to set SO_SNDTIMEO on socket: errno %d", errno);
+      return ESP_FAIL;
+    }
+
+    for (int i = 0; i < SIGNAL_WS_CLIENTS_MAX; i++) {
+      if (signal_ws_fds[i] >= 0 &&
+          (signal_ws_fds[i] == fd ||
+           httpd_ws_get_fd_info(server, signal_ws_fds[i]) !=
+               HTTPD_WS_CLIENT_WEBSOCKET)) {
+        signal_ws_fds[i] = -1;
+        atomic_fetch_sub(&signal_ws_client_count, 1);
+      }
+    }
+    for (int i = 0; i < SIGNAL_WS_CLIENTS_MAX; i++) {
+      if (signal_ws_fds[i] < 0) {
+        signal_ws_fds[i] = fd;
+        atomic_fetch_add(&signal_ws_client_count, 1);
+        // Send the new client every value, not just the changes.
+        signal_decoder_publish_all();
+        return ESP_OK;
+      }
+    }
+    ESP_LOGW(TAG, "Too many signal WebSocket clients.");
+    return ESP_FAIL;
+  }
+
+  // Clients have nothing to say. Read their frames, and ignore them.
+  uint8_t payload[32];
+  httpd_ws_frame_t frame = {0};
+  esp_err_t err = httpd_ws_recv_frame(req, &frame, 0);
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't receive WebSocket frame.");
+  if (frame.len > sizeof(payload)) {
+    return ESP_FAIL;
+  }
+  frame.payload = payload;
+  return httpd_ws_recv_frame(req, &frame, frame.len);
+}
+
+static esp_err_t publish_signal_update(const char *update) {
+  // Values count as published while nobody listens. New clients get
+  // all of them anyway.
+  if (atomic_load(&signal_ws_client_count) == 0) {
+    return ESP_OK;
+  }
+  // Slow clients hold the values back, instead of having them queue up.
+  if (atomic_load(&signal_update_pending)) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  snprintf(signal_update, sizeof(signal_update), "%s", update);
+  atomic_store(&signal_update_pending, true);
+  esp_err_t err = httpd_queue_work(server, send_signal_update, NULL);
+  if (err != ESP_OK) {
+    atomic_store(&signal_update_pending, false);
+    return ESP_ERR_INVALID_STATE;
+  }
+  return ESP_OK;
+}
+
+static void send_signal_update(void *arg) {
+  httpd_ws_frame_t frame = {
+      .final = true,
+      .fragmented = false,
+      .type = HTTPD_WS_TYPE_TEXT,
+      .payload = (uint8_t *)signal_update,
+      .len = strlen(signal_update),
+  };
+  for (int i = 0; i < SIGNAL_WS_CLIENTS_MAX; i++) {
+    int fd = signal_ws_fds[i];
+    if (fd < 0) {
+      continue;
+    }
+    if (httpd_ws_get_fd_info(server, fd) != HTTPD_WS_CLIENT_WEBSOCKET) {
+      signal_ws_fds[i] = -1;
+      atomic_fetch_sub(&signal_ws_client_count, 1);
+    } else if (httpd_ws_send_frame_async(server, fd, &frame) != ESP_OK) {
+      // Too slow, or gone. A frame may have been cut off midway,
+      // so the connection can't be used anymore.
+      signal_ws_fds[i] = -1;
+      atomic_fetch_sub(&signal_ws_client_count, 1);
+      httpd_sess_trigger_close(server, fd);
+    }
+  }
+  atomic_store(&signal_update_pending, false);
+}
+
+static esp_err_t serve_post_api_autobaud(httpd_req_t *req) {
+  esp_err_t err = httpd_resp_set_type(req, "application/json");
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't set response type.");
+
+  int64_t start_us = esp_timer_get_time();
+  enum can_bitrate_setting bitrate = 0;
+  esp_err_t autobaud_err = can_autobaud_run(&bitrate);
+  int64_t duration_ms = (esp_timer_get_time() - start_us) / 1000;
+
+  char response[128];
+  if (autobaud_err == ESP_OK) {
+    snprintf(response, sizeof(response),
+             "{\"detected\": true, \"can_bitrate\": %d, "
+             "\"duration_ms\": %lld}",
+             bitrate, duration_ms);
+  } else {
+    snprintf(response, sizeof(response),
+             "{\"detected\": false, \"error\": \"%s\", "
+             "\"duration_ms\": %lld}",
+             esp_err_to_name(autobaud_err), duration_ms);
+  }
+  return httpd_resp_send(req, response, HTTPD_RESP_USE_STRLEN);
+}
+
 // Temporarily stores the body of
 // the request in `serve_post_api_config()`.
 static char shared_post_buf[2048];
@@ -206,19 +1098,41 @@ static esp_err_t serve_post_api_config(httpd_req_t *req) {
 
   err = persistent_settings_save(&new_persistent_settings);
 
-  if (err == ESP_OK) {
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Couldn't save persistent settings.");
+    err = httpd_resp_send_err(
+        req, 500, "Internal error: Couldn't save persistent settings.");
+    return err;
+  }
+
+  if (settings_apply_needs_reboot(persistent_settings,
+                                  &new_persistent_settings)) {
     err = httpd_resp_send(req, "Updating settings and restarting adapter...",
                           HTTPD_RESP_USE_STRLEN);
     ESP_LOGI(TAG, "Restarting ESP32 to enact updated settings.");
     esp_restart();
     return err;
+  }
 
-  } else {
-    ESP_LOGE(TAG, "Couldn't save persistent settings.");
-    err = httpd_resp_send_err(
-        req, 500, "Internal error: Couldn't save persistent settings.");
-    return err;
+  // Keep a copy of the old settings,
+  // because reloading overwrites `persistent_settings`.
+  persistent_settings_t old_persistent_settings = *persistent_settings;
+  err = persistent_settings_load();
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't reload persistent settings.");
+
+  // Respond before applying, in case the
+  // request came in over an interface that gets reconfigured.
+  esp_err_t http_err = httpd_resp_send(
+      req, "Applied settings without restarting adapter.",
+      HTTPD_RESP_USE_STRLEN);
+
+  err = settings_apply(&old_persistent_settings, persistent_settings);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Couldn't apply all updated settings: %s",
+             esp_err_to_name(err));
   }
+
+  return http_err;
 }
 
 static esp_err_t update_persistent_settings_from_json(
@@ -412,5 +1326,333 @@ static esp_err_t update_persistent_settings_from_json(
     return err;
   }
 
+  // read log_udp_ip field
+  err = httpd_query_key_value(json, "log_udp_ip", arg_buf, sizeof(arg_buf));
+  if (err == ESP_OK) {
+    err = esp_netif_str_to_ip4(arg_buf, &cnf->log_udp_ip);
+    if (err != ESP_OK) {
+      return ESP_FAIL;
+    }
+  } else if (err != ESP_ERR_NOT_FOUND) {
+    return err;
+  }
+
+  // read log_udp_port field
+  err = httpd_query_key_value(json, "log_udp_port", arg_buf, sizeof(arg_buf));
+  if (err == ESP_OK) {
+    uint32_t num = strtol(arg_buf, NULL, 10);
+    if (num > 65535) {
+      return ESP_FAIL;
+    }
+    cnf->log_udp_port = num;
+  } else if (err != ESP_ERR_NOT_FOUND) {
+    return err;
+  }
+
+  // read task_profile field
+  err = httpd_query_key_value(json, "task_profile", arg_buf, sizeof(arg_buf));
+  if (err == ESP_OK) {
+    task_profile_t profile = 0;
+    while (profile < TASK_PROFILE_COUNT &&
+           strcmp(arg_buf, task_config_profile_name(profile)) != 0) {
+      profile++;
+    }
+    if (profile == TASK_PROFILE_COUNT) {
+      return ESP_FAIL;
+    }
+    cnf->task_profile = profile;
+  } else if (err != ESP_ERR_NOT_FOUND) {
+    return err;
+  }
+
+  // read overload_policies field
+  err = httpd_query_key_value(json, "overload_policies", arg_buf,
+                              sizeof(arg_buf));
+  if (err == ESP_OK) {
+    err = overload_control_policies_from_string(arg_buf,
+                                                cnf->overload_policies);
+    if (err != ESP_OK) {
+      return ESP_FAIL;
+    }
+  } else if (err != ESP_ERR_NOT_FOUND) {
+    return err;
+  }
+
+  // read overload_low_priority_id field
+  err = httpd_query_key_value(json, "overload_low_priority_id", arg_buf,
+                              sizeof(arg_buf));
+  if (err == ESP_OK) {
+    uint32_t num = strtol(arg_buf, NULL, 10);
+    if (num > 0x7FF) {
+      return ESP_FAIL;
+    }
+    cnf->overload_low_priority_id = num;
+  } else if (err != ESP_ERR_NOT_FOUND) {
+    return err;
+  }
+
+  // read client_queue_depth field
+  err = httpd_query_key_value(json, "client_queue_depth", arg_buf,
+                              sizeof(arg_buf));
+  if (err == ESP_OK) {
+    uint32_t num = strtol(arg_buf, NULL, 10);
+    if (num < CAN_LISTENER_MIN_DEPTH || num > CAN_LISTENER_FRAME_BUDGET) {
+      return ESP_FAIL;
+    }
+    cnf->client_queue_depth = num;
+  } else if (err != ESP_ERR_NOT_FOUND) {
+    return err;
+  }
+
+  // read client_overflow field
+  err = httpd_query_key_value(json, "client_overflow", arg_buf,
+                              sizeof(arg_buf));
+  if (err == ESP_OK) {
+    can_listener_overflow_t overflow;
+    if (can_listener_overflow_from_name(arg_buf, &overflow) != ESP_OK) {
+      return ESP_FAIL;
+    }
+    cnf->client_overflow = overflow;
+  } else if (err != ESP_ERR_NOT_FOUND) {
+    return err;
+  }
+
+  // read cannelloni_peer_ip field
+  err = httpd_query_key_value(json, "cannelloni_peer_ip", arg_buf,
+                              sizeof(arg_buf));
+  if (err == ESP_OK) {
+    err = esp_netif_str_to_ip4(arg_buf, &cnf->cannelloni_peer_ip);
+    if (err != ESP_OK) {
+      return ESP_FAIL;
+    }
+  } else if (err != ESP_ERR_NOT_FOUND) {
+    return err;
+  }
+
+  // read cannelloni_port field
+  err = httpd_query_key_value(json, "cannelloni_port", arg_buf,
+                              sizeof(arg_buf));
+  if (err == ESP_OK) {
+    uint32_t num = strtol(arg_buf, NULL, 10);
+    if (num > 65535) {
+      return ESP_FAIL;
+    }
+    cnf->cannelloni_port = num;
+  } else if (err != ESP_ERR_NOT_FOUND) {
+    return err;
+  }
+
+  // read cannelloni_timeout_us field
+  err = httpd_query_key_value(json, "cannelloni_timeout_us", arg_buf,
+                              sizeof(arg_buf));
+  if (err == ESP_OK) {
+    uint32_t num = strtol(arg_buf, NULL, 10);
+    // Up to one second, so frames don't wait longer than clients would.
+    if (num < 100 || num > 1000000) {
+      return ESP_FAIL;
+    }
+    cnf->cannelloni_timeout_us = num;
+  } else if (err != ESP_ERR_NOT_FOUND) {
+    return err;
+  }
+
+  // read cannelloni_mtu field
+  err = httpd_query_key_value(json, "cannelloni_mtu", arg_buf,
+                              sizeof(arg_buf));
+  if (err == ESP_OK) {
+    uint32_t num = strtol(arg_buf, NULL, 10);
+    if (num < CANNELLONI_MTU_MIN || num > CANNELLONI_MTU_MAX) {
+      return ESP_FAIL;
+    }
+    cnf->cannelloni_mtu = num;
+  } else if (err != ESP_ERR_NOT_FOUND) {
+    return err;
+  }
+
+  // read multicast_group field
+  err = httpd_query_key_value(json, "multicast_group", arg_buf,
+                              sizeof(arg_buf));
+  if (err == ESP_OK) {
+    err = esp_netif_str_to_ip4(arg_buf, &cnf->multicast_group);
+    if (err != ESP_OK || !IN_MULTICAST(ntohl(cnf->multicast_group.addr))) {
+      return ESP_FAIL;
+    }
+  } else if (err != ESP_ERR_NOT_FOUND) {
+    return err;
+  }
+
+  // read multicast_port field
+  err = httpd_query_key_value(json, "multicast_port", arg_buf,
+                              sizeof(arg_buf));
+  if (err == ESP_OK) {
+    uint32_t num = strtol(arg_buf, NULL, 10);
+    if (num > 65535) {
+      return ESP_FAIL;
+    }
+    cnf->multicast_port = num;
+  } else if (err != ESP_ERR_NOT_FOUND) {
+    return err;
+  }
+
+  // read bridge_peer_ip field
+  err = httpd_query_key_value(json, "bridge_peer_ip", arg_buf,
+                              sizeof(arg_buf));
+  if (err == ESP_OK) {
+    err = esp_netif_str_to_ip4(arg_buf, &cnf->bridge_peer_ip);
+    if (err != ESP_OK) {
+      return ESP_FAIL;
+    }
+  } else if (err != ESP_ERR_NOT_FOUND) {
+    return err;
+  }
+
+  // read bridge_port field
+  err = httpd_query_key_value(json, "bridge_port", arg_buf, sizeof(arg_buf));
+  if (err == ESP_OK) {
+    uint32_t num = strtol(arg_buf, NULL, 10);
+    if (num > 65535) {
+      return ESP_FAIL;
+    }
+    cnf->bridge_port = num;
+  } else if (err != ESP_ERR_NOT_FOUND) {
+    return err;
+  }
+
+  // read bridge_rules field, which is longer than `arg_buf`
+  // and contains characters that are form-encoded.
+  // Too large for the stack. Only used while holding `post_buf_mutex`.
+  static char rules_buf[3 * sizeof(cnf->bridge_rules)];
+  err = httpd_query_key_value(json, "bridge_rules", rules_buf,
+                              sizeof(rules_buf));
+  if (err == ESP_OK) {
+    can_bridge_rules_t rules;
+    if (form_decode(rules_buf) != ESP_OK ||
+        strlen(rules_buf) >= sizeof(cnf->bridge_rules) ||
+        can_bridge_parse_rules(rules_buf, &rules) != ESP_OK) {
+      return ESP_FAIL;
+    }
+    memcpy(cnf->bridge_rules, rules_buf, sizeof(cnf->bridge_rules));
+  } else if (err != ESP_ERR_NOT_FOUND) {
+    return err;
+  }
+
+  // read capture_triggers field, which is longer than `arg_buf`
+  // and mostly made of characters that are form-encoded.
+  // Too large for the stack. Only used while holding `post_buf_mutex`.
+  static char triggers_buf[3 * sizeof(cnf->capture_triggers)];
+  err = httpd_query_key_value(json, "capture_triggers", triggers_buf,
+                              sizeof(triggers_buf));
+  if (err == ESP_OK) {
+    capture_triggers_t triggers;
+    if (form_decode(triggers_buf) != ESP_OK ||
+        strlen(triggers_buf) >= sizeof(cnf->capture_triggers) ||
+        capture_trigger_parse(triggers_buf, &triggers) != ESP_OK) {
+      return ESP_FAIL;
+    }
+    memcpy(cnf->capture_triggers, triggers_buf,
+           sizeof(cnf->capture_triggers));
+  } else if (err != ESP_ERR_NOT_FOUND) {
+    return err;
+  }
+
+  // read replay_buffer_kb field
+  err = httpd_query_key_value(json, "replay_buffer_kb", arg_buf,
+                              sizeof(arg_buf));
+  if (err == ESP_OK) {
+    uint32_t num = strtol(arg_buf, NULL, 10);
+    if (num > CAN_REPLAY_BUFFER_KB_MAX) {
+      return ESP_FAIL;
+    }
+    cnf->replay_buffer_kb = num;
+  } else if (err != ESP_ERR_NOT_FOUND) {
+    return err;
+  }
+
+  // read reflex_rules field, which is longer than `arg_buf`
+  // and mostly made of characters that are form-encoded.
+  // Too large for the stack. Only used while holding `post_buf_mutex`.
+  static char reflex_buf[3 * sizeof(cnf->reflex_rules)];
+  static reflex_rules_t reflex_rules;
+  err = httpd_query_key_value(json, "reflex_rules", reflex_buf,
+                              sizeof(reflex_buf));
+  if (err == ESP_OK) {
+    if (form_decode(reflex_buf) != ESP_OK ||
+        strlen(reflex_buf) >= sizeof(cnf->reflex_rules) ||
+        reflex_rules_parse(reflex_buf, &reflex_rules) != ESP_OK) {
+      return ESP_FAIL;
+    }
+    memcpy(cnf->reflex_rules, reflex_buf, sizeof(cnf->reflex_rules));
+  } else if (err != ESP_ERR_NOT_FOUND) {
+    return err;
+  }
+
+  // read tx_rate_limits field, which is longer than `arg_buf`
+  // and mostly made of characters that are form-encoded.
+  // Too large for the stack. Only used while holding `post_buf_mutex`.
+  static char limits_buf[3 * sizeof(cnf->tx_rate_limits)];
+  err = httpd_query_key_value(json, "tx_rate_limits", limits_buf,
+                              sizeof(limits_buf));
+  if (err == ESP_OK) {
+    tx_rate_limits_t limits;
+    if (form_decode(limits_buf) != ESP_OK ||
+        strlen(limits_buf) >= sizeof(cnf->tx_rate_limits) ||
+        tx_rate_limit_parse(limits_buf, &limits) != ESP_OK) {
+      return ESP_FAIL;
+    }
+    memcpy(cnf->tx_rate_limits, limits_buf, sizeof(cnf->tx_rate_limits));
+  } else if (err != ESP_ERR_NOT_FOUND) {
+    return err;
+  }
+
+  // read gateway_rules field, which is longer than `arg_buf`
+  // and mostly made of characters that are form-encoded.
+  // Too large for the stack. Only used while holding `post_buf_mutex`.
+  static char gateway_buf[3 * sizeof(cnf->gateway_rules)];
+  static can_gateway_rules_t gateway_rules;
+  err = httpd_query_key_value(json, "gateway_rules", gateway_buf,
+                              sizeof(gateway_buf));
+  if (err == ESP_OK) {
+    if (form_decode(gateway_buf) != ESP_OK ||
+        strlen(gateway_buf) >= sizeof(cnf->gateway_rules) ||
+        can_gateway_parse(gateway_buf, &gateway_rules) != ESP_OK) {
+      return ESP_FAIL;
+    }
+    memcpy(cnf->gateway_rules, gateway_buf, sizeof(cnf->gateway_rules));
+  } else if (err != ESP_ERR_NOT_FOUND) {
+    return err;
+  }
+
+  // read socketcand_fast_path field
+  err = httpd_query_key_value(json, "socketcand_fast_path", arg_buf,
+                              sizeof(arg_buf));
+  if (err == ESP_OK) {
+    if (strncasecmp(arg_buf, "true", 4) == 0)
+      cnf->socketcand_fast_path = true;
+    else
+      cnf->socketcand_fast_path = false;
+  } else if (err != ESP_ERR_NOT_FOUND) {
+    return err;
+  }
+
   return ESP_OK;
-}
\ No newline at end of file
+}
+
+static esp_err_t form_decode(char *text) {
+  char *out = text;
+  for (const char *in = text; *in != '\0'; in++) {
+    if (*in == '+') {
+      *out++ = ' ';
+    } else if (*in == '%') {
+      if (!isxdigit((unsigned char)in[1]) || !isxdigit((unsigned char)in[2])) {
+        return ESP_FAIL;
+      }
+      char hex[3] = {in[1], in[2], '\0'};
+      *out++ = strtol(hex, NULL, 16);
+      in += 2;
+    } else {
+      *out++ = *in;
+    }
+  }
+  *out = '\0';
+  return ESP_OK;
+}
@@ -0,0 +1,113 @@
+#include "id_match_table.h"
+
+#include <stdbool.h>
+
+// Returns whether `a` goes before `b`: by the group of their mask,
+// then by ID, then in the order they were added.
+static bool entry_before(const id_match_table_t *table,
+                         const id_match_entry_t *a, const id_match_entry_t *b);
+
+// Returns the index of `mask` in the `masks` of `table`,
+// or `mask_count` if it isn't there.
+static uint8_t mask_index(const id_match_table_t *table, uint32_t mask);
+
+void id_match_table_init(id_match_table_t *table) {
+  table->entry_count = 0;
+  table->mask_count = 0;
+  table->group_start[0] = 0;
+}
+
+esp_err_t id_match_table_add(id_match_table_t *table, uint32_t id,
+                             uint32_t mask, uint16_t value) {
+  if (table->entry_count >= ID_MATCH_TABLE_ENTRIES_MAX) {
+    return ESP_ERR_NO_MEM;
+  }
+
+  if (mask_index(table, mask) == table->mask_count) {
+    if (table->mask_count >= ID_MATCH_TABLE_MASKS_MAX) {
+      return ESP_ERR_NO_MEM;
+    }
+    table->masks[table->mask_count] = mask;
+    table->mask_count += 1;
+  }
+
+  table->entries[table->entry_count] = (id_match_entry_t){
+      .mask = mask,
+      .id = id & mask,
+      .value = value,
+  };
+  table->entry_count += 1;
+  return ESP_OK;
+}
+
+void id_match_table_compile(id_match_table_t *table) {
+  // Insertion sort, as tables are small and only compiled at startup.
+  for (uint16_t i = 1; i < table->entry_count; i++) {
+    id_match_entry_t entry = table->entries[i];
+    uint16_t j = i;
+    while (j > 0 && entry_before(table, &entry, &table->entries[j - 1])) {
+      table->entries[j] = table->entries[j - 1];
+      j--;
+    }
+    table->entries[j] = entry;
+  }
+
+  uint16_t entry = 0;
+  for (uint8_t group = 0; group < table->mask_count; group++) {
+    table->group_start[group] = entry;
+    while (entry < table->entry_count &&
+           table->entries[entry].mask == table->masks[group]) {
+      entry++;
+    }
+  }
+  table->group_start[table->mask_count] = entry;
+}
+
+uint16_t id_match_table_lookup(const id_match_table_t *table, uint32_t id,
+                               uint16_t *values_out, uint16_t max_values) {
+  uint16_t found = 0;
+  for (uint8_t group = 0; group < table->mask_count; group++) {
+    uint32_t masked = id & table->masks[group];
+
+    // Find the first entry of the group with an ID of at least `masked`.
+    uint16_t low = table->group_start[group];
+    uint16_t high = table->group_start[group + 1];
+    while (low < high) {
+      uint16_t middle = low + (high - low) / 2;
+      if (table->entries[middle].id < masked) {
+        low = middle + 1;
+      } else {
+        high = middle;
+      }
+    }
+
+    for (; low < table->group_start[group + 1] &&
+           table->entries[low].id == masked && found < max_values;
+         low++) {
+      values_out[found] = table->entries[low].value;
+      found++;
+    }
+  }
+  return found;
+}
+
+static bool entry_before(const id_match_table_t *table,
+                         const id_match_entry_t *a, const id_match_entry_t *b) {
+  uint8_t group_a = mask_index(table, a->mask);
+  uint8_t group_b = mask_index(table, b->mask);
+  if (group_a != group_b) {
+    return group_a < group_b;
+  }
+  if (a->id != b->id) {
+    return a->id < b->id;
+  }
+  return a->value < b->value;
+}
+
+static uint8_t mask_index(const id_match_table_t *table, uint32_t mask) {
+  uint8_t index = 0;
+  while (index < table->mask_count && table->masks[index] != mask) {
+    index++;
+  }
+  return index;
+}
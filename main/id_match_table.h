@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+// A precompiled table of ID/mask entries, for looking up which of many
+// entries match a CAN ID in a few cycles, from the CAN data path.
+//
+// Entries are grouped by mask, and sorted by their masked ID within
+// each group, so a lookup is one binary search per distinct mask.
+// Tables usually have few distinct masks, as most entries are exact IDs.
+//
+// Build a table with `id_match_table_init()`, `id_match_table_add()`
+// and `id_match_table_compile()`. A compiled table is read-only,
+// so any number of tasks may look up IDs in it.
+
+// Maximum number of entries in a table.
+#define ID_MATCH_TABLE_ENTRIES_MAX 64
+
+// Maximum number of distinct masks in a table.
+#define ID_MATCH_TABLE_MASKS_MAX 8
+
+typedef struct {
+  uint32_t mask;
+
+  // The ID, with only the bits in `mask`.
+  uint32_t id;
+
+  // What the owner of the table stores for this entry,
+  // like the index of a rule.
+  uint16_t value;
+} id_match_entry_t;
+
+typedef struct {
+  // Entries sorted by group, then ID.
+  id_match_entry_t entries[ID_MATCH_TABLE_ENTRIES_MAX];
+  uint16_t entry_count;
+
+  // Entries with `masks[i]` are `group_start[i]` up to `group_start[i + 1]`.
+  uint32_t masks[ID_MATCH_TABLE_MASKS_MAX];
+  uint16_t group_start[ID_MATCH_TABLE_MASKS_MAX + 1];
+  uint8_t mask_count;
+} id_match_table_t;
+
+// Empties `table`.
+void id_match_table_init(id_match_table_t* table);
+
+// Adds an entry matching the IDs that equal `id` in the bits set
+// in `mask`, storing `value` for it.
+// Returns `ESP_ERR_NO_MEM` if `table` is full,
+// or if it would have too many distinct masks.
+esp_err_t id_match_table_add(id_match_table_t* table, uint32_t id,
+                             uint32_t mask, uint16_t value);
+
+// Sorts the entries of `table` for lookup.
+// Must be called after the last `id_match_table_add()`.
+void id_match_table_compile(id_match_table_t* table);
+
+// Writes the values of up to `max_values` entries matching `id`
+// to `values_out`, in no particular order.
+// Returns the number of values written.
+uint16_t id_match_table_lookup(const id_match_table_t* table, uint32_t id,
+                               uint16_t* values_out, uint16_t max_values);
@@ -1,17 +1,37 @@
+#include "boot_timeline.h"
+#include "can_bridge.h"
+#include "can_gateway.h"
 #include "can_listener.h"
+#include "can_replay.h"
+#include "cannelloni.h"
+#include "capture_ring.h"
+#include "capture_trigger.h"
 #include "cyphal_node.h"
+#include "deferred_log.h"
 #include "discovery_beacon.h"
 #include "driver_setup.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "http_server.h"
+#include "multicast_publisher.h"
+#include "overload_control.h"
 #include "persistent_settings.h"
+#include "reflex_rules.h"
+#include "signal_decoder.h"
 #include "socketcand_server.h"
 #include "status_report.h"
+#include "task_config.h"
+#include "traffic_gen.h"
+#include "tx_rate_limit.h"
+#include "tx_scheduler.h"
 
 // Name that will be used for logging
 static const char* TAG = "main";
 
 void app_main(void) {
+  // Start recording boot phase timings.
+  ESP_ERROR_CHECK(boot_timeline_init());
+
   // Create an event loop.
   ESP_ERROR_CHECK(esp_event_loop_create_default());
 
@@ -37,44 +57,21 @@ void app_main(void) {
   esp_err_t err;
   const esp_netif_ip_info_t* ip_info_setting;
 
-  // start wifi driver if enabled
-  if (persistent_settings->wifi_enabled) {
-    // Enable or disable DHCP
-    if (persistent_settings->wifi_use_dhcp) {
-      ip_info_setting = NULL;
-    } else {
-      ip_info_setting = &persistent_settings->wifi_ip_info;
-    }
-
-    err = driver_setup_wifi(ip_info_setting, persistent_settings->hostname,
-                            persistent_settings->wifi_ssid,
-                            persistent_settings->wifi_pass);
-
-    if (err != ESP_OK) {
-      ESP_LOGE(TAG, "CRITICAL: Couldn't start WIFI driver: %s",
-               esp_err_to_name(err));
-    }
-  }
-
-  // Ethernet driver setup will fail unless the ethernet hardware
-  // accquires a clock signal, which takes a few milliseconds.
-  vTaskDelay(pdMS_TO_TICKS(200));
-
-  // Enable or disable DHCP
-  if (persistent_settings->eth_use_dhcp) {
-    ip_info_setting = NULL;
-  } else {
-    ip_info_setting = &persistent_settings->eth_ip_info;
-  }
-
-  // Start ethernet driver
-  err = driver_setup_ethernet(ip_info_setting, persistent_settings->hostname);
+  // Select task priorities and cores before any task is created.
+  task_config_set_profile(persistent_settings->task_profile);
 
+  // Start the task that emits hot-path log summaries,
+  // and redirect logs to UDP if configured.
+  err = deferred_log_start(&persistent_settings->log_udp_ip,
+                           persistent_settings->log_udp_port);
   if (err != ESP_OK) {
-    ESP_LOGE(TAG, "CRITICAL: Couldn't start ethernet driver: %s",
+    ESP_LOGE(TAG, "CRITICAL: Couldn't start deferred logging: %s",
              esp_err_to_name(err));
   }
 
+  // Start CAN first, so that no bus traffic is missed
+  // while the network interfaces come up.
+
   // Get the CAN bus timing configuration
   twai_timing_config_t timing_config;
   err = persistent_settings_get_timing_config(persistent_settings->can_bitrate,
@@ -92,6 +89,8 @@ void app_main(void) {
   if (err != ESP_OK) {
     ESP_LOGE(TAG, "CRITICAL: Couldn't start CAN driver: %s",
              esp_err_to_name(err));
+  } else {
+    boot_timeline_mark(BOOT_PHASE_CAN_STARTED);
   }
 
   // Start the task that will listen for incoming CAN messages.
@@ -100,20 +99,141 @@ void app_main(void) {
   if (err != ESP_OK) {
     ESP_LOGE(TAG, "CRITICAL: Couldn't start CAN listener: %s",
              esp_err_to_name(err));
+  } else {
+    boot_timeline_mark(BOOT_PHASE_CAN_LISTENER_STARTED);
   }
 
+  // Start shedding load before queues overflow.
+  overload_control_configure(persistent_settings->overload_policies,
+                             persistent_settings->overload_low_priority_id);
+  err = overload_control_start();
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Couldn't start overload control: %s", esp_err_to_name(err));
+  }
+
+  // Start transmitting frames that clients schedule with `< sendat >`.
+  err = tx_scheduler_start();
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Couldn't start TX scheduler: %s", esp_err_to_name(err));
+  }
+
+  // Start the traffic generator, idle until started over HTTP.
+  err = traffic_gen_start();
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Couldn't start traffic generator: %s",
+             esp_err_to_name(err));
+  }
+
+  // Start the signal decoder, idle until a table is uploaded over HTTP.
+  err = signal_decoder_start();
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Couldn't start signal decoder: %s", esp_err_to_name(err));
+  }
+
+  // Answer requests with reflex rules, which may use the TX scheduler.
+  // Too large for the stack.
+  static reflex_rules_t reflex_rules;
+  err = reflex_rules_parse(persistent_settings->reflex_rules, &reflex_rules);
+  if (err == ESP_OK) {
+    err = reflex_rules_configure(&reflex_rules);
+  }
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Couldn't configure reflex rules: %s", esp_err_to_name(err));
+  }
+
+  // Limit what socketcand clients transmit, before they connect.
+  tx_rate_limits_t tx_rate_limits;
+  err = tx_rate_limit_parse(persistent_settings->tx_rate_limits,
+                            &tx_rate_limits);
+  if (err == ESP_OK) {
+    err = tx_rate_limit_configure(&tx_rate_limits);
+  }
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Couldn't configure TX rate limits: %s",
+             esp_err_to_name(err));
+  }
+
+  // Route the frames of socketcand clients, before they connect.
+  // Too large for the stack.
+  static can_gateway_rules_t gateway_rules;
+  err = can_gateway_parse(persistent_settings->gateway_rules, &gateway_rules);
+  if (err == ESP_OK) {
+    err = can_gateway_configure(&gateway_rules);
+  }
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Couldn't configure gateway rules: %s",
+             esp_err_to_name(err));
+  }
+
+  // Start the OpenCyphal node.
+  if (persistent_settings->enable_cyphal) {
+    err = cyphal_node_start(persistent_settings->cyphal_node_id);
+    if (err != ESP_OK) {
+      ESP_LOGE(TAG, "CRITICAL: Couldn't start OpenCyphal node: %s",
+               esp_err_to_name(err));
+    }
+  }
+
+  // The servers listen on all interfaces, so they can be started before
+  // any interface is up. They accept connections as soon as
+  // an interface gets an IP address.
+
   // start HTTP server used for configuring stuff
   err = start_http_server();
   if (err != ESP_OK) {
     ESP_LOGE(TAG, "CRITICAL: Couldn't start HTTP server: %s",
              esp_err_to_name(err));
+  } else {
+    boot_timeline_mark(BOOT_PHASE_HTTP_SERVER_STARTED);
   }
 
   // Start the socketcand translation server
+  socketcand_server_set_fast_path(persistent_settings->socketcand_fast_path);
+  socketcand_server_set_client_defaults(persistent_settings->client_queue_depth,
+                                        persistent_settings->client_overflow);
   err = socketcand_server_start();
   if (err != ESP_OK) {
     ESP_LOGE(TAG, "CRITICAL: Couldn't start socketcand server: %s",
              esp_err_to_name(err));
+  } else {
+    boot_timeline_mark(BOOT_PHASE_SOCKETCAND_SERVER_STARTED);
+  }
+
+  // Start the cannelloni transport if enabled
+  if (persistent_settings->cannelloni_port != 0) {
+    err = cannelloni_start(&persistent_settings->cannelloni_peer_ip,
+                           persistent_settings->cannelloni_port,
+                           persistent_settings->cannelloni_timeout_us,
+                           persistent_settings->cannelloni_mtu);
+    if (err != ESP_OK) {
+      ESP_LOGE(TAG, "CRITICAL: Couldn't start cannelloni: %s",
+               esp_err_to_name(err));
+    }
+  }
+
+  // Start the multicast publisher if enabled
+  if (persistent_settings->multicast_port != 0) {
+    err = multicast_publisher_start(&persistent_settings->multicast_group,
+                                    persistent_settings->multicast_port);
+    if (err != ESP_OK) {
+      ESP_LOGE(TAG, "CRITICAL: Couldn't start multicast publisher: %s",
+               esp_err_to_name(err));
+    }
+  }
+
+  // Start the bridge to another adapter if enabled
+  if (persistent_settings->bridge_port != 0) {
+    can_bridge_rules_t bridge_rules;
+    err = can_bridge_parse_rules(persistent_settings->bridge_rules,
+                                 &bridge_rules);
+    if (err == ESP_OK) {
+      err = can_bridge_start(&persistent_settings->bridge_peer_ip,
+                             persistent_settings->bridge_port, &bridge_rules);
+    }
+    if (err != ESP_OK) {
+      ESP_LOGE(TAG, "CRITICAL: Couldn't start CAN bridge: %s",
+               esp_err_to_name(err));
+    }
   }
 
   // start the UDP beacon
@@ -123,18 +243,86 @@ void app_main(void) {
              esp_err_to_name(err));
   }
 
-  // Start the OpenCyphal node.
-  if (persistent_settings->enable_cyphal) {
-    err = cyphal_node_start(persistent_settings->cyphal_node_id);
+  // Start the network interfaces. Neither of these waits for
+  // a connection, so both come up in parallel.
+
+  // start wifi driver if enabled
+  if (persistent_settings->wifi_enabled) {
+    // Enable or disable DHCP
+    if (persistent_settings->wifi_use_dhcp) {
+      ip_info_setting = NULL;
+    } else {
+      ip_info_setting = &persistent_settings->wifi_ip_info;
+    }
+
+    err = driver_setup_wifi(ip_info_setting, persistent_settings->hostname,
+                            persistent_settings->wifi_ssid,
+                            persistent_settings->wifi_pass);
+
     if (err != ESP_OK) {
-      ESP_LOGE(TAG, "CRITICAL: Couldn't start OpenCyphal node: %s",
+      ESP_LOGE(TAG, "CRITICAL: Couldn't start WIFI driver: %s",
                esp_err_to_name(err));
     }
   }
 
-  // Log network status after giving some time
-  // for connections to establish.
-  vTaskDelay(pdMS_TO_TICKS(10000));
+  // Ethernet driver setup will fail unless the ethernet hardware
+  // accquires a clock signal, which takes a few milliseconds.
+  // Usually that time has already passed while starting everything else.
+  int64_t eth_clock_ready_us = 200000;
+  if (esp_timer_get_time() < eth_clock_ready_us) {
+    vTaskDelay(pdMS_TO_TICKS(
+        (eth_clock_ready_us - esp_timer_get_time()) / 1000 + 1));
+  }
+
+  // Enable or disable DHCP
+  if (persistent_settings->eth_use_dhcp) {
+    ip_info_setting = NULL;
+  } else {
+    ip_info_setting = &persistent_settings->eth_ip_info;
+  }
+
+  // Start ethernet driver
+  err = driver_setup_ethernet(ip_info_setting, persistent_settings->hostname);
+
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "CRITICAL: Couldn't start ethernet driver: %s",
+             esp_err_to_name(err));
+  }
+
+  // Arm the capture triggers if any, before the capture ring
+  // takes the heap their snapshots need.
+  if (persistent_settings->capture_triggers[0] != '\0') {
+    capture_triggers_t capture_triggers;
+    err = capture_trigger_parse(persistent_settings->capture_triggers,
+                                &capture_triggers);
+    if (err == ESP_OK) {
+      err = capture_trigger_start(&capture_triggers);
+    }
+    if (err != ESP_OK) {
+      ESP_LOGE(TAG, "Couldn't arm capture triggers: %s", esp_err_to_name(err));
+    }
+  }
+
+  // Reserve the replay buffer if enabled, also before the capture ring.
+  if (persistent_settings->replay_buffer_kb != 0) {
+    err = can_replay_start(persistent_settings->replay_buffer_kb);
+    if (err != ESP_OK) {
+      ESP_LOGE(TAG, "Couldn't start replay: %s", esp_err_to_name(err));
+    }
+  }
+
+  // Give the heap that's left to the capture ring,
+  // now that everything else has allocated what it needs at boot.
+  err = capture_ring_start();
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Couldn't start capture ring: %s", esp_err_to_name(err));
+  }
+
+  // Log network status once an interface is up,
+  // or after giving up on waiting for one.
+  if (!driver_setup_wait_for_ip(pdMS_TO_TICKS(10000))) {
+    ESP_LOGE(TAG, "No network interface got an IP address in 10 seconds.");
+  }
   const char* json_status;
   err = status_report_get(&json_status, driver_setup_eth_netif,
                           driver_setup_wifi_netif);
@@ -0,0 +1,206 @@
+#include "multicast_publisher.h"
+
+#include <string.h>
+
+#include "can_listener.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "lwip/sockets.h"
+#include "task_config.h"
+
+// Size of a frame without its data.
+#define FRAME_HEADER_LEN 13
+
+// Datagrams stay on the local network.
+#define MULTICAST_TTL 1
+
+// Name that will be used for logging
+static const char *TAG = "multicast_publisher";
+
+static int udp_sock = -1;
+static struct sockaddr_in group_addr;
+
+// Queue of `can_listener_frame_t` incoming from the CAN bus.
+static QueueHandle_t can_rx_queue = NULL;
+
+static const can_listener_options_t can_rx_queue_options = {
+    .depth = CAN_LISTENER_DEFAULT_DEPTH,
+    .overflow = CAN_LISTENER_OVERFLOW_DROP_OLDEST,
+    .owner = "multicast",
+};
+
+static multicast_publisher_status_t status = {0};
+static SemaphoreHandle_t status_mutex = NULL;
+static StaticSemaphore_t status_mutex_mem;
+
+// Task that batches frames from the CAN bus into datagrams.
+static void multicast_publisher_task(void *pvParameters);
+static StackType_t multicast_publisher_task_stack[4096];
+static StaticTask_t multicast_publisher_task_mem;
+
+// Appends `frame` to `buf`.
+// Returns the number of bytes written.
+static size_t encode_frame(uint8_t *buf, const can_listener_frame_t *frame);
+
+// Writes `value` to `buf` in big-endian byte order.
+static void put_be32(uint8_t *buf, uint32_t value);
+
+esp_err_t multicast_publisher_start(const esp_ip4_addr_t *group,
+                                    uint16_t port) {
+  if (!IN_MULTICAST(ntohl(group->addr))) {
+    ESP_LOGE(TAG, IPSTR " isn't a multicast address.", IP2STR(group));
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  udp_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (udp_sock < 0) {
+    ESP_LOGE(TAG, "Unable to create socket: errno %d", errno);
+    return ESP_FAIL;
+  }
+
+  uint8_t ttl = MULTICAST_TTL;
+  int err = setsockopt(udp_sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl,
+                       sizeof(ttl));
+  if (err != 0) {
+    ESP_LOGE(TAG, "Unable to set multicast TTL: errno %d", errno);
+    close(udp_sock);
+    udp_sock = -1;
+    return ESP_FAIL;
+  }
+
+  memset(&group_addr, 0, sizeof(group_addr));
+  group_addr.sin_family = AF_INET;
+  group_addr.sin_addr.s_addr = group->addr;
+  group_addr.sin_port = htons(port);
+
+  esp_err_t esp_err = can_listener_get(&can_rx_queue_options, &can_rx_queue);
+  if (esp_err != ESP_OK) {
+    ESP_LOGE(TAG, "Couldn't get CAN receive queue: %s",
+             esp_err_to_name(esp_err));
+    close(udp_sock);
+    udp_sock = -1;
+    return esp_err;
+  }
+  // Passive viewers are shed first when the adapter is overloaded.
+  can_listener_set_class(can_rx_queue, CAN_LISTENER_CLASS_BEST_EFFORT);
+
+  status_mutex = xSemaphoreCreateMutexStatic(&status_mutex_mem);
+  if (status_mutex == NULL) {
+    ESP_LOGE(TAG, "Unreachable. status_mutex couldn't be created.");
+    return ESP_FAIL;
+  }
+
+  task_config_create_static(
+      TASK_ID_MULTICAST_PUBLISHER, multicast_publisher_task,
+      sizeof(multicast_publisher_task_stack), NULL,
+      multicast_publisher_task_stack, &multicast_publisher_task_mem);
+
+  ESP_LOGI(TAG, "Publishing CAN frames to " IPSTR ":%d.", IP2STR(group),
+           port);
+  return ESP_OK;
+}
+
+esp_err_t multicast_publisher_get_address(esp_ip4_addr_t *group_out,
+                                          uint16_t *port_out) {
+  if (status_mutex == NULL) {
+    return ESP_FAIL;
+  }
+
+  group_out->addr = group_addr.sin_addr.s_addr;
+  *port_out = ntohs(group_addr.sin_port);
+  return ESP_OK;
+}
+
+esp_err_t multicast_publisher_get_status(
+    multicast_publisher_status_t *status_out) {
+  if (status_mutex == NULL) {
+    return ESP_FAIL;
+  }
+
+  assert(xSemaphoreTake(status_mutex, portMAX_DELAY) == pdTRUE);
+  *status_out = status;
+  assert(xSemaphoreGive(status_mutex) == pdTRUE);
+
+  return ESP_OK;
+}
+
+static void multicast_publisher_task(void *pvParameters) {
+  uint8_t datagram[MULTICAST_PUBLISHER_MTU];
+  size_t len = MULTICAST_PUBLISHER_HEADER_LEN;
+  uint16_t count = 0;
+  uint32_t sequence = 0;
+  int64_t first_frame_us = 0;
+
+  while (true) {
+    // Wait for the first frame of a datagram as long as it takes,
+    // and for further ones until the batch times out.
+    int64_t deadline_us =
+        count > 0 ? first_frame_us + MULTICAST_PUBLISHER_TIMEOUT_US
+                  : INT64_MAX;
+    can_listener_frame_t rx_frame;
+    bool received =
+        can_listener_receive_until(can_rx_queue, deadline_us, &rx_frame);
+
+    // Send the datagram if it timed out, or the frame doesn't fit.
+    if (count > 0 &&
+        (!received ||
+         len + FRAME_HEADER_LEN + can_listener_data_len(&rx_frame.msg) >
+             MULTICAST_PUBLISHER_MTU)) {
+      datagram[0] = MULTICAST_PUBLISHER_VERSION;
+      datagram[1] = 0;
+      datagram[2] = count >> 8;
+      datagram[3] = count & 0xFF;
+      put_be32(&datagram[4], sequence);
+      put_be32(&datagram[8], can_listener_frames_dropped(can_rx_queue) +
+                                 can_listener_frames_shed(can_rx_queue));
+      sequence += 1;
+
+      bool sent = sendto(udp_sock, datagram, len, 0,
+                         (struct sockaddr *)&group_addr,
+                         sizeof(group_addr)) >= 0;
+
+      assert(xSemaphoreTake(status_mutex, portMAX_DELAY) == pdTRUE);
+      if (sent) {
+        status.datagrams_sent += 1;
+        status.frames_sent += count;
+      } else {
+        status.send_failed += 1;
+      }
+      assert(xSemaphoreGive(status_mutex) == pdTRUE);
+
+      len = MULTICAST_PUBLISHER_HEADER_LEN;
+      count = 0;
+    }
+
+    if (!received) {
+      continue;
+    }
+
+    if (count == 0) {
+      first_frame_us = esp_timer_get_time();
+    }
+    len += encode_frame(&datagram[len], &rx_frame);
+    count += 1;
+  }
+}
+
+static size_t encode_frame(uint8_t *buf, const can_listener_frame_t *frame) {
+  size_t len = can_listener_data_len(&frame->msg);
+  uint64_t rx_time_us = frame->rx_time_us;
+  put_be32(&buf[0], rx_time_us >> 32);
+  put_be32(&buf[4], rx_time_us & 0xFFFFFFFF);
+  put_be32(&buf[8], can_listener_socketcan_id(&frame->msg));
+  buf[12] = len;
+  memcpy(&buf[FRAME_HEADER_LEN], frame->msg.data, len);
+  return FRAME_HEADER_LEN + len;
+}
+
+static void put_be32(uint8_t *buf, uint32_t value) {
+  buf[0] = value >> 24;
+  buf[1] = (value >> 16) & 0xFF;
+  buf[2] = (value >> 8) & 0xFF;
+  buf[3] = value & 0xFF;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_netif_types.h"
+
+// Publishes the CAN bus stream once, as UDP multicast datagrams,
+// so any number of read-only consumers on the LAN can subscribe
+// at constant cost to the adapter.
+//
+// Every datagram starts with a header, all fields big-endian:
+//   uint8_t  version            MULTICAST_PUBLISHER_VERSION
+//   uint8_t  reserved           0
+//   uint16_t frame_count
+//   uint32_t sequence           incremented by 1 per datagram
+//   uint32_t frames_dropped     total frames the publisher's queue dropped,
+//                               or overload control shed
+// followed by `frame_count` frames:
+//   int64_t  rx_time_us         adapter uptime when the frame was received
+//   uint32_t can_id             with SocketCAN's EFF, RTR and ERR flags
+//   uint8_t  length
+//   uint8_t  data[length]       absent for RTR frames
+//
+// A gap in `sequence` means datagrams were lost on the network,
+// a change in `frames_dropped` means the adapter couldn't keep up.
+
+#define MULTICAST_PUBLISHER_VERSION 1
+
+// Size of the datagram header.
+#define MULTICAST_PUBLISHER_HEADER_LEN 12
+
+// Largest datagram, so it fits in one ethernet frame.
+#define MULTICAST_PUBLISHER_MTU 1400
+
+// How long a frame waits for others to share its datagram,
+// rounded up to a FreeRTOS tick.
+#define MULTICAST_PUBLISHER_TIMEOUT_US 2000
+
+// The status of the multicast publisher.
+// Get the current status using `multicast_publisher_get_status()`.
+typedef struct {
+  uint64_t datagrams_sent;
+  uint64_t frames_sent;
+
+  // Datagrams that couldn't be sent, for example because no
+  // interface is up. Their sequence numbers are skipped.
+  uint64_t send_failed;
+} multicast_publisher_status_t;
+
+// Starts publishing frames from the CAN bus to `group:port`.
+// `group` must be an IPv4 multicast address.
+// Must only be called once, after `can_listener_start()`.
+esp_err_t multicast_publisher_start(const esp_ip4_addr_t* group,
+                                    uint16_t port);
+
+// Returns the group and port being published to,
+// or `ESP_FAIL` if the publisher isn't running.
+esp_err_t multicast_publisher_get_address(esp_ip4_addr_t* group_out,
+                                          uint16_t* port_out);
+
+// Fills `status_out` with the current `multicast_publisher_status_t`.
+// Returns an error if the publisher isn't running.
+esp_err_t multicast_publisher_get_status(
+    multicast_publisher_status_t* status_out);
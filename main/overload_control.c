@@ -0,0 +1,369 @@
+#include "overload_control.h"
+
+#include <string.h>
+
+#include "driver_setup.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "socketcand_server.h"
+#include "stdatomic.h"
+#include "task_config.h"
+#include "trace_buffer.h"
+
+// How often the load is measured.
+#define PERIOD_MS 20
+
+// A policy is activated if any measurement is at or above its high mark.
+#define QUEUE_FILL_HIGH_PERCENT 75
+#define TWAI_BACKLOG_HIGH_PERCENT 50
+#define CPU_LOAD_HIGH_PERCENT 90
+
+// A policy is deactivated once all measurements were below
+// their low mark for `RELEASE_AFTER_MS`.
+#define QUEUE_FILL_LOW_PERCENT 25
+#define TWAI_BACKLOG_LOW_PERCENT 25
+#define CPU_LOAD_LOW_PERCENT 70
+#define RELEASE_AFTER_MS 1000
+
+// Minimum time between activating two policies,
+// so the previous one gets a chance to take effect.
+#define ESCALATE_AFTER_MS 100
+
+// The stack size of the overload control task.
+#define STACK_SIZE 4096
+
+// Name that will be used for logging
+static const char *TAG = "overload_control";
+
+// The configured list of policies, and the identifier
+// above which `OVERLOAD_POLICY_SHED_LOW_PRIORITY_IDS` sheds.
+// Read without locks by `overload_control_admit()`. A read that races
+// with `overload_control_configure()` only misjudges a single frame.
+static uint8_t policies[OVERLOAD_POLICIES_MAX] = {
+    OVERLOAD_POLICY_SHED_BEST_EFFORT,
+    OVERLOAD_POLICY_SHED_LOW_PRIORITY_IDS,
+    OVERLOAD_POLICY_THROTTLE,
+};
+static uint16_t low_priority_id = 0x400;
+
+// Number of policies from `policies` that are active.
+static atomic_int level = 0;
+
+// Counts frames while `OVERLOAD_POLICY_THROTTLE` is active.
+static atomic_uint throttle_counter = 0;
+
+// Frames shed by each policy. Updated by `overload_control_admit()`.
+static atomic_uint frames_shed[OVERLOAD_POLICY_COUNT];
+
+// Task that measures the load and changes `level`.
+static void overload_control_task(void *pvParameters);
+static StackType_t overload_control_task_stack[STACK_SIZE];
+static StaticTask_t overload_control_task_mem;
+
+// Purely informational status, except for `frames_shed`.
+static overload_control_status_t status = {0};
+static SemaphoreHandle_t status_mutex = NULL;
+static StaticSemaphore_t status_mutex_mem;
+
+// Returns the number of policies in `policies`.
+static int configured_policy_count(void);
+
+// Returns true if `message` has an identifier at or above
+// `low_priority_id`.
+static bool is_low_priority(const twai_message_t *message);
+
+// Returns the CPU load of the CAN core since the last call, in percent.
+// Always 0 without FreeRTOS run time statistics.
+static uint8_t measure_can_core_load(void);
+
+// Activates or deactivates a policy, and records it.
+static void change_level(int new_level, uint8_t triggers);
+
+esp_err_t overload_control_start(void) {
+  status_mutex = xSemaphoreCreateMutexStatic(&status_mutex_mem);
+  if (status_mutex == NULL) {
+    ESP_LOGE(TAG, "Unreachable. status_mutex couldn't be created.");
+    return ESP_FAIL;
+  }
+
+  task_config_create_static(TASK_ID_OVERLOAD_CONTROL, overload_control_task,
+                            sizeof(overload_control_task_stack), NULL,
+                            overload_control_task_stack,
+                            &overload_control_task_mem);
+  return ESP_OK;
+}
+
+void overload_control_configure(const uint8_t new_policies[OVERLOAD_POLICIES_MAX],
+                                uint16_t new_low_priority_id) {
+  atomic_store(&level, 0);
+  memcpy(policies, new_policies, sizeof(policies));
+  low_priority_id = new_low_priority_id;
+}
+
+uint8_t overload_control_admit(const twai_message_t *message) {
+  int current_level = atomic_load_explicit(&level, memory_order_relaxed);
+
+  // Error frames report the state of the bus. Never shed them.
+  if (current_level == 0 || (message->identifier & CAN_LISTENER_ERR_FLAG)) {
+    return CAN_LISTENER_CLASS_ALL;
+  }
+
+  const uint8_t shed_normal =
+      (1U << CAN_LISTENER_CLASS_NORMAL) | (1U << CAN_LISTENER_CLASS_BEST_EFFORT);
+
+  uint8_t admitted = CAN_LISTENER_CLASS_ALL;
+  for (int i = 0; i < current_level && i < OVERLOAD_POLICIES_MAX; i++) {
+    uint8_t shed = 0;
+    switch ((overload_policy_t)policies[i]) {
+      case OVERLOAD_POLICY_SHED_BEST_EFFORT:
+        shed = 1U << CAN_LISTENER_CLASS_BEST_EFFORT;
+        break;
+      case OVERLOAD_POLICY_SHED_LOW_PRIORITY_IDS:
+        if (is_low_priority(message)) {
+          shed = shed_normal;
+        }
+        break;
+      case OVERLOAD_POLICY_THROTTLE:
+        if (atomic_fetch_add_explicit(&throttle_counter, 1,
+                                      memory_order_relaxed) %
+                OVERLOAD_THROTTLE_DIVISOR !=
+            0) {
+          shed = shed_normal;
+        }
+        break;
+      default:
+        break;
+    }
+
+    if (admitted & shed) {
+      admitted &= ~shed;
+      atomic_fetch_add_explicit(&frames_shed[policies[i]], 1,
+                                memory_order_relaxed);
+    }
+  }
+  return admitted;
+}
+
+esp_err_t overload_control_get_status(overload_control_status_t *status_out) {
+  if (status_mutex == NULL) {
+    ESP_LOGE(TAG,
+             "Can't get status because overload control hasn't been started.");
+    return ESP_FAIL;
+  }
+
+  assert(xSemaphoreTake(status_mutex, portMAX_DELAY) == pdTRUE);
+  *status_out = status;
+  assert(xSemaphoreGive(status_mutex) == pdTRUE);
+
+  status_out->level = atomic_load(&level);
+  for (int i = 0; i < OVERLOAD_POLICY_COUNT; i++) {
+    status_out->frames_shed[i] = atomic_load(&frames_shed[i]);
+  }
+  return ESP_OK;
+}
+
+const char *overload_control_policy_name(overload_policy_t policy) {
+  switch (policy) {
+    case OVERLOAD_POLICY_NONE:
+      return "none";
+    case OVERLOAD_POLICY_SHED_BEST_EFFORT:
+      return "best_effort";
+    case OVERLOAD_POLICY_SHED_LOW_PRIORITY_IDS:
+      return "low_priority_ids";
+    case OVERLOAD_POLICY_THROTTLE:
+      return "throttle";
+    default:
+      return "unknown";
+  }
+}
+
+esp_err_t overload_control_policies_to_string(
+    const uint8_t list[OVERLOAD_POLICIES_MAX], char *buf, size_t buflen) {
+  size_t written = 0;
+  buf[0] = '\0';
+  for (int i = 0; i < OVERLOAD_POLICIES_MAX && list[i] != OVERLOAD_POLICY_NONE;
+       i++) {
+    int res = snprintf(buf + written, buflen - written, "%s%s",
+                       i == 0 ? "" : ",", overload_control_policy_name(list[i]));
+    written += res;
+    if (res < 0 || written >= buflen) {
+      return ESP_ERR_NO_MEM;
+    }
+  }
+  return ESP_OK;
+}
+
+esp_err_t overload_control_policies_from_string(
+    const char *str, uint8_t list_out[OVERLOAD_POLICIES_MAX]) {
+  memset(list_out, OVERLOAD_POLICY_NONE, OVERLOAD_POLICIES_MAX);
+
+  int count = 0;
+  while (*str != '\0') {
+    size_t len = strcspn(str, ",");
+    overload_policy_t policy = OVERLOAD_POLICY_SHED_BEST_EFFORT;
+    while (policy < OVERLOAD_POLICY_COUNT &&
+           (strlen(overload_control_policy_name(policy)) != len ||
+            strncmp(str, overload_control_policy_name(policy), len) != 0)) {
+      policy++;
+    }
+    if (policy == OVERLOAD_POLICY_COUNT || count == OVERLOAD_POLICIES_MAX) {
+      return ESP_FAIL;
+    }
+    list_out[count] = policy;
+    count += 1;
+
+    str += len;
+    if (*str == ',') {
+      str++;
+    }
+  }
+  return ESP_OK;
+}
+
+static int configured_policy_count(void) {
+  int count = 0;
+  while (count < OVERLOAD_POLICIES_MAX &&
+         policies[count] != OVERLOAD_POLICY_NONE) {
+    count++;
+  }
+  return count;
+}
+
+static bool is_low_priority(const twai_message_t *message) {
+  uint32_t base_id = message->identifier;
+  if (message->extd) {
+    base_id >>= 18;
+  }
+  return base_id >= low_priority_id;
+}
+
+static uint8_t measure_can_core_load(void) {
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+  static uint32_t last_idle_time = 0;
+  static int64_t last_time_us = 0;
+
+  // The run time counter counts microseconds of `esp_timer`.
+  uint32_t idle_time = ulTaskGetRunTimeCounter(
+      xTaskGetIdleTaskHandleForCore(TASK_CONFIG_CAN_CORE));
+  int64_t now_us = esp_timer_get_time();
+
+  uint32_t idle_us = idle_time - last_idle_time;
+  int64_t elapsed_us = now_us - last_time_us;
+  last_idle_time = idle_time;
+  last_time_us = now_us;
+
+  if (elapsed_us <= 0 || idle_us >= elapsed_us) {
+    return 0;
+  }
+  return 100 - (uint8_t)(idle_us * 100 / elapsed_us);
+#else
+  return 0;
+#endif
+}
+
+static void change_level(int new_level, uint8_t triggers) {
+  int old_level = atomic_load(&level);
+  atomic_store(&level, new_level);
+
+  // The policy that was activated or deactivated.
+  uint8_t policy = policies[new_level > old_level ? old_level : new_level];
+
+  assert(xSemaphoreTake(status_mutex, portMAX_DELAY) == pdTRUE);
+  if (new_level > old_level) {
+    status.activations[policy] += 1;
+    status.last_triggers = triggers;
+  }
+  status.last_change_us = esp_timer_get_time();
+  uint8_t queue_fill_percent = status.queue_fill_percent;
+  uint8_t can_core_load_percent = status.can_core_load_percent;
+  assert(xSemaphoreGive(status_mutex) == pdTRUE);
+
+  trace_buffer_record(TRACE_EVENT_OVERLOAD_LEVEL, new_level, policy, triggers,
+                      (can_core_load_percent << 8) | queue_fill_percent);
+
+  if (new_level > old_level) {
+    ESP_LOGW(TAG,
+             "Overloaded (triggers 0x%x, queues %d%%, CAN core %d%%). "
+             "Activated policy %s.",
+             triggers, queue_fill_percent, can_core_load_percent,
+             overload_control_policy_name(policy));
+  } else {
+    ESP_LOGI(TAG, "Load is back to normal. Deactivated policy %s.",
+             overload_control_policy_name(policy));
+  }
+}
+
+static void overload_control_task(void *pvParameters) {
+  uint32_t last_overruns = 0;
+  TickType_t last_change = xTaskGetTickCount();
+  TickType_t last_high = xTaskGetTickCount();
+  TickType_t last_wake = xTaskGetTickCount();
+
+  while (true) {
+    vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(PERIOD_MS));
+
+    uint8_t queue_fill = can_listener_max_fill_percent();
+    uint8_t fast_path_fill = socketcand_server_fast_path_fill_percent();
+    if (fast_path_fill > queue_fill) {
+      queue_fill = fast_path_fill;
+    }
+
+    uint8_t twai_backlog = 0;
+    bool overrun = false;
+    twai_status_info_t twai_status;
+    if (driver_setup_can_get_status_info(&twai_status) == ESP_OK) {
+      twai_backlog =
+          twai_status.msgs_to_rx * 100 / DRIVER_SETUP_CAN_RX_QUEUE_LEN;
+      uint32_t overruns =
+          twai_status.rx_overrun_count + twai_status.rx_missed_count;
+      // The counters restart when the driver is reinstalled.
+      overrun = overruns > last_overruns;
+      last_overruns = overruns;
+    }
+
+    uint8_t can_core_load = measure_can_core_load();
+
+    assert(xSemaphoreTake(status_mutex, portMAX_DELAY) == pdTRUE);
+    status.queue_fill_percent = queue_fill;
+    status.twai_backlog_percent = twai_backlog;
+    status.can_core_load_percent = can_core_load;
+    assert(xSemaphoreGive(status_mutex) == pdTRUE);
+
+    uint8_t triggers = 0;
+    if (queue_fill >= QUEUE_FILL_HIGH_PERCENT) {
+      triggers |= OVERLOAD_TRIGGER_QUEUE_FILL;
+    }
+    if (twai_backlog >= TWAI_BACKLOG_HIGH_PERCENT) {
+      triggers |= OVERLOAD_TRIGGER_TWAI_BACKLOG;
+    }
+    if (overrun) {
+      triggers |= OVERLOAD_TRIGGER_TWAI_OVERRUN;
+    }
+    if (can_core_load >= CPU_LOAD_HIGH_PERCENT) {
+      triggers |= OVERLOAD_TRIGGER_CPU_LOAD;
+    }
+
+    bool low = queue_fill < QUEUE_FILL_LOW_PERCENT &&
+               twai_backlog < TWAI_BACKLOG_LOW_PERCENT && !overrun &&
+               can_core_load < CPU_LOAD_LOW_PERCENT;
+
+    TickType_t now = xTaskGetTickCount();
+    if (!low) {
+      last_high = now;
+    }
+
+    int current_level = atomic_load(&level);
+    if (triggers != 0 && current_level < configured_policy_count() &&
+        now - last_change >= pdMS_TO_TICKS(ESCALATE_AFTER_MS)) {
+      change_level(current_level + 1, triggers);
+      last_change = now;
+    } else if (low && current_level > 0 &&
+               now - last_high >= pdMS_TO_TICKS(RELEASE_AFTER_MS) &&
+               now - last_change >= pdMS_TO_TICKS(RELEASE_AFTER_MS)) {
+      change_level(current_level - 1, 0);
+      last_change = now;
+    }
+  }
+}
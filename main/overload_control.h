@@ -0,0 +1,117 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "can_listener.h"
+#include "driver/twai.h"
+#include "esp_err.h"
+
+// Watches how well the adapter keeps up with the CAN bus,
+// and sheds load before frames get dropped at random.
+//
+// Every few milliseconds, a task checks the fill level of the CAN
+// listener queues and the socketcand fast path, the TWAI receive
+// backlog and overruns, and the CPU load of the CAN core.
+// While any of them is too high, it activates one more policy from
+// the configured list. Once all of them have been low for a while,
+// it deactivates the last activated policy.
+// `critical` listeners are never shed, so they keep lossless service
+// as long as their own queues keep up.
+
+// Maximum number of policies in the configured list.
+#define OVERLOAD_POLICIES_MAX 3
+
+// Ways of shedding load.
+// Stored in the `overload_policies` persistent setting,
+// so only ever append new ones.
+typedef enum {
+  // Ends the list of policies.
+  OVERLOAD_POLICY_NONE = 0,
+
+  // Stop delivering frames to `best_effort` listeners.
+  OVERLOAD_POLICY_SHED_BEST_EFFORT = 1,
+
+  // Stop delivering frames with an identifier at or above the configured
+  // `low_priority_id` to `normal` and `best_effort` listeners.
+  // Extended identifiers are compared by their 11-bit base identifier,
+  // because that's what decides their priority on the bus.
+  OVERLOAD_POLICY_SHED_LOW_PRIORITY_IDS = 2,
+
+  // Only deliver every `OVERLOAD_THROTTLE_DIVISOR`th frame
+  // to `normal` and `best_effort` listeners.
+  OVERLOAD_POLICY_THROTTLE = 3,
+
+  // Number of policies. Not a policy.
+  OVERLOAD_POLICY_COUNT,
+} overload_policy_t;
+
+// While `OVERLOAD_POLICY_THROTTLE` is active, shed listeners
+// get one out of this many frames.
+#define OVERLOAD_THROTTLE_DIVISOR 4
+
+// Bits of `overload_control_status_t.last_triggers`.
+// Each one is a reason why a policy was activated.
+#define OVERLOAD_TRIGGER_QUEUE_FILL (1 << 0)
+#define OVERLOAD_TRIGGER_TWAI_BACKLOG (1 << 1)
+#define OVERLOAD_TRIGGER_TWAI_OVERRUN (1 << 2)
+#define OVERLOAD_TRIGGER_CPU_LOAD (1 << 3)
+
+// The status of the overload controller.
+// Get the current status using `overload_control_get_status()`.
+typedef struct {
+  // Number of policies from the configured list that are active.
+  uint8_t level;
+
+  // Number of times each `overload_policy_t` was activated.
+  uint32_t activations[OVERLOAD_POLICY_COUNT];
+
+  // Number of frames that each `overload_policy_t` withheld
+  // from at least one listener class.
+  uint32_t frames_shed[OVERLOAD_POLICY_COUNT];
+
+  // `OVERLOAD_TRIGGER_*` bits of the last activation.
+  uint8_t last_triggers;
+
+  // `esp_timer_get_time()` of the last level change. 0 if none.
+  int64_t last_change_us;
+
+  // Latest measurements.
+  uint8_t queue_fill_percent;
+  uint8_t twai_backlog_percent;
+  uint8_t can_core_load_percent;
+} overload_control_status_t;
+
+// Starts the task that watches the load.
+// Must only be called once, after `can_listener_start()`.
+esp_err_t overload_control_start(void);
+
+// Sets the list of policies that are activated, in order,
+// and the lowest identifier that `OVERLOAD_POLICY_SHED_LOW_PRIORITY_IDS`
+// sheds. The list ends at the first `OVERLOAD_POLICY_NONE`.
+// Deactivates all policies. Can be called at any time.
+void overload_control_configure(const uint8_t policies[OVERLOAD_POLICIES_MAX],
+                                uint16_t low_priority_id);
+
+// Returns a mask with a bit set for every `can_listener_class_t`
+// that `message` may be delivered to under the active policies.
+// Lock-free and cheap enough to call for every frame,
+// but call it only once per frame, because it counts shed frames.
+uint8_t overload_control_admit(const twai_message_t* message);
+
+// Fills `status_out` with the current `overload_control_status_t`.
+// Returns an error if the overload controller hasn't been started.
+esp_err_t overload_control_get_status(overload_control_status_t* status_out);
+
+// Returns a human-readable name of `policy`.
+const char* overload_control_policy_name(overload_policy_t policy);
+
+// Writes `policies` to `buf` as a comma-separated list of names,
+// such as "best_effort,low_priority_ids,throttle".
+// Returns `ESP_ERR_NO_MEM` if `buflen` is too small.
+esp_err_t overload_control_policies_to_string(
+    const uint8_t policies[OVERLOAD_POLICIES_MAX], char* buf, size_t buflen);
+
+// Parses a list written by `overload_control_policies_to_string()`.
+// Returns `ESP_FAIL` if a name is unknown or the list is too long.
+esp_err_t overload_control_policies_from_string(
+    const char* str, uint8_t policies_out[OVERLOAD_POLICIES_MAX]);
@@ -6,6 +6,7 @@
 #include "freertos/FreeRTOS.h"
 #include "iot_button.h"
 #include "nvs_flash.h"
+#include "task_config.h"
 
 // Name that will be used for logging
 static const char *TAG = "persistent_settings";
@@ -14,7 +15,7 @@ const persistent_settings_t *persistent_settings = NULL;
 static persistent_settings_t persistent_settings_data;
 
 const char *persistent_settings_json = NULL;
-static char persistent_settings_json_data[1024];
+static char persistent_settings_json_data[3328];
 
 // A callback that gets called whenever button 1 is long-pressed.
 // Resets the persistent settings back to default.
@@ -62,6 +63,10 @@ esp_err_t persistent_settings_load(void) {
   err = nvs_open("main_config", NVS_READWRITE, &nvs);
   ESP_RETURN_ON_ERROR(err, TAG, "Couldn't open NVS.");
 
+  // Start from the defaults, so that settings saved by older firmware,
+  // which lack the newest trailing fields, load with those fields
+  // set to their defaults.
+  persistent_settings_data = persistent_settings_default;
   size_t config_size = sizeof(persistent_settings_t);
   err = nvs_get_blob(nvs, "config", &persistent_settings_data, &config_size);
 
@@ -76,6 +81,12 @@ esp_err_t persistent_settings_load(void) {
 
   persistent_settings = &persistent_settings_data;
 
+  char overload_policies_str[64];
+  err = overload_control_policies_to_string(
+      persistent_settings->overload_policies, overload_policies_str,
+      sizeof(overload_policies_str));
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't print overload policies.");
+
   // Also fill out `persistent_settings_json`.
   int bytes_written = snprintf(
       persistent_settings_json_data, sizeof(persistent_settings_json_data),
@@ -130,7 +141,77 @@ esp_err_t persistent_settings_load(void) {
       "%s,\n"
 
       "\"cyphal_node_id\": "
-      "%d\n"
+      "%d,\n"
+
+      "\"log_udp_ip\": "
+      "\"" IPSTR
+      "\",\n"
+
+      "\"log_udp_port\": "
+      "%d,\n"
+
+      "\"task_profile\": "
+      "\"%s\",\n"
+
+      "\"socketcand_fast_path\": "
+      "%s,\n"
+
+      "\"overload_policies\": "
+      "\"%s\",\n"
+
+      "\"overload_low_priority_id\": "
+      "%d,\n"
+
+      "\"client_queue_depth\": "
+      "%d,\n"
+
+      "\"client_overflow\": "
+      "\"%s\",\n"
+
+      "\"cannelloni_peer_ip\": "
+      "\"" IPSTR
+      "\",\n"
+
+      "\"cannelloni_port\": "
+      "%d,\n"
+
+      "\"cannelloni_timeout_us\": "
+      "%lu,\n"
+
+      "\"cannelloni_mtu\": "
+      "%d,\n"
+
+      "\"multicast_group\": "
+      "\"" IPSTR
+      "\",\n"
+
+      "\"multicast_port\": "
+      "%d,\n"
+
+      "\"bridge_peer_ip\": "
+      "\"" IPSTR
+      "\",\n"
+
+      "\"bridge_port\": "
+      "%d,\n"
+
+      "\"bridge_rules\": "
+      "\"%s\",\n"
+
+      "\"capture_triggers\": "
+      "\"%s\",\n"
+
+      "\"replay_buffer_kb\": "
+      "%d,\n"
+
+      "\"reflex_rules\": "
+      "\"%s\",\n"
+
+      "\"tx_rate_limits\": "
+      "\"%s\",\n"
+
+      "\"gateway_rules\": "
+      "\"%s\"\n"
 
       "}\n",
       persistent_settings->hostname,
@@ -147,7 +228,26 @@ esp_err_t persistent_settings_load(void) {
       IP2STR(&persistent_settings->wifi_ip_info.gw),
       persistent_settings->can_bitrate,
       persistent_settings->enable_cyphal ? "true" : "false",
-      persistent_settings->cyphal_node_id);
+      persistent_settings->cyphal_node_id,
+      IP2STR(&persistent_settings->log_udp_ip),
+      persistent_settings->log_udp_port,
+      task_config_profile_name(persistent_settings->task_profile),
+      persistent_settings->socketcand_fast_path ? "true" : "false",
+      overload_policies_str, persistent_settings->overload_low_priority_id,
+      persistent_settings->client_queue_depth,
+      can_listener_overflow_name(persistent_settings->client_overflow),
+      IP2STR(&persistent_settings->cannelloni_peer_ip),
+      persistent_settings->cannelloni_port,
+      persistent_settings->cannelloni_timeout_us,
+      persistent_settings->cannelloni_mtu,
+      IP2STR(&persistent_settings->multicast_group),
+      persistent_settings->multicast_port,
+      IP2STR(&persistent_settings->bridge_peer_ip),
+      persistent_settings->bridge_port, persistent_settings->bridge_rules,
+      persistent_settings->capture_triggers,
+      persistent_settings->replay_buffer_kb,
+      persistent_settings->reflex_rules, persistent_settings->tx_rate_limits,
+      persistent_settings->gateway_rules);
 
   if (bytes_written < 0 ||
       bytes_written >= sizeof(persistent_settings_json_data)) {
@@ -2,7 +2,14 @@
 
 #include <hal/twai_types.h>
 
+#include "can_bridge.h"
+#include "can_gateway.h"
+#include "can_listener.h"
+#include "capture_trigger.h"
 #include "esp_netif.h"
+#include "overload_control.h"
+#include "reflex_rules.h"
+#include "tx_rate_limit.h"
 
 // The different CAN bitrates that the ESP32 supports
 enum can_bitrate_setting {
@@ -52,6 +59,73 @@ typedef struct {
   // ID of Cyphal Node if enabled.
   uint8_t cyphal_node_id;
 
+  // If `log_udp_port` isn't 0, logs are sent as UDP datagrams
+  // to `log_udp_ip:log_udp_port` instead of over UART.
+  esp_ip4_addr_t log_udp_ip;
+  uint16_t log_udp_port;
+
+  // Task priorities and core assignments. A `task_profile_t`.
+  uint8_t task_profile;
+
+  // Should socketcand clients get CAN frames through the shared
+  // fast path writer? See `socketcand_server_set_fast_path()`.
+  bool socketcand_fast_path;
+
+  // `overload_policy_t`s that are activated in order under overload,
+  // ending at the first `OVERLOAD_POLICY_NONE`.
+  uint8_t overload_policies[OVERLOAD_POLICIES_MAX];
+
+  // Lowest 11-bit identifier shed by `OVERLOAD_POLICY_SHED_LOW_PRIORITY_IDS`.
+  uint16_t overload_low_priority_id;
+
+  // Depth and `can_listener_overflow_t` of the CAN receive queue of
+  // socketcand clients that don't choose their own.
+  // See `socketcand_server_set_client_defaults()`.
+  uint16_t client_queue_depth;
+  uint8_t client_overflow;
+
+  // If `cannelloni_port` isn't 0, CAN frames are also exchanged with
+  // `cannelloni_peer_ip` over UDP in cannelloni format.
+  // See `cannelloni_start()`.
+  esp_ip4_addr_t cannelloni_peer_ip;
+  uint16_t cannelloni_port;
+  uint32_t cannelloni_timeout_us;
+  uint16_t cannelloni_mtu;
+
+  // If `multicast_port` isn't 0, the CAN bus stream is published
+  // to the `multicast_group` for passive listeners.
+  // See `multicast_publisher_start()`.
+  esp_ip4_addr_t multicast_group;
+  uint16_t multicast_port;
+
+  // If `bridge_port` isn't 0, the CAN bus is bridged to the
+  // adapter at `bridge_peer_ip`, forwarding frames that pass
+  // `bridge_rules`. See `can_bridge_start()`.
+  esp_ip4_addr_t bridge_peer_ip;
+  uint16_t bridge_port;
+  char bridge_rules[CAN_BRIDGE_RULES_LEN];
+
+  // Frames that start a snapshot of the traffic around them.
+  // Empty disables snapshots. See `capture_trigger_parse()`.
+  char capture_triggers[CAPTURE_TRIGGER_SPEC_LEN];
+
+  // Size of the buffer for logs uploaded to `/api/replay`, in KiB.
+  // It's taken from the capture ring. 0 disables replay.
+  // See `can_replay_start()`.
+  uint16_t replay_buffer_kb;
+
+  // Requests that the adapter answers by itself.
+  // Empty disables them. See `reflex_rules_parse()`.
+  char reflex_rules[REFLEX_RULES_SPEC_LEN];
+
+  // Token buckets that limit the frames socketcand clients transmit.
+  // Empty disables them. See `tx_rate_limit_parse()`.
+  char tx_rate_limits[TX_RATE_LIMIT_SPEC_LEN];
+
+  // Rules that rewrite, drop or duplicate the frames of socketcand
+  // clients. Empty disables them. See `can_gateway_parse()`.
+  char gateway_rules[CAN_GATEWAY_SPEC_LEN];
+
 } persistent_settings_t;
 
 // Default `persistent_settings_t`.
@@ -71,6 +145,30 @@ static const persistent_settings_t persistent_settings_default = {
     .can_bitrate = CAN_KBITS_500,
     .enable_cyphal = false,
     .cyphal_node_id = 98,
+    .log_udp_ip.addr = ESP_IP4TOADDR(0, 0, 0, 0),
+    .log_udp_port = 0,
+    .task_profile = 0,
+    .socketcand_fast_path = false,
+    .overload_policies = {OVERLOAD_POLICY_SHED_BEST_EFFORT,
+                          OVERLOAD_POLICY_SHED_LOW_PRIORITY_IDS,
+                          OVERLOAD_POLICY_THROTTLE},
+    .overload_low_priority_id = 0x400,
+    .client_queue_depth = CAN_LISTENER_DEFAULT_DEPTH,
+    .client_overflow = CAN_LISTENER_OVERFLOW_DROP_NEWEST,
+    .cannelloni_peer_ip.addr = ESP_IP4TOADDR(0, 0, 0, 0),
+    .cannelloni_port = 0,
+    .cannelloni_timeout_us = 1000,
+    .cannelloni_mtu = 1400,
+    .multicast_group.addr = ESP_IP4TOADDR(239, 255, 29, 53),
+    .multicast_port = 0,
+    .bridge_peer_ip.addr = ESP_IP4TOADDR(0, 0, 0, 0),
+    .bridge_port = 0,
+    .bridge_rules = "",
+    .capture_triggers = "",
+    .replay_buffer_kb = 0,
+    .reflex_rules = "",
+    .tx_rate_limits = "",
+    .gateway_rules = "",
 };
 
 // Pointer to the current persistent settings.
@@ -0,0 +1,77 @@
+#include "precise_wait.h"
+
+#include "esp_log.h"
+
+// Name that will be used for logging
+static const char *TAG = "precise_wait";
+
+// Wakes the task of the `precise_wait_t` in `arg`.
+static void wake_task(void *arg);
+
+esp_err_t precise_wait_init(precise_wait_t *wait, const char *name,
+                            TaskHandle_t *task, uint32_t spin_us) {
+  wait->task = task;
+  wait->spin_us = spin_us;
+
+  const esp_timer_create_args_t timer_args = {
+      .callback = wake_task,
+      .arg = wait,
+      .dispatch_method = ESP_TIMER_TASK,
+      .name = name,
+      .skip_unhandled_events = true,
+  };
+  esp_err_t err = esp_timer_create(&timer_args, &wait->timer);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Couldn't create %s timer: %s", name, esp_err_to_name(err));
+  }
+  return err;
+}
+
+bool precise_wait_until(precise_wait_t *wait, int64_t target_us,
+                        atomic_bool *cancel) {
+  // Sleep until shortly before `target_us`. Other notifications,
+  // like a stop, wake the task early.
+  while (!atomic_load(cancel)) {
+    int64_t remaining_us = target_us - esp_timer_get_time();
+    if (remaining_us <= (int64_t)wait->spin_us) {
+      break;
+    }
+    esp_timer_stop(wait->timer);
+    esp_timer_start_once(wait->timer, remaining_us - wait->spin_us);
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+  }
+  if (atomic_load(cancel)) {
+    return false;
+  }
+
+  // Then spin for the rest.
+  while (esp_timer_get_time() < target_us) {
+  }
+  return true;
+}
+
+void precise_wait_stop(precise_wait_t *wait) { esp_timer_stop(wait->timer); }
+
+void precise_wait_count_error(precise_wait_errors_t *errors,
+                              int64_t error_us) {
+  uint32_t error = error_us > 0 ? error_us : 0;
+
+  errors->frames += 1;
+  errors->sum_us += error;
+  errors->avg_us = errors->sum_us / errors->frames;
+  if (error > errors->max_us) {
+    errors->max_us = error;
+  }
+
+  uint32_t bucket = 0;
+  while (bucket < PRECISE_WAIT_BUCKETS - 1 &&
+         error >= errors->bounds_us[bucket]) {
+    bucket += 1;
+  }
+  errors->histogram[bucket] += 1;
+}
+
+static void wake_task(void *arg) {
+  precise_wait_t *wait = arg;
+  xTaskNotifyGive(*wait->task);
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "stdatomic.h"
+
+// Waits for absolute times with microsecond precision, for the tasks
+// that transmit frames at given times: the replay, the TX scheduler
+// and the traffic generator.
+//
+// A one-shot `esp_timer` wakes the waiting task shortly before the
+// time, and the task spins for the rest. How much later than their
+// time frames were queued for transmission is collected in a
+// `precise_wait_errors_t`, for the status.
+
+// How long a timed frame may wait for space in the CAN transmit queue.
+#define PRECISE_WAIT_TX_TIMEOUT_MS 100
+
+// Times sooner than this aren't waited for with a timer.
+#define PRECISE_WAIT_SPIN_US 100
+
+// Number of buckets of the error histogram.
+#define PRECISE_WAIT_BUCKETS 4
+
+// The timer of a task that waits.
+// Set up with `precise_wait_init()`.
+typedef struct {
+  esp_timer_handle_t timer;
+  TaskHandle_t* task;
+  uint32_t spin_us;
+} precise_wait_t;
+
+// How much later than their time frames were queued for transmission.
+typedef struct {
+  uint64_t frames;
+  uint32_t avg_us;
+  uint32_t max_us;
+
+  // Upper bounds of all buckets of the histogram but the last,
+  // which counts the later frames.
+  uint32_t bounds_us[PRECISE_WAIT_BUCKETS - 1];
+  uint64_t histogram[PRECISE_WAIT_BUCKETS];
+
+  uint64_t sum_us;
+} precise_wait_errors_t;
+
+// Creates the timer of `wait`, which wakes `*task`, `spin_us` before
+// each time. With a `spin_us` of 0 the task doesn't spin, and is only
+// as precise as the timer.
+esp_err_t precise_wait_init(precise_wait_t* wait, const char* name,
+                            TaskHandle_t* task, uint32_t spin_us);
+
+// Waits until `target_us`, in `esp_timer_get_time()` time.
+// Must be called by the task of `wait`. Other notifications of the
+// task wake it early, and if `*cancel` is set by then, it returns
+// false without waiting further.
+bool precise_wait_until(precise_wait_t* wait, int64_t target_us,
+                        atomic_bool* cancel);
+
+// Stops the timer of `wait`, so it doesn't wake the task later.
+void precise_wait_stop(precise_wait_t* wait);
+
+// Adds a frame queued `error_us` after its time to `errors`.
+void precise_wait_count_error(precise_wait_errors_t* errors,
+                              int64_t error_us);
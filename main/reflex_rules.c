@@ -0,0 +1,358 @@
+#include "reflex_rules.h"
+
+#include <string.h>
+
+#include "can_listener.h"
+#include "driver_setup.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "id_match_table.h"
+#include "stdatomic.h"
+#include "text_parse.h"
+#include "tx_scheduler.h"
+
+_Static_assert(REFLEX_RULES_MAX <= ID_MATCH_TABLE_ENTRIES_MAX,
+               "Every rule needs an entry in the match table");
+
+// A compiled set of rules.
+typedef struct {
+  reflex_rules_t rules;
+  id_match_table_t table;
+
+  // The rolling counter of every rule.
+  uint8_t counters[REFLEX_RULES_MAX];
+
+  // Tells responses scheduled by this set from those of others.
+  uint16_t generation;
+} rule_set_t;
+
+// Name that will be used for logging
+static const char *TAG = "reflex_rules";
+
+// The active set is one of these, and the other is filled by
+// `reflex_rules_configure()`. NULL if no rules are active.
+static rule_set_t rule_sets[2];
+static _Atomic(rule_set_t *) active_set = NULL;
+
+// Number of `reflex_rules_check()` calls using `active_set`.
+static atomic_int checking = 0;
+
+// Serializes `reflex_rules_configure()`.
+static SemaphoreHandle_t configure_mutex = NULL;
+static StaticSemaphore_t configure_mutex_mem;
+
+// Counters of the active rules, and what's needed to update them.
+static reflex_rules_status_t status = {0};
+static uint16_t status_generation = 0;
+static uint32_t delays_us[REFLEX_RULES_MAX];
+static uint64_t latency_sum_us[REFLEX_RULES_MAX];
+static SemaphoreHandle_t status_mutex = NULL;
+static StaticSemaphore_t status_mutex_mem;
+
+// Parses one rule from `text` into `rule_out`.
+static bool parse_rule(char *text, reflex_rule_t *rule_out);
+
+// Parses one response byte from `text` into `rule`.
+static bool parse_byte(const char *text, reflex_rule_t *rule);
+
+// Builds the response of `rule` to `request`.
+static void build_response(const reflex_rule_t *rule, uint8_t *counter,
+                           const twai_message_t *request,
+                           twai_message_t *response_out);
+
+// Called by the `tx_scheduler` for delayed responses.
+static void response_sent(void *arg, int64_t deadline_us, int64_t sent_us,
+                          esp_err_t err);
+
+// Adds a response of rule `index` to the status.
+// Must be called with `status_mutex` held.
+static void count_response(uint8_t index, esp_err_t err,
+                           int64_t latency_us);
+
+esp_err_t reflex_rules_parse(const char *spec, reflex_rules_t *rules_out) {
+  char buf[REFLEX_RULES_SPEC_LEN];
+  if (strlen(spec) >= sizeof(buf)) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  strcpy(buf, spec);
+
+  rules_out->count = 0;
+  char *saveptr;
+  for (char *token = strtok_r(buf, " ", &saveptr); token != NULL;
+       token = strtok_r(NULL, " ", &saveptr)) {
+    if (rules_out->count >= REFLEX_RULES_MAX ||
+        !parse_rule(token, &rules_out->rules[rules_out->count])) {
+      return ESP_ERR_INVALID_ARG;
+    }
+    rules_out->count += 1;
+  }
+
+  return ESP_OK;
+}
+
+esp_err_t reflex_rules_configure(const reflex_rules_t *rules) {
+  if (configure_mutex == NULL) {
+    configure_mutex = xSemaphoreCreateMutexStatic(&configure_mutex_mem);
+    status_mutex = xSemaphoreCreateMutexStatic(&status_mutex_mem);
+    if (configure_mutex == NULL || status_mutex == NULL) {
+      ESP_LOGE(TAG, "Unreachable. Reflex mutexes couldn't be created.");
+      return ESP_FAIL;
+    }
+  }
+  assert(xSemaphoreTake(configure_mutex, portMAX_DELAY) == pdTRUE);
+
+  // The last call waited until nobody used the inactive set.
+  rule_set_t *current = atomic_load(&active_set);
+  rule_set_t *next = current == &rule_sets[0] ? &rule_sets[1] : &rule_sets[0];
+  next->rules = *rules;
+  memset(next->counters, 0, sizeof(next->counters));
+  id_match_table_init(&next->table);
+  for (uint8_t i = 0; i < rules->count; i++) {
+    esp_err_t err =
+        id_match_table_add(&next->table, rules->rules[i].match.id,
+                           rules->rules[i].match.mask, i);
+    if (err != ESP_OK) {
+      ESP_LOGE(TAG, "Too many distinct reflex rule masks.");
+      assert(xSemaphoreGive(configure_mutex) == pdTRUE);
+      return err;
+    }
+  }
+  id_match_table_compile(&next->table);
+
+  assert(xSemaphoreTake(status_mutex, portMAX_DELAY) == pdTRUE);
+  status_generation += 1;
+  next->generation = status_generation;
+  memset(&status, 0, sizeof(status));
+  status.count = rules->count;
+  for (uint8_t i = 0; i < rules->count; i++) {
+    delays_us[i] = rules->rules[i].delay_us;
+    latency_sum_us[i] = 0;
+  }
+  assert(xSemaphoreGive(status_mutex) == pdTRUE);
+
+  atomic_store(&active_set, rules->count > 0 ? next : NULL);
+
+  // Wait until no check uses the old set, so the next call may fill it.
+  while (atomic_load(&checking) > 0) {
+    vTaskDelay(1);
+  }
+
+  assert(xSemaphoreGive(configure_mutex) == pdTRUE);
+  ESP_LOGI(TAG, "Configured %d reflex rules.", rules->count);
+  return ESP_OK;
+}
+
+uint8_t reflex_rules_check(const twai_message_t *msg, int64_t rx_time_us,
+                           twai_message_t *sent_out) {
+  if (atomic_load_explicit(&active_set, memory_order_relaxed) == NULL) {
+    return 0;
+  }
+
+  atomic_fetch_add(&checking, 1);
+  rule_set_t *set = atomic_load(&active_set);
+  uint8_t sent_count = 0;
+
+  uint16_t matches[REFLEX_RULES_MAX];
+  uint16_t match_count = 0;
+  if (set != NULL) {
+    match_count =
+        id_match_table_lookup(&set->table, msg->identifier & CAN_EFF_MASK,
+                              matches, REFLEX_RULES_MAX);
+  }
+
+  for (uint16_t i = 0; i < match_count; i++) {
+    uint8_t index = matches[i];
+    const reflex_rule_t *rule = &set->rules.rules[index];
+    if (!capture_trigger_payload_matches(&rule->match, msg)) {
+      continue;
+    }
+
+    twai_message_t response;
+    build_response(rule, &set->counters[index], msg, &response);
+
+    esp_err_t err;
+    int64_t latency_us = 0;
+    if (rule->delay_us == 0) {
+      err = driver_setup_can_transmit(&response, 0);
+      latency_us = esp_timer_get_time() - rx_time_us;
+      if (err == ESP_OK) {
+        sent_out[sent_count] = response;
+        sent_count += 1;
+      }
+    } else {
+      void *arg = (void *)((uintptr_t)set->generation << 8 | index);
+      err = tx_scheduler_add(&response, rx_time_us + rule->delay_us,
+                             response_sent, arg);
+    }
+
+    assert(xSemaphoreTake(status_mutex, portMAX_DELAY) == pdTRUE);
+    if (set->generation == status_generation) {
+      status.rules[index].matched += 1;
+      // Delayed responses are counted once they're sent.
+      if (rule->delay_us == 0 || err != ESP_OK) {
+        count_response(index, err, latency_us);
+      }
+    }
+    assert(xSemaphoreGive(status_mutex) == pdTRUE);
+  }
+
+  atomic_fetch_sub(&checking, 1);
+  return sent_count;
+}
+
+esp_err_t reflex_rules_get_status(reflex_rules_status_t *status_out) {
+  if (status_mutex == NULL) {
+    return ESP_FAIL;
+  }
+
+  assert(xSemaphoreTake(status_mutex, portMAX_DELAY) == pdTRUE);
+  *status_out = status;
+  assert(xSemaphoreGive(status_mutex) == pdTRUE);
+
+  return ESP_OK;
+}
+
+static void build_response(const reflex_rule_t *rule, uint8_t *counter,
+                           const twai_message_t *request,
+                           twai_message_t *response_out) {
+  *response_out = (twai_message_t){0};
+  response_out->identifier = rule->response_id;
+  // Response IDs above the largest standard ID are extended.
+  response_out->extd = rule->response_id > CAN_SFF_MASK;
+  response_out->data_length_code = rule->response_len;
+
+  for (uint8_t i = 0; i < rule->response_len; i++) {
+    const reflex_byte_t *byte = &rule->response[i];
+    if (byte->op == REFLEX_BYTE_LITERAL) {
+      response_out->data[i] = byte->value;
+    } else if (byte->op == REFLEX_BYTE_COPY) {
+      // `match.min_len` ensures the request has this byte.
+      response_out->data[i] = request->data[byte->source] + byte->value;
+    } else {
+      response_out->data[i] = *counter;
+    }
+  }
+  *counter += 1;
+}
+
+static void response_sent(void *arg, int64_t deadline_us, int64_t sent_us,
+                          esp_err_t err) {
+  uint16_t generation = (uintptr_t)arg >> 8;
+  uint8_t index = (uintptr_t)arg & 0xFF;
+
+  assert(xSemaphoreTake(status_mutex, portMAX_DELAY) == pdTRUE);
+  // Ignore responses of rules that were replaced meanwhile.
+  if (generation == status_generation) {
+    int64_t rx_time_us = deadline_us - delays_us[index];
+    count_response(index, err, sent_us - rx_time_us);
+  }
+  assert(xSemaphoreGive(status_mutex) == pdTRUE);
+}
+
+static void count_response(uint8_t index, esp_err_t err,
+                           int64_t latency_us) {
+  reflex_rule_status_t *rule_status = &status.rules[index];
+  if (err != ESP_OK) {
+    rule_status->failed += 1;
+    return;
+  }
+
+  uint32_t latency = latency_us > 0 ? latency_us : 0;
+  rule_status->sent += 1;
+  latency_sum_us[index] += latency;
+  rule_status->latency_avg_us = latency_sum_us[index] / rule_status->sent;
+  if (rule_status->sent == 1 || latency < rule_status->latency_min_us) {
+    rule_status->latency_min_us = latency;
+  }
+  if (latency > rule_status->latency_max_us) {
+    rule_status->latency_max_us = latency;
+  }
+}
+
+static bool parse_rule(char *text, reflex_rule_t *rule_out) {
+  memset(rule_out, 0, sizeof(*rule_out));
+
+  // Split into the trigger, the response and the delay.
+  // Comparisons may use `>` too, but responses don't.
+  char *response = strrchr(text, '>');
+  if (response == NULL) {
+    return false;
+  }
+  *response = '\0';
+  response += 1;
+  char *delay = strchr(response, '@');
+  if (delay != NULL) {
+    *delay = '\0';
+    delay += 1;
+  }
+  char *data = strchr(response, '#');
+  if (data == NULL) {
+    return false;
+  }
+  *data = '\0';
+  data += 1;
+
+  if (!capture_trigger_parse_one(text, &rule_out->match) ||
+      !text_parse_number(response, 16, CAN_EFF_MASK, &rule_out->response_id) ||
+      (delay != NULL &&
+       !text_parse_number(delay, 10, REFLEX_RULES_DELAY_MAX_US,
+                          &rule_out->delay_us))) {
+    return false;
+  }
+
+  // An empty `data` is a response without data bytes.
+  if (*data == '\0') {
+    return true;
+  }
+  char *saveptr;
+  for (char *byte = strtok_r(data, ".", &saveptr); byte != NULL;
+       byte = strtok_r(NULL, ".", &saveptr)) {
+    if (rule_out->response_len >= sizeof(rule_out->response) /
+                                      sizeof(rule_out->response[0]) ||
+        !parse_byte(byte, rule_out)) {
+      return false;
+    }
+    rule_out->response_len += 1;
+  }
+  return true;
+}
+
+static bool parse_byte(const char *text, reflex_rule_t *rule) {
+  reflex_byte_t *byte = &rule->response[rule->response_len];
+
+  if (strcmp(text, "++") == 0) {
+    *byte = (reflex_byte_t){.op = REFLEX_BYTE_COUNTER};
+    return true;
+  }
+
+  uint32_t value = 0;
+  if (text[0] != '$') {
+    if (!text_parse_number(text, 16, 0xFF, &value)) {
+      return false;
+    }
+    *byte = (reflex_byte_t){.op = REFLEX_BYTE_LITERAL, .value = value};
+    return true;
+  }
+
+  // `$N` or `$N+XX`, with a single digit `N`.
+  if (text[1] < '0' || text[1] > '7' ||
+      (text[2] != '\0' && text[2] != '+') ||
+      (text[2] == '+' && !text_parse_number(text + 3, 16, 0xFF, &value))) {
+    return false;
+  }
+  uint8_t source = text[1] - '0';
+  *byte = (reflex_byte_t){
+      .op = REFLEX_BYTE_COPY,
+      .source = source,
+      .value = value,
+  };
+
+  // Only match requests that have the byte.
+  if (source + 1 > rule->match.min_len) {
+    rule->match.min_len = source + 1;
+  }
+  return true;
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "capture_trigger.h"
+#include "driver/twai.h"
+#include "esp_err.h"
+
+// Answers requests from ECUs under test on the adapter itself,
+// within microseconds, instead of through a PC and two TCP hops.
+//
+// Each rule matches requests like a capture trigger, and transmits a
+// response built from literal bytes, bytes copied from the request,
+// optionally incremented, and a rolling counter. Rules are looked up in
+// an `id_match_table_t` by the `can_listener` task for every frame it
+// receives. Responses without a delay are transmitted right away,
+// delayed ones through the `tx_scheduler`. The latency from request to
+// response is reported per rule.
+
+// Maximum length of the textual rules, including the terminator.
+#define REFLEX_RULES_SPEC_LEN 256
+
+// Maximum number of rules.
+#define REFLEX_RULES_MAX 16
+
+// Longest delay of a response.
+#define REFLEX_RULES_DELAY_MAX_US 1000000
+
+typedef enum {
+  // `value`.
+  REFLEX_BYTE_LITERAL,
+
+  // Request byte `source` plus `value`.
+  REFLEX_BYTE_COPY,
+
+  // A counter that goes up by one with every response of the rule.
+  REFLEX_BYTE_COUNTER,
+} reflex_byte_op_t;
+
+// How one data byte of a response is made.
+typedef struct {
+  reflex_byte_op_t op;
+  uint8_t source;
+  uint8_t value;
+} reflex_byte_t;
+
+typedef struct {
+  // Matches requests. Its `min_len` covers every byte that's copied.
+  capture_trigger_t match;
+
+  // Extended if larger than 0x7FF, like in `< send >`.
+  uint32_t response_id;
+  uint8_t response_len;
+  reflex_byte_t response[8];
+
+  // How long after the request the response is transmitted.
+  uint32_t delay_us;
+} reflex_rule_t;
+
+typedef struct {
+  reflex_rule_t rules[REFLEX_RULES_MAX];
+  uint8_t count;
+} reflex_rules_t;
+
+// Counters of one rule since it was configured.
+typedef struct {
+  uint32_t matched;
+  uint32_t sent;
+
+  // Responses that couldn't be transmitted or scheduled.
+  uint32_t failed;
+
+  // Time from receiving the request
+  // to queueing the response for transmission.
+  uint32_t latency_min_us;
+  uint32_t latency_avg_us;
+  uint32_t latency_max_us;
+} reflex_rule_status_t;
+
+// The status of the rules.
+// Get the current status using `reflex_rules_get_status()`.
+typedef struct {
+  uint8_t count;
+  reflex_rule_status_t rules[REFLEX_RULES_MAX];
+} reflex_rules_status_t;
+
+// Parses the textual `spec` into `rules_out`.
+// Rules are separated by spaces. Each is a `capture_trigger_parse()`
+// trigger, `>`, the response as `ID#BYTES`, and an optional `@` and
+// delay in decimal µs. `BYTES` are separated by dots, and each is
+// hex, `$N` to copy request byte `N`, `$N+XX` to add `XX` to it,
+// or `++` for a rolling counter:
+//   7DF:0=02,1=01>7E8#06.$1+40.$2.00.00.00.00.00@500
+//   18DA10F1/1FFFFFFF>18DAF110#$0.++
+// Returns `ESP_ERR_INVALID_ARG` if `spec` is invalid.
+esp_err_t reflex_rules_parse(const char* spec, reflex_rules_t* rules_out);
+
+// Replaces the active rules with `rules`, and resets their counters.
+// Safe to call while frames are being checked.
+// Returns `ESP_ERR_NO_MEM` if the rules have too many distinct masks.
+esp_err_t reflex_rules_configure(const reflex_rules_t* rules);
+
+// Answers `msg`, received at `rx_time_us`, if it matches a rule.
+// Writes the responses that were transmitted right away to
+// `sent_out`, which must hold `REFLEX_RULES_MAX`, so the caller can
+// pass them on after `msg`.
+// Returns the number of responses written.
+// Only called by the `can_listener` task.
+uint8_t reflex_rules_check(const twai_message_t* msg, int64_t rx_time_us,
+                           twai_message_t* sent_out);
+
+// Fills `status_out` with the current `reflex_rules_status_t`.
+// Returns an error if no rules were ever configured.
+esp_err_t reflex_rules_get_status(reflex_rules_status_t* status_out);
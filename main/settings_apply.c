@@ -0,0 +1,259 @@
+#include "settings_apply.h"
+
+#include <string.h>
+
+#include "can_gateway.h"
+#include "cyphal_node.h"
+#include "driver_setup.h"
+#include "esp_log.h"
+#include "overload_control.h"
+#include "reflex_rules.h"
+#include "socketcand_server.h"
+#include "tx_rate_limit.h"
+
+// Name that will be used for logging
+static const char *TAG = "settings_apply";
+
+// Returns true if the two `esp_netif_ip_info_t` are different.
+static bool ip_info_changed(const esp_netif_ip_info_t *a,
+                            const esp_netif_ip_info_t *b);
+
+// Apply one group of settings each.
+static esp_err_t apply_can(const persistent_settings_t *old_settings,
+                           const persistent_settings_t *new_settings);
+static esp_err_t apply_cyphal(const persistent_settings_t *old_settings,
+                              const persistent_settings_t *new_settings);
+static esp_err_t apply_wifi(const persistent_settings_t *old_settings,
+                            const persistent_settings_t *new_settings);
+
+bool settings_apply_needs_reboot(const persistent_settings_t *old_settings,
+                                 const persistent_settings_t *new_settings) {
+  // The hostname is used by both interfaces,
+  // and only sent to DHCP servers when the lease starts.
+  if (strncmp(old_settings->hostname, new_settings->hostname,
+              sizeof(old_settings->hostname)) != 0) {
+    return true;
+  }
+
+  // Changing the ethernet address would break the HTTP connection
+  // this request came in on, so just reboot.
+  if (old_settings->eth_use_dhcp != new_settings->eth_use_dhcp ||
+      (!new_settings->eth_use_dhcp &&
+       ip_info_changed(&old_settings->eth_ip_info,
+                       &new_settings->eth_ip_info))) {
+    return true;
+  }
+
+  // Tasks are pinned and prioritized when they're created.
+  if (old_settings->task_profile != new_settings->task_profile) {
+    return true;
+  }
+
+  // Log redirection is set up once at boot.
+  if (old_settings->log_udp_ip.addr != new_settings->log_udp_ip.addr ||
+      old_settings->log_udp_port != new_settings->log_udp_port) {
+    return true;
+  }
+
+  // The cannelloni tasks are started once at boot.
+  if (old_settings->cannelloni_peer_ip.addr !=
+          new_settings->cannelloni_peer_ip.addr ||
+      old_settings->cannelloni_port != new_settings->cannelloni_port ||
+      old_settings->cannelloni_timeout_us !=
+          new_settings->cannelloni_timeout_us ||
+      old_settings->cannelloni_mtu != new_settings->cannelloni_mtu) {
+    return true;
+  }
+
+  // So is the multicast publisher.
+  if (old_settings->multicast_group.addr !=
+          new_settings->multicast_group.addr ||
+      old_settings->multicast_port != new_settings->multicast_port) {
+    return true;
+  }
+
+  // And the bridge.
+  if (old_settings->bridge_peer_ip.addr != new_settings->bridge_peer_ip.addr ||
+      old_settings->bridge_port != new_settings->bridge_port ||
+      strncmp(old_settings->bridge_rules, new_settings->bridge_rules,
+              sizeof(old_settings->bridge_rules)) != 0) {
+    return true;
+  }
+
+  // Triggers are armed once, before the capture ring takes the spare heap.
+  if (strncmp(old_settings->capture_triggers, new_settings->capture_triggers,
+              sizeof(old_settings->capture_triggers)) != 0) {
+    return true;
+  }
+
+  // So is the replay buffer.
+  if (old_settings->replay_buffer_kb != new_settings->replay_buffer_kb) {
+    return true;
+  }
+
+  return false;
+}
+
+esp_err_t settings_apply(const persistent_settings_t *old_settings,
+                         const persistent_settings_t *new_settings) {
+  esp_err_t first_err = ESP_OK;
+
+  esp_err_t err = apply_can(old_settings, new_settings);
+  if (first_err == ESP_OK) {
+    first_err = err;
+  }
+
+  err = apply_cyphal(old_settings, new_settings);
+  if (first_err == ESP_OK) {
+    first_err = err;
+  }
+
+  err = apply_wifi(old_settings, new_settings);
+  if (first_err == ESP_OK) {
+    first_err = err;
+  }
+
+  // Only affects clients that connect from now on.
+  socketcand_server_set_fast_path(new_settings->socketcand_fast_path);
+  socketcand_server_set_client_defaults(new_settings->client_queue_depth,
+                                        new_settings->client_overflow);
+
+  if (memcmp(old_settings->overload_policies, new_settings->overload_policies,
+             sizeof(old_settings->overload_policies)) != 0 ||
+      old_settings->overload_low_priority_id !=
+          new_settings->overload_low_priority_id) {
+    overload_control_configure(new_settings->overload_policies,
+                               new_settings->overload_low_priority_id);
+  }
+
+  if (strncmp(old_settings->reflex_rules, new_settings->reflex_rules,
+              sizeof(old_settings->reflex_rules)) != 0) {
+    // Too large for the stack. Only one settings change is applied at once.
+    static reflex_rules_t reflex_rules;
+    err = reflex_rules_parse(new_settings->reflex_rules, &reflex_rules);
+    if (err == ESP_OK) {
+      err = reflex_rules_configure(&reflex_rules);
+    }
+    if (err != ESP_OK) {
+      ESP_LOGE(TAG, "Couldn't configure reflex rules: %s",
+               esp_err_to_name(err));
+      if (first_err == ESP_OK) {
+        first_err = err;
+      }
+    }
+  }
+
+  if (strncmp(old_settings->tx_rate_limits, new_settings->tx_rate_limits,
+              sizeof(old_settings->tx_rate_limits)) != 0) {
+    tx_rate_limits_t limits;
+    err = tx_rate_limit_parse(new_settings->tx_rate_limits, &limits);
+    if (err == ESP_OK) {
+      err = tx_rate_limit_configure(&limits);
+    }
+    if (err != ESP_OK) {
+      ESP_LOGE(TAG, "Couldn't configure TX rate limits: %s",
+               esp_err_to_name(err));
+      if (first_err == ESP_OK) {
+        first_err = err;
+      }
+    }
+  }
+
+  if (strncmp(old_settings->gateway_rules, new_settings->gateway_rules,
+              sizeof(old_settings->gateway_rules)) != 0) {
+    // Too large for the stack. Only one settings change is applied at once.
+    static can_gateway_rules_t gateway_rules;
+    err = can_gateway_parse(new_settings->gateway_rules, &gateway_rules);
+    if (err == ESP_OK) {
+      err = can_gateway_configure(&gateway_rules);
+    }
+    if (err != ESP_OK) {
+      ESP_LOGE(TAG, "Couldn't configure gateway rules: %s",
+               esp_err_to_name(err));
+      if (first_err == ESP_OK) {
+        first_err = err;
+      }
+    }
+  }
+
+  return first_err;
+}
+
+static bool ip_info_changed(const esp_netif_ip_info_t *a,
+                            const esp_netif_ip_info_t *b) {
+  return a->ip.addr != b->ip.addr || a->netmask.addr != b->netmask.addr ||
+         a->gw.addr != b->gw.addr;
+}
+
+static esp_err_t apply_can(const persistent_settings_t *old_settings,
+                           const persistent_settings_t *new_settings) {
+  if (old_settings->can_bitrate == new_settings->can_bitrate) {
+    return ESP_OK;
+  }
+
+  twai_timing_config_t timing_config;
+  esp_err_t err = persistent_settings_get_timing_config(
+      new_settings->can_bitrate, &timing_config);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Invalid CAN bitrate %d.", new_settings->can_bitrate);
+    return err;
+  }
+
+  err = driver_setup_can_reconfigure(&timing_config, TWAI_MODE_NORMAL);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Couldn't change CAN bitrate: %s", esp_err_to_name(err));
+    return err;
+  }
+
+  ESP_LOGI(TAG, "Changed CAN bitrate from %d to %d kbit/s.",
+           old_settings->can_bitrate, new_settings->can_bitrate);
+  return ESP_OK;
+}
+
+static esp_err_t apply_cyphal(const persistent_settings_t *old_settings,
+                              const persistent_settings_t *new_settings) {
+  if (!new_settings->enable_cyphal) {
+    if (old_settings->enable_cyphal) {
+      return cyphal_node_stop();
+    }
+    return ESP_OK;
+  }
+
+  if (old_settings->enable_cyphal &&
+      old_settings->cyphal_node_id == new_settings->cyphal_node_id) {
+    return ESP_OK;
+  }
+
+  return cyphal_node_start(new_settings->cyphal_node_id);
+}
+
+static esp_err_t apply_wifi(const persistent_settings_t *old_settings,
+                            const persistent_settings_t *new_settings) {
+  bool changed =
+      old_settings->wifi_enabled != new_settings->wifi_enabled ||
+      strncmp(old_settings->wifi_ssid, new_settings->wifi_ssid,
+              sizeof(old_settings->wifi_ssid)) != 0 ||
+      strncmp(old_settings->wifi_pass, new_settings->wifi_pass,
+              sizeof(old_settings->wifi_pass)) != 0 ||
+      old_settings->wifi_use_dhcp != new_settings->wifi_use_dhcp ||
+      (!new_settings->wifi_use_dhcp &&
+       ip_info_changed(&old_settings->wifi_ip_info,
+                       &new_settings->wifi_ip_info));
+
+  if (!changed) {
+    return ESP_OK;
+  }
+
+  const esp_netif_ip_info_t *ip_info = NULL;
+  if (!new_settings->wifi_use_dhcp) {
+    ip_info = &new_settings->wifi_ip_info;
+  }
+
+  esp_err_t err = driver_setup_wifi_reconfigure(
+      new_settings->wifi_enabled, ip_info, new_settings->hostname,
+      new_settings->wifi_ssid, new_settings->wifi_pass);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Couldn't apply Wi-Fi settings: %s", esp_err_to_name(err));
+  }
+  return err;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "esp_err.h"
+#include "persistent_settings.h"
+
+// Applies changed persistent settings at runtime,
+// so that most settings changes don't need a reboot.
+//
+// Changes to the CAN bitrate reinstall the CAN driver,
+// changes to the OpenCyphal node start, stop or renumber it,
+// changes to Wi-Fi reconnect only Wi-Fi,
+// changes to reflex rules, TX rate limits, gateway rules
+// and overload policies replace them,
+// and changes to client defaults apply to new clients.
+// socketcand clients stay connected through all of these,
+// unless they're connected over Wi-Fi and Wi-Fi changed.
+//
+// Changes to the hostname, ethernet, UDP log sink, task profile,
+// cannelloni, multicast publisher, bridge, capture triggers
+// or `replay_buffer_kb` still need a reboot.
+
+// Returns true if going from `old_settings` to `new_settings`
+// needs a reboot, and can't be done by `settings_apply()`.
+bool settings_apply_needs_reboot(const persistent_settings_t* old_settings,
+                                 const persistent_settings_t* new_settings);
+
+// Applies every difference between `old_settings` and `new_settings`.
+// Must only be called if `settings_apply_needs_reboot()` returned false.
+// Keeps applying the other settings if one of them fails,
+// and returns the first error.
+esp_err_t settings_apply(const persistent_settings_t* old_settings,
+                         const persistent_settings_t* new_settings);
@@ -0,0 +1,628 @@
+#include "signal_decoder.h"
+
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "can_listener.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "id_match_table.h"
+#include "stdatomic.h"
+#include "task_config.h"
+#include "text_parse.h"
+
+_Static_assert(SIGNAL_DECODER_MESSAGES_MAX <= ID_MATCH_TABLE_ENTRIES_MAX,
+               "Every message needs an entry in the match table");
+
+// Longest interval of a signal, in ms.
+#define INTERVAL_MS_MAX 60000
+
+// A signal, with its bit-extraction descriptor.
+typedef struct {
+  char name[SIGNAL_DECODER_NAME_LEN];
+  char unit[SIGNAL_DECODER_UNIT_LEN];
+
+  // The ID of its message, with `CAN_EFF_FLAG` if it's extended.
+  uint32_t key;
+
+  // The raw value is `(data >> shift) & mask`, where `data` are the
+  // data bytes loaded as a little-endian or big-endian 64-bit number.
+  // Frames with less than `min_len` data bytes don't carry it.
+  bool big_endian;
+  bool is_signed;
+  uint8_t shift;
+  uint8_t min_len;
+  uint64_t mask;
+
+  float scale;
+  float offset;
+
+  // 0 to publish the signal when it changes.
+  uint16_t interval_ms;
+} signal_t;
+
+typedef struct {
+  // Sorted by `key` when loading ends.
+  signal_t signals[SIGNAL_DECODER_SIGNALS_MAX];
+  uint8_t signal_count;
+
+  // Signals of message `i` are `message_start[i]` up to
+  // `message_start[i + 1]`. The match table maps keys to messages.
+  uint8_t message_start[SIGNAL_DECODER_MESSAGES_MAX + 1];
+  uint8_t message_count;
+  id_match_table_t table;
+} signal_table_t;
+
+// What's known about the value of a signal.
+typedef struct {
+  float value;
+  bool received;
+
+  // Set when a frame carried the signal since it was last published.
+  bool fresh;
+
+  // Set once the signal was published, with the value and the time.
+  bool published;
+  float published_value;
+  int64_t published_us;
+} signal_value_t;
+
+// Name that will be used for logging
+static const char *TAG = "signal_decoder";
+
+// The table being loaded, only used by the loading task.
+static signal_table_t loading_table;
+static esp_err_t load_err = ESP_OK;
+static uint32_t load_line = 0;
+static char carry[SIGNAL_DECODER_LINE_LEN + 1];
+static size_t carry_len = 0;
+
+// Guards everything below.
+static SemaphoreHandle_t table_mutex = NULL;
+static StaticSemaphore_t table_mutex_mem;
+
+static bool loaded = false;
+static signal_table_t table;
+static signal_value_t values[SIGNAL_DECODER_SIGNALS_MAX];
+static signal_decoder_status_t status = {0};
+
+// The update being published. Fits every signal, with the longest
+// name and value.
+static char update[SIGNAL_DECODER_UPDATE_LEN];
+_Static_assert(SIGNAL_DECODER_UPDATE_LEN >
+                   32 + SIGNAL_DECODER_SIGNALS_MAX *
+                            (SIGNAL_DECODER_NAME_LEN + 20),
+               "Updates must fit every signal");
+
+static _Atomic(signal_decoder_hook_t) publish_hook = NULL;
+
+// Queue of `can_listener_frame_t` incoming from the CAN bus.
+// Only loaned once a table was loaded.
+static QueueHandle_t can_rx_queue = NULL;
+
+static const can_listener_options_t can_rx_queue_options = {
+    .depth = CAN_LISTENER_DEFAULT_DEPTH,
+    .overflow = CAN_LISTENER_OVERFLOW_DROP_OLDEST,
+    .owner = "signal_decoder",
+};
+
+// Task that decodes frames and publishes the values.
+static void signal_decoder_task(void *pvParameters);
+static StackType_t signal_decoder_task_stack[4096];
+static StaticTask_t signal_decoder_task_mem;
+static TaskHandle_t signal_decoder_task_handle = NULL;
+
+// Parses `line` of the table into `loading_table`.
+static esp_err_t parse_line(char *line);
+
+// Parses the bits of a signal, like `24|16@1+`, into `signal`.
+static bool parse_bits(const char *text, signal_t *signal);
+
+// Parses `text` as a finite number.
+static bool parse_float(const char *text, float *value_out);
+
+// Sorts `loading_table` by message, and builds its match table.
+static esp_err_t compile_table(void);
+
+// Decodes the signals of `frame` into `values`.
+// Must be called with `table_mutex` held.
+static void decode(const can_listener_frame_t *frame);
+
+// Hands the values that are due at `now` to the hook.
+// Must be called with `table_mutex` held.
+static void publish(int64_t now);
+
+// Returns true if the value of `signal` is due at `now`.
+static bool is_due(const signal_t *signal, const signal_value_t *value,
+                   int64_t now);
+
+// Writes `value` to `buf` as a JSON number, or `null` if it has none.
+static int format_value(char *buf, size_t buf_len, float value);
+
+esp_err_t signal_decoder_start(void) {
+  table_mutex = xSemaphoreCreateMutexStatic(&table_mutex_mem);
+  if (table_mutex == NULL) {
+    ESP_LOGE(TAG, "Unreachable. Decoder mutex couldn't be created.");
+    return ESP_FAIL;
+  }
+
+  signal_decoder_task_handle = task_config_create_static(
+      TASK_ID_SIGNAL_DECODER, signal_decoder_task,
+      sizeof(signal_decoder_task_stack), NULL, signal_decoder_task_stack,
+      &signal_decoder_task_mem);
+  return ESP_OK;
+}
+
+void signal_decoder_set_hook(signal_decoder_hook_t hook) {
+  atomic_store(&publish_hook, hook);
+}
+
+esp_err_t signal_decoder_load_begin(void) {
+  if (table_mutex == NULL) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  memset(&loading_table, 0, sizeof(loading_table));
+  load_err = ESP_OK;
+  load_line = 0;
+  carry_len = 0;
+  return ESP_OK;
+}
+
+esp_err_t signal_decoder_load_data(const char *data, size_t len) {
+  if (load_err != ESP_OK) {
+    return load_err;
+  }
+  for (size_t i = 0; i < len && load_err == ESP_OK; i++) {
+    if (data[i] == '\n') {
+      carry[carry_len] = '\0';
+      carry_len = 0;
+      load_err = parse_line(carry);
+    } else if (carry_len < SIGNAL_DECODER_LINE_LEN) {
+      carry[carry_len] = data[i];
+      carry_len += 1;
+    } else {
+      load_line += 1;
+      load_err = ESP_ERR_INVALID_ARG;
+    }
+  }
+  if (load_err != ESP_OK) {
+    ESP_LOGW(TAG, "Line %lu of the signal table is invalid.", load_line);
+  }
+  return load_err;
+}
+
+esp_err_t signal_decoder_load_end(void) {
+  if (load_err == ESP_OK && carry_len > 0) {
+    // The last line may lack its newline.
+    carry[carry_len] = '\0';
+    carry_len = 0;
+    load_err = parse_line(carry);
+    if (load_err != ESP_OK) {
+      ESP_LOGW(TAG, "Line %lu of the signal table is invalid.", load_line);
+    }
+  }
+  if (load_err == ESP_OK) {
+    load_err = compile_table();
+  }
+  if (load_err != ESP_OK) {
+    return load_err;
+  }
+
+  // Frames are only taken from the bus once there's something to decode.
+  if (can_rx_queue == NULL) {
+    esp_err_t err = can_listener_get(&can_rx_queue_options, &can_rx_queue);
+    if (err != ESP_OK) {
+      ESP_LOGE(TAG, "Couldn't get CAN receive queue: %s",
+               esp_err_to_name(err));
+      return err;
+    }
+    // Dashboards are shed first when the adapter is overloaded.
+    can_listener_set_class(can_rx_queue, CAN_LISTENER_CLASS_BEST_EFFORT);
+    xTaskNotifyGive(signal_decoder_task_handle);
+  }
+
+  assert(xSemaphoreTake(table_mutex, portMAX_DELAY) == pdTRUE);
+  loaded = true;
+  table = loading_table;
+  memset(values, 0, sizeof(values));
+  status = (signal_decoder_status_t){
+      .signals = table.signal_count,
+      .messages = table.message_count,
+  };
+  assert(xSemaphoreGive(table_mutex) == pdTRUE);
+
+  ESP_LOGI(TAG, "Loaded %d signals of %d messages.",
+           loading_table.signal_count, loading_table.message_count);
+  return ESP_OK;
+}
+
+void signal_decoder_publish_all(void) {
+  if (table_mutex == NULL) {
+    return;
+  }
+  assert(xSemaphoreTake(table_mutex, portMAX_DELAY) == pdTRUE);
+  for (uint8_t i = 0; i < table.signal_count; i++) {
+    values[i].fresh = values[i].received;
+    values[i].published = false;
+  }
+  assert(xSemaphoreGive(table_mutex) == pdTRUE);
+}
+
+esp_err_t signal_decoder_values_json(char *buf, size_t buf_len) {
+  if (table_mutex == NULL) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  assert(xSemaphoreTake(table_mutex, portMAX_DELAY) == pdTRUE);
+  size_t len = snprintf(buf, buf_len, "{");
+  for (uint8_t i = 0; i < table.signal_count && len < buf_len; i++) {
+    const signal_t *signal = &table.signals[i];
+    len += snprintf(buf + len, buf_len - len, "%s\"%s\": {\"value\": ",
+                    i > 0 ? ", " : "", signal->name);
+    if (len >= buf_len) {
+      break;
+    }
+    len += format_value(buf + len, buf_len - len,
+                        values[i].received ? values[i].value : NAN);
+    if (len >= buf_len) {
+      break;
+    }
+    len += snprintf(buf + len, buf_len - len, ", \"unit\": \"%s\"}",
+                    signal->unit);
+  }
+  if (len < buf_len) {
+    len += snprintf(buf + len, buf_len - len, "}");
+  }
+  assert(xSemaphoreGive(table_mutex) == pdTRUE);
+
+  return len < buf_len ? ESP_OK : ESP_ERR_INVALID_SIZE;
+}
+
+esp_err_t signal_decoder_get_status(signal_decoder_status_t *status_out) {
+  if (table_mutex == NULL) {
+    return ESP_FAIL;
+  }
+
+  assert(xSemaphoreTake(table_mutex, portMAX_DELAY) == pdTRUE);
+  bool was_loaded = loaded;
+  *status_out = status;
+  assert(xSemaphoreGive(table_mutex) == pdTRUE);
+
+  return was_loaded ? ESP_OK : ESP_FAIL;
+}
+
+static void signal_decoder_task(void *pvParameters) {
+  // Wait for the first table.
+  ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+  const int64_t period_us = SIGNAL_DECODER_PERIOD_MS * 1000;
+  int64_t next_publish_us = esp_timer_get_time() + period_us;
+  while (true) {
+    can_listener_frame_t frame;
+    bool received =
+        can_listener_receive_until(can_rx_queue, next_publish_us, &frame);
+
+    int64_t now = esp_timer_get_time();
+    bool publishing = now >= next_publish_us;
+    if (!received && !publishing) {
+      continue;
+    }
+
+    assert(xSemaphoreTake(table_mutex, portMAX_DELAY) == pdTRUE);
+    if (received) {
+      decode(&frame);
+    }
+    if (publishing) {
+      publish(now);
+    }
+    assert(xSemaphoreGive(table_mutex) == pdTRUE);
+
+    if (publishing) {
+      // Skip periods that were missed, instead of catching up.
+      next_publish_us += period_us;
+      if (next_publish_us <= now) {
+        next_publish_us = now + period_us;
+      }
+    }
+  }
+}
+
+static void decode(const can_listener_frame_t *frame) {
+  const twai_message_t *msg = &frame->msg;
+  if (msg->rtr || (msg->identifier & CAN_LISTENER_ERR_FLAG)) {
+    return;
+  }
+
+  uint32_t key = msg->identifier & CAN_EFF_MASK;
+  if (msg->extd) {
+    key |= CAN_EFF_FLAG;
+  }
+  uint16_t message;
+  if (id_match_table_lookup(&table.table, key, &message, 1) == 0) {
+    return;
+  }
+
+  // Load the data bytes both ways once, for all signals of the message.
+  uint8_t len = msg->data_length_code;
+  if (len > TWAI_FRAME_MAX_DLC) {
+    len = TWAI_FRAME_MAX_DLC;
+  }
+  uint64_t little = 0;
+  uint64_t big = 0;
+  for (uint8_t i = 0; i < len; i++) {
+    little |= (uint64_t)msg->data[i] << (8 * i);
+    big |= (uint64_t)msg->data[i] << (56 - 8 * i);
+  }
+
+  bool too_short = false;
+  for (uint8_t i = table.message_start[message];
+       i < table.message_start[message + 1]; i++) {
+    const signal_t *signal = &table.signals[i];
+    if (signal->min_len > len) {
+      too_short = true;
+      continue;
+    }
+
+    uint64_t raw = ((signal->big_endian ? big : little) >> signal->shift) &
+                   signal->mask;
+    float value;
+    if (signal->is_signed && (raw & ~(signal->mask >> 1)) != 0) {
+      // The sign bit is set. Extend it.
+      value = (float)(int64_t)(raw | ~signal->mask);
+    } else {
+      value = (float)raw;
+    }
+
+    signal_value_t *signal_value = &values[i];
+    signal_value->value = value * signal->scale + signal->offset;
+    signal_value->received = true;
+    signal_value->fresh = true;
+  }
+
+  status.frames_decoded += 1;
+  if (too_short) {
+    status.frames_too_short += 1;
+  }
+}
+
+static void publish(int64_t now) {
+  signal_decoder_hook_t hook = atomic_load(&publish_hook);
+  if (hook == NULL) {
+    return;
+  }
+
+  bool due[SIGNAL_DECODER_SIGNALS_MAX];
+  uint8_t due_count = 0;
+  int len = snprintf(update, sizeof(update), "{\"t\": %lld", now / 1000);
+  for (uint8_t i = 0; i < table.signal_count; i++) {
+    due[i] = is_due(&table.signals[i], &values[i], now);
+    if (!due[i]) {
+      continue;
+    }
+    len += snprintf(update + len, sizeof(update) - len, ", \"%s\": ",
+                    table.signals[i].name);
+    len += format_value(update + len, sizeof(update) - len, values[i].value);
+    due_count += 1;
+  }
+  if (due_count == 0) {
+    return;
+  }
+  snprintf(update + len, sizeof(update) - len, "}");
+
+  if (hook(update) != ESP_OK) {
+    status.updates_deferred += 1;
+    return;
+  }
+
+  for (uint8_t i = 0; i < table.signal_count; i++) {
+    if (due[i]) {
+      values[i].fresh = false;
+      values[i].published = true;
+      values[i].published_value = values[i].value;
+      values[i].published_us = now;
+    }
+  }
+  status.updates_published += 1;
+  status.values_published += due_count;
+}
+
+static bool is_due(const signal_t *signal, const signal_value_t *value,
+                   int64_t now) {
+  if (!value->fresh) {
+    return false;
+  }
+  if (!value->published) {
+    return true;
+  }
+  if (signal->interval_ms == 0) {
+    return value->value != value->published_value;
+  }
+  return now - value->published_us >= signal->interval_ms * 1000LL;
+}
+
+static int format_value(char *buf, size_t buf_len, float value) {
+  if (!isfinite(value)) {
+    return snprintf(buf, buf_len, "null");
+  }
+  return snprintf(buf, buf_len, "%.7g", value);
+}
+
+static esp_err_t compile_table(void) {
+  signal_table_t *t = &loading_table;
+
+  // Names are the keys of updates, so they must be unique.
+  for (uint8_t i = 0; i < t->signal_count; i++) {
+    for (uint8_t j = i + 1; j < t->signal_count; j++) {
+      if (strcmp(t->signals[i].name, t->signals[j].name) == 0) {
+        ESP_LOGW(TAG, "Signal %s is in the table twice.", t->signals[i].name);
+        return ESP_ERR_INVALID_ARG;
+      }
+    }
+  }
+
+  // Sort the signals by message, keeping their order within it.
+  for (uint8_t i = 1; i < t->signal_count; i++) {
+    signal_t signal = t->signals[i];
+    uint8_t j = i;
+    for (; j > 0 && t->signals[j - 1].key > signal.key; j--) {
+      t->signals[j] = t->signals[j - 1];
+    }
+    t->signals[j] = signal;
+  }
+
+  id_match_table_init(&t->table);
+  t->message_count = 0;
+  for (uint8_t i = 0; i < t->signal_count; i++) {
+    if (i > 0 && t->signals[i].key == t->signals[i - 1].key) {
+      continue;
+    }
+    if (t->message_count >= SIGNAL_DECODER_MESSAGES_MAX) {
+      ESP_LOGW(TAG, "The signal table has more than %d messages.",
+               SIGNAL_DECODER_MESSAGES_MAX);
+      return ESP_ERR_NO_MEM;
+    }
+    t->message_start[t->message_count] = i;
+    esp_err_t err = id_match_table_add(&t->table, t->signals[i].key,
+                                       UINT32_MAX, t->message_count);
+    if (err != ESP_OK) {
+      return err;
+    }
+    t->message_count += 1;
+  }
+  t->message_start[t->message_count] = t->signal_count;
+  id_match_table_compile(&t->table);
+
+  return ESP_OK;
+}
+
+static esp_err_t parse_line(char *line) {
+  load_line += 1;
+
+  char *saveptr;
+  const char *id = strtok_r(line, " \t\r", &saveptr);
+  if (id == NULL || id[0] == '#') {
+    return ESP_OK;
+  }
+  if (loading_table.signal_count >= SIGNAL_DECODER_SIGNALS_MAX) {
+    return ESP_ERR_NO_MEM;
+  }
+  signal_t *signal = &loading_table.signals[loading_table.signal_count];
+  memset(signal, 0, sizeof(*signal));
+
+  if (!text_parse_number(id, 16, CAN_EFF_MASK, &signal->key)) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (strlen(id) == 8) {
+    signal->key |= CAN_EFF_FLAG;
+  } else if (signal->key > CAN_SFF_MASK) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  const char *name = strtok_r(NULL, " \t\r", &saveptr);
+  if (name == NULL || strlen(name) >= sizeof(signal->name)) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  for (const char *c = name; *c != '\0'; c++) {
+    if (!isalnum((unsigned char)*c) && *c != '_') {
+      return ESP_ERR_INVALID_ARG;
+    }
+  }
+  strcpy(signal->name, name);
+
+  const char *bits = strtok_r(NULL, " \t\r", &saveptr);
+  const char *scale = strtok_r(NULL, " \t\r", &saveptr);
+  const char *offset = strtok_r(NULL, " \t\r", &saveptr);
+  if (bits == NULL || !parse_bits(bits, signal) || scale == NULL ||
+      !parse_float(scale, &signal->scale) || offset == NULL ||
+      !parse_float(offset, &signal->offset)) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  // The unit and the interval are optional, in that order.
+  const char *option = strtok_r(NULL, " \t\r", &saveptr);
+  if (option != NULL && option[0] != '@') {
+    if (strlen(option) >= sizeof(signal->unit)) {
+      return ESP_ERR_INVALID_ARG;
+    }
+    for (const char *c = option; *c != '\0'; c++) {
+      if (!isprint((unsigned char)*c) || *c == '"' || *c == '\\') {
+        return ESP_ERR_INVALID_ARG;
+      }
+    }
+    strcpy(signal->unit, option);
+    option = strtok_r(NULL, " \t\r", &saveptr);
+  }
+  if (option != NULL) {
+    uint32_t interval_ms;
+    if (option[0] != '@' ||
+        !text_parse_number(option + 1, 10, INTERVAL_MS_MAX, &interval_ms) ||
+        interval_ms == 0) {
+      return ESP_ERR_INVALID_ARG;
+    }
+    signal->interval_ms = interval_ms;
+  }
+  if (strtok_r(NULL, " \t\r", &saveptr) != NULL) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  loading_table.signal_count += 1;
+  return ESP_OK;
+}
+
+static bool parse_bits(const char *text, signal_t *signal) {
+  char *end;
+  unsigned long start = strtoul(text, &end, 10);
+  if (end == text || *end != '|') {
+    return false;
+  }
+  const char *length_text = end + 1;
+  unsigned long length = strtoul(length_text, &end, 10);
+  if (end == length_text || end[0] != '@' ||
+      (end[1] != '0' && end[1] != '1') || (end[2] != '+' && end[2] != '-') ||
+      end[3] != '\0' || start > 63 || length < 1 || length > 64) {
+    return false;
+  }
+
+  signal->big_endian = end[1] == '0';
+  signal->is_signed = end[2] == '-';
+  signal->mask = length == 64 ? UINT64_MAX : (1ULL << length) - 1;
+
+  if (!signal->big_endian) {
+    // `start` is the least significant bit, counting from bit 0 of the
+    // first byte, which is bit 0 of the little-endian number.
+    if (start + length > 64) {
+      return false;
+    }
+    signal->shift = start;
+    signal->min_len = (start + length + 7) / 8;
+    return true;
+  }
+
+  // `start` is the most significant bit, counting bits within each byte
+  // from the least significant one, and bytes from the first one.
+  // The first byte is the most significant of the big-endian number.
+  unsigned long msb = (7 - start / 8) * 8 + start % 8;
+  if (msb + 1 < length) {
+    return false;
+  }
+  signal->shift = msb + 1 - length;
+  signal->min_len = 8 - signal->shift / 8;
+  return true;
+}
+
+static bool parse_float(const char *text, float *value_out) {
+  char *end;
+  float value = strtof(text, &end);
+  if (end == text || *end != '\0' || !isfinite(value)) {
+    return false;
+  }
+  *value_out = value;
+  return true;
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+// Decodes signals from frames on the bus into physical values on the
+// adapter, so dashboards can show a few gauges without every frame of
+// the bus being shipped to a PC first.
+//
+// The signals are uploaded as a table derived from a DBC file, with
+// `tools/dbc_signals.py`. Each signal is compiled into a bit-extraction
+// descriptor, the signals of a message are kept together, and frames
+// are dispatched to their message with an `id_match_table_t`.
+//
+// Every `SIGNAL_DECODER_PERIOD_MS` the values that are due are handed
+// to a hook as one JSON update. A signal is due when it changed since
+// it was last published, or, if it has an interval, when the interval
+// has passed and a new frame carried it.
+
+// Maximum number of signals, and of messages carrying them.
+#define SIGNAL_DECODER_SIGNALS_MAX 64
+#define SIGNAL_DECODER_MESSAGES_MAX 32
+
+// Maximum length of a signal name and of a unit, including the
+// terminator.
+#define SIGNAL_DECODER_NAME_LEN 24
+#define SIGNAL_DECODER_UNIT_LEN 12
+
+// Maximum length of a line of the table, without the newline.
+#define SIGNAL_DECODER_LINE_LEN 127
+
+// How often updates are published.
+#define SIGNAL_DECODER_PERIOD_MS 50
+
+// Maximum length of an update, and of `signal_decoder_values_json()`,
+// including the terminator. Both fit every signal.
+#define SIGNAL_DECODER_UPDATE_LEN 3072
+#define SIGNAL_DECODER_VALUES_LEN 5632
+
+// The status of the decoder.
+// Get the current status using `signal_decoder_get_status()`.
+typedef struct {
+  uint8_t signals;
+  uint8_t messages;
+
+  // Frames of a message in the table.
+  uint64_t frames_decoded;
+
+  // Frames too short for some of their signals,
+  // which keep their previous values.
+  uint64_t frames_too_short;
+
+  // Updates handed to the hook, and the values in them.
+  uint64_t updates_published;
+  uint64_t values_published;
+
+  // Updates the hook couldn't take, and were offered again later.
+  uint64_t updates_deferred;
+} signal_decoder_status_t;
+
+// Publishes an update of the values that are due, like
+//   {"t": 123456, "EngineSpeed": 1520.25, "Gear": 3}
+// where `t` is `esp_timer_get_time()` in ms.
+// Returns `ESP_ERR_INVALID_STATE` if it can't take the update now,
+// so the values stay due. Runs on the decoder task.
+typedef esp_err_t (*signal_decoder_hook_t)(const char* update);
+
+// Starts the decoder task, which waits for the first table.
+// Must only be called once.
+esp_err_t signal_decoder_start(void);
+
+// Sets the hook that publishes updates, or NULL for none.
+void signal_decoder_set_hook(signal_decoder_hook_t hook);
+
+// Starts loading a new table. The current one stays active until
+// `signal_decoder_load_end()`.
+esp_err_t signal_decoder_load_begin(void);
+
+// Parses the next `len` bytes of the table. The table may be split
+// anywhere. It has one signal per line:
+//   <ID> <name> <start>|<length>@<order><sign> <scale> <offset>
+//       [unit] [@interval_ms]
+// The ID is hex, and extended if it has 8 digits, as in candump.
+// The bits are as in a DBC `SG_` line: `1` is little-endian (Intel),
+// `0` big-endian (Motorola), `+` unsigned and `-` signed. Signals
+// without an interval are published when they change. Blank lines
+// and lines starting with `#` are ignored:
+//   0C4 EngineSpeed 24|16@1+ 0.25 0 rpm
+//   18FEF100 WheelSpeed 8|16@1+ 0.00390625 0 km/h @200
+// Returns `ESP_ERR_INVALID_ARG` if a line is malformed,
+// and `ESP_ERR_NO_MEM` if there are too many signals.
+esp_err_t signal_decoder_load_data(const char* data, size_t len);
+
+// Makes the loaded table active, forgetting all values.
+// Returns `ESP_ERR_INVALID_ARG` if it ended in a malformed line or a
+// name repeats, and `ESP_ERR_NO_MEM` if there are too many messages.
+esp_err_t signal_decoder_load_end(void);
+
+// Publishes every value that was received with the next update,
+// for a client that just subscribed.
+void signal_decoder_publish_all(void);
+
+// Writes the latest value and the unit of every signal to `buf` as
+// JSON, like
+//   {"EngineSpeed": {"value": 1520.25, "unit": "rpm"}}
+// with a `null` value for signals that weren't received yet.
+// `buf_len` should be `SIGNAL_DECODER_VALUES_LEN`.
+esp_err_t signal_decoder_values_json(char* buf, size_t buf_len);
+
+// Fills `status_out` with the current `signal_decoder_status_t`.
+// Returns an error if no table was ever loaded.
+esp_err_t signal_decoder_get_status(signal_decoder_status_t* status_out);
@@ -1,13 +1,26 @@
 #include "socketcand_server.h"
 
+#include <string.h>
+
+#include "boot_timeline.h"
+#include "can_gateway.h"
 #include "can_listener.h"
+#include "deferred_log.h"
+#include "driver_setup.h"
 #include "driver/twai.h"
+#include "esp_check.h"
 #include "esp_intr_alloc.h"
 #include "esp_log.h"
 #include "esp_timer.h"
 #include "frame_io.h"
 #include "lwip/sockets.h"
+#include "socketcand_session.h"
 #include "socketcand_translate.h"
+#include "stdatomic.h"
+#include "task_config.h"
+#include "trace_buffer.h"
+#include "tx_rate_limit.h"
+#include "tx_scheduler.h"
 
 // Name that will be used for logging
 static const char *TAG = "socketcand_server";
@@ -20,15 +33,35 @@ static const char *TAG = "socketcand_server";
 // Stack size allocated for every FreeRTOS task.
 #define STACK_SIZE 4096
 
-// Set the `twai_message_t` `data_length_code` to this value
+// Set the `can_listener_frame_t` `msg.data_length_code` to this value
 // to indicate this isn't a CAN bus frame.
 // If a task pops this off the queue, that means it should
 // exit and disconnect from its TCP client.
 #define CAN_INTERRUPT_FRAME 0xff
 
+// Number of frames that can wait in `fast_ring` for the
+// `fast_writer_task`. Must be a power of two.
+#define FAST_RING_LEN 128
+
+// Size of the buffer in which the `fast_writer_task` batches
+// frames for one client before writing them to TCP at once.
+#define FAST_BATCH_LEN 1024
+
+// How long the `fast_writer_task` may block writing to one client.
+// Clients that take longer are disconnected, so one client that
+// stops reading can't hold up the others.
+#define FAST_SEND_TIMEOUT_MS 100
+
+// How often parked sessions are checked for expiry, in seconds.
+#define SESSION_REAP_PERIOD_S 1
+
+// How long a resume waits for the old connection of a session
+// to notice that it's gone.
+#define RESUME_TIMEOUT_MS 1000
+
 // Data that each client handler gets a pointer to.
 typedef struct {
-  // Queue of `twai_message_t` incoming from the CAN bus.
+  // Queue of `can_listener_frame_t` incoming from the CAN bus.
   // Initialized using `can_listener_get()`.
   QueueHandle_t can_rx_queue;
 
@@ -56,6 +89,49 @@ typedef struct {
   // FreeRTOS memory for the second task serving this client.
   StaticTask_t free_rtos_mem_2;
 
+  // True if frames are written to this client by the `fast_writer_task`
+  // instead of its own `bus_to_socketcand_task`.
+  // Only changed while holding `handler_task_delete_mutex`.
+  atomic_bool fast;
+
+  // Frames formatted by the `fast_writer_task`
+  // that haven't been written to TCP yet.
+  // Only used by the `fast_writer_task`.
+  char fast_batch[FAST_BATCH_LEN];
+  size_t fast_batch_len;
+  uint32_t fast_batch_frames;
+
+  // Sum and minimum of `rx_time_us` of the frames in `fast_batch`,
+  // for the latency status.
+  int64_t fast_batch_rx_time_total_us;
+  int64_t fast_batch_rx_time_min_us;
+
+  // True while the `fast_writer_task` writes to the socket without
+  // holding `handler_task_delete_mutex`. The socket isn't closed
+  // until it's done.
+  atomic_bool fast_writing;
+
+  // True once the client sent `< credit n >`. From then on,
+  // the `bus_to_socketcand_task` only sends frames while `credits`
+  // isn't zero, and reports dropped frames with `< dropped n seq >`.
+  atomic_bool credit_mode;
+  atomic_uint credits;
+
+  // The `bus_to_socketcand_task`, which is notified when credits
+  // are granted or the client disconnects. NULL for fast clients.
+  TaskHandle_t bus_task;
+
+  // Set before notifying the `bus_task` that the client disconnected.
+  atomic_bool closing;
+
+  // The resumable session of the client, or NULL.
+  // Its `can_rx_queue` is the session's, which outlives the connection.
+  socketcand_session_t *session;
+
+  // The TX rate limit bucket of this client.
+  // Only used by the `socketcand_to_bus_task`.
+  tx_rate_limit_client_t rate_limit;
+
 } client_handler_data_t;
 
 // An array of `client_handler_data_t`. Each pair of tasks handling
@@ -83,6 +159,10 @@ static client_handler_data_t *get_client_handler_data(int client_sock);
 static void free_client_handler_data(
     client_handler_data_t *client_handler_data);
 
+// Returns the index of `client_handler_data` in `client_handler_datas`.
+// Used to identify clients in the trace buffer.
+static uint8_t client_slot(const client_handler_data_t *client_handler_data);
+
 // Task that continuously listens for incoming TCP connections.
 // pvParameters should be a listener socket FD.
 static void run_server_task(void *pvParameters);
@@ -93,14 +173,51 @@ static StaticTask_t run_server_task_mem;
 // pvParameters should be a pointer to a `client_handler_data_t`.
 static void serve_client_task(void *pvParameters);
 
+// Attaches `client_handler_data` to the session with `token`,
+// and replays what the client missed since `position`.
+// On success, the client is in rawmode.
+static esp_err_t resume_session(client_handler_data_t *client_handler_data,
+                                uint32_t token, uint32_t position);
+
+// Tells the client that the handshake failed, and frees its
+// `client_handler_data`. Must be called from `serve_client_task`,
+// which it deletes.
+static void fail_handshake(client_handler_data_t *client_handler_data,
+                           int32_t completed_phase);
+
 // Task that forwards messages from TCP to CAN bus.
 // pvParameters should be a pointer to a `client_handler_data_t`.
 static void socketcand_to_bus_task(void *pvParameters);
 
+// Transmits `msg` from the client on the bus,
+// and passes it to the other clients.
+static void transmit_frame(client_handler_data_t *client_handler_data,
+                           const twai_message_t *msg);
+
+// Applies the TX rate limits to `msg` from the client.
+// Returns false if the client must be disconnected.
+// Sets `*transmit_out` to whether `msg` may be transmitted.
+static bool rate_limit_frame(client_handler_data_t *client_handler_data,
+                             const twai_message_t *msg, bool *transmit_out);
+
 // Task that forwards messages from CAN bus to TCP.
 // pvParameters should be a pointer to a `client_handler_data_t`.
 static void bus_to_socketcand_task(void *pvParameters);
 
+// In credit mode, waits until the client of a `bus_to_socketcand_task`
+// grants a credit. Returns false if the client is being disconnected.
+static bool wait_for_credit(client_handler_data_t *client_handler_data);
+
+// Writes `rx_frame` to the client of a `bus_to_socketcand_task`,
+// after telling it how many frames it missed, if it wants to know.
+// `position_ptr` and `dropped_reported_ptr` are the position of the
+// next frame in the stream, and the number of drops reported.
+// Returns an error if the client must be disconnected.
+static esp_err_t write_frame_to_client(
+    client_handler_data_t *client_handler_data,
+    const can_listener_frame_t *rx_frame, uint32_t *position_ptr,
+    uint32_t *dropped_reported_ptr);
+
 // Both tasks serving a client must call this function
 // before returning.
 // This function deletes the task and does some things
@@ -109,6 +226,64 @@ static void bus_to_socketcand_task(void *pvParameters);
 static void delete_serve_client_task(
     client_handler_data_t *client_handler_data);
 
+// A slot in `fast_ring`.
+typedef struct {
+  // `seq + 1` once the slot is completely written. Zero while writing.
+  atomic_uint stamp;
+  can_listener_frame_t frame;
+  QueueHandle_t skip_queue;
+  uint8_t admitted_classes;
+} fast_slot_t;
+
+// Frames from `fast_path_hook()` waiting for the `fast_writer_task`.
+// Written by any task that calls `can_listener_enqueue_msg()`,
+// without locks, in the same way as `trace_buffer`.
+static fast_slot_t fast_ring[FAST_RING_LEN];
+
+// Sequence number of the next frame written to `fast_ring`.
+static atomic_uint fast_next_write_seq = 0;
+
+// Sequence number of the next frame read by the `fast_writer_task`.
+// Only written by the `fast_writer_task`.
+static atomic_uint fast_next_read_seq = 0;
+
+// True if clients connecting from now on use the fast path.
+static atomic_bool fast_path_enabled = false;
+
+// Receive queue options of clients that don't choose their own.
+// Set with `socketcand_server_set_client_defaults()`.
+static atomic_uint default_queue_depth = CAN_LISTENER_DEFAULT_DEPTH;
+static atomic_int default_overflow = CAN_LISTENER_OVERFLOW_DROP_NEWEST;
+
+// Number of connected clients that use the fast path.
+static atomic_int fast_clients = 0;
+
+// Hook installed with `can_listener_set_hook()`.
+// Adds the frame to `fast_ring`, and wakes the `fast_writer_task`.
+static void fast_path_hook(const can_listener_frame_t *frame,
+                           QueueHandle_t skip_queue, uint8_t admitted_classes);
+
+// Reads the next frame from `fast_ring`.
+// Returns false if there are no more complete frames.
+static bool fast_ring_read(can_listener_frame_t *frame_out,
+                           QueueHandle_t *skip_queue_out,
+                           uint8_t *admitted_classes_out);
+
+// Task that formats every frame from `fast_ring` once,
+// and writes it to all fast path clients in batches.
+static void fast_writer_task(void *pvParameters);
+static TaskHandle_t fast_writer_task_handle = NULL;
+static StackType_t fast_writer_task_stack[STACK_SIZE];
+static StaticTask_t fast_writer_task_mem;
+
+// Appends `str` to the `fast_batch` of `client_handler_data`,
+// writing the batch to TCP first if `str` doesn't fit.
+static void fast_batch_append(client_handler_data_t *client_handler_data,
+                              const char *str, int64_t rx_time_us);
+
+// Writes the `fast_batch` of `client_handler_data` to TCP.
+static void fast_batch_flush(client_handler_data_t *client_handler_data);
+
 // Purely informational status of this server
 static socketcand_server_status_t server_status = {0};
 static SemaphoreHandle_t server_status_mutex = NULL;
@@ -167,6 +342,24 @@ esp_err_t socketcand_server_start(void) {
     return ESP_FAIL;
   }
 
+  // Wake up from `accept()` periodically to expire parked sessions.
+  struct timeval accept_timeout = {
+      .tv_sec = SESSION_REAP_PERIOD_S,
+      .tv_usec = 0,
+  };
+  err = setsockopt(listen_sock, SOL_SOCKET, SO_RCVTIMEO, &accept_timeout,
+                   sizeof(accept_timeout));
+  if (err != 0) {
+    ESP_LOGE(TAG, "Unable to set SO_RCVTIMEO on socket: errno %d", errno);
+    close(listen_sock);
+    return ESP_FAIL;
+  }
+
+  if (socketcand_session_init() != ESP_OK) {
+    close(listen_sock);
+    return ESP_FAIL;
+  }
+
   // Initialize the mutex for accessing the `server_status` struct.
   server_status_mutex = xSemaphoreCreateMutexStatic(&server_status_mutex_mem);
   if (server_status_mutex == NULL) {
@@ -194,6 +387,10 @@ esp_err_t socketcand_server_start(void) {
     client_handler_datas[i].can_rx_queue = NULL;
 
     client_handler_datas[i].tcp_messenger.socket_fd = -1;
+    atomic_store(&client_handler_datas[i].fast, false);
+    client_handler_datas[i].fast_batch_len = 0;
+    client_handler_datas[i].fast_batch_frames = 0;
+    atomic_store(&client_handler_datas[i].fast_writing, false);
 
     client_handler_datas[i].handler_task_delete_mutex =
         xSemaphoreCreateMutexStatic(
@@ -217,15 +414,22 @@ esp_err_t socketcand_server_start(void) {
     }
   }
 
+  // The `fast_writer_task` sleeps until `fast_path_hook()` wakes it.
+  fast_writer_task_handle = task_config_create_static(
+      TASK_ID_SOCKETCAND_FAST_WRITER, fast_writer_task,
+      sizeof(fast_writer_task_stack), NULL, fast_writer_task_stack,
+      &fast_writer_task_mem);
+  can_listener_set_hook(fast_path_hook);
+
   // Log that we've started listening.
   ESP_LOGD(TAG, "Started socketcand TCP server listening on %s:%d",
            inet_ntoa(server_addr.sin_addr), ntohs(server_addr.sin_port));
 
   // Task that continuously listens for incoming TCP connections.
   // pvParameters is set to the listener socket FD.
-  xTaskCreateStatic(run_server_task, "socketcand_server",
-                    sizeof(run_server_task_stack), (void *)listen_sock, 6,
-                    run_server_task_stack, &run_server_task_mem);
+  task_config_create_static(TASK_ID_SOCKETCAND_SERVER, run_server_task,
+                            sizeof(run_server_task_stack), (void *)listen_sock,
+                            run_server_task_stack, &run_server_task_mem);
 
   return ESP_OK;
 }
@@ -238,13 +442,11 @@ static client_handler_data_t *get_client_handler_data(int client_sock) {
     return NULL;
   }
 
-  // Fill out the `can_rx_queue` of this `client_handler_data`.
-  esp_err_t err = can_listener_get(&client_handler_data_ptr->can_rx_queue);
-  if (err != ESP_OK) {
-    assert(xQueueSend(unused_client_handler_data_queue,
-                      &client_handler_data_ptr, 0) == pdTRUE);
-    return NULL;
-  }
+  atomic_store(&client_handler_data_ptr->credit_mode, false);
+  atomic_store(&client_handler_data_ptr->credits, 0);
+  atomic_store(&client_handler_data_ptr->closing, false);
+  client_handler_data_ptr->bus_task = NULL;
+  client_handler_data_ptr->session = NULL;
 
   // Initialize the `tcp_messenger`.
   client_handler_data_ptr->tcp_messenger.l = 0;
@@ -254,8 +456,24 @@ static client_handler_data_t *get_client_handler_data(int client_sock) {
   return client_handler_data_ptr;
 }
 
+static uint8_t client_slot(const client_handler_data_t *client_handler_data) {
+  return (uint8_t)(client_handler_data - client_handler_datas);
+}
+
 static void free_client_handler_data(
     client_handler_data_t *client_handler_data) {
+  trace_buffer_record(TRACE_EVENT_CLIENT_CLOSED,
+                      client_slot(client_handler_data), 0, 0, 0);
+
+  // Keep the session's queue filling until the client resumes it.
+  // Parked before the socket is closed, so a resume never shuts down
+  // a socket number that was reused.
+  if (client_handler_data->session != NULL) {
+    socketcand_session_park(client_handler_data->session);
+    client_handler_data->session = NULL;
+    client_handler_data->can_rx_queue = NULL;
+  }
+
   // Close client connection if one is still open
   if (client_handler_data->tcp_messenger.socket_fd != -1) {
     shutdown(client_handler_data->tcp_messenger.socket_fd, 0);
@@ -267,12 +485,15 @@ static void free_client_handler_data(
   client_handler_data->tcp_messenger.r = 0;
   client_handler_data->tcp_messenger.socket_fd = -1;
 
-  esp_err_t err = can_listener_free(client_handler_data->can_rx_queue);
-  if (err != ESP_OK) {
-    ESP_LOGE(TAG, "Unreachable. Couldn't free CAN RX queue.");
-    abort();
+  // The queue is only loaned once the client completes the handshake.
+  if (client_handler_data->can_rx_queue != NULL) {
+    esp_err_t err = can_listener_free(client_handler_data->can_rx_queue);
+    if (err != ESP_OK) {
+      ESP_LOGE(TAG, "Unreachable. Couldn't free CAN RX queue.");
+      abort();
+    }
+    client_handler_data->can_rx_queue = NULL;
   }
-  client_handler_data->can_rx_queue = NULL;
 
   assert(xQueueSend(unused_client_handler_data_queue, &client_handler_data,
                     0) == pdTRUE);
@@ -288,8 +509,18 @@ static void run_server_task(void *pvParameters) {
     socklen_t addr_len = sizeof(source_addr);
     int client_sock =
         accept(listen_sock, (struct sockaddr *)&source_addr, &addr_len);
+
+    uint32_t expired = socketcand_session_reap();
+    if (expired > 0) {
+      assert(xSemaphoreTake(server_status_mutex, portMAX_DELAY) == pdTRUE);
+      server_status.sessions_expired += expired;
+      assert(xSemaphoreGive(server_status_mutex) == pdTRUE);
+    }
+
     if (client_sock < 0) {
-      ESP_LOGE(TAG, "Unable to accept connection: errno %d", errno);
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        ESP_LOGE(TAG, "Unable to accept connection: errno %d", errno);
+      }
       continue;
     }
 
@@ -307,17 +538,24 @@ static void run_server_task(void *pvParameters) {
                "limit of %d "
                "simultaneous clients.",
                MAX_CLIENTS);
+      trace_buffer_record(TRACE_EVENT_CLIENT_REJECTED, 0, 0,
+                          source_addr.sin_addr.s_addr, 0);
       shutdown(client_sock, 0);
       close(client_sock);
       continue;
     }
 
+    trace_buffer_record(TRACE_EVENT_CLIENT_ACCEPTED,
+                        client_slot(client_handler_data), 0,
+                        source_addr.sin_addr.s_addr, 0);
+    boot_timeline_mark(BOOT_PHASE_FIRST_CLIENT);
+
     // spawn a thread to serve the client with this index
-    xTaskCreateStatic(serve_client_task, "serving_socketcand_client",
-                      sizeof(client_handler_data->free_rtos_stack_1),
-                      (void *)client_handler_data, 11,
-                      client_handler_data->free_rtos_stack_1,
-                      &client_handler_data->free_rtos_mem_1);
+    task_config_create_static(TASK_ID_SOCKETCAND_TO_BUS, serve_client_task,
+                              sizeof(client_handler_data->free_rtos_stack_1),
+                              (void *)client_handler_data,
+                              client_handler_data->free_rtos_stack_1,
+                              &client_handler_data->free_rtos_mem_1);
   }
 }
 
@@ -325,17 +563,91 @@ static void serve_client_task(void *pvParameters) {
   client_handler_data_t *client_handler_data =
       (client_handler_data_t *)pvParameters;
 
+  // Queue options the client gets unless it asks for others in `< open >`.
+  bool fast = atomic_load(&fast_path_enabled);
+  can_listener_options_t queue_options = {
+      .depth = atomic_load(&default_queue_depth),
+      .overflow = atomic_load(&default_overflow),
+      .owner = "socketcand",
+  };
+
   // Establish a socketcand rawmode connection
   char frame_str[SOCKETCAND_RAW_MAX_LEN] = "";
+  int32_t phase = 0;
   while (true) {
+    esp_err_t err;
+    int32_t completed_phase = phase;
+    if (strncmp(frame_str, "< open ", 7) == 0 &&
+        socketcand_translate_open_options(frame_str, &queue_options) !=
+            ESP_OK) {
+      fail_handshake(client_handler_data, completed_phase);
+      return;
+    }
+
+    // A client that lost its connection can resume its session
+    // instead of opening the bus again.
+    uint32_t token;
+    uint32_t position;
+    err = socketcand_translate_string_to_resume(frame_str, &token, &position);
+    if (completed_phase == 1 && err != ESP_ERR_NOT_FOUND) {
+      if (err != ESP_OK ||
+          resume_session(client_handler_data, token, position) != ESP_OK) {
+        fail_handshake(client_handler_data, completed_phase);
+        return;
+      }
+      break;
+    }
+
     // write a handshake frame
-    int32_t phase = socketcand_translate_open_raw(frame_str, sizeof(frame_str));
-    esp_err_t err = frame_io_write_str(
-        client_handler_data->tcp_messenger.socket_fd, frame_str);
+    if (completed_phase == 2 && socketcand_translate_is_session(frame_str)) {
+      // Answer with a session token, and stay in this phase.
+      if (client_handler_data->session == NULL) {
+        err = socketcand_session_open(
+            client_handler_data->tcp_messenger.socket_fd,
+            &client_handler_data->session);
+        if (err != ESP_OK) {
+          fail_handshake(client_handler_data, completed_phase);
+          return;
+        }
+      }
+      socketcand_translate_session_to_string(
+          frame_str, sizeof(frame_str), client_handler_data->session->token);
+      phase = completed_phase;
+    } else {
+      phase = socketcand_translate_open_raw(frame_str, sizeof(frame_str));
+    }
+
+    if (phase == 3) {
+      // Loan the receive queue before confirming rawmode,
+      // so the client learns if the frame budget is used up.
+      if (fast && client_handler_data->session == NULL) {
+        // Frames bypass the queue, which only identifies the client.
+        queue_options.depth = CAN_LISTENER_MIN_DEPTH;
+      }
+      err = can_listener_get(&queue_options,
+                             &client_handler_data->can_rx_queue);
+      if (err != ESP_OK) {
+        ESP_LOGE(TAG,
+                 "Couldn't get a CAN receive queue of depth %u for client: %s",
+                 queue_options.depth, esp_err_to_name(err));
+        fail_handshake(client_handler_data, completed_phase);
+        return;
+      }
+      if (client_handler_data->session != NULL) {
+        client_handler_data->session->can_rx_queue =
+            client_handler_data->can_rx_queue;
+      }
+    }
+
+    err = frame_io_write_str(client_handler_data->tcp_messenger.socket_fd,
+                             frame_str);
     if (err != ESP_OK) {
       ESP_LOGE(TAG,
                "Disconnecting because couldn't send socketcand to client: %s",
                esp_err_to_name(err));
+      trace_buffer_record(TRACE_EVENT_HANDSHAKE_FAILED,
+                          client_slot(client_handler_data), completed_phase, 0,
+                          0);
       free_client_handler_data(client_handler_data);
       vTaskDelete(NULL);
       return;
@@ -354,6 +666,9 @@ static void serve_client_task(void *pvParameters) {
                "rawmode. "
                "Closing connection.",
                frame_str);
+      trace_buffer_record(TRACE_EVENT_HANDSHAKE_FAILED,
+                          client_slot(client_handler_data), completed_phase, 0,
+                          0);
       // Increment the server status error counter
       assert(xSemaphoreTake(server_status_mutex, portMAX_DELAY) == pdTRUE);
       server_status.invalid_socketcand_frames_received += 1;
@@ -376,17 +691,48 @@ static void serve_client_task(void *pvParameters) {
       ESP_LOGI(TAG,
                "Error reading socketcand rawmode negotiation < > frame from "
                "client. Closing connection.");
+      trace_buffer_record(TRACE_EVENT_HANDSHAKE_FAILED,
+                          client_slot(client_handler_data), phase, 0, 0);
       free_client_handler_data(client_handler_data);
       vTaskDelete(NULL);
       return;
     }
   }
 
+  // Sessions need the history of the client's own task,
+  // so they don't use the fast path.
+  if (fast && client_handler_data->session == NULL) {
+    struct timeval send_timeout = {
+        .tv_sec = 0,
+        .tv_usec = FAST_SEND_TIMEOUT_MS * 1000,
+    };
+    if (setsockopt(client_handler_data->tcp_messenger.socket_fd, SOL_SOCKET,
+                   SO_SNDTIMEO, &send_timeout, sizeof(send_timeout)) != 0) {
+      ESP_LOGE(TAG, "Unable to set SO_SNDTIMEO on socket: errno %d", errno);
+      free_client_handler_data(client_handler_data);
+      vTaskDelete(NULL);
+      return;
+    }
+
+    // Let the `fast_writer_task` write CAN frames to this client.
+    assert(xSemaphoreTake(client_handler_data->handler_task_delete_mutex,
+                          portMAX_DELAY) == pdTRUE);
+    can_listener_set_bypass(client_handler_data->can_rx_queue, true);
+    atomic_store(&client_handler_data->fast, true);
+    atomic_fetch_add(&fast_clients, 1);
+    assert(xSemaphoreGive(client_handler_data->handler_task_delete_mutex) ==
+           pdTRUE);
+
+    socketcand_to_bus_task(pvParameters);
+    return;
+  }
+
   // run translation in both directions simultaneously
-  xTaskCreateStatic(bus_to_socketcand_task, "bus_to_socketcand",
-                    sizeof(client_handler_data->free_rtos_stack_2),
-                    pvParameters, 10, client_handler_data->free_rtos_stack_2,
-                    &client_handler_data->free_rtos_mem_2);
+  client_handler_data->bus_task = task_config_create_static(
+      TASK_ID_BUS_TO_SOCKETCAND, bus_to_socketcand_task,
+      sizeof(client_handler_data->free_rtos_stack_2), pvParameters,
+      client_handler_data->free_rtos_stack_2,
+      &client_handler_data->free_rtos_mem_2);
   socketcand_to_bus_task(pvParameters);
 }
 
@@ -397,6 +743,8 @@ static void socketcand_to_bus_task(void *pvParameters) {
   // A single C string storing a complete frame.
   char frame_str[SOCKETCAND_RAW_MAX_LEN];
 
+  tx_rate_limit_client_init(&client_handler_data->rate_limit);
+
   while (true) {
     // Try to read the next data < > frame from the network.
     esp_err_t err = frame_io_read_next_frame(
@@ -409,12 +757,123 @@ static void socketcand_to_bus_task(void *pvParameters) {
       return;
     }
 
+    // Let the client choose its `can_listener_class_t`.
+    can_listener_class_t listener_class;
+    err = socketcand_translate_string_to_class(frame_str, &listener_class);
+    if (err == ESP_OK) {
+      can_listener_set_class(client_handler_data->can_rx_queue,
+                             listener_class);
+      ESP_LOGI(TAG, "Socketcand client in slot %d is now %s.",
+               client_slot(client_handler_data),
+               can_listener_class_name(listener_class));
+      continue;
+    } else if (err != ESP_ERR_NOT_FOUND) {
+      ESP_LOGE(TAG,
+               "Couldn't parse socketcand class from client. Disconnecting.");
+      trace_buffer_record(TRACE_EVENT_INVALID_FRAME,
+                          client_slot(client_handler_data), 0, 0, 0);
+      assert(xSemaphoreTake(server_status_mutex, portMAX_DELAY) == pdTRUE);
+      server_status.invalid_socketcand_frames_received += 1;
+      assert(xSemaphoreGive(server_status_mutex) == pdTRUE);
+
+      delete_serve_client_task(client_handler_data);
+      return;
+    }
+
+    // Let the client grant credits for frames it's ready to receive.
+    uint32_t credits;
+    err = socketcand_translate_string_to_credit(frame_str, &credits);
+    if (err == ESP_OK) {
+      if (atomic_load(&client_handler_data->fast)) {
+        ESP_LOGW(TAG,
+                 "Ignoring credit from socketcand client in slot %d, "
+                 "because the fast path doesn't support it.",
+                 client_slot(client_handler_data));
+        continue;
+      }
+      uint32_t total =
+          atomic_fetch_add(&client_handler_data->credits, credits) + credits;
+      if (total > SOCKETCAND_CREDIT_MAX) {
+        atomic_store(&client_handler_data->credits, SOCKETCAND_CREDIT_MAX);
+      }
+      atomic_store(&client_handler_data->credit_mode, true);
+
+      // Wake the `bus_task`, unless it already deleted itself.
+      assert(xSemaphoreTake(client_handler_data->handler_task_delete_mutex,
+                            portMAX_DELAY) == pdTRUE);
+      if (!atomic_load(&client_handler_data->closing)) {
+        xTaskNotifyGive(client_handler_data->bus_task);
+      }
+      assert(xSemaphoreGive(client_handler_data->handler_task_delete_mutex) ==
+             pdTRUE);
+      continue;
+    } else if (err != ESP_ERR_NOT_FOUND) {
+      ESP_LOGE(TAG,
+               "Couldn't parse socketcand credit from client. Disconnecting.");
+      trace_buffer_record(TRACE_EVENT_INVALID_FRAME,
+                          client_slot(client_handler_data), 0, 0, 0);
+      assert(xSemaphoreTake(server_status_mutex, portMAX_DELAY) == pdTRUE);
+      server_status.invalid_socketcand_frames_received += 1;
+      assert(xSemaphoreGive(server_status_mutex) == pdTRUE);
+
+      delete_serve_client_task(client_handler_data);
+      return;
+    }
+
+    // Let the client schedule frames for a precise time.
+    twai_message_t scheduled_msg = {0};
+    int64_t deadline_us;
+    err = socketcand_translate_string_to_sendat(frame_str, &scheduled_msg,
+                                                &deadline_us);
+    if (err == ESP_OK) {
+      assert(xSemaphoreTake(server_status_mutex, portMAX_DELAY) == pdTRUE);
+      server_status.socketcand_frames_received += 1;
+      assert(xSemaphoreGive(server_status_mutex) == pdTRUE);
+
+      // Rewrite the frame for the bus, which may also drop it,
+      // or send it twice.
+      twai_message_t routed_msgs[CAN_GATEWAY_OUTPUTS_MAX];
+      uint8_t routed_count =
+          can_gateway_route(CAN_GATEWAY_TX, &scheduled_msg, routed_msgs);
+      for (uint8_t i = 0; i < routed_count; i++) {
+        // Scheduled frames count when they're scheduled,
+        // so a client can't queue up a burst for later.
+        bool transmit;
+        if (!rate_limit_frame(client_handler_data, &routed_msgs[i],
+                              &transmit)) {
+          delete_serve_client_task(client_handler_data);
+          return;
+        }
+        if (!transmit) {
+          continue;
+        }
+
+        // The scheduler counts rejected frames, for the status page.
+        // Not logged, since a client can send them at line rate.
+        tx_scheduler_add(&routed_msgs[i], deadline_us, NULL, NULL);
+      }
+      continue;
+    } else if (err != ESP_ERR_NOT_FOUND) {
+      ESP_LOGE(TAG,
+               "Couldn't parse socketcand sendat from client. Disconnecting.");
+      trace_buffer_record(TRACE_EVENT_INVALID_FRAME,
+                          client_slot(client_handler_data), 0, 0, 0);
+      assert(xSemaphoreTake(server_status_mutex, portMAX_DELAY) == pdTRUE);
+      server_status.invalid_socketcand_frames_received += 1;
+      assert(xSemaphoreGive(server_status_mutex) == pdTRUE);
+
+      delete_serve_client_task(client_handler_data);
+      return;
+    }
+
     // Parse the message
     twai_message_t received_msg = {0};
     err = socketcand_translate_string_to_frame(frame_str, &received_msg);
     if (err != ESP_OK) {
       ESP_LOGE(TAG,
                "Couldn't parse socketcand frame from client. Disconnecting.");
+      trace_buffer_record(TRACE_EVENT_INVALID_FRAME,
+                          client_slot(client_handler_data), 0, 0, 0);
       // Increment the server status error counter
       assert(xSemaphoreTake(server_status_mutex, portMAX_DELAY) == pdTRUE);
       server_status.invalid_socketcand_frames_received += 1;
@@ -429,40 +888,95 @@ static void socketcand_to_bus_task(void *pvParameters) {
     server_status.socketcand_frames_received += 1;
     assert(xSemaphoreGive(server_status_mutex) == pdTRUE);
 
-    // Enqueue the frame for CAN transmission, with a timeout of 2 seconds
-    err = twai_transmit(&received_msg, pdMS_TO_TICKS(2000));
-    if (err == ESP_OK) {
-      // Increment the server status can bus counter
-      assert(xSemaphoreTake(server_status_mutex, portMAX_DELAY) == pdTRUE);
-      server_status.can_bus_frames_sent += 1;
-      assert(xSemaphoreGive(server_status_mutex) == pdTRUE);
-    } else {
-      ESP_LOGE(TAG, "Couldn't transmit frame to CAN. %s", esp_err_to_name(err));
-
-      assert(xSemaphoreTake(server_status_mutex, portMAX_DELAY) == pdTRUE);
-      server_status.can_bus_frames_send_timeouts += 1;
-      assert(xSemaphoreGive(server_status_mutex) == pdTRUE);
+    // Rewrite the frame for the bus, which may also drop it,
+    // or send it twice.
+    twai_message_t routed_msgs[CAN_GATEWAY_OUTPUTS_MAX];
+    uint8_t routed_count =
+        can_gateway_route(CAN_GATEWAY_TX, &received_msg, routed_msgs);
+    for (uint8_t i = 0; i < routed_count; i++) {
+      bool transmit;
+      if (!rate_limit_frame(client_handler_data, &routed_msgs[i],
+                            &transmit)) {
+        delete_serve_client_task(client_handler_data);
+        return;
+      }
+      if (transmit) {
+        transmit_frame(client_handler_data, &routed_msgs[i]);
+      }
     }
-
-    // Send the message to other TCP socketcand clients.
-    can_listener_enqueue_msg(&received_msg, client_handler_data->can_rx_queue);
   }
 
   delete_serve_client_task(client_handler_data);
   return;
 }
 
+static void transmit_frame(client_handler_data_t *client_handler_data,
+                           const twai_message_t *msg) {
+  // Enqueue the frame for CAN transmission, with a timeout of 2 seconds
+  esp_err_t err = driver_setup_can_transmit(msg, pdMS_TO_TICKS(2000));
+  if (err == ESP_OK) {
+    // Increment the server status can bus counter
+    assert(xSemaphoreTake(server_status_mutex, portMAX_DELAY) == pdTRUE);
+    server_status.can_bus_frames_sent += 1;
+    assert(xSemaphoreGive(server_status_mutex) == pdTRUE);
+  } else {
+    deferred_log(DEFERRED_LOG_CAN_TX_FAILED, err);
+    trace_buffer_record(TRACE_EVENT_CAN_TX_FAILED,
+                        client_slot(client_handler_data), 0, err,
+                        msg->identifier);
+
+    assert(xSemaphoreTake(server_status_mutex, portMAX_DELAY) == pdTRUE);
+    server_status.can_bus_frames_send_timeouts += 1;
+    assert(xSemaphoreGive(server_status_mutex) == pdTRUE);
+  }
+
+  // Send the message to other TCP socketcand clients.
+  can_listener_enqueue_msg(msg, client_handler_data->can_rx_queue);
+}
+
+static bool rate_limit_frame(client_handler_data_t *client_handler_data,
+                             const twai_message_t *msg, bool *transmit_out) {
+  esp_err_t err = tx_rate_limit_admit(&client_handler_data->rate_limit, msg);
+  *transmit_out = err == ESP_OK;
+  if (err != ESP_ERR_INVALID_RESPONSE) {
+    return true;
+  }
+
+  ESP_LOGW(TAG,
+           "Disconnecting socketcand client in slot %d because it exceeded "
+           "a TX rate limit.",
+           client_slot(client_handler_data));
+  trace_buffer_record(TRACE_EVENT_TX_RATE_LIMITED,
+                      client_slot(client_handler_data), 0, msg->identifier, 0);
+  return false;
+}
+
 static void bus_to_socketcand_task(void *pvParameters) {
   client_handler_data_t *client_handler_data =
       (client_handler_data_t *)pvParameters;
 
-  char buf[SOCKETCAND_RAW_MAX_LEN];
+  // Position of the next frame in the stream sent to the client,
+  // and the number of queue drops reported to it.
+  // Only used in credit mode and in sessions, which keep their own.
+  socketcand_session_t *session = client_handler_data->session;
+  uint32_t position = 0;
+  uint32_t dropped_reported = 0;
+  uint32_t *position_ptr = session != NULL ? &session->position : &position;
+  uint32_t *dropped_reported_ptr =
+      session != NULL ? &session->dropped_reported : &dropped_reported;
 
   while (true) {
+    // In credit mode, leave frames in the queue until the client
+    // grants credits, so a client that stops reading never blocks TCP.
+    if (!wait_for_credit(client_handler_data)) {
+      delete_serve_client_task(client_handler_data);
+      return;
+    }
+
     // Receive an incoming frame from the CAN bus queue
-    twai_message_t twai_msg;
-    BaseType_t res = xQueueReceive(client_handler_data->can_rx_queue, &twai_msg,
-                                   portMAX_DELAY);
+    can_listener_frame_t rx_frame;
+    BaseType_t res = xQueueReceive(client_handler_data->can_rx_queue,
+                                   &rx_frame, portMAX_DELAY);
     if (res != pdTRUE) {
       ESP_LOGE(TAG, "Unreachable. Couldn't receive CAN bus frame from queue.");
       delete_serve_client_task(client_handler_data);
@@ -471,51 +985,174 @@ static void bus_to_socketcand_task(void *pvParameters) {
 
     // If received a special frame that means we should
     // disconnect from the client.
-    if (twai_msg.data_length_code == CAN_INTERRUPT_FRAME) {
+    // A resumed session's queue may still hold one from its
+    // previous connection, which is ignored.
+    if (rx_frame.msg.data_length_code == CAN_INTERRUPT_FRAME) {
+      if (!atomic_load(&client_handler_data->closing)) {
+        continue;
+      }
       delete_serve_client_task(client_handler_data);
       return;
     }
 
-    // `socketcand_translate_frame_to_string()` requires the current time.
-    int64_t micros = esp_timer_get_time();
-    int64_t secs = micros / 1000000;
-    int64_t usecs = micros % 1000000;
-
-    // write the message to TCP
-    esp_err_t err = socketcand_translate_frame_to_string(
-        buf, sizeof(buf), &twai_msg, secs, usecs);
-    if (err != ESP_OK) {
-      ESP_LOGE(TAG, "Couldn't translate CAN frame to socketcand < > string.");
+    // The client asked to be disconnected rather than lose frames.
+    if (can_listener_overflowed(client_handler_data->can_rx_queue)) {
+      ESP_LOGW(TAG,
+               "Disconnecting socketcand client because its CAN receive "
+               "queue overflowed.");
       delete_serve_client_task(client_handler_data);
       return;
     }
 
-    err = frame_io_write_str(client_handler_data->tcp_messenger.socket_fd, buf);
-    if (err != ESP_OK) {
-      ESP_LOGD(TAG, "Error sending socketcand frame to client over TCP.");
-      delete_serve_client_task(client_handler_data);
-      return;
+    // Rewrite the frame for the client, which may also drop it,
+    // or pass it twice.
+    twai_message_t routed_msgs[CAN_GATEWAY_OUTPUTS_MAX];
+    uint8_t routed_count =
+        can_gateway_route(CAN_GATEWAY_RX, &rx_frame.msg, routed_msgs);
+    for (uint8_t i = 0; i < routed_count; i++) {
+      // The original of a duplicated frame may have used the last credit.
+      if (!wait_for_credit(client_handler_data)) {
+        delete_serve_client_task(client_handler_data);
+        return;
+      }
+      rx_frame.msg = routed_msgs[i];
+      esp_err_t err = write_frame_to_client(client_handler_data, &rx_frame,
+                                            position_ptr, dropped_reported_ptr);
+      if (err != ESP_OK) {
+        delete_serve_client_task(client_handler_data);
+        return;
+      }
     }
-
-    // Increment the server status socketcand sent counter
-    assert(xSemaphoreTake(server_status_mutex, portMAX_DELAY) == pdTRUE);
-    server_status.socketcand_frames_sent += 1;
-    assert(xSemaphoreGive(server_status_mutex) == pdTRUE);
   }
 
   delete_serve_client_task(client_handler_data);
   return;
 }
 
+static bool wait_for_credit(client_handler_data_t *client_handler_data) {
+  if (!atomic_load(&client_handler_data->credit_mode) ||
+      atomic_load(&client_handler_data->credits) > 0) {
+    return true;
+  }
+
+  // Its queue filling up meanwhile isn't an overload of the adapter.
+  can_listener_set_paused(client_handler_data->can_rx_queue, true);
+  while (atomic_load(&client_handler_data->credits) == 0) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    if (atomic_load(&client_handler_data->closing)) {
+      return false;
+    }
+  }
+  can_listener_set_paused(client_handler_data->can_rx_queue, false);
+  return true;
+}
+
+static esp_err_t write_frame_to_client(
+    client_handler_data_t *client_handler_data,
+    const can_listener_frame_t *rx_frame, uint32_t *position_ptr,
+    uint32_t *dropped_reported_ptr) {
+  char buf[SOCKETCAND_RAW_MAX_LEN];
+  socketcand_session_t *session = client_handler_data->session;
+
+  // Tell the client how many frames it missed, and where.
+  // Positions are advanced before writing, so if the connection
+  // drops now, a resumed session replays the marker and the frame.
+  esp_err_t err;
+  bool credit_mode = atomic_load(&client_handler_data->credit_mode);
+  if (credit_mode || session != NULL) {
+    uint32_t dropped =
+        can_listener_frames_dropped(client_handler_data->can_rx_queue);
+    uint32_t newly_dropped = dropped - *dropped_reported_ptr;
+    uint32_t dropped_position = *position_ptr;
+    *dropped_reported_ptr = dropped;
+    *position_ptr += newly_dropped;
+    if (session != NULL) {
+      socketcand_session_record(session, rx_frame);
+    } else {
+      *position_ptr += 1;
+    }
+    // `wait_for_credit()` made sure there's one,
+    // unless credit mode started since.
+    if (credit_mode && atomic_load(&client_handler_data->credits) > 0) {
+      atomic_fetch_sub(&client_handler_data->credits, 1);
+    }
+
+    if (newly_dropped != 0) {
+      err = socketcand_translate_dropped_to_string(
+          buf, sizeof(buf), newly_dropped, dropped_position);
+      if (err == ESP_OK) {
+        err = frame_io_write_str(client_handler_data->tcp_messenger.socket_fd,
+                                 buf);
+      }
+      if (err != ESP_OK) {
+        ESP_LOGD(TAG, "Error sending socketcand dropped marker to client.");
+        return err;
+      }
+    }
+  }
+
+  // Timestamp the frame with when it was received,
+  // not when it's sent, so queueing doesn't add jitter.
+  int64_t secs = rx_frame->rx_time_us / 1000000;
+  int64_t usecs = rx_frame->rx_time_us % 1000000;
+
+  // write the message to TCP
+  err = socketcand_translate_frame_to_string(buf, sizeof(buf), &rx_frame->msg,
+                                             secs, usecs);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Couldn't translate CAN frame to socketcand < > string.");
+    return err;
+  }
+
+  err = frame_io_write_str(client_handler_data->tcp_messenger.socket_fd, buf);
+  if (err != ESP_OK) {
+    ESP_LOGD(TAG, "Error sending socketcand frame to client over TCP.");
+    return err;
+  }
+
+  // Time from receiving the frame to handing it to lwIP.
+  int64_t latency_us = esp_timer_get_time() - rx_frame->rx_time_us;
+
+  // Increment the server status socketcand sent counter
+  assert(xSemaphoreTake(server_status_mutex, portMAX_DELAY) == pdTRUE);
+  server_status.socketcand_frames_sent += 1;
+  server_status.frame_latency_total_us += latency_us;
+  if (latency_us > server_status.frame_latency_max_us) {
+    server_status.frame_latency_max_us = latency_us;
+  }
+  assert(xSemaphoreGive(server_status_mutex) == pdTRUE);
+
+  return ESP_OK;
+}
+
 static void delete_serve_client_task(
     client_handler_data_t *client_handler_data) {
   // Enter the critical section.
   assert(xSemaphoreTake(client_handler_data->handler_task_delete_mutex,
                         portMAX_DELAY) == pdTRUE);
 
-  // If socket_fd hasn't already been set to -1, that means
-  // I'm the first task to notice the client disconnected.
-  if (client_handler_data->tcp_messenger.socket_fd != -1) {
+  if (atomic_load(&client_handler_data->fast)) {
+    // There is no second task serving this client. The
+    // `fast_writer_task` may still be writing to it, until it's done
+    // or the write times out.
+    atomic_store(&client_handler_data->fast, false);
+    atomic_fetch_sub(&fast_clients, 1);
+    while (atomic_load(&client_handler_data->fast_writing)) {
+      vTaskDelay(1);
+    }
+    free_client_handler_data(client_handler_data);
+
+    ESP_LOGI(TAG, "Socketcand client disconnected.");
+
+  } else if (client_handler_data->tcp_messenger.socket_fd != -1) {
+    // socket_fd hasn't already been set to -1, so
+    // I'm the first task to notice the client disconnected.
+    // Don't let a resume shut down this socket number once it's closed,
+    // and possibly reused by another connection.
+    if (client_handler_data->session != NULL) {
+      socketcand_session_disconnect(client_handler_data->session);
+    }
+
     // Gracefully shutdown the socket that the client is connected to.
     shutdown(client_handler_data->tcp_messenger.socket_fd, 0);
     close(client_handler_data->tcp_messenger.socket_fd);
@@ -523,10 +1160,16 @@ static void delete_serve_client_task(
 
     // Send a `termination_msg` to `can_rx_queue` so if the other task
     // is blocking on receiving `can_rx_queue`, it knows to stop.
-    twai_message_t termination_msg = {0};
-    termination_msg.data_length_code = CAN_INTERRUPT_FRAME;
+    atomic_store(&client_handler_data->closing, true);
+    can_listener_frame_t termination_msg = {0};
+    termination_msg.msg.data_length_code = CAN_INTERRUPT_FRAME;
     xQueueSend(client_handler_data->can_rx_queue, &termination_msg, 0);
 
+    // It may also be waiting for credits instead.
+    if (client_handler_data->bus_task != NULL) {
+      xTaskNotifyGive(client_handler_data->bus_task);
+    }
+
   } else {
     // Else, the other task has already disconnected from the client.
     // Free  this client handler data.
@@ -541,3 +1184,262 @@ static void delete_serve_client_task(
   vTaskDelete(NULL);
   return;
 }
+
+static esp_err_t resume_session(client_handler_data_t *client_handler_data,
+                                uint32_t token, uint32_t position) {
+  int socket_fd = client_handler_data->tcp_messenger.socket_fd;
+  socketcand_session_t *session;
+  esp_err_t err = socketcand_session_resume(
+      token, socket_fd, pdMS_TO_TICKS(RESUME_TIMEOUT_MS), &session);
+  if (err != ESP_OK) {
+    ESP_LOGW(TAG, "Client tried to resume unknown session %08lX.", token);
+    return err;
+  }
+
+  // From here on, freeing the client parks the session again.
+  client_handler_data->session = session;
+  client_handler_data->can_rx_queue = session->can_rx_queue;
+
+  // The queue kept filling while the client was gone. If it had to
+  // disconnect on overflow, there's no lossless stream to resume.
+  if (can_listener_overflowed(session->can_rx_queue)) {
+    ESP_LOGW(TAG, "Not resuming session %08lX, its queue overflowed.", token);
+    client_handler_data->session = NULL;
+    client_handler_data->can_rx_queue = NULL;
+    socketcand_session_close(session);
+    return ESP_FAIL;
+  }
+
+  err = frame_io_write_str(socket_fd, "< ok >");
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't confirm resume.");
+
+  err = socketcand_session_replay(session, position, socket_fd);
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't replay session %08lX.", token);
+
+  ESP_LOGI(TAG, "Resumed session %08lX from position %lu of %lu.", token,
+           position, session->position);
+  assert(xSemaphoreTake(server_status_mutex, portMAX_DELAY) == pdTRUE);
+  server_status.sessions_resumed += 1;
+  assert(xSemaphoreGive(server_status_mutex) == pdTRUE);
+  return ESP_OK;
+}
+
+static void fail_handshake(client_handler_data_t *client_handler_data,
+                           int32_t completed_phase) {
+  frame_io_write_str(client_handler_data->tcp_messenger.socket_fd,
+                     "< error >");
+  trace_buffer_record(TRACE_EVENT_HANDSHAKE_FAILED,
+                      client_slot(client_handler_data), completed_phase, 0, 0);
+  free_client_handler_data(client_handler_data);
+  vTaskDelete(NULL);
+}
+
+void socketcand_server_set_client_defaults(uint16_t depth,
+                                           can_listener_overflow_t overflow) {
+  atomic_store(&default_queue_depth, depth);
+  atomic_store(&default_overflow, overflow);
+}
+
+void socketcand_server_set_fast_path(bool enabled) {
+  atomic_store(&fast_path_enabled, enabled);
+}
+
+uint8_t socketcand_server_fast_path_fill_percent(void) {
+  uint32_t waiting = atomic_load(&fast_next_write_seq) -
+                     atomic_load(&fast_next_read_seq);
+  if (waiting > FAST_RING_LEN) {
+    waiting = FAST_RING_LEN;
+  }
+  return waiting * 100 / FAST_RING_LEN;
+}
+
+static void fast_path_hook(const can_listener_frame_t *frame,
+                           QueueHandle_t skip_queue, uint8_t admitted_classes) {
+  if (atomic_load(&fast_clients) == 0) {
+    return;
+  }
+
+  uint32_t seq =
+      atomic_fetch_add_explicit(&fast_next_write_seq, 1, memory_order_relaxed);
+  fast_slot_t *slot = &fast_ring[seq & (FAST_RING_LEN - 1)];
+
+  atomic_store_explicit(&slot->stamp, 0, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  slot->frame = *frame;
+  slot->skip_queue = skip_queue;
+  slot->admitted_classes = admitted_classes;
+  atomic_store_explicit(&slot->stamp, seq + 1, memory_order_release);
+
+  xTaskNotifyGive(fast_writer_task_handle);
+}
+
+static bool fast_ring_read(can_listener_frame_t *frame_out,
+                           QueueHandle_t *skip_queue_out,
+                           uint8_t *admitted_classes_out) {
+  uint32_t read_seq = atomic_load(&fast_next_read_seq);
+  while (true) {
+    uint32_t write_seq =
+        atomic_load_explicit(&fast_next_write_seq, memory_order_acquire);
+    if (read_seq == write_seq) {
+      return false;
+    }
+
+    // If writers lapped the ring, skip to the oldest frame still in it.
+    if (write_seq - read_seq > FAST_RING_LEN) {
+      uint32_t lost = write_seq - read_seq - FAST_RING_LEN;
+      read_seq = write_seq - FAST_RING_LEN;
+      atomic_store(&fast_next_read_seq, read_seq);
+
+      assert(xSemaphoreTake(server_status_mutex, portMAX_DELAY) == pdTRUE);
+      server_status.fast_path_frames_dropped += lost;
+      assert(xSemaphoreGive(server_status_mutex) == pdTRUE);
+    }
+
+    const fast_slot_t *slot = &fast_ring[read_seq & (FAST_RING_LEN - 1)];
+    uint32_t stamp = atomic_load_explicit(&slot->stamp, memory_order_acquire);
+    if (stamp == 0 || (int32_t)(stamp - (read_seq + 1)) < 0) {
+      // A writer claimed this slot but hasn't finished writing it.
+      // It notifies us once it has.
+      return false;
+    }
+
+    *frame_out = slot->frame;
+    *skip_queue_out = slot->skip_queue;
+    *admitted_classes_out = slot->admitted_classes;
+
+    // If a writer claimed the slot while we were copying, the copy is torn.
+    atomic_thread_fence(memory_order_acquire);
+    uint32_t stamp_after =
+        atomic_load_explicit(&slot->stamp, memory_order_relaxed);
+    read_seq += 1;
+    atomic_store(&fast_next_read_seq, read_seq);
+    if (stamp == read_seq && stamp_after == stamp) {
+      return true;
+    }
+
+    // Overwritten by a writer that lapped the ring.
+    assert(xSemaphoreTake(server_status_mutex, portMAX_DELAY) == pdTRUE);
+    server_status.fast_path_frames_dropped += 1;
+    assert(xSemaphoreGive(server_status_mutex) == pdTRUE);
+  }
+}
+
+static void fast_writer_task(void *pvParameters) {
+  char buf[SOCKETCAND_RAW_MAX_LEN];
+
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    // Format each frame once, and batch it for every fast path client.
+    can_listener_frame_t rx_frame;
+    QueueHandle_t skip_queue;
+    uint8_t admitted_classes;
+    while (fast_ring_read(&rx_frame, &skip_queue, &admitted_classes)) {
+      // Rewrite the frame once for all clients.
+      twai_message_t routed_msgs[CAN_GATEWAY_OUTPUTS_MAX];
+      uint8_t routed_count =
+          can_gateway_route(CAN_GATEWAY_RX, &rx_frame.msg, routed_msgs);
+      for (uint8_t routed = 0; routed < routed_count; routed++) {
+        int64_t secs = rx_frame.rx_time_us / 1000000;
+        int64_t usecs = rx_frame.rx_time_us % 1000000;
+        esp_err_t err = socketcand_translate_frame_to_string(
+            buf, sizeof(buf), &routed_msgs[routed], secs, usecs);
+        if (err != ESP_OK) {
+          ESP_LOGE(TAG,
+                   "Couldn't translate CAN frame to socketcand < > string.");
+          continue;
+        }
+
+        for (int i = 0; i < MAX_CLIENTS; i++) {
+          client_handler_data_t *client_handler_data =
+              &client_handler_datas[i];
+          if (atomic_load(&client_handler_data->fast) &&
+              client_handler_data->can_rx_queue != skip_queue &&
+              (admitted_classes &
+               (1U << can_listener_get_class(
+                    client_handler_data->can_rx_queue)))) {
+            fast_batch_append(client_handler_data, buf, rx_frame.rx_time_us);
+          }
+        }
+      }
+    }
+
+    // The ring is empty, so send what we have.
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+      fast_batch_flush(&client_handler_datas[i]);
+    }
+  }
+}
+
+static void fast_batch_append(client_handler_data_t *client_handler_data,
+                              const char *str, int64_t rx_time_us) {
+  size_t len = strlen(str);
+  if (client_handler_data->fast_batch_len + len >
+      sizeof(client_handler_data->fast_batch) - 1) {
+    fast_batch_flush(client_handler_data);
+  }
+
+  memcpy(&client_handler_data->fast_batch[client_handler_data->fast_batch_len],
+         str, len);
+  client_handler_data->fast_batch_len += len;
+
+  if (client_handler_data->fast_batch_frames == 0 ||
+      rx_time_us < client_handler_data->fast_batch_rx_time_min_us) {
+    client_handler_data->fast_batch_rx_time_min_us = rx_time_us;
+  }
+  client_handler_data->fast_batch_rx_time_total_us += rx_time_us;
+  client_handler_data->fast_batch_frames += 1;
+}
+
+static void fast_batch_flush(client_handler_data_t *client_handler_data) {
+  if (client_handler_data->fast_batch_len == 0) {
+    return;
+  }
+  client_handler_data->fast_batch[client_handler_data->fast_batch_len] = '\0';
+  uint32_t frames = client_handler_data->fast_batch_frames;
+  int64_t rx_time_total_us = client_handler_data->fast_batch_rx_time_total_us;
+  int64_t rx_time_min_us = client_handler_data->fast_batch_rx_time_min_us;
+  client_handler_data->fast_batch_len = 0;
+  client_handler_data->fast_batch_frames = 0;
+  client_handler_data->fast_batch_rx_time_total_us = 0;
+
+  // Keep the socket from being closed while we're writing, without
+  // holding the mutex, so the client's teardown isn't blocked by us.
+  assert(xSemaphoreTake(client_handler_data->handler_task_delete_mutex,
+                        portMAX_DELAY) == pdTRUE);
+  int fd = client_handler_data->tcp_messenger.socket_fd;
+  bool connected = atomic_load(&client_handler_data->fast) && fd != -1;
+  atomic_store(&client_handler_data->fast_writing, connected);
+  assert(xSemaphoreGive(client_handler_data->handler_task_delete_mutex) ==
+         pdTRUE);
+  if (!connected) {
+    return;
+  }
+
+  esp_err_t err = frame_io_write_str(fd, client_handler_data->fast_batch);
+  if (err != ESP_OK) {
+    // Gone, or stopped reading, and part of a frame may have been
+    // written. Make the `socketcand_to_bus_task` of this client
+    // notice, and clean up.
+    ESP_LOGW(TAG,
+             "Disconnecting fast path client in slot %d, which is gone or "
+             "stopped reading.",
+             client_slot(client_handler_data));
+    shutdown(fd, SHUT_RDWR);
+  }
+  atomic_store(&client_handler_data->fast_writing, false);
+  if (err != ESP_OK) {
+    return;
+  }
+
+  // Time from receiving the frames to handing them to lwIP.
+  int64_t now_us = esp_timer_get_time();
+  assert(xSemaphoreTake(server_status_mutex, portMAX_DELAY) == pdTRUE);
+  server_status.socketcand_frames_sent += frames;
+  server_status.frame_latency_total_us +=
+      (int64_t)frames * now_us - rx_time_total_us;
+  if (now_us - rx_time_min_us > server_status.frame_latency_max_us) {
+    server_status.frame_latency_max_us = now_us - rx_time_min_us;
+  }
+  assert(xSemaphoreGive(server_status_mutex) == pdTRUE);
+}
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "can_listener.h"
 #include "esp_err.h"
 
 // The status of the socketcand server.
@@ -10,6 +14,20 @@ typedef struct {
   uint64_t invalid_socketcand_frames_received;
   uint64_t can_bus_frames_sent;
   uint64_t can_bus_frames_send_timeouts;
+
+  // Time from receiving a frame from the CAN bus
+  // to writing it to a socketcand client, in microseconds.
+  // The average is `frame_latency_total_us / socketcand_frames_sent`.
+  int64_t frame_latency_total_us;
+  int64_t frame_latency_max_us;
+
+  // Frames that the fast path writer fell too far behind to send.
+  uint64_t fast_path_frames_dropped;
+
+  // Sessions that were resumed after a disconnect,
+  // and that weren't resumed in time.
+  uint32_t sessions_resumed;
+  uint32_t sessions_expired;
 } socketcand_server_status_t;
 
 // Starts a socketcand TCP server listening on IPv4 `0.0.0.0:29536` on a new
@@ -20,4 +38,23 @@ esp_err_t socketcand_server_start(void);
 
 // Fills `status_out` with the current `socketcand_server_status_t`.
 // Returns an error if the server isn't running.
-esp_err_t socketcand_server_status(socketcand_server_status_t* status_out);
\ No newline at end of file
+esp_err_t socketcand_server_status(socketcand_server_status_t* status_out);
+
+// Sets the depth and `can_listener_overflow_t` of the CAN receive queue
+// of clients that connect from now on, unless they choose their own with
+// `< open can0 queue=depth overflow=policy >`.
+// All clients share a budget of `CAN_LISTENER_FRAME_BUDGET` frames.
+void socketcand_server_set_client_defaults(uint16_t depth,
+                                           can_listener_overflow_t overflow);
+
+// If `enabled`, clients that connect from now on get CAN frames
+// from one shared writer task, which formats every frame once
+// and batches it straight from the CAN listener,
+// instead of through a queue and a task per client.
+// This lowers latency and CPU use, but a client that reads slowly
+// delays all other fast path clients.
+// Clients that are already connected keep their current path.
+void socketcand_server_set_fast_path(bool enabled);
+
+// Returns how full the queue of the fast path writer is, in percent.
+uint8_t socketcand_server_fast_path_fill_percent(void);
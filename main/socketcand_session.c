@@ -0,0 +1,262 @@
+#include "socketcand_session.h"
+
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "frame_io.h"
+#include "freertos/semphr.h"
+#include "lwip/sockets.h"
+#include "socketcand_translate.h"
+
+// How often `socketcand_session_resume()` checks whether
+// the old connection of an active session was parked.
+#define RESUME_POLL_MS 10
+
+// Name that will be used for logging
+static const char *TAG = "socketcand_session";
+
+static socketcand_session_t sessions[SOCKETCAND_SESSIONS_MAX];
+
+// Taken while changing the `state` of any session.
+static SemaphoreHandle_t sessions_mutex = NULL;
+static StaticSemaphore_t sessions_mutex_mem;
+
+// Frees the queue of `session` and marks it free.
+// Must be called with `sessions_mutex` taken.
+static void close_locked(socketcand_session_t *session);
+
+// Returns the session with `token`, or NULL.
+// Must be called with `sessions_mutex` taken.
+static socketcand_session_t *find_locked(uint32_t token);
+
+esp_err_t socketcand_session_init(void) {
+  sessions_mutex = xSemaphoreCreateMutexStatic(&sessions_mutex_mem);
+  if (sessions_mutex == NULL) {
+    ESP_LOGE(TAG, "Unreachable. sessions_mutex couldn't be created.");
+    return ESP_FAIL;
+  }
+
+  for (int i = 0; i < SOCKETCAND_SESSIONS_MAX; i++) {
+    sessions[i].state = SOCKETCAND_SESSION_FREE;
+  }
+  return ESP_OK;
+}
+
+esp_err_t socketcand_session_open(int socket_fd,
+                                  socketcand_session_t **session_out) {
+  assert(xSemaphoreTake(sessions_mutex, portMAX_DELAY) == pdTRUE);
+
+  socketcand_session_t *session = NULL;
+  for (int i = 0; i < SOCKETCAND_SESSIONS_MAX; i++) {
+    if (sessions[i].state == SOCKETCAND_SESSION_FREE) {
+      session = &sessions[i];
+      break;
+    }
+  }
+  if (session == NULL) {
+    assert(xSemaphoreGive(sessions_mutex) == pdTRUE);
+    ESP_LOGW(TAG, "Reached limit of %d sessions.", SOCKETCAND_SESSIONS_MAX);
+    return ESP_ERR_NO_MEM;
+  }
+
+  // Tokens are random, so a client can't resume another client's session
+  // by guessing, and never 0.
+  uint32_t token;
+  do {
+    token = esp_random();
+  } while (token == 0 || find_locked(token) != NULL);
+
+  session->state = SOCKETCAND_SESSION_ACTIVE;
+  session->token = token;
+  session->expires_us = 0;
+  session->socket_fd = socket_fd;
+  session->can_rx_queue = NULL;
+  session->position = 0;
+  session->dropped_reported = 0;
+  session->history_start = 0;
+  session->history_count = 0;
+
+  assert(xSemaphoreGive(sessions_mutex) == pdTRUE);
+
+  *session_out = session;
+  return ESP_OK;
+}
+
+void socketcand_session_close(socketcand_session_t *session) {
+  assert(xSemaphoreTake(sessions_mutex, portMAX_DELAY) == pdTRUE);
+  close_locked(session);
+  assert(xSemaphoreGive(sessions_mutex) == pdTRUE);
+}
+
+void socketcand_session_disconnect(socketcand_session_t *session) {
+  assert(xSemaphoreTake(sessions_mutex, portMAX_DELAY) == pdTRUE);
+  session->socket_fd = -1;
+  assert(xSemaphoreGive(sessions_mutex) == pdTRUE);
+}
+
+void socketcand_session_park(socketcand_session_t *session) {
+  assert(xSemaphoreTake(sessions_mutex, portMAX_DELAY) == pdTRUE);
+  if (session->can_rx_queue == NULL) {
+    // Never reached rawmode, so there's nothing to resume.
+    close_locked(session);
+  } else {
+    session->state = SOCKETCAND_SESSION_PARKED;
+    session->socket_fd = -1;
+    // Nobody reads the queue until the session resumes,
+    // so it filling up isn't an overload of the adapter.
+    can_listener_set_paused(session->can_rx_queue, true);
+    session->expires_us =
+        esp_timer_get_time() + SOCKETCAND_SESSION_GRACE_MS * 1000LL;
+    ESP_LOGI(TAG, "Parked session %08lX at position %lu.", session->token,
+             session->position);
+  }
+  assert(xSemaphoreGive(sessions_mutex) == pdTRUE);
+}
+
+esp_err_t socketcand_session_resume(uint32_t token, int socket_fd,
+                                    TickType_t timeout,
+                                    socketcand_session_t **session_out) {
+  TickType_t start = xTaskGetTickCount();
+  bool shut_down = false;
+
+  while (true) {
+    assert(xSemaphoreTake(sessions_mutex, portMAX_DELAY) == pdTRUE);
+    socketcand_session_t *session = find_locked(token);
+    if (session == NULL) {
+      assert(xSemaphoreGive(sessions_mutex) == pdTRUE);
+      return ESP_ERR_NOT_FOUND;
+    }
+
+    if (session->state == SOCKETCAND_SESSION_PARKED) {
+      session->state = SOCKETCAND_SESSION_ACTIVE;
+      session->socket_fd = socket_fd;
+      can_listener_set_paused(session->can_rx_queue, false);
+      assert(xSemaphoreGive(sessions_mutex) == pdTRUE);
+      *session_out = session;
+      return ESP_OK;
+    }
+
+    // The old connection hasn't noticed that its client is gone,
+    // as usual after roaming. Make its tasks notice.
+    if (!shut_down && session->socket_fd != -1) {
+      shutdown(session->socket_fd, SHUT_RDWR);
+      shut_down = true;
+    }
+    assert(xSemaphoreGive(sessions_mutex) == pdTRUE);
+
+    if (xTaskGetTickCount() - start >= timeout) {
+      ESP_LOGW(TAG, "Session %08lX is still active. Not resuming it.", token);
+      return ESP_ERR_TIMEOUT;
+    }
+    vTaskDelay(pdMS_TO_TICKS(RESUME_POLL_MS));
+  }
+}
+
+void socketcand_session_record(socketcand_session_t *session,
+                               const can_listener_frame_t *frame) {
+  uint32_t index;
+  if (session->history_count < SOCKETCAND_SESSION_HISTORY_LEN) {
+    index = (session->history_start + session->history_count) %
+            SOCKETCAND_SESSION_HISTORY_LEN;
+    session->history_count += 1;
+  } else {
+    // Overwrite the oldest entry.
+    index = session->history_start;
+    session->history_start =
+        (session->history_start + 1) % SOCKETCAND_SESSION_HISTORY_LEN;
+  }
+
+  session->history[index].position = session->position;
+  session->history[index].frame = *frame;
+  session->position += 1;
+}
+
+esp_err_t socketcand_session_replay(const socketcand_session_t *session,
+                                    uint32_t from, int socket_fd) {
+  if ((int32_t)(session->position - from) < 0) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  char buf[SOCKETCAND_RAW_MAX_LEN];
+  esp_err_t err;
+  uint32_t position = from;
+  for (uint32_t i = 0; i < session->history_count; i++) {
+    const socketcand_session_entry_t *entry =
+        &session->history[(session->history_start + i) %
+                          SOCKETCAND_SESSION_HISTORY_LEN];
+    if ((int32_t)(entry->position - position) < 0) {
+      // The client already has this frame.
+      continue;
+    }
+
+    // Frames between `position` and this one are gone.
+    if (entry->position != position) {
+      err = socketcand_translate_dropped_to_string(
+          buf, sizeof(buf), entry->position - position, position);
+      ESP_RETURN_ON_ERROR(err, TAG, "Couldn't translate dropped marker.");
+      err = frame_io_write_str(socket_fd, buf);
+      ESP_RETURN_ON_ERROR(err, TAG, "Couldn't write dropped marker.");
+    }
+
+    err = socketcand_translate_frame_to_string(
+        buf, sizeof(buf), &entry->frame.msg,
+        entry->frame.rx_time_us / 1000000, entry->frame.rx_time_us % 1000000);
+    ESP_RETURN_ON_ERROR(err, TAG, "Couldn't translate replayed frame.");
+    err = frame_io_write_str(socket_fd, buf);
+    ESP_RETURN_ON_ERROR(err, TAG, "Couldn't write replayed frame.");
+    position = entry->position + 1;
+  }
+
+  // Frames dropped after the last one sent are gone too.
+  if (position != session->position) {
+    err = socketcand_translate_dropped_to_string(
+        buf, sizeof(buf), session->position - position, position);
+    ESP_RETURN_ON_ERROR(err, TAG, "Couldn't translate dropped marker.");
+    err = frame_io_write_str(socket_fd, buf);
+    ESP_RETURN_ON_ERROR(err, TAG, "Couldn't write dropped marker.");
+  }
+
+  return ESP_OK;
+}
+
+uint32_t socketcand_session_reap(void) {
+  uint32_t reaped = 0;
+  int64_t now = esp_timer_get_time();
+
+  assert(xSemaphoreTake(sessions_mutex, portMAX_DELAY) == pdTRUE);
+  for (int i = 0; i < SOCKETCAND_SESSIONS_MAX; i++) {
+    if (sessions[i].state == SOCKETCAND_SESSION_PARKED &&
+        now >= sessions[i].expires_us) {
+      ESP_LOGI(TAG, "Session %08lX expired.", sessions[i].token);
+      close_locked(&sessions[i]);
+      reaped += 1;
+    }
+  }
+  assert(xSemaphoreGive(sessions_mutex) == pdTRUE);
+
+  return reaped;
+}
+
+static void close_locked(socketcand_session_t *session) {
+  if (session->can_rx_queue != NULL) {
+    esp_err_t err = can_listener_free(session->can_rx_queue);
+    if (err != ESP_OK) {
+      ESP_LOGE(TAG, "Unreachable. Couldn't free CAN RX queue.");
+      abort();
+    }
+    session->can_rx_queue = NULL;
+  }
+  session->state = SOCKETCAND_SESSION_FREE;
+  session->token = 0;
+}
+
+static socketcand_session_t *find_locked(uint32_t token) {
+  for (int i = 0; i < SOCKETCAND_SESSIONS_MAX; i++) {
+    if (sessions[i].state != SOCKETCAND_SESSION_FREE &&
+        sessions[i].token == token) {
+      return &sessions[i];
+    }
+  }
+  return NULL;
+}
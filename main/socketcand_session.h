@@ -0,0 +1,117 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "can_listener.h"
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+// Resumable socketcand sessions.
+//
+// A client that asks for a session during the rawmode handshake gets a
+// token. When its connection drops, its CAN receive queue stays loaned
+// and keeps filling for `SOCKETCAND_SESSION_GRACE_MS`, and the last
+// `SOCKETCAND_SESSION_HISTORY_LEN` frames it was sent are kept.
+// A client that reconnects with `< resume token position >` in time gets
+// exactly the frames after `position` that it didn't receive,
+// and `< dropped n position >` markers for those that are gone.
+//
+// Positions count every frame of the session's stream,
+// both sent and dropped ones, starting at 0.
+
+// Maximum number of sessions, active or parked.
+#define SOCKETCAND_SESSIONS_MAX 5
+
+// Number of sent frames kept per session, for replay after a resume.
+#define SOCKETCAND_SESSION_HISTORY_LEN 32
+
+// How long a disconnected session can be resumed.
+#define SOCKETCAND_SESSION_GRACE_MS 5000
+
+// A frame of a session's history, and its position in the stream.
+typedef struct {
+  uint32_t position;
+  can_listener_frame_t frame;
+} socketcand_session_entry_t;
+
+typedef enum {
+  SOCKETCAND_SESSION_FREE,
+
+  // Served by a connected client.
+  SOCKETCAND_SESSION_ACTIVE,
+
+  // Waiting for its client to resume it until `expires_us`.
+  SOCKETCAND_SESSION_PARKED,
+} socketcand_session_state_t;
+
+typedef struct {
+  // Changed only by this module, while holding its mutex.
+  socketcand_session_state_t state;
+  uint32_t token;
+  int64_t expires_us;
+
+  // Socket of the client serving the session while it's active.
+  // Shut down when the session is resumed over another connection.
+  int socket_fd;
+
+  // The CAN receive queue of the session, or NULL before rawmode.
+  // It's freed when the session ends.
+  QueueHandle_t can_rx_queue;
+
+  // Position of the next frame of the stream,
+  // and the number of queue drops that were reported as `< dropped >`.
+  // Only used by the client serving the session.
+  uint32_t position;
+  uint32_t dropped_reported;
+
+  // Ring of the last frames sent, oldest at `history_start`.
+  socketcand_session_entry_t history[SOCKETCAND_SESSION_HISTORY_LEN];
+  uint32_t history_start;
+  uint32_t history_count;
+} socketcand_session_t;
+
+// Initializes the session table.
+// Must only be called once, before any other function of this module.
+esp_err_t socketcand_session_init(void);
+
+// Starts an active session served by the client at `socket_fd`.
+// Returns `ESP_ERR_NO_MEM` if there are already
+// `SOCKETCAND_SESSIONS_MAX` sessions.
+esp_err_t socketcand_session_open(int socket_fd,
+                                  socketcand_session_t** session_out);
+
+// Ends `session` at once, and frees its `can_rx_queue`.
+void socketcand_session_close(socketcand_session_t* session);
+
+// Called when the connection of an active `session` is about to be
+// closed, while its tasks are still stopping.
+void socketcand_session_disconnect(socketcand_session_t* session);
+
+// Called when the client serving `session` disconnects.
+// Keeps the session for `SOCKETCAND_SESSION_GRACE_MS`,
+// or closes it if it never reached rawmode.
+void socketcand_session_park(socketcand_session_t* session);
+
+// Makes the session with `token` active again, served by `socket_fd`.
+// If it's still active, shuts down its old connection and waits up to
+// `timeout` for it to be parked.
+// Returns `ESP_ERR_NOT_FOUND` if there's no such session.
+esp_err_t socketcand_session_resume(uint32_t token, int socket_fd,
+                                    TickType_t timeout,
+                                    socketcand_session_t** session_out);
+
+// Remembers that `frame` was sent at `session->position`,
+// and advances the position.
+void socketcand_session_record(socketcand_session_t* session,
+                               const can_listener_frame_t* frame);
+
+// Writes what the client missed since `from` to `socket_fd`:
+// the frames still in the history, and `< dropped >` markers for the rest.
+// Returns `ESP_ERR_INVALID_ARG` if `from` is after `session->position`.
+esp_err_t socketcand_session_replay(const socketcand_session_t* session,
+                                    uint32_t from, int socket_fd);
+
+// Closes parked sessions whose grace period is over.
+// Returns the number of sessions closed.
+uint32_t socketcand_session_reap(void);
@@ -76,6 +76,12 @@ esp_err_t socketcand_translate_string_to_frame(const char *buf,
     return ESP_FAIL;
   }
 
+  // Larger IDs would carry flags, like that of error frames.
+  if (msg->identifier > CAN_EFF_MASK) {
+    ESP_LOGE(TAG, "Invalid ID in received socketcand frame.");
+    return ESP_FAIL;
+  }
+
   if (msg->identifier > CAN_SHORT_ID_MASK) {
     msg->extd = 1;
   } else {
@@ -85,6 +91,169 @@ esp_err_t socketcand_translate_string_to_frame(const char *buf,
   return ESP_OK;
 }
 
+esp_err_t socketcand_translate_string_to_sendat(const char *buf,
+                                                twai_message_t *msg,
+                                                int64_t *deadline_us_out) {
+  if (strncmp("< sendat ", buf, 9) != 0) {
+    return ESP_ERR_NOT_FOUND;
+  }
+
+  // The time is written like in `< frame >`, with exactly 6 digits
+  // of `usecs`, so `12.5` isn't mistaken for 12 s and 5 µs.
+  // `sscanf()` would also accept signs and whitespace.
+  const char *time = buf + 9;
+  size_t secs_len = strspn(time, "0123456789");
+  const char *usecs_text = time + secs_len + 1;
+  if (secs_len == 0 || secs_len > 10 || time[secs_len] != '.' ||
+      strspn(usecs_text, "0123456789") != 6) {
+    ESP_LOGE(TAG, "Invalid time in received socketcand sendat.");
+    return ESP_FAIL;
+  }
+  uint64_t secs = strtoull(time, NULL, 10);
+  uint32_t usecs = strtoul(usecs_text, NULL, 10);
+
+  // The rest is the same as in `< send >`.
+  char send[SOCKETCAND_RAW_MAX_LEN];
+  int len = snprintf(send, sizeof(send), "< send%s", usecs_text + 6);
+  if (len < 0 || (size_t)len >= sizeof(send)) {
+    return ESP_FAIL;
+  }
+  esp_err_t err = socketcand_translate_string_to_frame(send, msg);
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  *deadline_us_out = (int64_t)secs * 1000000 + usecs;
+  return ESP_OK;
+}
+
+esp_err_t socketcand_translate_string_to_class(
+    const char *buf, can_listener_class_t *class_out) {
+  if (strncmp("< class ", buf, 8) != 0) {
+    return ESP_ERR_NOT_FOUND;
+  }
+
+  char name[16];
+  if (sscanf(buf, "< class %15s >", name) != 1) {
+    return ESP_FAIL;
+  }
+
+  for (can_listener_class_t c = 0; c < CAN_LISTENER_CLASS_COUNT; c++) {
+    if (strcmp(name, can_listener_class_name(c)) == 0) {
+      *class_out = c;
+      return ESP_OK;
+    }
+  }
+  ESP_LOGE(TAG, "Unknown class '%s' in received socketcand frame.", name);
+  return ESP_FAIL;
+}
+
+esp_err_t socketcand_translate_string_to_credit(const char *buf,
+                                                uint32_t *credits_out) {
+  if (strncmp("< credit ", buf, 9) != 0) {
+    return ESP_ERR_NOT_FOUND;
+  }
+
+  unsigned long credits;
+  char end;
+  if (sscanf(buf, "< credit %lu %c", &credits, &end) != 2 || end != '>' ||
+      credits > SOCKETCAND_CREDIT_MAX) {
+    ESP_LOGE(TAG, "Invalid credit in received socketcand frame.");
+    return ESP_FAIL;
+  }
+
+  *credits_out = credits;
+  return ESP_OK;
+}
+
+esp_err_t socketcand_translate_dropped_to_string(char *buf, size_t bufsize,
+                                                 uint32_t dropped,
+                                                 uint32_t seq) {
+  int written = snprintf(buf, bufsize, "< dropped %lu %lu >", dropped, seq);
+  if (written < 0 || written >= bufsize) {
+    return ESP_ERR_NO_MEM;
+  }
+  return ESP_OK;
+}
+
+bool socketcand_translate_is_session(const char *buf) {
+  return strcmp(buf, "< session >") == 0;
+}
+
+esp_err_t socketcand_translate_session_to_string(char *buf, size_t bufsize,
+                                                 uint32_t token) {
+  int written = snprintf(buf, bufsize, "< session %08lX >", token);
+  if (written < 0 || written >= bufsize) {
+    return ESP_ERR_NO_MEM;
+  }
+  return ESP_OK;
+}
+
+esp_err_t socketcand_translate_string_to_resume(const char *buf,
+                                                uint32_t *token_out,
+                                                uint32_t *position_out) {
+  if (strncmp("< resume ", buf, 9) != 0) {
+    return ESP_ERR_NOT_FOUND;
+  }
+
+  unsigned long token;
+  unsigned long position;
+  char end;
+  if (sscanf(buf, "< resume %lx %lu %c", &token, &position, &end) != 3 ||
+      end != '>') {
+    ESP_LOGE(TAG, "Invalid resume in received socketcand frame.");
+    return ESP_FAIL;
+  }
+
+  *token_out = token;
+  *position_out = position;
+  return ESP_OK;
+}
+
+esp_err_t socketcand_translate_open_options(const char *buf,
+                                            can_listener_options_t *options) {
+  char copy[SOCKETCAND_RAW_MAX_LEN];
+  if (strlen(buf) >= sizeof(copy)) {
+    return ESP_FAIL;
+  }
+  strcpy(copy, buf);
+
+  // Skip "<", "open" and the bus name.
+  char *saveptr;
+  char *token = strtok_r(copy, " ", &saveptr);
+  for (int i = 0; i < 2 && token != NULL; i++) {
+    token = strtok_r(NULL, " ", &saveptr);
+  }
+
+  while ((token = strtok_r(NULL, " ", &saveptr)) != NULL) {
+    if (strcmp(token, ">") == 0) {
+      return ESP_OK;
+    } else if (strncmp(token, "queue=", 6) == 0) {
+      char *end;
+      long depth = strtol(token + 6, &end, 10);
+      if (*end != '\0' || depth < CAN_LISTENER_MIN_DEPTH ||
+          depth > CAN_LISTENER_FRAME_BUDGET) {
+        ESP_LOGE(TAG, "Invalid queue depth '%s' in socketcand open.", token);
+        return ESP_FAIL;
+      }
+      options->depth = depth;
+    } else if (strncmp(token, "overflow=", 9) == 0) {
+      if (can_listener_overflow_from_name(token + 9, &options->overflow) !=
+          ESP_OK) {
+        ESP_LOGE(TAG, "Invalid overflow policy '%s' in socketcand open.",
+                 token);
+        return ESP_FAIL;
+      }
+    } else {
+      ESP_LOGE(TAG, "Unknown option '%s' in socketcand open.", token);
+      return ESP_FAIL;
+    }
+  }
+
+  // The closing '>' is missing.
+  return ESP_FAIL;
+}
+
 int32_t socketcand_translate_open_raw(char *buf, size_t bufsize) {
   if (bufsize < 12) {
     // buf is too small
@@ -5,6 +5,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "can_listener.h"
 #include "driver/twai.h"
 
 #include "esp_err.h"
@@ -12,12 +13,16 @@
 // Longest socketcand frames that get used during rawmode:
 // '< send XXXXXXXX l xx xx xx xx xx xx xx xx >'
 // '< frame XXXXXXXX 1000000.1000000 XXXXXXXXXXXXXXXX >'
-// The one above is 51 bytes long. Just in case I made
-// a calculation error, let's round up to 64.
+// '< sendat 4294967295.999999 XXXXXXXX l xx xx xx xx xx xx xx xx >'
+// The last one is 63 bytes long. Just in case I made
+// a calculation error, let's round up to 80.
 
 // A buffer of this size should be large enough
 // enough to hold all socketcand `send` and `frame` message strings.
-#define SOCKETCAND_RAW_MAX_LEN 64
+#define SOCKETCAND_RAW_MAX_LEN 80
+
+// Largest number of frames a client can be granted with `< credit n >`.
+#define SOCKETCAND_CREDIT_MAX 100000
 
 // Translates a `socketcand_translate_frame_t` to a socketcand string of form `<
 // frame can_id seconds.useconds [data]* >`.
@@ -34,6 +39,73 @@ esp_err_t socketcand_translate_frame_to_string(
 esp_err_t socketcand_translate_string_to_frame(
     const char *buf, twai_message_t *msg);
 
+// Translates a null-terminated string of form
+// `< sendat secs.usecs can_id can_dlc [data]* >` to a frame, and the
+// time it should be transmitted at, in `esp_timer_get_time()` time.
+// This is an extension of rawmode for frames that must be on the bus
+// at a precise time. Like in `< frame >`, the time is the adapter's
+// uptime, and `usecs` has exactly 6 digits.
+// Returns `ESP_ERR_NOT_FOUND` if `buf` isn't a `sendat` command,
+// and `ESP_FAIL` if it's malformed.
+esp_err_t socketcand_translate_string_to_sendat(const char *buf,
+                                                twai_message_t *msg,
+                                                int64_t *deadline_us_out);
+
+// Translates a null-terminated string of form `< class name >`
+// to a `can_listener_class_t`, where `name` is a
+// `can_listener_class_name()`.
+// This is an extension of rawmode, that lets a client choose how
+// important it is that it receives every frame under overload.
+// Returns `ESP_ERR_NOT_FOUND` if `buf` isn't a `class` command,
+// and `ESP_FAIL` if the class name is unknown.
+esp_err_t socketcand_translate_string_to_class(
+    const char *buf, can_listener_class_t *class_out);
+
+// Parses a rawmode message of form `< credit n >`, where `n` is the
+// number of further frames the client is ready to receive.
+// This is an extension of rawmode. Once a client sends it,
+// the server never sends more frames than it was granted,
+// and reports frames it had to drop with `< dropped n seq >`.
+// Returns `ESP_ERR_NOT_FOUND` if `buf` isn't a `credit` command,
+// and `ESP_FAIL` if `n` is invalid.
+esp_err_t socketcand_translate_string_to_credit(const char *buf,
+                                                uint32_t *credits_out);
+
+// Writes a `< dropped n seq >` string to `buf`, which tells a client
+// that used `< credit n >` that `n` frames were dropped after the
+// `seq` frames it was sent so far.
+// Returns `ESP_ERR_NO_MEM` if `bufsize` is too small too fit the string.
+esp_err_t socketcand_translate_dropped_to_string(char *buf, size_t bufsize,
+                                                 uint32_t dropped,
+                                                 uint32_t seq);
+
+// Returns true if `buf` is `< session >`, which a client sends between
+// `< open >` and `< rawmode >` to start a resumable session.
+// This is an extension of rawmode, see `socketcand_session.h`.
+bool socketcand_translate_is_session(const char *buf);
+
+// Writes the `< session token >` answer to `< session >` to `buf`.
+// Returns `ESP_ERR_NO_MEM` if `bufsize` is too small too fit the string.
+esp_err_t socketcand_translate_session_to_string(char *buf, size_t bufsize,
+                                                 uint32_t token);
+
+// Parses `< resume token position >`, which a client sends instead of
+// `< open >` to resume a session, where `token` is hexadecimal.
+// Returns `ESP_ERR_NOT_FOUND` if `buf` isn't a `resume` command,
+// and `ESP_FAIL` if it's malformed.
+esp_err_t socketcand_translate_string_to_resume(const char *buf,
+                                                uint32_t *token_out,
+                                                uint32_t *position_out);
+
+// Parses the options that this adapter accepts after the bus name of
+// `< open bus [queue=depth] [overflow=policy] >`, where `policy` is a
+// `can_listener_overflow_name()`. They choose how the client's
+// receive queue behaves.
+// Only changes the fields of `options` that are given.
+// Returns `ESP_FAIL` if an option is unknown or invalid.
+esp_err_t socketcand_translate_open_options(const char *buf,
+                                            can_listener_options_t *options);
+
 // This function is used to mimic the socketcand protocol
 // for opening a rawmode connection.
 //
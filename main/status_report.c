@@ -1,14 +1,31 @@
 #include "status_report.h"
 
+#include "boot_timeline.h"
+#include "can_bridge.h"
+#include "can_gateway.h"
 #include "can_listener.h"
+#include "can_replay.h"
+#include "cannelloni.h"
+#include "capture_ring.h"
+#include "capture_trigger.h"
 #include "cyphal_node.h"
 #include "driver/twai.h"
+#include "driver_setup.h"
 #include "esp_check.h"
 #include "esp_netif_types.h"
 #include "esp_timer.h"
 #include "freertos/semphr.h"
+#include "multicast_publisher.h"
+#include "overload_control.h"
+#include "persistent_settings.h"
+#include "reflex_rules.h"
+#include "signal_decoder.h"
 #include "socketcand_server.h"
 #include "string.h"
+#include "task_config.h"
+#include "traffic_gen.h"
+#include "tx_rate_limit.h"
+#include "tx_scheduler.h"
 
 // Name that will be used for logging
 static const char *TAG = "status_report";
@@ -37,7 +54,98 @@ static esp_err_t print_application_status(char *buf_out, size_t buflen,
 static esp_err_t print_cyphal_status(char *buf_out, size_t buflen,
                                      size_t *bytes_written);
 
-static char status_json[2048];
+// Prints the status of `overload_control` to `buf_out` in JSON format.
+// Returns an error if `buflen` was too small.
+// Increments `bytes_written` by the number of bytes written.
+static esp_err_t print_overload_status(char *buf_out, size_t buflen,
+                                       size_t *bytes_written);
+
+// Prints the status of every loaned CAN listener queue
+// to `buf_out` in JSON format.
+// Returns an error if `buflen` was too small.
+// Increments `bytes_written` by the number of bytes written.
+static esp_err_t print_queue_status(char *buf_out, size_t buflen,
+                                    size_t *bytes_written);
+
+// Prints the status of the cannelloni transport to `buf_out` in JSON format.
+// Returns an error if `buflen` was too small.
+// Increments `bytes_written` by the number of bytes written.
+static esp_err_t print_cannelloni_status(char *buf_out, size_t buflen,
+                                         size_t *bytes_written);
+
+// Prints the status of the multicast publisher to `buf_out` in JSON format.
+// Returns an error if `buflen` was too small.
+// Increments `bytes_written` by the number of bytes written.
+static esp_err_t print_multicast_status(char *buf_out, size_t buflen,
+                                        size_t *bytes_written);
+
+// Prints the status of the CAN bridge to `buf_out` in JSON format.
+// Returns an error if `buflen` was too small.
+// Increments `bytes_written` by the number of bytes written.
+static esp_err_t print_bridge_status(char *buf_out, size_t buflen,
+                                     size_t *bytes_written);
+
+// Prints the status of the capture ring to `buf_out` in JSON format.
+// Returns an error if `buflen` was too small.
+// Increments `bytes_written` by the number of bytes written.
+static esp_err_t print_capture_status(char *buf_out, size_t buflen,
+                                      size_t *bytes_written);
+
+// Prints the status of the capture triggers to `buf_out` in JSON format.
+// Returns an error if `buflen` was too small.
+// Increments `bytes_written` by the number of bytes written.
+static esp_err_t print_trigger_status(char *buf_out, size_t buflen,
+                                      size_t *bytes_written);
+
+// Prints the status of the replay to `buf_out` in JSON format.
+// Returns an error if `buflen` was too small.
+// Increments `bytes_written` by the number of bytes written.
+static esp_err_t print_replay_status(char *buf_out, size_t buflen,
+                                     size_t *bytes_written);
+
+// Prints the status of scheduled transmission to `buf_out` in JSON format.
+// Returns an error if `buflen` was too small.
+// Increments `bytes_written` by the number of bytes written.
+static esp_err_t print_scheduler_status(char *buf_out, size_t buflen,
+                                        size_t *bytes_written);
+
+// Prints the counters of every reflex rule to `buf_out` in JSON format.
+// Returns an error if `buflen` was too small.
+// Increments `bytes_written` by the number of bytes written.
+static esp_err_t print_reflex_status(char *buf_out, size_t buflen,
+                                     size_t *bytes_written);
+
+// Prints the counters of every TX rate limit bucket to `buf_out`
+// in JSON format. Returns an error if `buflen` was too small.
+// Increments `bytes_written` by the number of bytes written.
+static esp_err_t print_rate_limit_status(char *buf_out, size_t buflen,
+                                         size_t *bytes_written);
+
+// Prints the hits of every gateway rule to `buf_out` in JSON format.
+// Returns an error if `buflen` was too small.
+// Increments `bytes_written` by the number of bytes written.
+static esp_err_t print_gateway_status(char *buf_out, size_t buflen,
+                                      size_t *bytes_written);
+
+// Prints the status of the traffic generator to `buf_out` in JSON format.
+// Returns an error if `buflen` was too small.
+// Increments `bytes_written` by the number of bytes written.
+static esp_err_t print_generator_status(char *buf_out, size_t buflen,
+                                        size_t *bytes_written);
+
+// Prints the counters of the signal decoder to `buf_out` in JSON format.
+// Returns an error if `buflen` was too small.
+// Increments `bytes_written` by the number of bytes written.
+static esp_err_t print_signal_decoder_status(char *buf_out, size_t buflen,
+                                             size_t *bytes_written);
+
+// Prints the boot phase timings to `buf_out` in JSON format.
+// Returns an error if `buflen` was too small.
+// Increments `bytes_written` by the number of bytes written.
+static esp_err_t print_boot_timeline(char *buf_out, size_t buflen,
+                                     size_t *bytes_written);
+
+static char status_json[16384];
 static SemaphoreHandle_t status_json_mutex = NULL;
 static StaticSemaphore_t status_json_mutex_mem;
 
@@ -134,6 +242,216 @@ esp_err_t status_report_get(const char **json_out, esp_netif_t *eth_netif,
                                  sizeof(status_json) - written, &written);
   ESP_RETURN_ON_ERROR(err, TAG, "Couldn't print OpenCyphal status.");
 
+  res = snprintf(status_json + written, sizeof(status_json) - written,
+                 ",\n"
+                 "\"Overload control\": ");
+  written += res;
+  if (res < 0 || written >= sizeof(status_json)) {
+    ESP_LOGE(TAG, "driver_setup_get_status_json() buflen too small.");
+    return ESP_ERR_NO_MEM;
+  }
+
+  // Print the overload control status
+  err = print_overload_status(status_json + written,
+                              sizeof(status_json) - written, &written);
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't print overload control status.");
+
+  res = snprintf(status_json + written, sizeof(status_json) - written,
+                 ",\n"
+                 "\"CAN listener queues\": ");
+  written += res;
+  if (res < 0 || written >= sizeof(status_json)) {
+    ESP_LOGE(TAG, "driver_setup_get_status_json() buflen too small.");
+    return ESP_ERR_NO_MEM;
+  }
+
+  // Print the CAN listener queue status
+  err = print_queue_status(status_json + written,
+                           sizeof(status_json) - written, &written);
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't print CAN listener queue status.");
+
+  res = snprintf(status_json + written, sizeof(status_json) - written,
+                 ",\n"
+                 "\"Cannelloni\": ");
+  written += res;
+  if (res < 0 || written >= sizeof(status_json)) {
+    ESP_LOGE(TAG, "driver_setup_get_status_json() buflen too small.");
+    return ESP_ERR_NO_MEM;
+  }
+
+  // Print the cannelloni status
+  err = print_cannelloni_status(status_json + written,
+                                sizeof(status_json) - written, &written);
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't print cannelloni status.");
+
+  res = snprintf(status_json + written, sizeof(status_json) - written,
+                 ",\n"
+                 "\"Multicast publisher\": ");
+  written += res;
+  if (res < 0 || written >= sizeof(status_json)) {
+    ESP_LOGE(TAG, "driver_setup_get_status_json() buflen too small.");
+    return ESP_ERR_NO_MEM;
+  }
+
+  // Print the multicast publisher status
+  err = print_multicast_status(status_json + written,
+                               sizeof(status_json) - written, &written);
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't print multicast publisher status.");
+
+  res = snprintf(status_json + written, sizeof(status_json) - written,
+                 ",\n"
+                 "\"CAN bridge\": ");
+  written += res;
+  if (res < 0 || written >= sizeof(status_json)) {
+    ESP_LOGE(TAG, "driver_setup_get_status_json() buflen too small.");
+    return ESP_ERR_NO_MEM;
+  }
+
+  // Print the CAN bridge status
+  err = print_bridge_status(status_json + written,
+                            sizeof(status_json) - written, &written);
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't print CAN bridge status.");
+
+  res = snprintf(status_json + written, sizeof(status_json) - written,
+                 ",\n"
+                 "\"Capture ring\": ");
+  written += res;
+  if (res < 0 || written >= sizeof(status_json)) {
+    ESP_LOGE(TAG, "driver_setup_get_status_json() buflen too small.");
+    return ESP_ERR_NO_MEM;
+  }
+
+  // Print the capture ring status
+  err = print_capture_status(status_json + written,
+                             sizeof(status_json) - written, &written);
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't print capture ring status.");
+
+  res = snprintf(status_json + written, sizeof(status_json) - written,
+                 ",\n"
+                 "\"Capture triggers\": ");
+  written += res;
+  if (res < 0 || written >= sizeof(status_json)) {
+    ESP_LOGE(TAG, "driver_setup_get_status_json() buflen too small.");
+    return ESP_ERR_NO_MEM;
+  }
+
+  // Print the capture trigger status
+  err = print_trigger_status(status_json + written,
+                             sizeof(status_json) - written, &written);
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't print capture trigger status.");
+
+  res = snprintf(status_json + written, sizeof(status_json) - written,
+                 ",\n"
+                 "\"Replay\": ");
+  written += res;
+  if (res < 0 || written >= sizeof(status_json)) {
+    ESP_LOGE(TAG, "driver_setup_get_status_json() buflen too small.");
+    return ESP_ERR_NO_MEM;
+  }
+
+  // Print the replay status
+  err = print_replay_status(status_json + written,
+                            sizeof(status_json) - written, &written);
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't print replay status.");
+
+  res = snprintf(status_json + written, sizeof(status_json) - written,
+                 ",\n"
+                 "\"Scheduled TX\": ");
+  written += res;
+  if (res < 0 || written >= sizeof(status_json)) {
+    ESP_LOGE(TAG, "driver_setup_get_status_json() buflen too small.");
+    return ESP_ERR_NO_MEM;
+  }
+
+  // Print the status of scheduled transmission
+  err = print_scheduler_status(status_json + written,
+                               sizeof(status_json) - written, &written);
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't print scheduler status.");
+
+  res = snprintf(status_json + written, sizeof(status_json) - written,
+                 ",\n"
+                 "\"Reflex rules\": ");
+  written += res;
+  if (res < 0 || written >= sizeof(status_json)) {
+    ESP_LOGE(TAG, "driver_setup_get_status_json() buflen too small.");
+    return ESP_ERR_NO_MEM;
+  }
+
+  // Print the reflex rule counters
+  err = print_reflex_status(status_json + written,
+                            sizeof(status_json) - written, &written);
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't print reflex rule status.");
+
+  res = snprintf(status_json + written, sizeof(status_json) - written,
+                 ",\n"
+                 "\"TX rate limits\": ");
+  written += res;
+  if (res < 0 || written >= sizeof(status_json)) {
+    ESP_LOGE(TAG, "driver_setup_get_status_json() buflen too small.");
+    return ESP_ERR_NO_MEM;
+  }
+
+  // Print the TX rate limit counters
+  err = print_rate_limit_status(status_json + written,
+                                sizeof(status_json) - written, &written);
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't print TX rate limit status.");
+
+  res = snprintf(status_json + written, sizeof(status_json) - written,
+                 ",\n"
+                 "\"Gateway rules\": ");
+  written += res;
+  if (res < 0 || written >= sizeof(status_json)) {
+    ESP_LOGE(TAG, "driver_setup_get_status_json() buflen too small.");
+    return ESP_ERR_NO_MEM;
+  }
+
+  // Print the gateway rule hits
+  err = print_gateway_status(status_json + written,
+                             sizeof(status_json) - written, &written);
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't print gateway status.");
+
+  res = snprintf(status_json + written, sizeof(status_json) - written,
+                 ",\n"
+                 "\"Traffic generator\": ");
+  written += res;
+  if (res < 0 || written >= sizeof(status_json)) {
+    ESP_LOGE(TAG, "driver_setup_get_status_json() buflen too small.");
+    return ESP_ERR_NO_MEM;
+  }
+
+  // Print the traffic generator status
+  err = print_generator_status(status_json + written,
+                               sizeof(status_json) - written, &written);
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't print traffic generator status.");
+
+  res = snprintf(status_json + written, sizeof(status_json) - written,
+                 ",\n"
+                 "\"Signal decoder\": ");
+  written += res;
+  if (res < 0 || written >= sizeof(status_json)) {
+    ESP_LOGE(TAG, "driver_setup_get_status_json() buflen too small.");
+    return ESP_ERR_NO_MEM;
+  }
+
+  // Print the signal decoder counters
+  err = print_signal_decoder_status(status_json + written,
+                                    sizeof(status_json) - written, &written);
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't print signal decoder status.");
+
+  res = snprintf(status_json + written, sizeof(status_json) - written,
+                 ",\n"
+                 "\"Boot timeline (ms since boot)\": ");
+  written += res;
+  if (res < 0 || written >= sizeof(status_json)) {
+    ESP_LOGE(TAG, "driver_setup_get_status_json() buflen too small.");
+    return ESP_ERR_NO_MEM;
+  }
+
+  // Print the boot timeline
+  err = print_boot_timeline(status_json + written,
+                            sizeof(status_json) - written, &written);
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't print boot timeline.");
+
   res = snprintf(status_json + written, sizeof(status_json) - written,
                  "\n"
                  "}\n");
@@ -245,27 +563,45 @@ static esp_err_t print_netif_status(esp_netif_t *netif, char *buf_out,
 
 static esp_err_t print_can_status(char *buf_out, size_t buflen,
                                   size_t *bytes_written) {
-  twai_status_info_t can_status;
-  esp_err_t err = twai_get_status_info(&can_status);
-  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't get CAN bus info.");
+  // Report zero counters while the driver is reinstalled,
+  // which resets them anyway.
+  twai_status_info_t can_status = {0};
+  esp_err_t err = driver_setup_can_get_status_info(&can_status);
+  bool reconfiguring = err == ESP_ERR_INVALID_STATE;
+  if (!reconfiguring) {
+    ESP_RETURN_ON_ERROR(err, TAG, "Couldn't get CAN bus info.");
+  }
+
+  driver_setup_can_recovery_status_t recovery_status;
+  err = driver_setup_get_can_recovery_status(&recovery_status);
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't get CAN recovery status.");
+  int64_t average_recovery_us = 0;
+  if (recovery_status.recoveries_completed > 0) {
+    average_recovery_us = recovery_status.total_recovery_us /
+                          recovery_status.recoveries_completed;
+  }
 
   char can_state[64];
-  switch (can_status.state) {
-    case TWAI_STATE_STOPPED:
-      strcpy(can_state, "stopped");
-      break;
-    case TWAI_STATE_RUNNING:
-      strcpy(can_state, "running");
-      break;
-    case TWAI_STATE_BUS_OFF:
-      strcpy(can_state, "bus off due to exceeded error count");
-      break;
-    case TWAI_STATE_RECOVERING:
-      strcpy(can_state, "recovering");
-      break;
-    default:
-      strcpy(can_state, "UNDEFINED");
-      break;
+  if (reconfiguring) {
+    strcpy(can_state, "reconfiguring");
+  } else {
+    switch (can_status.state) {
+      case TWAI_STATE_STOPPED:
+        strcpy(can_state, "stopped");
+        break;
+      case TWAI_STATE_RUNNING:
+        strcpy(can_state, "running");
+        break;
+      case TWAI_STATE_BUS_OFF:
+        strcpy(can_state, "bus off due to exceeded error count");
+        break;
+      case TWAI_STATE_RECOVERING:
+        strcpy(can_state, "recovering");
+        break;
+      default:
+        strcpy(can_state, "UNDEFINED");
+        break;
+    }
   }
 
   int written = snprintf(
@@ -299,14 +635,36 @@ static esp_err_t print_can_status(char *buf_out, size_t buflen,
       "%ld,\n"
 
       "\"Total number of bus errors\": "
-      "%ld\n"
+      "%ld,\n"
+
+      "\"Times gone bus-off\": "
+      "%ld,\n"
+
+      "\"Times gone error passive\": "
+      "%ld,\n"
+
+      "\"Completed bus-off recoveries\": "
+      "%ld,\n"
+
+      "\"Last bus-off recovery time (ms)\": "
+      "%lld,\n"
+
+      "\"Longest bus-off recovery time (ms)\": "
+      "%lld,\n"
+
+      "\"Average bus-off recovery time (ms)\": "
+      "%lld\n"
 
       "}",
       can_state, can_status.msgs_to_tx, can_status.msgs_to_rx,
       can_status.tx_error_counter, can_status.rx_error_counter,
       can_status.tx_failed_count, can_status.rx_missed_count,
       can_status.rx_overrun_count, can_status.arb_lost_count,
-      can_status.bus_error_count);
+      can_status.bus_error_count, recovery_status.bus_off_count,
+      recovery_status.error_passive_count,
+      recovery_status.recoveries_completed,
+      recovery_status.last_recovery_us / 1000,
+      recovery_status.max_recovery_us / 1000, average_recovery_us / 1000);
 
   if (written < 0 || written >= buflen) {
     ESP_LOGE(TAG, "print_netif_status buflen too short.");
@@ -346,10 +704,19 @@ static esp_err_t print_application_status(char *buf_out, size_t buflen,
     return ESP_OK;
   }
 
+  int64_t average_latency_us = 0;
+  if (socketcand_status.socketcand_frames_sent > 0) {
+    average_latency_us = socketcand_status.frame_latency_total_us /
+                         (int64_t)socketcand_status.socketcand_frames_sent;
+  }
+
   int written =
       snprintf(buf_out, buflen,
                "{\n"
 
+               "\"Task profile\": "
+               "\"%s\",\n"
+
                "\"Total socketcand frames received over TCP\": "
                "%lld,\n"
 
@@ -369,16 +736,36 @@ static esp_err_t print_application_status(char *buf_out, size_t buflen,
                "%lld,\n"
 
                "\"Total socketcand frames sent over TCP\": "
-               "%lld\n"
+               "%lld,\n"
+
+               "\"Average CAN to TCP latency (us)\": "
+               "%lld,\n"
+
+               "\"Maximum CAN to TCP latency (us)\": "
+               "%lld,\n"
+
+               "\"Total frames dropped by the socketcand fast path\": "
+               "%lld,\n"
+
+               "\"Socketcand sessions resumed\": "
+               "%lu,\n"
+
+               "\"Socketcand sessions expired\": "
+               "%lu\n"
 
                "}",
+               task_config_profile_name(task_config_get_profile()),
                socketcand_status.socketcand_frames_received,
                socketcand_status.invalid_socketcand_frames_received,
                socketcand_status.can_bus_frames_sent,
                socketcand_status.can_bus_frames_send_timeouts,
                can_listener_status.can_bus_frames_received,
                can_listener_status.can_bus_incoming_frames_dropped,
-               socketcand_status.socketcand_frames_sent);
+               socketcand_status.socketcand_frames_sent, average_latency_us,
+               socketcand_status.frame_latency_max_us,
+               socketcand_status.fast_path_frames_dropped,
+               socketcand_status.sessions_resumed,
+               socketcand_status.sessions_expired);
 
   if (written < 0 || written >= buflen) {
     ESP_LOGE(TAG, "print_application_status buflen too short.");
@@ -427,4 +814,721 @@ static esp_err_t print_cyphal_status(char *buf_out, size_t buflen,
 
   *bytes_written += written;
   return ESP_OK;
-}
\ No newline at end of file
+}
+
+static esp_err_t print_overload_status(char *buf_out, size_t buflen,
+                                       size_t *bytes_written) {
+  overload_control_status_t overload_status;
+  esp_err_t err = overload_control_get_status(&overload_status);
+  if (err != ESP_OK) {
+    int written = snprintf(buf_out, buflen, "\"Not running\"");
+    if (written < 0 || written >= buflen) {
+      ESP_LOGE(TAG, "print_overload_status buflen too short.");
+      return ESP_ERR_NO_MEM;
+    }
+    *bytes_written += written;
+    return ESP_OK;
+  }
+
+  char policies_str[64];
+  err = overload_control_policies_to_string(
+      persistent_settings->overload_policies, policies_str,
+      sizeof(policies_str));
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't print overload policies.");
+
+  int64_t since_change_ms = -1;
+  if (overload_status.last_change_us != 0) {
+    since_change_ms =
+        (esp_timer_get_time() - overload_status.last_change_us) / 1000;
+  }
+
+  int written = snprintf(
+      buf_out, buflen,
+      "{\n"
+
+      "\"Policies, in order\": "
+      "\"%s\",\n"
+
+      "\"Active policies\": "
+      "%d,\n"
+
+      "\"Milliseconds since last change (-1 if never)\": "
+      "%lld,\n"
+
+      "\"Triggers of last activation\": "
+      "\"%s%s%s%s\",\n"
+
+      "\"Fullest queue (%%)\": "
+      "%d,\n"
+
+      "\"TWAI receive backlog (%%)\": "
+      "%d,\n"
+
+      "\"CAN core load (%%)\": "
+      "%d,\n"
+
+      "\"best_effort activations\": "
+      "%lu,\n"
+
+      "\"best_effort frames shed\": "
+      "%lu,\n"
+
+      "\"low_priority_ids activations\": "
+      "%lu,\n"
+
+      "\"low_priority_ids frames shed\": "
+      "%lu,\n"
+
+      "\"throttle activations\": "
+      "%lu,\n"
+
+      "\"throttle frames shed\": "
+      "%lu\n"
+
+      "}",
+      policies_str, overload_status.level, since_change_ms,
+      overload_status.last_triggers & OVERLOAD_TRIGGER_QUEUE_FILL
+          ? "queue_fill "
+          : "",
+      overload_status.last_triggers & OVERLOAD_TRIGGER_TWAI_BACKLOG
+          ? "twai_backlog "
+          : "",
+      overload_status.last_triggers & OVERLOAD_TRIGGER_TWAI_OVERRUN
+          ? "twai_overrun "
+          : "",
+      overload_status.last_triggers & OVERLOAD_TRIGGER_CPU_LOAD ? "cpu_load"
+                                                                 : "",
+      overload_status.queue_fill_percent, overload_status.twai_backlog_percent,
+      overload_status.can_core_load_percent,
+      overload_status.activations[OVERLOAD_POLICY_SHED_BEST_EFFORT],
+      overload_status.frames_shed[OVERLOAD_POLICY_SHED_BEST_EFFORT],
+      overload_status.activations[OVERLOAD_POLICY_SHED_LOW_PRIORITY_IDS],
+      overload_status.frames_shed[OVERLOAD_POLICY_SHED_LOW_PRIORITY_IDS],
+      overload_status.activations[OVERLOAD_POLICY_THROTTLE],
+      overload_status.frames_shed[OVERLOAD_POLICY_THROTTLE]);
+
+  if (written < 0 || written >= buflen) {
+    ESP_LOGE(TAG, "print_overload_status buflen too short.");
+    return ESP_ERR_NO_MEM;
+  }
+
+  *bytes_written += written;
+  return ESP_OK;
+}
+
+static esp_err_t print_queue_status(char *buf_out, size_t buflen,
+                                    size_t *bytes_written) {
+  size_t written = 0;
+  int res = snprintf(buf_out, buflen, "{");
+  if (res < 0 || res >= buflen) {
+    ESP_LOGE(TAG, "print_queue_status buflen too short.");
+    return ESP_ERR_NO_MEM;
+  }
+  written += res;
+
+  const char *separator = "\n";
+  for (size_t i = 0; i < CAN_LISTENERS_MAX; i++) {
+    can_listener_queue_status_t queue_status;
+    if (can_listener_get_queue_status(i, &queue_status) != ESP_OK) {
+      continue;
+    }
+
+    res = snprintf(
+        buf_out + written, buflen - written,
+        "%s\"Queue %d\": {"
+        "\"owner\": \"%s\", "
+        "\"depth\": %d, "
+        "\"overflow\": \"%s\", "
+        "\"class\": \"%s\", "
+        "\"bypassed\": %s, "
+        "\"high water\": %lu, "
+        "\"frames dropped\": %lu}",
+        separator, i, queue_status.owner, queue_status.depth,
+        can_listener_overflow_name(queue_status.overflow),
+        can_listener_class_name(queue_status.listener_class),
+        queue_status.bypassed ? "true" : "false", queue_status.high_water,
+        queue_status.frames_dropped);
+    if (res < 0 || res >= buflen - written) {
+      ESP_LOGE(TAG, "print_queue_status buflen too short.");
+      return ESP_ERR_NO_MEM;
+    }
+    written += res;
+    separator = ",\n";
+  }
+
+  res = snprintf(buf_out + written, buflen - written, "\n}");
+  if (res < 0 || res >= buflen - written) {
+    ESP_LOGE(TAG, "print_queue_status buflen too short.");
+    return ESP_ERR_NO_MEM;
+  }
+  written += res;
+
+  *bytes_written += written;
+  return ESP_OK;
+}
+
+static esp_err_t print_cannelloni_status(char *buf_out, size_t buflen,
+                                         size_t *bytes_written) {
+  cannelloni_status_t cannelloni_status;
+  esp_err_t err = cannelloni_get_status(&cannelloni_status);
+  if (err != ESP_OK) {
+    int written = snprintf(buf_out, buflen, "\"Disabled\"");
+    if (written < 0 || written >= buflen) {
+      ESP_LOGE(TAG, "print_cannelloni_status buflen too short.");
+      return ESP_ERR_NO_MEM;
+    }
+    *bytes_written += written;
+
+    return ESP_OK;
+  }
+
+  int written =
+      snprintf(buf_out, buflen,
+               "{\n"
+               "\"Datagrams sent\": %llu,\n"
+               "\"Frames sent\": %llu,\n"
+               "\"Datagrams received\": %llu,\n"
+               "\"Frames received\": %llu,\n"
+               "\"Datagrams lost\": %llu,\n"
+               "\"Invalid datagrams\": %llu,\n"
+               "\"Invalid frames\": %llu,\n"
+               "\"CAN TX failed\": %llu,\n"
+               "\"Frames without peer\": %llu\n"
+               "}",
+               cannelloni_status.datagrams_sent, cannelloni_status.frames_sent,
+               cannelloni_status.datagrams_received,
+               cannelloni_status.frames_received,
+               cannelloni_status.datagrams_lost,
+               cannelloni_status.invalid_datagrams,
+               cannelloni_status.invalid_frames,
+               cannelloni_status.can_tx_failed,
+               cannelloni_status.frames_without_peer);
+  if (written < 0 || written >= buflen) {
+    ESP_LOGE(TAG, "print_cannelloni_status buflen too short.");
+    return ESP_ERR_NO_MEM;
+  }
+
+  *bytes_written += written;
+  return ESP_OK;
+}
+
+static esp_err_t print_multicast_status(char *buf_out, size_t buflen,
+                                        size_t *bytes_written) {
+  multicast_publisher_status_t multicast_status;
+  esp_ip4_addr_t group;
+  uint16_t port;
+  esp_err_t err = multicast_publisher_get_status(&multicast_status);
+  if (err == ESP_OK) {
+    err = multicast_publisher_get_address(&group, &port);
+  }
+  if (err != ESP_OK) {
+    int written = snprintf(buf_out, buflen, "\"Disabled\"");
+    if (written < 0 || written >= buflen) {
+      ESP_LOGE(TAG, "print_multicast_status buflen too short.");
+      return ESP_ERR_NO_MEM;
+    }
+    *bytes_written += written;
+
+    return ESP_OK;
+  }
+
+  int written = snprintf(buf_out, buflen,
+                         "{\n"
+                         "\"Group\": \"" IPSTR ":%d\",\n"
+                         "\"Datagrams sent\": %llu,\n"
+                         "\"Frames sent\": %llu,\n"
+                         "\"Send failed\": %llu\n"
+                         "}",
+                         IP2STR(&group), port, multicast_status.datagrams_sent,
+                         multicast_status.frames_sent,
+                         multicast_status.send_failed);
+  if (written < 0 || written >= buflen) {
+    ESP_LOGE(TAG, "print_multicast_status buflen too short.");
+    return ESP_ERR_NO_MEM;
+  }
+
+  *bytes_written += written;
+  return ESP_OK;
+}
+
+static esp_err_t print_bridge_status(char *buf_out, size_t buflen,
+                                     size_t *bytes_written) {
+  can_bridge_status_t bridge_status;
+  esp_err_t err = can_bridge_get_status(&bridge_status);
+  if (err != ESP_OK) {
+    int written = snprintf(buf_out, buflen, "\"Disabled\"");
+    if (written < 0 || written >= buflen) {
+      ESP_LOGE(TAG, "print_bridge_status buflen too short.");
+      return ESP_ERR_NO_MEM;
+    }
+    *bytes_written += written;
+
+    return ESP_OK;
+  }
+
+  int written =
+      snprintf(buf_out, buflen,
+               "{\n"
+               "\"Peer up\": %s,\n"
+               "\"Round trip (us)\": {\"last\": %lu, \"min\": %lu, "
+               "\"max\": %lu},\n"
+               "\"Average batching delay (us)\": %lu,\n"
+               "\"Datagrams sent\": %llu,\n"
+               "\"Frames sent\": %llu,\n"
+               "\"Datagrams received\": %llu,\n"
+               "\"Frames received\": %llu,\n"
+               "\"Datagrams lost\": %llu,\n"
+               "\"Frames filtered\": %llu,\n"
+               "\"Frames rewritten\": %llu,\n"
+               "\"Loops dropped\": %llu,\n"
+               "\"CAN TX failed\": %llu,\n"
+               "\"Send failed\": %llu\n"
+               "}",
+               bridge_status.peer_up ? "true" : "false",
+               bridge_status.rtt_last_us, bridge_status.rtt_min_us,
+               bridge_status.rtt_max_us, bridge_status.batch_wait_avg_us,
+               bridge_status.datagrams_sent, bridge_status.frames_sent,
+               bridge_status.datagrams_received, bridge_status.frames_received,
+               bridge_status.datagrams_lost, bridge_status.frames_filtered,
+               bridge_status.frames_rewritten, bridge_status.loops_dropped,
+               bridge_status.can_tx_failed, bridge_status.send_failed);
+  if (written < 0 || written >= buflen) {
+    ESP_LOGE(TAG, "print_bridge_status buflen too short.");
+    return ESP_ERR_NO_MEM;
+  }
+
+  *bytes_written += written;
+  return ESP_OK;
+}
+
+static esp_err_t print_capture_status(char *buf_out, size_t buflen,
+                                      size_t *bytes_written) {
+  capture_ring_status_t capture_status;
+  esp_err_t err = capture_ring_get_status(&capture_status);
+  if (err != ESP_OK) {
+    int written = snprintf(buf_out, buflen, "\"Not running\"");
+    if (written < 0 || written >= buflen) {
+      ESP_LOGE(TAG, "print_capture_status buflen too short.");
+      return ESP_ERR_NO_MEM;
+    }
+    *bytes_written += written;
+
+    return ESP_OK;
+  }
+
+  int written = snprintf(buf_out, buflen,
+                         "{\n"
+                         "\"Size (bytes)\": %lu,\n"
+                         "\"Capacity (frames)\": %lu,\n"
+                         "\"Frames held\": %lu,\n"
+                         "\"Fill (%%)\": %lu,\n"
+                         "\"Oldest frame (ms ago)\": %lu,\n"
+                         "\"Frames captured\": %lu\n"
+                         "}",
+                         capture_status.size_bytes, capture_status.capacity,
+                         capture_status.held,
+                         capture_status.held * 100 / capture_status.capacity,
+                         capture_status.oldest_age_ms, capture_status.total);
+  if (written < 0 || written >= buflen) {
+    ESP_LOGE(TAG, "print_capture_status buflen too short.");
+    return ESP_ERR_NO_MEM;
+  }
+
+  *bytes_written += written;
+  return ESP_OK;
+}
+
+static esp_err_t print_trigger_status(char *buf_out, size_t buflen,
+                                      size_t *bytes_written) {
+  capture_trigger_status_t trigger_status;
+  esp_err_t err = capture_trigger_get_status(&trigger_status);
+  if (err != ESP_OK) {
+    int written = snprintf(buf_out, buflen, "\"Disabled\"");
+    if (written < 0 || written >= buflen) {
+      ESP_LOGE(TAG, "print_trigger_status buflen too short.");
+      return ESP_ERR_NO_MEM;
+    }
+    *bytes_written += written;
+
+    return ESP_OK;
+  }
+
+  int written = snprintf(buf_out, buflen,
+                         "{\n"
+                         "\"Armed\": %d,\n"
+                         "\"Snapshots taken\": %lu,\n"
+                         "\"Last snapshot\": %lu,\n"
+                         "\"Matches held off\": %lu\n"
+                         "}",
+                         trigger_status.armed, trigger_status.fired,
+                         trigger_status.last_number, trigger_status.held_off);
+  if (written < 0 || written >= buflen) {
+    ESP_LOGE(TAG, "print_trigger_status buflen too short.");
+    return ESP_ERR_NO_MEM;
+  }
+
+  *bytes_written += written;
+  return ESP_OK;
+}
+
+static esp_err_t print_replay_status(char *buf_out, size_t buflen,
+                                     size_t *bytes_written) {
+  can_replay_status_t replay_status;
+  esp_err_t err = can_replay_get_status(&replay_status);
+  if (err != ESP_OK) {
+    int written = snprintf(buf_out, buflen, "\"Disabled\"");
+    if (written < 0 || written >= buflen) {
+      ESP_LOGE(TAG, "print_replay_status buflen too short.");
+      return ESP_ERR_NO_MEM;
+    }
+    *bytes_written += written;
+
+    return ESP_OK;
+  }
+
+  int written = snprintf(
+      buf_out, buflen,
+      "{\n"
+      "\"Playing\": %s,\n"
+      "\"Frames loaded\": %lu,\n"
+      "\"Capacity (frames)\": %lu,\n"
+      "\"Duration (ms)\": %lu,\n"
+      "\"Speed (permille)\": %lu,\n"
+      "\"Loops done\": %lu,\n"
+      "\"Frames sent\": %llu,\n"
+      "\"Frames filtered\": %llu,\n"
+      "\"CAN TX failed\": %llu,\n"
+      "\"Scheduling error (us)\": {\"avg\": %lu, \"max\": %lu},\n"
+      "\"Scheduling error histogram\": {\"<50us\": %llu, \"<200us\": %llu, "
+      "\"<1ms\": %llu, \">=1ms\": %llu}\n"
+      "}",
+      replay_status.playing ? "true" : "false", replay_status.frames_loaded,
+      replay_status.capacity, replay_status.duration_ms,
+      replay_status.options.speed_permille, replay_status.loops_done,
+      replay_status.errors.frames, replay_status.frames_filtered,
+      replay_status.tx_failed, replay_status.errors.avg_us,
+      replay_status.errors.max_us, replay_status.errors.histogram[0],
+      replay_status.errors.histogram[1], replay_status.errors.histogram[2],
+      replay_status.errors.histogram[3]);
+  if (written < 0 || written >= buflen) {
+    ESP_LOGE(TAG, "print_replay_status buflen too short.");
+    return ESP_ERR_NO_MEM;
+  }
+
+  *bytes_written += written;
+  return ESP_OK;
+}
+
+static esp_err_t print_scheduler_status(char *buf_out, size_t buflen,
+                                        size_t *bytes_written) {
+  tx_scheduler_status_t scheduler_status;
+  esp_err_t err = tx_scheduler_get_status(&scheduler_status);
+  if (err != ESP_OK) {
+    int written = snprintf(buf_out, buflen, "\"Not running\"");
+    if (written < 0 || written >= buflen) {
+      ESP_LOGE(TAG, "print_scheduler_status buflen too short.");
+      return ESP_ERR_NO_MEM;
+    }
+    *bytes_written += written;
+
+    return ESP_OK;
+  }
+
+  int written = snprintf(
+      buf_out, buflen,
+      "{\n"
+      "\"Pending\": %lu,\n"
+      "\"Frames scheduled\": %llu,\n"
+      "\"Frames sent\": %llu,\n"
+      "\"Rejected\": %llu,\n"
+      "\"Already late\": %llu,\n"
+      "\"CAN TX failed\": %llu,\n"
+      "\"Scheduling error (us)\": {\"avg\": %lu, \"max\": %lu},\n"
+      "\"Scheduling error histogram\": {\"<20us\": %llu, \"<100us\": %llu, "
+      "\"<1ms\": %llu, \">=1ms\": %llu}\n"
+      "}",
+      scheduler_status.pending, scheduler_status.frames_scheduled,
+      scheduler_status.errors.frames, scheduler_status.rejected,
+      scheduler_status.already_late, scheduler_status.tx_failed,
+      scheduler_status.errors.avg_us, scheduler_status.errors.max_us,
+      scheduler_status.errors.histogram[0],
+      scheduler_status.errors.histogram[1],
+      scheduler_status.errors.histogram[2],
+      scheduler_status.errors.histogram[3]);
+  if (written < 0 || written >= buflen) {
+    ESP_LOGE(TAG, "print_scheduler_status buflen too short.");
+    return ESP_ERR_NO_MEM;
+  }
+
+  *bytes_written += written;
+  return ESP_OK;
+}
+
+static esp_err_t print_reflex_status(char *buf_out, size_t buflen,
+                                     size_t *bytes_written) {
+  reflex_rules_status_t reflex_status;
+  esp_err_t err = reflex_rules_get_status(&reflex_status);
+  if (err != ESP_OK || reflex_status.count == 0) {
+    int written = snprintf(buf_out, buflen, "\"Disabled\"");
+    if (written < 0 || written >= buflen) {
+      ESP_LOGE(TAG, "print_reflex_status buflen too short.");
+      return ESP_ERR_NO_MEM;
+    }
+    *bytes_written += written;
+
+    return ESP_OK;
+  }
+
+  size_t written = 0;
+  for (uint8_t i = 0; i < reflex_status.count; i++) {
+    const reflex_rule_status_t *rule = &reflex_status.rules[i];
+    int res = snprintf(
+        buf_out + written, buflen - written,
+        "%s\"Rule %d\": {\"Matched\": %lu, \"Sent\": %lu, "
+        "\"Failed\": %lu, \"Latency (us)\": {\"min\": %lu, "
+        "\"avg\": %lu, \"max\": %lu}}",
+        i == 0 ? "{\n" : ",\n", i, rule->matched, rule->sent, rule->failed,
+        rule->latency_min_us, rule->latency_avg_us, rule->latency_max_us);
+    written += res;
+    if (res < 0 || written >= buflen) {
+      ESP_LOGE(TAG, "print_reflex_status buflen too short.");
+      return ESP_ERR_NO_MEM;
+    }
+  }
+
+  int res = snprintf(buf_out + written, buflen - written, "\n}");
+  written += res;
+  if (res < 0 || written >= buflen) {
+    ESP_LOGE(TAG, "print_reflex_status buflen too short.");
+    return ESP_ERR_NO_MEM;
+  }
+
+  *bytes_written += written;
+  return ESP_OK;
+}
+
+static esp_err_t print_rate_limit_status(char *buf_out, size_t buflen,
+                                         size_t *bytes_written) {
+  tx_rate_limit_status_t limit_status;
+  esp_err_t err = tx_rate_limit_get_status(&limit_status);
+  if (err != ESP_OK || limit_status.limits.count == 0) {
+    int written = snprintf(buf_out, buflen, "\"Disabled\"");
+    if (written < 0 || written >= buflen) {
+      ESP_LOGE(TAG, "print_rate_limit_status buflen too short.");
+      return ESP_ERR_NO_MEM;
+    }
+    *bytes_written += written;
+
+    return ESP_OK;
+  }
+
+  size_t written = 0;
+  for (uint8_t i = 0; i < limit_status.limits.count; i++) {
+    const tx_rate_limit_bucket_t *bucket = &limit_status.limits.buckets[i];
+    const tx_rate_limit_bucket_status_t *counters = &limit_status.buckets[i];
+
+    char scope[24];
+    if (bucket->per_client) {
+      snprintf(scope, sizeof(scope), "client");
+    } else {
+      snprintf(scope, sizeof(scope), "%lX-%lX", bucket->id_min,
+               bucket->id_max);
+    }
+
+    int res = snprintf(
+        buf_out + written, buflen - written,
+        "%s\"%s:%lu/%lu:%s\": {\"Passed\": %lu, \"Delayed\": %lu, "
+        "\"Dropped\": %lu, \"Disconnects\": %lu}",
+        i == 0 ? "{\n" : ",\n", scope, bucket->rate, bucket->burst,
+        tx_rate_limit_policy_name(bucket->policy), counters->passed,
+        counters->delayed, counters->dropped, counters->disconnects);
+    written += res;
+    if (res < 0 || written >= buflen) {
+      ESP_LOGE(TAG, "print_rate_limit_status buflen too short.");
+      return ESP_ERR_NO_MEM;
+    }
+  }
+
+  int res = snprintf(buf_out + written, buflen - written, "\n}");
+  written += res;
+  if (res < 0 || written >= buflen) {
+    ESP_LOGE(TAG, "print_rate_limit_status buflen too short.");
+    return ESP_ERR_NO_MEM;
+  }
+
+  *bytes_written += written;
+  return ESP_OK;
+}
+
+static esp_err_t print_gateway_status(char *buf_out, size_t buflen,
+                                      size_t *bytes_written) {
+  can_gateway_status_t gateway_status;
+  esp_err_t err = can_gateway_get_status(&gateway_status);
+  if (err != ESP_OK || gateway_status.count == 0) {
+    int written = snprintf(buf_out, buflen, "\"Disabled\"");
+    if (written < 0 || written >= buflen) {
+      ESP_LOGE(TAG, "print_gateway_status buflen too short.");
+      return ESP_ERR_NO_MEM;
+    }
+    *bytes_written += written;
+
+    return ESP_OK;
+  }
+
+  size_t written = 0;
+  for (uint8_t i = 0; i < gateway_status.count; i++) {
+    int res = snprintf(buf_out + written, buflen - written,
+                       "%s\"Rule %d hits\": %lu", i == 0 ? "{\n" : ",\n", i,
+                       gateway_status.hits[i]);
+    written += res;
+    if (res < 0 || written >= buflen) {
+      ESP_LOGE(TAG, "print_gateway_status buflen too short.");
+      return ESP_ERR_NO_MEM;
+    }
+  }
+
+  int res = snprintf(buf_out + written, buflen - written, "\n}");
+  written += res;
+  if (res < 0 || written >= buflen) {
+    ESP_LOGE(TAG, "print_gateway_status buflen too short.");
+    return ESP_ERR_NO_MEM;
+  }
+
+  *bytes_written += written;
+  return ESP_OK;
+}
+
+static esp_err_t print_generator_status(char *buf_out, size_t buflen,
+                                        size_t *bytes_written) {
+  traffic_gen_status_t gen_status;
+  esp_err_t err = traffic_gen_get_status(&gen_status);
+  if (err != ESP_OK) {
+    int written = snprintf(buf_out, buflen, "\"Not running\"");
+    if (written < 0 || written >= buflen) {
+      ESP_LOGE(TAG, "print_generator_status buflen too short.");
+      return ESP_ERR_NO_MEM;
+    }
+    *bytes_written += written;
+
+    return ESP_OK;
+  }
+
+  // Bits per second, over bits per second of the bus, in percent.
+  uint32_t bus_load_percent =
+      gen_status.bits_per_second / (persistent_settings->can_bitrate * 10);
+
+  const traffic_gen_options_t *options = &gen_status.options;
+  int written = snprintf(
+      buf_out, buflen,
+      "{\n"
+      "\"Running\": %s,\n"
+      "\"Rate (frames/s)\": %lu,\n"
+      "\"IDs\": \"%s %lX-%lX%s\",\n"
+      "\"Data\": \"%s\",\n"
+      "\"Frames sent\": %llu,\n"
+      "\"Elapsed (ms)\": %lu,\n"
+      "\"Achieved rate (frames/s)\": %lu,\n"
+      "\"Estimated bus load (%%)\": %lu,\n"
+      "\"TX queue full\": %llu,\n"
+      "\"CAN TX failed\": %llu,\n"
+      "\"TX errors\": %lu,\n"
+      "\"Arbitrations lost\": %lu,\n"
+      "\"Bus errors\": %lu\n"
+      "}",
+      gen_status.running ? "true" : "false", options->rate,
+      traffic_gen_ids_name(options->ids), options->id_min, options->id_max,
+      options->extd ? " extended" : "",
+      traffic_gen_data_name(options->data), gen_status.frames_sent,
+      gen_status.elapsed_ms, gen_status.achieved_rate, bus_load_percent,
+      gen_status.tx_queue_full, gen_status.tx_failed, gen_status.tx_errors,
+      gen_status.arb_lost, gen_status.bus_errors);
+  if (written < 0 || written >= buflen) {
+    ESP_LOGE(TAG, "print_generator_status buflen too short.");
+    return ESP_ERR_NO_MEM;
+  }
+
+  *bytes_written += written;
+  return ESP_OK;
+}
+
+static esp_err_t print_signal_decoder_status(char *buf_out, size_t buflen,
+                                             size_t *bytes_written) {
+  signal_decoder_status_t decoder_status;
+  esp_err_t err = signal_decoder_get_status(&decoder_status);
+  if (err != ESP_OK) {
+    int written = snprintf(buf_out, buflen, "\"Disabled\"");
+    if (written < 0 || written >= buflen) {
+      ESP_LOGE(TAG, "print_signal_decoder_status buflen too short.");
+      return ESP_ERR_NO_MEM;
+    }
+    *bytes_written += written;
+
+    return ESP_OK;
+  }
+
+  int written = snprintf(buf_out, buflen,
+                         "{\n"
+                         "\"Signals\": %d,\n"
+                         "\"Messages\": %d,\n"
+                         "\"Frames decoded\": %llu,\n"
+                         "\"Frames too short\": %llu,\n"
+                         "\"Updates published\": %llu,\n"
+                         "\"Values published\": %llu,\n"
+                         "\"Updates deferred\": %llu\n"
+                         "}",
+                         decoder_status.signals, decoder_status.messages,
+                         decoder_status.frames_decoded,
+                         decoder_status.frames_too_short,
+                         decoder_status.updates_published,
+                         decoder_status.values_published,
+                         decoder_status.updates_deferred);
+  if (written < 0 || written >= buflen) {
+    ESP_LOGE(TAG, "print_signal_decoder_status buflen too short.");
+    return ESP_ERR_NO_MEM;
+  }
+
+  *bytes_written += written;
+  return ESP_OK;
+}
+
+static esp_err_t print_boot_timeline(char *buf_out, size_t buflen,
+                                     size_t *bytes_written) {
+  int64_t marks[BOOT_PHASE_COUNT];
+  esp_err_t err = boot_timeline_get(marks);
+  ESP_RETURN_ON_ERROR(err, TAG, "Couldn't get boot timeline.");
+
+  size_t written = 0;
+  int res = snprintf(buf_out, buflen, "{");
+  if (res < 0 || res >= buflen) {
+    ESP_LOGE(TAG, "print_boot_timeline buflen too short.");
+    return ESP_ERR_NO_MEM;
+  }
+  written += res;
+
+  for (int phase = 0; phase < BOOT_PHASE_COUNT; phase++) {
+    const char *separator = phase == 0 ? "\n" : ",\n";
+    if (marks[phase] == 0) {
+      res = snprintf(buf_out + written, buflen - written, "%s\"%s\": null",
+                     separator, boot_timeline_phase_name(phase));
+    } else {
+      res = snprintf(buf_out + written, buflen - written, "%s\"%s\": %lld",
+                     separator, boot_timeline_phase_name(phase),
+                     marks[phase] / 1000);
+    }
+    if (res < 0 || res >= buflen - written) {
+      ESP_LOGE(TAG, "print_boot_timeline buflen too short.");
+      return ESP_ERR_NO_MEM;
+    }
+    written += res;
+  }
+
+  res = snprintf(buf_out + written, buflen - written, "\n}");
+  if (res < 0 || res >= buflen - written) {
+    ESP_LOGE(TAG, "print_boot_timeline buflen too short.");
+    return ESP_ERR_NO_MEM;
+  }
+  written += res;
+
+  *bytes_written += written;
+  return ESP_OK;
+}
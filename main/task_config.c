@@ -0,0 +1,135 @@
+#include "task_config.h"
+
+#include "esp_log.h"
+
+// Name that will be used for logging
+static const char *TAG = "task_config";
+
+// Task configuration of every profile, indexed by `task_profile_t`
+// and `task_id_t`.
+static const task_config_t task_configs[TASK_PROFILE_COUNT][TASK_ID_COUNT] = {
+    [TASK_PROFILE_LOW_LATENCY] =
+        {
+            [TASK_ID_CAN_LISTENER] = {"can_listener", 14,
+                                      TASK_CONFIG_CAN_CORE},
+            [TASK_ID_CAN_RECOVERY] = {"can_recovery", 7, TASK_CONFIG_CAN_CORE},
+            [TASK_ID_SOCKETCAND_SERVER] = {"socketcand_server", 6,
+                                           TASK_CONFIG_NETWORK_CORE},
+            [TASK_ID_SOCKETCAND_TO_BUS] = {"serving_socketcand_client", 11,
+                                           TASK_CONFIG_CAN_CORE},
+            [TASK_ID_BUS_TO_SOCKETCAND] = {"bus_to_socketcand", 10,
+                                           TASK_CONFIG_CAN_CORE},
+            [TASK_ID_SOCKETCAND_FAST_WRITER] = {"socketcand_fast_writer", 10,
+                                                TASK_CONFIG_CAN_CORE},
+            [TASK_ID_CYPHAL_LISTENER] = {"cyphal_listener_task", 3,
+                                         TASK_CONFIG_NETWORK_CORE},
+            [TASK_ID_CYPHAL_HEARTBEAT] = {"cyphal_heartbeat_task", 3,
+                                          TASK_CONFIG_NETWORK_CORE},
+            [TASK_ID_DISCOVERY_BEACON] = {"discovery_beacon", 2,
+                                          TASK_CONFIG_NETWORK_CORE},
+            [TASK_ID_WIFI_RECOVERY] = {"wifi_recovery", 7,
+                                       TASK_CONFIG_NETWORK_CORE},
+            [TASK_ID_DEFERRED_LOG] = {"deferred_log", 1,
+                                      TASK_CONFIG_NETWORK_CORE},
+            [TASK_ID_OVERLOAD_CONTROL] = {"overload_control", 12,
+                                          TASK_CONFIG_CAN_CORE},
+            [TASK_ID_CANNELLONI_TX] = {"cannelloni_tx", 10,
+                                       TASK_CONFIG_CAN_CORE},
+            [TASK_ID_CANNELLONI_RX] = {"cannelloni_rx", 11,
+                                       TASK_CONFIG_CAN_CORE},
+            [TASK_ID_MULTICAST_PUBLISHER] = {"multicast_publisher", 8,
+                                             TASK_CONFIG_NETWORK_CORE},
+            [TASK_ID_CAN_BRIDGE_TX] = {"can_bridge_tx", 10,
+                                       TASK_CONFIG_CAN_CORE},
+            [TASK_ID_CAN_BRIDGE_RX] = {"can_bridge_rx", 11,
+                                       TASK_CONFIG_CAN_CORE},
+            [TASK_ID_CAPTURE_TRIGGER] = {"capture_trigger", 5,
+                                         TASK_CONFIG_NETWORK_CORE},
+            [TASK_ID_CAN_REPLAY] = {"can_replay", 13, TASK_CONFIG_CAN_CORE},
+            [TASK_ID_TX_SCHEDULER] = {"tx_scheduler", 13,
+                                      TASK_CONFIG_CAN_CORE},
+            [TASK_ID_TRAFFIC_GEN] = {"traffic_gen", 13, TASK_CONFIG_CAN_CORE},
+            [TASK_ID_SIGNAL_DECODER] = {"signal_decoder", 5,
+                                        TASK_CONFIG_NETWORK_CORE},
+        },
+    [TASK_PROFILE_MAX_CLIENTS] =
+        {
+            [TASK_ID_CAN_LISTENER] = {"can_listener", 14,
+                                      TASK_CONFIG_CAN_CORE},
+            [TASK_ID_CAN_RECOVERY] = {"can_recovery", 7, TASK_CONFIG_CAN_CORE},
+            [TASK_ID_SOCKETCAND_SERVER] = {"socketcand_server", 6,
+                                           TASK_CONFIG_NETWORK_CORE},
+            [TASK_ID_SOCKETCAND_TO_BUS] = {"serving_socketcand_client", 9,
+                                           tskNO_AFFINITY},
+            [TASK_ID_BUS_TO_SOCKETCAND] = {"bus_to_socketcand", 9,
+                                           tskNO_AFFINITY},
+            [TASK_ID_SOCKETCAND_FAST_WRITER] = {"socketcand_fast_writer", 9,
+                                                tskNO_AFFINITY},
+            [TASK_ID_CYPHAL_LISTENER] = {"cyphal_listener_task", 3,
+                                         TASK_CONFIG_NETWORK_CORE},
+            [TASK_ID_CYPHAL_HEARTBEAT] = {"cyphal_heartbeat_task", 3,
+                                          TASK_CONFIG_NETWORK_CORE},
+            [TASK_ID_DISCOVERY_BEACON] = {"discovery_beacon", 2,
+                                          TASK_CONFIG_NETWORK_CORE},
+            [TASK_ID_WIFI_RECOVERY] = {"wifi_recovery", 7,
+                                       TASK_CONFIG_NETWORK_CORE},
+            [TASK_ID_DEFERRED_LOG] = {"deferred_log", 1,
+                                      TASK_CONFIG_NETWORK_CORE},
+            [TASK_ID_OVERLOAD_CONTROL] = {"overload_control", 12,
+                                          TASK_CONFIG_CAN_CORE},
+            [TASK_ID_CANNELLONI_TX] = {"cannelloni_tx", 9, tskNO_AFFINITY},
+            [TASK_ID_CANNELLONI_RX] = {"cannelloni_rx", 9, tskNO_AFFINITY},
+            [TASK_ID_MULTICAST_PUBLISHER] = {"multicast_publisher", 8,
+                                             tskNO_AFFINITY},
+            [TASK_ID_CAN_BRIDGE_TX] = {"can_bridge_tx", 9, tskNO_AFFINITY},
+            [TASK_ID_CAN_BRIDGE_RX] = {"can_bridge_rx", 9, tskNO_AFFINITY},
+            [TASK_ID_CAPTURE_TRIGGER] = {"capture_trigger", 5,
+                                         tskNO_AFFINITY},
+            [TASK_ID_CAN_REPLAY] = {"can_replay", 13, TASK_CONFIG_CAN_CORE},
+            [TASK_ID_TX_SCHEDULER] = {"tx_scheduler", 13,
+                                      TASK_CONFIG_CAN_CORE},
+            [TASK_ID_TRAFFIC_GEN] = {"traffic_gen", 13, TASK_CONFIG_CAN_CORE},
+            [TASK_ID_SIGNAL_DECODER] = {"signal_decoder", 5,
+                                        tskNO_AFFINITY},
+        },
+};
+
+static task_profile_t selected_profile = TASK_PROFILE_LOW_LATENCY;
+
+void task_config_set_profile(task_profile_t profile) {
+  if (profile >= TASK_PROFILE_COUNT) {
+    ESP_LOGE(TAG, "Invalid task profile %d. Using low latency profile.",
+             profile);
+    profile = TASK_PROFILE_LOW_LATENCY;
+  }
+  selected_profile = profile;
+}
+
+task_profile_t task_config_get_profile(void) { return selected_profile; }
+
+const char *task_config_profile_name(task_profile_t profile) {
+  switch (profile) {
+    case TASK_PROFILE_LOW_LATENCY:
+      return "low_latency";
+    case TASK_PROFILE_MAX_CLIENTS:
+      return "max_clients";
+    default:
+      return "unknown";
+  }
+}
+
+const task_config_t *task_config_get(task_id_t task) {
+  return &task_configs[selected_profile][task];
+}
+
+TaskHandle_t task_config_create_static(task_id_t task,
+                                       TaskFunction_t task_function,
+                                       uint32_t stack_depth, void *parameters,
+                                       StackType_t *stack_buffer,
+                                       StaticTask_t *task_buffer) {
+  const task_config_t *config = task_config_get(task);
+  return xTaskCreateStaticPinnedToCore(task_function, config->name,
+                                       stack_depth, parameters,
+                                       config->priority, stack_buffer,
+                                       task_buffer, config->core);
+}
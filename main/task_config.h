@@ -0,0 +1,95 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// Central table of the priority and core of every task in this firmware.
+//
+// The ESP32 has two cores. The CAN data path (the TWAI interrupt,
+// `can_listener` and the socketcand translation tasks) runs on
+// `TASK_CONFIG_CAN_CORE`, and the network stack (lwIP, ethernet, Wi-Fi,
+// the HTTP server) on `TASK_CONFIG_NETWORK_CORE`, so they don't
+// preempt each other.
+
+// The core that the network stack runs on.
+// lwIP and Wi-Fi are pinned here in `sdkconfig.defaults`.
+#define TASK_CONFIG_NETWORK_CORE 0
+
+// The core that the CAN data path runs on.
+#define TASK_CONFIG_CAN_CORE 1
+
+// Selectable sets of task priorities and core assignments.
+// Stored in the `task_profile` persistent setting,
+// so only ever append new ones.
+typedef enum {
+  // All translation tasks are pinned to the CAN core,
+  // so frames are forwarded with the least jitter.
+  TASK_PROFILE_LOW_LATENCY = 0,
+
+  // Translation tasks may run on either core,
+  // so many busy clients share both cores.
+  TASK_PROFILE_MAX_CLIENTS = 1,
+
+  // Number of profiles. Not a profile.
+  TASK_PROFILE_COUNT,
+} task_profile_t;
+
+// Every task in this firmware.
+typedef enum {
+  TASK_ID_CAN_LISTENER,
+  TASK_ID_CAN_RECOVERY,
+  TASK_ID_SOCKETCAND_SERVER,
+  TASK_ID_SOCKETCAND_TO_BUS,
+  TASK_ID_BUS_TO_SOCKETCAND,
+  TASK_ID_SOCKETCAND_FAST_WRITER,
+  TASK_ID_CYPHAL_LISTENER,
+  TASK_ID_CYPHAL_HEARTBEAT,
+  TASK_ID_DISCOVERY_BEACON,
+  TASK_ID_WIFI_RECOVERY,
+  TASK_ID_DEFERRED_LOG,
+  TASK_ID_OVERLOAD_CONTROL,
+  TASK_ID_CANNELLONI_TX,
+  TASK_ID_CANNELLONI_RX,
+  TASK_ID_MULTICAST_PUBLISHER,
+  TASK_ID_CAN_BRIDGE_TX,
+  TASK_ID_CAN_BRIDGE_RX,
+  TASK_ID_CAPTURE_TRIGGER,
+  TASK_ID_CAN_REPLAY,
+  TASK_ID_TX_SCHEDULER,
+  TASK_ID_TRAFFIC_GEN,
+  TASK_ID_SIGNAL_DECODER,
+
+  // Number of tasks. Not a task.
+  TASK_ID_COUNT,
+} task_id_t;
+
+// How a task gets created.
+typedef struct {
+  const char* name;
+  UBaseType_t priority;
+
+  // `TASK_CONFIG_CAN_CORE`, `TASK_CONFIG_NETWORK_CORE` or `tskNO_AFFINITY`.
+  BaseType_t core;
+} task_config_t;
+
+// Selects the profile used by tasks created from now on.
+// Must be called before any task is created.
+// Falls back to `TASK_PROFILE_LOW_LATENCY` if `profile` is invalid.
+void task_config_set_profile(task_profile_t profile);
+
+// Returns the profile selected with `task_config_set_profile()`.
+task_profile_t task_config_get_profile(void);
+
+// Returns a human-readable name of `profile`.
+const char* task_config_profile_name(task_profile_t profile);
+
+// Returns the configuration of `task` in the selected profile.
+const task_config_t* task_config_get(task_id_t task);
+
+// Same as `xTaskCreateStatic()`, but takes the name, priority and core
+// from the configuration of `task`.
+TaskHandle_t task_config_create_static(task_id_t task,
+                                       TaskFunction_t task_function,
+                                       uint32_t stack_depth, void* parameters,
+                                       StackType_t* stack_buffer,
+                                       StaticTask_t* task_buffer);
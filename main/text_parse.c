@@ -0,0 +1,21 @@
+#include "text_parse.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+
+bool text_parse_number(const char *text, int base, uint32_t max,
+                       uint32_t *value_out) {
+  // `strtoul()` skips whitespace and accepts a sign.
+  if (!isalnum((unsigned char)*text)) {
+    return false;
+  }
+  char *end;
+  errno = 0;
+  unsigned long value = strtoul(text, &end, base);
+  if (*end != '\0' || errno == ERANGE || value > max) {
+    return false;
+  }
+  *value_out = value;
+  return true;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Parsing helpers shared by the modules that read rule tables
+// and other settings from text.
+
+// Parses all of `text` as a number in `base`, no larger than `max`.
+// Unlike `strtoul()`, empty text, leading whitespace or signs,
+// and values that overflow are rejected.
+// Returns false if it isn't one.
+bool text_parse_number(const char* text, int base, uint32_t max,
+                       uint32_t* value_out);
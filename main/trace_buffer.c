@@ -0,0 +1,71 @@
+#include "trace_buffer.h"
+
+#include "esp_timer.h"
+#include "stdatomic.h"
+
+_Static_assert(sizeof(trace_record_t) == 24, "trace_record_t must be packed");
+_Static_assert(sizeof(trace_buffer_header_t) == 24,
+               "trace_buffer_header_t must be packed");
+_Static_assert((TRACE_BUFFER_LEN & (TRACE_BUFFER_LEN - 1)) == 0,
+               "TRACE_BUFFER_LEN must be a power of two");
+
+// A slot in the ring.
+typedef struct {
+  // `seq + 1` of the event in this slot once it's completely written.
+  // Zero while a writer is filling the slot.
+  atomic_uint stamp;
+
+  // The event. Only valid while `stamp` is unchanged.
+  trace_record_t record;
+} trace_slot_t;
+
+static trace_slot_t trace_slots[TRACE_BUFFER_LEN];
+
+// Sequence number that the next recorded event will get.
+static atomic_uint next_seq = 0;
+
+void trace_buffer_record(trace_event_t event, uint8_t arg8, uint16_t arg16,
+                         uint32_t arg32_a, uint32_t arg32_b) {
+  // Claim a slot. This is the only synchronization between writers.
+  uint32_t seq = atomic_fetch_add_explicit(&next_seq, 1, memory_order_relaxed);
+  trace_slot_t *slot = &trace_slots[seq & (TRACE_BUFFER_LEN - 1)];
+
+  // Mark the slot as being written, so readers discard it.
+  atomic_store_explicit(&slot->stamp, 0, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  slot->record.timestamp_us = esp_timer_get_time();
+  slot->record.seq = seq;
+  slot->record.event = event;
+  slot->record.arg8 = arg8;
+  slot->record.arg16 = arg16;
+  slot->record.arg32_a = arg32_a;
+  slot->record.arg32_b = arg32_b;
+
+  // Publish the slot.
+  atomic_store_explicit(&slot->stamp, seq + 1, memory_order_release);
+}
+
+void trace_buffer_range(uint32_t *first_out, uint32_t *end_out) {
+  uint32_t end = atomic_load_explicit(&next_seq, memory_order_acquire);
+  *end_out = end;
+  *first_out = end > TRACE_BUFFER_LEN ? end - TRACE_BUFFER_LEN : 0;
+}
+
+bool trace_buffer_read(uint32_t seq, trace_record_t *record_out) {
+  const trace_slot_t *slot = &trace_slots[seq & (TRACE_BUFFER_LEN - 1)];
+
+  uint32_t stamp_before =
+      atomic_load_explicit(&slot->stamp, memory_order_acquire);
+  if (stamp_before != seq + 1) {
+    return false;
+  }
+
+  *record_out = slot->record;
+
+  // If a writer claimed the slot while we were copying, the copy is torn.
+  atomic_thread_fence(memory_order_acquire);
+  uint32_t stamp_after =
+      atomic_load_explicit(&slot->stamp, memory_order_relaxed);
+  return stamp_after == stamp_before;
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+// A fixed-size, lock-free ring of binary events.
+// Used as a flight recorder for connection, queue and CAN bus
+// events that would otherwise only show up as UART log lines.
+// The ring can be downloaded over HTTP from `/api/trace`,
+// and decoded on a host with `tools/trace_decode.py`.
+
+// Number of events the ring holds. Must be a power of two.
+#define TRACE_BUFFER_LEN 512
+
+// The kinds of events that get recorded.
+// These values are part of the `/api/trace` binary format,
+// so only ever append new ones.
+typedef enum {
+  // A socketcand client connected.
+  // `arg8` is the client slot, `arg32_a` is the IPv4 address.
+  TRACE_EVENT_CLIENT_ACCEPTED = 1,
+
+  // A socketcand client was refused because all slots are in use.
+  // `arg32_a` is the IPv4 address.
+  TRACE_EVENT_CLIENT_REJECTED = 2,
+
+  // A socketcand client slot was freed.
+  // `arg8` is the client slot.
+  TRACE_EVENT_CLIENT_CLOSED = 3,
+
+  // Rawmode negotiation with a socketcand client failed.
+  // `arg8` is the client slot, `arg16` is the last completed phase.
+  TRACE_EVENT_HANDSHAKE_FAILED = 4,
+
+  // A client sent a frame that couldn't be parsed.
+  // `arg8` is the client slot.
+  TRACE_EVENT_INVALID_FRAME = 5,
+
+  // A CAN receive queue was full, so a frame was dropped.
+  // `arg8` is the queue index, `arg32_a` is the CAN identifier.
+  TRACE_EVENT_RX_QUEUE_FULL = 6,
+
+  // A frame couldn't be queued for CAN transmission.
+  // `arg8` is the client slot, `arg32_a` is the `esp_err_t`,
+  // `arg32_b` is the CAN identifier.
+  TRACE_EVENT_CAN_TX_FAILED = 7,
+
+  // The TWAI driver changed state.
+  // `arg8` is the new `twai_state_t`, `arg32_a` is the transmit
+  // error counter, `arg32_b` is the receive error counter.
+  TRACE_EVENT_CAN_STATE = 8,
+
+  // CAN bus-off recovery was initiated.
+  TRACE_EVENT_CAN_RECOVERY_STARTED = 9,
+
+  // The TWAI driver was restarted after recovery.
+  TRACE_EVENT_CAN_RESTARTED = 10,
+
+  // The overload controller activated or deactivated a policy.
+  // `arg8` is the new number of active policies, `arg16` is the
+  // `overload_policy_t` that changed, `arg32_a` is the
+  // `OVERLOAD_TRIGGER_*` bits, `arg32_b` is the CAN core load in
+  // percent shifted left by 8, ORed with the queue fill in percent.
+  TRACE_EVENT_OVERLOAD_LEVEL = 11,
+
+  // A socketcand client was disconnected by a TX rate limit.
+  // `arg8` is the client slot, `arg32_a` is the CAN identifier.
+  TRACE_EVENT_TX_RATE_LIMITED = 12,
+} trace_event_t;
+
+// One event, as it is stored in the `/api/trace` download.
+// All fields are little-endian. Exactly 24 bytes.
+typedef struct {
+  // Microseconds since boot, from `esp_timer_get_time()`.
+  int64_t timestamp_us;
+
+  // Position of this event in the sequence of all recorded events.
+  // Gaps mean events were overwritten or torn while reading.
+  uint32_t seq;
+
+  // A `trace_event_t`.
+  uint8_t event;
+
+  // Event-specific payload. See `trace_event_t`.
+  uint8_t arg8;
+  uint16_t arg16;
+  uint32_t arg32_a;
+  uint32_t arg32_b;
+} trace_record_t;
+
+// Header that precedes the records in the `/api/trace` download.
+// All fields are little-endian. Exactly 24 bytes.
+typedef struct {
+  // Always `TRACE_BUFFER_MAGIC`.
+  uint32_t magic;
+
+  // Always `TRACE_BUFFER_FORMAT_VERSION`.
+  uint16_t version;
+
+  // `sizeof(trace_record_t)`.
+  uint16_t record_size;
+
+  // Total number of events recorded since boot.
+  // Events older than the last `TRACE_BUFFER_LEN` were overwritten.
+  uint32_t total_recorded;
+
+  // Number of `trace_record_t` that follow the header.
+  uint32_t record_count;
+
+  // `esp_timer_get_time()` when the download started.
+  int64_t now_us;
+} trace_buffer_header_t;
+
+// "SCTR" in little-endian.
+#define TRACE_BUFFER_MAGIC 0x52544353
+#define TRACE_BUFFER_FORMAT_VERSION 1
+
+// Records an event in the ring, overwriting the oldest one.
+// Lock-free and safe to call from any task.
+// Doesn't block, log, or allocate.
+void trace_buffer_record(trace_event_t event, uint8_t arg8, uint16_t arg16,
+                         uint32_t arg32_a, uint32_t arg32_b);
+
+// Returns the sequence numbers of the oldest and one-past-the-newest
+// events currently held in the ring.
+void trace_buffer_range(uint32_t* first_out, uint32_t* end_out);
+
+// Copies the event with sequence number `seq` to `record_out`.
+// Returns false if that event was overwritten, or is still being written.
+bool trace_buffer_read(uint32_t seq, trace_record_t* record_out);
@@ -0,0 +1,326 @@
+#include "traffic_gen.h"
+
+#include <string.h>
+
+#include "can_listener.h"
+#include "driver/twai.h"
+#include "driver_setup.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "precise_wait.h"
+#include "stdatomic.h"
+#include "task_config.h"
+
+// Bits of a frame without data bytes and stuff bits, including the
+// interframe space.
+#define STD_FRAME_BITS 47
+#define EXT_FRAME_BITS 67
+
+// How often the counters in the status are updated.
+#define STATUS_INTERVAL_MS 100
+
+// Name that will be used for logging
+static const char *TAG = "traffic_gen";
+
+// Set while the task generates frames, and to make it stop.
+static atomic_bool running = false;
+static atomic_bool stop_requested = false;
+
+static traffic_gen_status_t status = {0};
+static SemaphoreHandle_t status_mutex = NULL;
+static StaticSemaphore_t status_mutex_mem;
+
+// TWAI counters when the status was last updated, if `twai_last_valid`.
+static twai_status_info_t twai_last;
+static bool twai_last_valid = false;
+
+// Task that generates the frames.
+static void traffic_gen_task(void *pvParameters);
+static StackType_t traffic_gen_task_stack[3072];
+static StaticTask_t traffic_gen_task_mem;
+static TaskHandle_t traffic_gen_task_handle = NULL;
+
+// Wakes the generator task when the next frame is nearly due.
+static precise_wait_t wait;
+
+// Generates frames until done or stopped.
+static void generate(const traffic_gen_options_t *options);
+
+// Fills `msg` with frame `number` of `options`.
+static void make_frame(const traffic_gen_options_t *options, uint64_t number,
+                       twai_message_t *msg);
+
+// Updates the counters of the status from those of the task,
+// and the TWAI driver. Must be called with `status_mutex` held.
+static void update_status(int64_t start_us, uint64_t frames_sent,
+                          uint64_t bits_sent);
+
+// Returns how much a TWAI counter grew from `last` to `now`.
+static uint32_t counter_delta(uint32_t now, uint32_t last);
+
+const char *traffic_gen_ids_name(traffic_gen_ids_t ids) {
+  switch (ids) {
+    case TRAFFIC_GEN_IDS_FIXED:
+      return "fixed";
+    case TRAFFIC_GEN_IDS_INCREMENT:
+      return "increment";
+    case TRAFFIC_GEN_IDS_RANDOM:
+      return "random";
+    default:
+      return "unknown";
+  }
+}
+
+esp_err_t traffic_gen_ids_from_name(const char *name,
+                                    traffic_gen_ids_t *ids_out) {
+  for (traffic_gen_ids_t ids = 0; ids < TRAFFIC_GEN_IDS_COUNT; ids++) {
+    if (strcmp(name, traffic_gen_ids_name(ids)) == 0) {
+      *ids_out = ids;
+      return ESP_OK;
+    }
+  }
+  return ESP_FAIL;
+}
+
+const char *traffic_gen_data_name(traffic_gen_data_t data) {
+  switch (data) {
+    case TRAFFIC_GEN_DATA_ZERO:
+      return "zero";
+    case TRAFFIC_GEN_DATA_COUNTER:
+      return "counter";
+    case TRAFFIC_GEN_DATA_RANDOM:
+      return "random";
+    default:
+      return "unknown";
+  }
+}
+
+esp_err_t traffic_gen_data_from_name(const char *name,
+                                     traffic_gen_data_t *data_out) {
+  for (traffic_gen_data_t data = 0; data < TRAFFIC_GEN_DATA_COUNT; data++) {
+    if (strcmp(name, traffic_gen_data_name(data)) == 0) {
+      *data_out = data;
+      return ESP_OK;
+    }
+  }
+  return ESP_FAIL;
+}
+
+esp_err_t traffic_gen_start(void) {
+  // Fixed rates are kept on average, as frame times don't drift, so
+  // the task doesn't spin and starve the tasks below it on the CAN core.
+  esp_err_t err =
+      precise_wait_init(&wait, "traffic_gen", &traffic_gen_task_handle, 0);
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  status_mutex = xSemaphoreCreateMutexStatic(&status_mutex_mem);
+  if (status_mutex == NULL) {
+    ESP_LOGE(TAG, "Unreachable. Generator mutex couldn't be created.");
+    return ESP_FAIL;
+  }
+
+  traffic_gen_task_handle = task_config_create_static(
+      TASK_ID_TRAFFIC_GEN, traffic_gen_task, sizeof(traffic_gen_task_stack),
+      NULL, traffic_gen_task_stack, &traffic_gen_task_mem);
+  return ESP_OK;
+}
+
+esp_err_t traffic_gen_run(const traffic_gen_options_t *options) {
+  if (traffic_gen_task_handle == NULL) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  uint32_t id_limit = options->extd ? CAN_EFF_MASK : CAN_SFF_MASK;
+  if (options->rate > TRAFFIC_GEN_RATE_MAX ||
+      options->ids >= TRAFFIC_GEN_IDS_COUNT ||
+      options->data >= TRAFFIC_GEN_DATA_COUNT ||
+      options->id_min > options->id_max || options->id_max > id_limit ||
+      options->dlc > TWAI_FRAME_MAX_DLC) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  esp_err_t err = traffic_gen_stop();
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  assert(xSemaphoreTake(status_mutex, portMAX_DELAY) == pdTRUE);
+  status = (traffic_gen_status_t){
+      .options = *options,
+  };
+  assert(xSemaphoreGive(status_mutex) == pdTRUE);
+
+  atomic_store(&stop_requested, false);
+  atomic_store(&running, true);
+  xTaskNotifyGive(traffic_gen_task_handle);
+  return ESP_OK;
+}
+
+esp_err_t traffic_gen_stop(void) {
+  if (traffic_gen_task_handle == NULL) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  atomic_store(&stop_requested, true);
+  while (atomic_load(&running)) {
+    xTaskNotifyGive(traffic_gen_task_handle);
+    vTaskDelay(1);
+  }
+  return ESP_OK;
+}
+
+esp_err_t traffic_gen_get_status(traffic_gen_status_t *status_out) {
+  if (status_mutex == NULL) {
+    return ESP_FAIL;
+  }
+
+  assert(xSemaphoreTake(status_mutex, portMAX_DELAY) == pdTRUE);
+  *status_out = status;
+  status_out->running = atomic_load(&running);
+  assert(xSemaphoreGive(status_mutex) == pdTRUE);
+
+  return ESP_OK;
+}
+
+static void traffic_gen_task(void *pvParameters) {
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    if (!atomic_load(&running)) {
+      // A late wake-up from the last run.
+      continue;
+    }
+
+    assert(xSemaphoreTake(status_mutex, portMAX_DELAY) == pdTRUE);
+    traffic_gen_options_t options = status.options;
+    assert(xSemaphoreGive(status_mutex) == pdTRUE);
+
+    ESP_LOGI(TAG, "Generating %lu frames per second.", options.rate);
+    generate(&options);
+    precise_wait_stop(&wait);
+    atomic_store(&running, false);
+    ESP_LOGI(TAG, "Generator stopped.");
+  }
+}
+
+static void generate(const traffic_gen_options_t *options) {
+  twai_last_valid = driver_setup_can_get_status_info(&twai_last) == ESP_OK;
+
+  int64_t start_us = esp_timer_get_time();
+  int64_t status_us = start_us;
+  uint64_t frames_sent = 0;
+  uint64_t bits_sent = 0;
+  uint64_t tx_queue_full = 0;
+  uint64_t tx_failed = 0;
+
+  for (uint64_t number = 0; options->count == 0 || number < options->count;
+       number++) {
+    if (options->rate != 0) {
+      int64_t target_us = start_us + number * 1000000 / options->rate;
+      if (!precise_wait_until(&wait, target_us, &stop_requested)) {
+        break;
+      }
+    } else if (atomic_load(&stop_requested)) {
+      break;
+    }
+
+    twai_message_t msg;
+    make_frame(options, number, &msg);
+
+    // Try without waiting first, to count how often the queue is full.
+    esp_err_t err = driver_setup_can_transmit(&msg, 0);
+    if (err == ESP_ERR_TIMEOUT) {
+      tx_queue_full += 1;
+      err = driver_setup_can_transmit(
+          &msg, pdMS_TO_TICKS(PRECISE_WAIT_TX_TIMEOUT_MS));
+    }
+    if (err == ESP_OK) {
+      frames_sent += 1;
+      bits_sent += (msg.extd ? EXT_FRAME_BITS : STD_FRAME_BITS) +
+                   8 * msg.data_length_code;
+    } else {
+      tx_failed += 1;
+      // The bus is off, or the driver is being reconfigured.
+      vTaskDelay(1);
+    }
+
+    int64_t now_us = esp_timer_get_time();
+    if (now_us - status_us >= STATUS_INTERVAL_MS * 1000) {
+      status_us = now_us;
+      assert(xSemaphoreTake(status_mutex, portMAX_DELAY) == pdTRUE);
+      status.tx_queue_full = tx_queue_full;
+      status.tx_failed = tx_failed;
+      update_status(start_us, frames_sent, bits_sent);
+      assert(xSemaphoreGive(status_mutex) == pdTRUE);
+    }
+  }
+
+  assert(xSemaphoreTake(status_mutex, portMAX_DELAY) == pdTRUE);
+  status.tx_queue_full = tx_queue_full;
+  status.tx_failed = tx_failed;
+  update_status(start_us, frames_sent, bits_sent);
+  assert(xSemaphoreGive(status_mutex) == pdTRUE);
+}
+
+static void make_frame(const traffic_gen_options_t *options, uint64_t number,
+                       twai_message_t *msg) {
+  *msg = (twai_message_t){0};
+  msg->extd = options->extd;
+
+  uint32_t id_range = options->id_max - options->id_min + 1;
+  if (options->ids == TRAFFIC_GEN_IDS_INCREMENT) {
+    msg->identifier = options->id_min + number % id_range;
+  } else if (options->ids == TRAFFIC_GEN_IDS_RANDOM) {
+    msg->identifier = options->id_min + esp_random() % id_range;
+  } else {
+    msg->identifier = options->id_min;
+  }
+
+  msg->data_length_code = options->random_dlc
+                              ? esp_random() % (TWAI_FRAME_MAX_DLC + 1)
+                              : options->dlc;
+
+  if (options->data == TRAFFIC_GEN_DATA_COUNTER) {
+    // The ESP32 is little-endian.
+    memcpy(msg->data, &number, sizeof(msg->data));
+  } else if (options->data == TRAFFIC_GEN_DATA_RANDOM) {
+    uint32_t random[2] = {esp_random(), esp_random()};
+    memcpy(msg->data, random, sizeof(msg->data));
+  }
+}
+
+static void update_status(int64_t start_us, uint64_t frames_sent,
+                          uint64_t bits_sent) {
+  int64_t elapsed_us = esp_timer_get_time() - start_us;
+  status.frames_sent = frames_sent;
+  status.elapsed_ms = elapsed_us / 1000;
+  if (elapsed_us > 0) {
+    status.achieved_rate = frames_sent * 1000000 / elapsed_us;
+    status.bits_per_second = bits_sent * 1000000 / elapsed_us;
+  }
+
+  // Accumulated, since the counters restart when the driver is
+  // reinstalled during the run.
+  twai_status_info_t twai_now;
+  if (driver_setup_can_get_status_info(&twai_now) != ESP_OK) {
+    return;
+  }
+  if (twai_last_valid) {
+    status.tx_errors +=
+        counter_delta(twai_now.tx_failed_count, twai_last.tx_failed_count);
+    status.arb_lost +=
+        counter_delta(twai_now.arb_lost_count, twai_last.arb_lost_count);
+    status.bus_errors +=
+        counter_delta(twai_now.bus_error_count, twai_last.bus_error_count);
+  }
+  twai_last = twai_now;
+  twai_last_valid = true;
+}
+
+static uint32_t counter_delta(uint32_t now, uint32_t last) {
+  // A counter that went back restarted from 0.
+  return now >= last ? now - last : now;
+}
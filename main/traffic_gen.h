@@ -0,0 +1,124 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+// Generates known CAN traffic on the adapter itself, to find the
+// throughput limits of a bus, and of the nodes and adapters on it,
+// which a PC sending `< send >` frames over TCP can't load to the wire.
+//
+// A high-priority task on the CAN core transmits frames at a fixed
+// rate, or as fast as the TWAI transmit queue takes them. Fixed rates
+// are kept with a `precise_wait_t` that doesn't spin, so each frame
+// may be a little late, but late frames are caught up on. Generated
+// frames aren't passed to clients, so they load the bus and not the
+// adapter's network path.
+
+// Highest fixed rate, in frames per second. Faster than any CAN bus.
+#define TRAFFIC_GEN_RATE_MAX 20000
+
+// How the IDs of generated frames are chosen,
+// between `id_min` and `id_max`.
+typedef enum {
+  TRAFFIC_GEN_IDS_FIXED,
+  TRAFFIC_GEN_IDS_INCREMENT,
+  TRAFFIC_GEN_IDS_RANDOM,
+
+  // Number of ways. Not a way.
+  TRAFFIC_GEN_IDS_COUNT,
+} traffic_gen_ids_t;
+
+// What the data bytes of generated frames hold.
+typedef enum {
+  TRAFFIC_GEN_DATA_ZERO,
+
+  // The number of the frame since the start,
+  // little-endian, truncated to the data length.
+  TRAFFIC_GEN_DATA_COUNTER,
+
+  TRAFFIC_GEN_DATA_RANDOM,
+
+  // Number of patterns. Not a pattern.
+  TRAFFIC_GEN_DATA_COUNT,
+} traffic_gen_data_t;
+
+// What to generate.
+typedef struct {
+  // Frames per second, or 0 for as fast as the bus takes them.
+  uint32_t rate;
+
+  // Frames to send, or 0 to send until stopped.
+  uint32_t count;
+
+  traffic_gen_ids_t ids;
+  uint32_t id_min;
+  uint32_t id_max;
+  bool extd;
+
+  // Data length, or random lengths if `random_dlc`.
+  uint8_t dlc;
+  bool random_dlc;
+
+  traffic_gen_data_t data;
+} traffic_gen_options_t;
+
+// The status of the generator.
+// Get the current status using `traffic_gen_get_status()`.
+typedef struct {
+  bool running;
+
+  // Options of the current or last run.
+  traffic_gen_options_t options;
+
+  // Counters of the current or last run.
+  uint64_t frames_sent;
+  uint32_t elapsed_ms;
+
+  // Frames sent per second, and the bits they took on the wire,
+  // without stuff bits.
+  uint32_t achieved_rate;
+  uint32_t bits_per_second;
+
+  // Times the TWAI transmit queue was full, so the generator had to
+  // wait for the bus, and frames the driver didn't take at all.
+  uint64_t tx_queue_full;
+  uint64_t tx_failed;
+
+  // Changes of the TWAI error counters during the run,
+  // also across reinstalls of the driver.
+  uint32_t tx_errors;
+  uint32_t arb_lost;
+  uint32_t bus_errors;
+} traffic_gen_status_t;
+
+// Returns the name of `ids`, like "random".
+const char* traffic_gen_ids_name(traffic_gen_ids_t ids);
+
+// Sets `ids_out` to the `traffic_gen_ids_t` called `name`.
+// Returns `ESP_FAIL` if there's none.
+esp_err_t traffic_gen_ids_from_name(const char* name,
+                                    traffic_gen_ids_t* ids_out);
+
+// Returns the name of `data`, like "counter".
+const char* traffic_gen_data_name(traffic_gen_data_t data);
+
+// Sets `data_out` to the `traffic_gen_data_t` called `name`.
+// Returns `ESP_FAIL` if there's none.
+esp_err_t traffic_gen_data_from_name(const char* name,
+                                     traffic_gen_data_t* data_out);
+
+// Starts the generator task, idle. Must only be called once.
+esp_err_t traffic_gen_start(void);
+
+// Starts generating frames with `options`, stopping any run first.
+// Returns `ESP_ERR_INVALID_ARG` if `options` are invalid.
+esp_err_t traffic_gen_run(const traffic_gen_options_t* options);
+
+// Stops generating frames, and waits until it has stopped.
+esp_err_t traffic_gen_stop(void);
+
+// Fills `status_out` with the current `traffic_gen_status_t`.
+// Returns an error if the generator task isn't running.
+esp_err_t traffic_gen_get_status(traffic_gen_status_t* status_out);
@@ -0,0 +1,279 @@
+#include "tx_rate_limit.h"
+
+#include <string.h>
+
+#include "can_listener.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "text_parse.h"
+
+// One frame, in the millionths that tokens are counted in, so a rate
+// in frames per second refills one token unit per µs and frame.
+#define TOKEN 1000000LL
+
+// Name that will be used for logging
+static const char *TAG = "tx_rate_limit";
+
+static const char *policy_names[TX_RATE_LIMIT_POLICY_COUNT] = {
+    [TX_RATE_LIMIT_DELAY] = "delay",
+    [TX_RATE_LIMIT_DROP] = "drop",
+    [TX_RATE_LIMIT_DISCONNECT] = "disconnect",
+};
+
+// Guards everything below. Only held to do arithmetic,
+// because it's taken for every frame from a client.
+static portMUX_TYPE limits_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static bool configured = false;
+static tx_rate_limits_t limits = {0};
+
+// Incremented by `tx_rate_limit_configure()`,
+// so `client` buckets of older limits are refilled.
+static uint16_t generation = 0;
+
+// Buckets shared by all clients. Unused for `client` buckets.
+static int64_t shared_tokens[TX_RATE_LIMIT_BUCKETS_MAX];
+static int64_t shared_refill_time_us[TX_RATE_LIMIT_BUCKETS_MAX];
+
+static tx_rate_limit_bucket_status_t counters[TX_RATE_LIMIT_BUCKETS_MAX];
+
+// Parses one bucket from `text` into `bucket_out`.
+static bool parse_bucket(char *text, tx_rate_limit_bucket_t *bucket_out);
+
+// Fills the `client` bucket of `client` for the current limits.
+// Must be called with `limits_lock` held.
+static void client_refill_full(tx_rate_limit_client_t *client, int64_t now);
+
+// Adds the tokens that `bucket` earned since `*refill_time_us`.
+static void refill(const tx_rate_limit_bucket_t *bucket, int64_t *tokens,
+                   int64_t *refill_time_us, int64_t now);
+
+const char *tx_rate_limit_policy_name(tx_rate_limit_policy_t policy) {
+  if (policy >= TX_RATE_LIMIT_POLICY_COUNT) {
+    return "unknown";
+  }
+  return policy_names[policy];
+}
+
+esp_err_t tx_rate_limit_parse(const char *spec, tx_rate_limits_t *limits_out) {
+  char buf[TX_RATE_LIMIT_SPEC_LEN];
+  if (strlen(spec) >= sizeof(buf)) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  strcpy(buf, spec);
+
+  limits_out->count = 0;
+  bool has_client_bucket = false;
+  char *saveptr;
+  for (char *token = strtok_r(buf, " ", &saveptr); token != NULL;
+       token = strtok_r(NULL, " ", &saveptr)) {
+    tx_rate_limit_bucket_t *bucket = &limits_out->buckets[limits_out->count];
+    if (limits_out->count >= TX_RATE_LIMIT_BUCKETS_MAX ||
+        !parse_bucket(token, bucket)) {
+      return ESP_ERR_INVALID_ARG;
+    }
+    // Clients only keep one bucket of their own.
+    if (bucket->per_client) {
+      if (has_client_bucket) {
+        return ESP_ERR_INVALID_ARG;
+      }
+      has_client_bucket = true;
+    }
+    limits_out->count += 1;
+  }
+
+  return ESP_OK;
+}
+
+esp_err_t tx_rate_limit_configure(const tx_rate_limits_t *new_limits) {
+  int64_t now = esp_timer_get_time();
+
+  taskENTER_CRITICAL(&limits_lock);
+  configured = true;
+  limits = *new_limits;
+  generation += 1;
+  for (uint8_t i = 0; i < limits.count; i++) {
+    shared_tokens[i] = limits.buckets[i].burst * TOKEN;
+    shared_refill_time_us[i] = now;
+  }
+  memset(counters, 0, sizeof(counters));
+  taskEXIT_CRITICAL(&limits_lock);
+
+  ESP_LOGI(TAG, "Configured %d TX rate limits.", new_limits->count);
+  return ESP_OK;
+}
+
+void tx_rate_limit_client_init(tx_rate_limit_client_t *client) {
+  int64_t now = esp_timer_get_time();
+
+  taskENTER_CRITICAL(&limits_lock);
+  client_refill_full(client, now);
+  taskEXIT_CRITICAL(&limits_lock);
+}
+
+esp_err_t tx_rate_limit_admit(tx_rate_limit_client_t *client,
+                              const twai_message_t *msg) {
+  uint32_t id = msg->identifier & CAN_EFF_MASK;
+  int64_t now = esp_timer_get_time();
+  esp_err_t result = ESP_OK;
+  int64_t wait_us = 0;
+
+  taskENTER_CRITICAL(&limits_lock);
+  if (client->generation != generation) {
+    client_refill_full(client, now);
+  }
+
+  // Find the strictest bucket without a token, whose policy doesn't wait.
+  int8_t exceeded = -1;
+  for (uint8_t i = 0; i < limits.count; i++) {
+    const tx_rate_limit_bucket_t *bucket = &limits.buckets[i];
+    if (!bucket->per_client && (id < bucket->id_min || id > bucket->id_max)) {
+      continue;
+    }
+    int64_t *tokens = bucket->per_client ? &client->tokens : &shared_tokens[i];
+    int64_t *refill_time_us = bucket->per_client ? &client->refill_time_us
+                                                 : &shared_refill_time_us[i];
+    refill(bucket, tokens, refill_time_us, now);
+    if (*tokens < TOKEN && bucket->policy != TX_RATE_LIMIT_DELAY &&
+        (exceeded < 0 || bucket->policy > limits.buckets[exceeded].policy)) {
+      exceeded = i;
+    }
+  }
+
+  if (exceeded >= 0) {
+    if (limits.buckets[exceeded].policy == TX_RATE_LIMIT_DISCONNECT) {
+      counters[exceeded].disconnects += 1;
+      result = ESP_ERR_INVALID_RESPONSE;
+    } else {
+      counters[exceeded].dropped += 1;
+      result = ESP_ERR_INVALID_STATE;
+    }
+  } else {
+    // Take the tokens now, going into debt for `delay` buckets,
+    // so the wait is all that's left to do without the lock.
+    for (uint8_t i = 0; i < limits.count; i++) {
+      const tx_rate_limit_bucket_t *bucket = &limits.buckets[i];
+      if (!bucket->per_client &&
+          (id < bucket->id_min || id > bucket->id_max)) {
+        continue;
+      }
+      int64_t *tokens =
+          bucket->per_client ? &client->tokens : &shared_tokens[i];
+      *tokens -= TOKEN;
+      if (*tokens < 0) {
+        int64_t bucket_wait_us = -*tokens / bucket->rate;
+        if (bucket_wait_us > wait_us) {
+          wait_us = bucket_wait_us;
+        }
+        counters[i].delayed += 1;
+      }
+      counters[i].passed += 1;
+    }
+  }
+  taskEXIT_CRITICAL(&limits_lock);
+
+  if (wait_us > 0) {
+    // Waiting longer than needed, to the next tick, leaves the bucket
+    // fuller, so the average rate is still kept.
+    int64_t tick_us = portTICK_PERIOD_MS * 1000;
+    vTaskDelay((wait_us + tick_us - 1) / tick_us);
+  }
+
+  return result;
+}
+
+esp_err_t tx_rate_limit_get_status(tx_rate_limit_status_t *status_out) {
+  taskENTER_CRITICAL(&limits_lock);
+  bool was_configured = configured;
+  status_out->limits = limits;
+  memcpy(status_out->buckets, counters, sizeof(counters));
+  taskEXIT_CRITICAL(&limits_lock);
+
+  return was_configured ? ESP_OK : ESP_FAIL;
+}
+
+static void client_refill_full(tx_rate_limit_client_t *client, int64_t now) {
+  client->tokens = 0;
+  for (uint8_t i = 0; i < limits.count; i++) {
+    if (limits.buckets[i].per_client) {
+      client->tokens = limits.buckets[i].burst * TOKEN;
+    }
+  }
+  client->refill_time_us = now;
+  client->generation = generation;
+}
+
+static void refill(const tx_rate_limit_bucket_t *bucket, int64_t *tokens,
+                   int64_t *refill_time_us, int64_t now) {
+  int64_t capacity = bucket->burst * TOKEN;
+  *tokens += (now - *refill_time_us) * bucket->rate;
+  if (*tokens > capacity) {
+    *tokens = capacity;
+  }
+  *refill_time_us = now;
+}
+
+static bool parse_bucket(char *text, tx_rate_limit_bucket_t *bucket_out) {
+  memset(bucket_out, 0, sizeof(*bucket_out));
+
+  // Split into the scope, the rate, the burst and the policy.
+  char *rate = strchr(text, ':');
+  if (rate == NULL) {
+    return false;
+  }
+  *rate = '\0';
+  rate += 1;
+  char *policy = strchr(rate, ':');
+  if (policy != NULL) {
+    *policy = '\0';
+    policy += 1;
+  }
+  char *burst = strchr(rate, '/');
+  if (burst == NULL) {
+    return false;
+  }
+  *burst = '\0';
+  burst += 1;
+
+  if (strcmp(text, "client") == 0) {
+    bucket_out->per_client = true;
+  } else {
+    char *id_max = strchr(text, '-');
+    if (id_max != NULL) {
+      *id_max = '\0';
+      id_max += 1;
+    }
+    if (!text_parse_number(text, 16, CAN_EFF_MASK, &bucket_out->id_min)) {
+      return false;
+    }
+    bucket_out->id_max = bucket_out->id_min;
+    if (id_max != NULL &&
+        (!text_parse_number(id_max, 16, CAN_EFF_MASK, &bucket_out->id_max) ||
+         bucket_out->id_max < bucket_out->id_min)) {
+      return false;
+    }
+  }
+
+  if (!text_parse_number(rate, 10, TX_RATE_LIMIT_RATE_MAX,
+                         &bucket_out->rate) ||
+      bucket_out->rate == 0 ||
+      !text_parse_number(burst, 10, TX_RATE_LIMIT_BURST_MAX,
+                         &bucket_out->burst) ||
+      bucket_out->burst == 0) {
+    return false;
+  }
+
+  bucket_out->policy = TX_RATE_LIMIT_DELAY;
+  if (policy == NULL) {
+    return true;
+  }
+  for (int i = 0; i < TX_RATE_LIMIT_POLICY_COUNT; i++) {
+    if (strcmp(policy, policy_names[i]) == 0) {
+      bucket_out->policy = i;
+      return true;
+    }
+  }
+  return false;
+}
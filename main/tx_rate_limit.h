@@ -0,0 +1,124 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "driver/twai.h"
+#include "esp_err.h"
+
+// Limits how many frames socketcand clients may transmit, so a
+// misbehaving client can't saturate the bus and starve real ECUs.
+//
+// Each limit is a token bucket, which holds up to `burst` frames and
+// refills at `rate` frames per second. The `client` bucket is kept once
+// for every client, and ID range buckets are shared by all of them.
+// A frame takes a token from every bucket it falls in, before it's
+// queued for transmission. What happens to frames that find a bucket
+// empty is the policy of that bucket.
+
+// Maximum length of the textual limits, including the terminator.
+#define TX_RATE_LIMIT_SPEC_LEN 128
+
+// Maximum number of buckets.
+#define TX_RATE_LIMIT_BUCKETS_MAX 8
+
+// Largest rate, in frames per second. Faster than any CAN bus.
+#define TX_RATE_LIMIT_RATE_MAX 20000
+
+// Largest burst, in frames.
+#define TX_RATE_LIMIT_BURST_MAX 1000
+
+// What happens to frames that exceed a bucket.
+typedef enum {
+  // The client waits until the bucket has a token again,
+  // which also stops it from reading TCP.
+  TX_RATE_LIMIT_DELAY,
+
+  // The frame isn't transmitted.
+  TX_RATE_LIMIT_DROP,
+
+  // The client is disconnected.
+  TX_RATE_LIMIT_DISCONNECT,
+
+  // Number of policies. Not a policy.
+  TX_RATE_LIMIT_POLICY_COUNT,
+} tx_rate_limit_policy_t;
+
+typedef struct {
+  // True for the bucket of every client, which holds all IDs.
+  // False for a bucket shared by all clients,
+  // which holds IDs from `id_min` to `id_max`.
+  bool per_client;
+  uint32_t id_min;
+  uint32_t id_max;
+
+  // Frames per second, and the most frames sent at once.
+  uint32_t rate;
+  uint32_t burst;
+
+  tx_rate_limit_policy_t policy;
+} tx_rate_limit_bucket_t;
+
+typedef struct {
+  tx_rate_limit_bucket_t buckets[TX_RATE_LIMIT_BUCKETS_MAX];
+  uint8_t count;
+} tx_rate_limits_t;
+
+// The `client` bucket of one client.
+// Initialize it with `tx_rate_limit_client_init()` when it connects.
+typedef struct {
+  // In millionths of a frame.
+  int64_t tokens;
+  int64_t refill_time_us;
+
+  // The configuration that `tokens` belong to.
+  uint16_t generation;
+} tx_rate_limit_client_t;
+
+// Counters of one bucket since it was configured.
+typedef struct {
+  // Frames that found a token, including after a delay.
+  uint32_t passed;
+
+  // Frames that exceeded the bucket, by its policy.
+  uint32_t delayed;
+  uint32_t dropped;
+  uint32_t disconnects;
+} tx_rate_limit_bucket_status_t;
+
+// The status of the limits.
+// Get the current status using `tx_rate_limit_get_status()`.
+typedef struct {
+  tx_rate_limits_t limits;
+  tx_rate_limit_bucket_status_t buckets[TX_RATE_LIMIT_BUCKETS_MAX];
+} tx_rate_limit_status_t;
+
+// Returns the name of `policy`, like "drop".
+const char* tx_rate_limit_policy_name(tx_rate_limit_policy_t policy);
+
+// Parses the textual `spec` into `limits_out`.
+// Buckets are separated by spaces. Each is `client`, or a hex ID or
+// range, then `:`, the rate in frames per second, `/`, the burst,
+// and optionally `:` and the name of a policy, by default `delay`:
+//   client:1000/50 0-FF:200/10:drop 700-7FF:100/5:disconnect
+// Returns `ESP_ERR_INVALID_ARG` if `spec` is invalid.
+esp_err_t tx_rate_limit_parse(const char* spec, tx_rate_limits_t* limits_out);
+
+// Replaces the active limits with `limits`, refills all buckets,
+// and resets their counters. Can be called at any time.
+esp_err_t tx_rate_limit_configure(const tx_rate_limits_t* limits);
+
+// Fills the `client` bucket of a client that just connected.
+void tx_rate_limit_client_init(tx_rate_limit_client_t* client);
+
+// Takes a token for `msg` from every bucket it falls in, the `client`
+// one from `client`. Waits for the tokens of `delay` buckets.
+// Returns `ESP_OK` if `msg` may be transmitted, `ESP_ERR_INVALID_STATE`
+// if it must be dropped, and `ESP_ERR_INVALID_RESPONSE` if the client
+// must be disconnected. Frames that aren't transmitted take no tokens.
+esp_err_t tx_rate_limit_admit(tx_rate_limit_client_t* client,
+                              const twai_message_t* msg);
+
+// Fills `status_out` with the current `tx_rate_limit_status_t`.
+// Returns an error if no limits were ever configured.
+esp_err_t tx_rate_limit_get_status(tx_rate_limit_status_t* status_out);
@@ -0,0 +1,230 @@
+#include "tx_scheduler.h"
+
+#include <stdbool.h>
+
+#include "can_listener.h"
+#include "deferred_log.h"
+#include "driver_setup.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "stdatomic.h"
+#include "task_config.h"
+
+// A frame waiting for its deadline.
+typedef struct {
+  int64_t deadline_us;
+  tx_scheduler_sent_cb_t sent_cb;
+  void *arg;
+  twai_message_t msg;
+} scheduled_frame_t;
+
+// Name that will be used for logging
+static const char *TAG = "tx_scheduler";
+
+// A binary min-heap of frames, ordered by `deadline_us`.
+// Held only for a few swaps, so a spinlock.
+static scheduled_frame_t heap[TX_SCHEDULER_CAPACITY];
+static uint32_t heap_len = 0;
+static portMUX_TYPE heap_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static tx_scheduler_status_t status = {
+    .errors = {.bounds_us = {20, 100, 1000}},
+};
+static SemaphoreHandle_t status_mutex = NULL;
+static StaticSemaphore_t status_mutex_mem;
+
+// Task that transmits frames at their deadline.
+static void tx_scheduler_task(void *pvParameters);
+static StackType_t tx_scheduler_task_stack[3072];
+static StaticTask_t tx_scheduler_task_mem;
+static TaskHandle_t tx_scheduler_task_handle = NULL;
+
+// Wakes the dispatcher task when the earliest frame is nearly due.
+static precise_wait_t wait;
+
+// Set when a frame became the earliest, so the dispatcher starts over.
+static atomic_bool earlier_frame = false;
+
+// Sifts the frame at `index` up or down, until the heap is ordered.
+// Must be called with `heap_lock` held.
+static void sift_up(uint32_t index);
+static void sift_down(uint32_t index);
+
+esp_err_t tx_scheduler_start(void) {
+  esp_err_t err = precise_wait_init(&wait, "tx_scheduler",
+                                    &tx_scheduler_task_handle,
+                                    PRECISE_WAIT_SPIN_US);
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  status_mutex = xSemaphoreCreateMutexStatic(&status_mutex_mem);
+  if (status_mutex == NULL) {
+    ESP_LOGE(TAG, "Unreachable. Scheduler mutex couldn't be created.");
+    return ESP_FAIL;
+  }
+
+  tx_scheduler_task_handle = task_config_create_static(
+      TASK_ID_TX_SCHEDULER, tx_scheduler_task,
+      sizeof(tx_scheduler_task_stack), NULL, tx_scheduler_task_stack,
+      &tx_scheduler_task_mem);
+  return ESP_OK;
+}
+
+esp_err_t tx_scheduler_add(const twai_message_t *msg, int64_t deadline_us,
+                           tx_scheduler_sent_cb_t sent_cb, void *arg) {
+  if (tx_scheduler_task_handle == NULL) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  int64_t now_us = esp_timer_get_time();
+  bool too_far = deadline_us - now_us > TX_SCHEDULER_HORIZON_US;
+
+  bool full = true;
+  bool earliest = false;
+  if (!too_far) {
+    portENTER_CRITICAL(&heap_lock);
+    if (heap_len < TX_SCHEDULER_CAPACITY) {
+      full = false;
+      heap[heap_len] = (scheduled_frame_t){
+          .deadline_us = deadline_us,
+          .sent_cb = sent_cb,
+          .arg = arg,
+          .msg = *msg,
+      };
+      heap_len += 1;
+      sift_up(heap_len - 1);
+      earliest = heap[0].deadline_us == deadline_us;
+    }
+    portEXIT_CRITICAL(&heap_lock);
+  }
+
+  assert(xSemaphoreTake(status_mutex, portMAX_DELAY) == pdTRUE);
+  if (too_far || full) {
+    status.rejected += 1;
+  } else {
+    status.frames_scheduled += 1;
+    if (deadline_us <= now_us) {
+      status.already_late += 1;
+    }
+  }
+  assert(xSemaphoreGive(status_mutex) == pdTRUE);
+
+  if (too_far) {
+    return ESP_ERR_INVALID_ARG;
+  } else if (full) {
+    return ESP_ERR_NO_MEM;
+  }
+
+  // The dispatcher waits for a later frame, or for none.
+  if (earliest) {
+    atomic_store(&earlier_frame, true);
+    xTaskNotifyGive(tx_scheduler_task_handle);
+  }
+  return ESP_OK;
+}
+
+esp_err_t tx_scheduler_get_status(tx_scheduler_status_t *status_out) {
+  if (status_mutex == NULL) {
+    return ESP_FAIL;
+  }
+
+  assert(xSemaphoreTake(status_mutex, portMAX_DELAY) == pdTRUE);
+  *status_out = status;
+  assert(xSemaphoreGive(status_mutex) == pdTRUE);
+
+  portENTER_CRITICAL(&heap_lock);
+  status_out->pending = heap_len;
+  portEXIT_CRITICAL(&heap_lock);
+
+  return ESP_OK;
+}
+
+static void tx_scheduler_task(void *pvParameters) {
+  while (true) {
+    atomic_store(&earlier_frame, false);
+    portENTER_CRITICAL(&heap_lock);
+    bool empty = heap_len == 0;
+    int64_t deadline_us = empty ? 0 : heap[0].deadline_us;
+    portEXIT_CRITICAL(&heap_lock);
+
+    if (empty) {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      continue;
+    }
+
+    // An earlier frame wakes the task early, and it starts over.
+    if (!precise_wait_until(&wait, deadline_us, &earlier_frame)) {
+      continue;
+    }
+
+    // Frames can only have been added meanwhile, so the earliest one
+    // is still due.
+    portENTER_CRITICAL(&heap_lock);
+    scheduled_frame_t frame = heap[0];
+    heap_len -= 1;
+    heap[0] = heap[heap_len];
+    sift_down(0);
+    portEXIT_CRITICAL(&heap_lock);
+
+    esp_err_t err = driver_setup_can_transmit(
+        &frame.msg, pdMS_TO_TICKS(PRECISE_WAIT_TX_TIMEOUT_MS));
+    int64_t sent_us = esp_timer_get_time();
+    if (err != ESP_OK) {
+      deferred_log(DEFERRED_LOG_CAN_TX_FAILED, err);
+      assert(xSemaphoreTake(status_mutex, portMAX_DELAY) == pdTRUE);
+      status.tx_failed += 1;
+      assert(xSemaphoreGive(status_mutex) == pdTRUE);
+    } else {
+      assert(xSemaphoreTake(status_mutex, portMAX_DELAY) == pdTRUE);
+      precise_wait_count_error(&status.errors, sent_us - frame.deadline_us);
+      assert(xSemaphoreGive(status_mutex) == pdTRUE);
+
+      // Send the frame to the socketcand clients. The queue of the
+      // client that scheduled it may have been reused since.
+      can_listener_enqueue_msg(&frame.msg, NULL);
+    }
+
+    if (frame.sent_cb != NULL) {
+      frame.sent_cb(frame.arg, frame.deadline_us, sent_us, err);
+    }
+  }
+}
+
+static void sift_up(uint32_t index) {
+  while (index > 0) {
+    uint32_t parent = (index - 1) / 2;
+    if (heap[parent].deadline_us <= heap[index].deadline_us) {
+      return;
+    }
+    scheduled_frame_t swap = heap[parent];
+    heap[parent] = heap[index];
+    heap[index] = swap;
+    index = parent;
+  }
+}
+
+static void sift_down(uint32_t index) {
+  while (true) {
+    uint32_t smallest = index;
+    uint32_t left = 2 * index + 1;
+    uint32_t right = left + 1;
+    if (left < heap_len &&
+        heap[left].deadline_us < heap[smallest].deadline_us) {
+      smallest = left;
+    }
+    if (right < heap_len &&
+        heap[right].deadline_us < heap[smallest].deadline_us) {
+      smallest = right;
+    }
+    if (smallest == index) {
+      return;
+    }
+    scheduled_frame_t swap = heap[smallest];
+    heap[smallest] = heap[index];
+    heap[index] = swap;
+    index = smallest;
+  }
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "driver/twai.h"
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "precise_wait.h"
+
+// Transmits CAN frames at absolute times, which socketcand clients
+// request with `< sendat secs.usecs id dlc data >`, so HIL tests can
+// place frames on the bus without the jitter of TCP and host scheduling.
+//
+// Frames wait in a min-heap keyed by their deadline. A
+// `precise_wait_t` wakes the dispatcher task shortly before the
+// earliest deadline, and the task spins for the rest. It runs below
+// `can_listener`, so the spin doesn't delay received frames. How much
+// later than requested each frame was queued for transmission is
+// reported in the status.
+
+// Number of frames that can wait for their deadline.
+#define TX_SCHEDULER_CAPACITY 256
+
+// Deadlines further ahead than this are rejected,
+// so a typo can't hold a slot until the next reboot.
+#define TX_SCHEDULER_HORIZON_US (3600LL * 1000000)
+
+// The status of the scheduler.
+// Get the current status using `tx_scheduler_get_status()`.
+typedef struct {
+  // Number of frames waiting for their deadline.
+  uint32_t pending;
+
+  uint64_t frames_scheduled;
+  uint64_t tx_failed;
+
+  // Frames rejected because the heap was full,
+  // or the deadline was beyond `TX_SCHEDULER_HORIZON_US`.
+  uint64_t rejected;
+
+  // Frames whose deadline had already passed when they were scheduled.
+  // They are sent right away.
+  uint64_t already_late;
+
+  // The frames sent, and how much later than requested they were
+  // queued for transmission, within 20 µs, 100 µs, 1 ms or later.
+  precise_wait_errors_t errors;
+} tx_scheduler_status_t;
+
+// Called by the dispatcher task after it queued a frame due at
+// `deadline_us` for transmission at `sent_us`, or failed to with `err`.
+typedef void (*tx_scheduler_sent_cb_t)(void* arg, int64_t deadline_us,
+                                       int64_t sent_us, esp_err_t err);
+
+// Starts the dispatcher task. Must only be called once.
+esp_err_t tx_scheduler_start(void);
+
+// Transmits `msg` at `deadline_us`, in `esp_timer_get_time()` time,
+// and then hands it to every `can_listener` queue, and calls `sent_cb`
+// with `arg`, unless it's NULL. The sender may be gone by then, so it
+// gets the frame back too, with the time it was sent.
+// Returns `ESP_ERR_NO_MEM` if the heap is full,
+// and `ESP_ERR_INVALID_ARG` if the deadline is too far ahead.
+esp_err_t tx_scheduler_add(const twai_message_t* msg, int64_t deadline_us,
+                           tx_scheduler_sent_cb_t sent_cb, void* arg);
+
+// Fills `status_out` with the current `tx_scheduler_status_t`.
+// Returns an error if the scheduler isn't running.
+esp_err_t tx_scheduler_get_status(tx_scheduler_status_t* status_out);
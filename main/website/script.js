@@ -49,6 +49,28 @@ const network_settings_data = {
         }
     },
 
+    // Ask the server to detect the CAN bitrate of the connected bus.
+    // The detected bitrate is applied and saved without a reboot.
+    async autobaud() {
+        try {
+            this.status_message = "Detecting CAN bitrate...";
+            const response = await fetch('/api/autobaud', {
+                method: 'POST',
+                signal: AbortSignal.timeout(10000)
+            });
+            const result = await response.json();
+            if (result.detected) {
+                this.conf.can_bitrate = result.can_bitrate;
+                this.original_conf.can_bitrate = result.can_bitrate;
+                this.status_message = `Detected and saved CAN bitrate ${result.can_bitrate} kbit/s in ${result.duration_ms} ms.`;
+            } else {
+                this.status_message = `Couldn't detect CAN bitrate: ${result.error}`;
+            }
+        } catch (error) {
+            this.status_message = `ERROR: Couldn't detect CAN bitrate: ${error}`;
+        }
+    },
+
     // Submit the current configuration to the server.
     async submit() {
         if (this.original_conf === null) {
@@ -63,10 +85,12 @@ const network_settings_data = {
         }
 
         // Make an object that only contains changed settings.
+        // Empty fields count as unchanged, except those that may be cleared.
+        const clearable = ['bridge_rules', 'capture_triggers', 'reflex_rules', 'tx_rate_limits', 'gateway_rules'];
         const post_obj = {};
         for (const key of Object.keys(this.conf)) {
 
-            if (this.conf[key] !== '' && this.conf[key] !== null && this.conf[key] !== this.original_conf[key]) {
+            if ((this.conf[key] !== '' || clearable.includes(key)) && this.conf[key] !== null && this.conf[key] !== this.original_conf[key]) {
                 post_obj[key] = this.conf[key];
             }
         }
@@ -87,8 +111,8 @@ const network_settings_data = {
             });
             this.status_message = await response.text();
 
-            // If the response is OK, the server will restart,
-            // so reload the page
+            // If the response is OK, the server either applied the settings
+            // or is restarting, so reload the page
             if (response.ok) {
                 setTimeout(() => {
                     window.location.reload();
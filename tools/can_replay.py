@@ -0,0 +1,89 @@
+#!/usr/bin/env python3
+"""Uploads a candump log to the adapter and plays it onto the CAN bus.
+
+Usage:
+    python3 can_replay.py 192.168.2.163 log.txt [speed] [loops] [filter]
+
+The adapter needs the `replay_buffer_kb` setting. The log is converted to
+the compact binary form described in `main/can_replay.h`, which takes
+about a third of the upload size of candump text, then played at
+`speed` times the original speed (default 1), `loops` times
+(default 1, 0 until stopped), with only the IDs in `filter`,
+like `7E8,700/700` (default all).
+
+Waits for playback to end, then prints the scheduling error statistics
+from the status page.
+"""
+
+import json
+import re
+import struct
+import sys
+import time
+import urllib.parse
+import urllib.request
+
+LINE_RE = re.compile(r"\((\d+)\.(\d{6})\)\s+\S+\s+([0-9A-Fa-f]+)#(R|[0-9A-Fa-f]*)")
+FRAME = struct.Struct("<IIB")
+CAN_EFF_FLAG = 0x80000000
+CAN_RTR_FLAG = 0x40000000
+CAN_ERR_FLAG = 0x20000000
+
+
+def convert(path):
+    out = bytearray()
+    first_us = None
+    with open(path) as log:
+        for line in log:
+            match = LINE_RE.match(line.strip())
+            if not match:
+                continue
+            seconds, micros, ident, payload = match.groups()
+            time_us = int(seconds) * 1000000 + int(micros)
+            can_id = int(ident, 16)
+            if can_id & CAN_ERR_FLAG:
+                continue
+            if len(ident) == 8:
+                can_id |= CAN_EFF_FLAG
+            if payload == "R":
+                can_id |= CAN_RTR_FLAG
+                data = b""
+            else:
+                data = bytes.fromhex(payload)
+            if first_us is None:
+                first_us = time_us
+            out += FRAME.pack(time_us - first_us, can_id, len(data)) + data
+    return bytes(out)
+
+
+def post(host, path, body=b""):
+    request = urllib.request.Request(f"http://{host}{path}", data=body, method="POST")
+    with urllib.request.urlopen(request) as response:
+        return response.read().decode()
+
+
+def main():
+    if not 3 <= len(sys.argv) <= 6:
+        sys.exit(__doc__)
+    host, path = sys.argv[1], sys.argv[2]
+    speed = sys.argv[3] if len(sys.argv) > 3 else "1"
+    loops = sys.argv[4] if len(sys.argv) > 4 else "1"
+    id_filter = sys.argv[5] if len(sys.argv) > 5 else ""
+
+    print("Loaded:", post(host, "/api/replay?format=binary", convert(path)))
+    query = urllib.parse.urlencode(
+        {"action": "start", "speed": speed, "loops": loops, "filter": id_filter}
+    )
+    post(host, f"/api/replay/control?{query}")
+
+    while True:
+        time.sleep(1)
+        with urllib.request.urlopen(f"http://{host}/api/status") as response:
+            replay = json.load(response)["Replay"]
+        if not replay["Playing"]:
+            break
+    print(json.dumps(replay, indent=2))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,137 @@
+#!/usr/bin/env python3
+"""Compares receive latency and loss of socketcand rawmode and cannelloni.
+
+Usage:
+    python3 cannelloni_bench.py 192.168.2.163 [cannelloni_port] [frame_count] [frames_per_second]
+
+The adapter needs the `cannelloni_port` setting (default here: 20000),
+with the cannelloni peer IP set to this host or to 0.0.0.0.
+
+Opens a socketcand rawmode connection that sends `frame_count` frames,
+which the adapter transmits to the CAN bus and forwards to every listener.
+They're received both over a second socketcand rawmode connection
+and as cannelloni datagrams, so the two transports see the same frames.
+
+The CAN bus must be connected and have at least one other node that
+acknowledges frames, or transmission will time out.
+Frames use CAN ID 0x7E5, so pick a quiet bus.
+"""
+
+import socket
+import statistics
+import struct
+import sys
+import threading
+import time
+
+from socketcand_bench import CAN_ID, open_rawmode, receive
+
+HEADER = struct.Struct(">BBBH")
+CAN_EFF_FLAG = 0x80000000
+CAN_RTR_FLAG = 0x40000000
+
+
+def receive_cannelloni(sock, count, arrivals, stats):
+    sock.settimeout(5)
+    expected_seq = None
+    try:
+        while len(arrivals) < count:
+            datagram = sock.recv(2048)
+            now = time.perf_counter()
+            if len(datagram) < HEADER.size:
+                continue
+            _, _, seq, frames = HEADER.unpack_from(datagram)
+            stats["datagrams"] += 1
+            if expected_seq is not None and seq != expected_seq:
+                stats["datagrams_lost"] += (seq - expected_seq) % 256
+            expected_seq = (seq + 1) % 256
+
+            offset = HEADER.size
+            for _ in range(frames):
+                (can_id,) = struct.unpack_from(">I", datagram, offset)
+                length = datagram[offset + 4]
+                offset += 5
+                if can_id & CAN_RTR_FLAG:
+                    continue
+                data = datagram[offset : offset + length]
+                offset += length
+                if can_id & ~CAN_EFF_FLAG != CAN_ID or len(data) != 8:
+                    continue
+                (frame_seq,) = struct.unpack("<Q", data)
+                arrivals[frame_seq] = now
+    except socket.timeout:
+        return
+
+
+def report(name, count, sent_at, arrivals):
+    received = sorted(arrivals)
+    if not received:
+        print(f"{name}: nothing received.")
+        return
+    latencies = [(arrivals[s] - sent_at[s]) * 1e3 for s in received]
+    print(
+        f"{name}: received {len(received)}, lost {count - len(received)}, "
+        f"latency (ms) mean {statistics.mean(latencies):.3f}, "
+        f"median {statistics.median(latencies):.3f}, "
+        f"max {max(latencies):.3f}, jitter {statistics.pstdev(latencies):.3f}"
+    )
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit(__doc__)
+    host = sys.argv[1]
+    port = int(sys.argv[2]) if len(sys.argv) > 2 else 20000
+    count = int(sys.argv[3]) if len(sys.argv) > 3 else 2000
+    rate = float(sys.argv[4]) if len(sys.argv) > 4 else 1000.0
+
+    udp = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    udp.bind(("", port))
+    # An empty datagram makes the adapter learn this host as its peer,
+    # if no peer IP is configured. It's counted as invalid.
+    udp.sendto(b"", (host, port))
+
+    receiver = open_rawmode(host)
+    sender = open_rawmode(host)
+
+    tcp_arrivals = {}
+    udp_arrivals = {}
+    stats = {"datagrams": 0, "datagrams_lost": 0}
+    threads = [
+        threading.Thread(target=receive, args=(receiver, count, tcp_arrivals, {})),
+        threading.Thread(
+            target=receive_cannelloni, args=(udp, count, udp_arrivals, stats)
+        ),
+    ]
+    for thread in threads:
+        thread.start()
+
+    sent_at = {}
+    start = time.perf_counter()
+    for seq in range(count):
+        # Pace the frames evenly.
+        target = start + seq / rate
+        while time.perf_counter() < target:
+            pass
+        data = " ".join(f"{b:02X}" for b in struct.pack("<Q", seq))
+        sent_at[seq] = time.perf_counter()
+        sender.sendall(f"< send {CAN_ID:X} 8 {data} >".encode())
+    for thread in threads:
+        thread.join()
+    sender.close()
+    receiver.close()
+    udp.close()
+
+    print(f"Sent {count} frames at {rate:.0f} frames/s.")
+    report("socketcand", count, sent_at, tcp_arrivals)
+    report("cannelloni", count, sent_at, udp_arrivals)
+    if stats["datagrams"]:
+        print(
+            f"cannelloni: {stats['datagrams']} datagrams, "
+            f"{len(udp_arrivals) / stats['datagrams']:.1f} frames each, "
+            f"{stats['datagrams_lost']} lost"
+        )
+
+
+if __name__ == "__main__":
+    main()
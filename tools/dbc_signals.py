@@ -0,0 +1,110 @@
+#!/usr/bin/env python3
+"""Converts signals of a DBC file into the adapter's signal table.
+
+Usage:
+    python3 dbc_signals.py vehicle.dbc [signal[:interval_ms] ...] > signals.txt
+
+Prints the table described in `main/signal_decoder.h` for the listed
+signals, or for all signals of the file if none are listed. Signals with
+an interval are sent at most every `interval_ms`, and the others when
+they change. Upload the table with
+    curl --data-binary @signals.txt http://192.168.2.163/api/signals
+
+Multiplexed signals aren't supported, and are skipped. Names must be
+unique on the adapter, so signals whose name several messages use are
+skipped too, or rejected if listed.
+"""
+
+import re
+import sys
+
+BO_RE = re.compile(r"^BO_\s+(\d+)\s+\w+\s*:")
+SG_RE = re.compile(
+    r"^\s+SG_\s+(\w+)\s*(\S*)\s*:\s*(\d+)\|(\d+)@([01])([+-])\s*"
+    r"\(([^,]+),([^)]+)\)\s*\[[^]]*\]\s*\"([^\"]*)\""
+)
+CAN_EFF_FLAG = 0x80000000
+CAN_EFF_MASK = 0x1FFFFFFF
+
+# Limits of the adapter, without the terminators.
+NAME_MAX = 23
+UNIT_MAX = 11
+
+# The adapter only takes printable ASCII units.
+UNIT_CHARS = {"°": "deg", "µ": "u", "μ": "u", "²": "2", "³": "3", "Ω": "Ohm"}
+
+
+def read_lines(path):
+    # DBC files are usually Windows-1252 or Latin-1, and sometimes UTF-8.
+    with open(path, "rb") as dbc:
+        data = dbc.read()
+    try:
+        return data.decode("utf-8").splitlines()
+    except UnicodeDecodeError:
+        return data.decode("latin-1").splitlines()
+
+
+def convert_unit(unit):
+    unit = "".join(UNIT_CHARS.get(char, char) for char in unit.strip())
+    return re.sub(r"[^!#-\[\]-~]+", "_", unit)[:UNIT_MAX]
+
+
+def read_signals(path):
+    signals = {}
+    ids = {}
+    can_id = None
+    for line in read_lines(path):
+        match = BO_RE.match(line)
+        if match:
+            can_id = int(match.group(1))
+            continue
+        match = SG_RE.match(line)
+        if not match or can_id is None:
+            continue
+        name, mux, start, length, order, sign, scale, offset, unit = match.groups()
+        if mux and mux != "M":
+            print(f"Skipping multiplexed signal {name}.", file=sys.stderr)
+            continue
+        if can_id & CAN_EFF_FLAG:
+            ident = f"{can_id & CAN_EFF_MASK:08X}"
+        else:
+            ident = f"{can_id:03X}"
+        unit = convert_unit(unit)
+        ids.setdefault(name, []).append(ident)
+        signals[name] = (
+            f"{ident} {name} {start}|{length}@{order}{sign} "
+            f"{scale.strip()} {offset.strip()}" + (f" {unit}" if unit else "")
+        )
+    duplicates = {name: idents for name, idents in ids.items() if len(idents) > 1}
+    return signals, duplicates
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit(__doc__)
+    signals, duplicates = read_signals(sys.argv[1])
+
+    wanted = sys.argv[2:]
+    if not wanted:
+        for name, idents in duplicates.items():
+            print(
+                f"Skipping signal {name} of several messages: {', '.join(idents)}.",
+                file=sys.stderr,
+            )
+        wanted = [name for name in signals if name not in duplicates]
+    for spec in wanted:
+        name, _, interval = spec.partition(":")
+        if name not in signals:
+            sys.exit(f"{name} isn't a signal of {sys.argv[1]}.")
+        if name in duplicates:
+            sys.exit(
+                f"{name} is a signal of several messages: "
+                f"{', '.join(duplicates[name])}."
+            )
+        if len(name) > NAME_MAX:
+            sys.exit(f"{name} is longer than {NAME_MAX} characters.")
+        print(signals[name] + (f" @{int(interval)}" if interval else ""))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,104 @@
+#!/usr/bin/env python3
+"""Prints the CAN frames the adapter publishes by UDP multicast.
+
+Usage:
+    python3 multicast_listen.py [group] [port]
+
+Defaults to the group and port announced by the adapter's discovery
+beacon on UDP port 42000, so the `multicast_port` setting is all that
+needs to be set on the adapter.
+
+Prints frames in candump's log format, with the adapter's timestamps,
+and a note whenever datagrams were lost on the network
+or frames were dropped by the adapter.
+The format is described in `main/multicast_publisher.h`.
+"""
+
+import re
+import socket
+import struct
+import sys
+
+HEADER = struct.Struct(">BBHII")
+FRAME = struct.Struct(">qIB")
+CAN_EFF_FLAG = 0x80000000
+CAN_RTR_FLAG = 0x40000000
+CAN_ERR_FLAG = 0x20000000
+BEACON_RE = re.compile(rb"<Multicast url='udp://([\d.]+):(\d+)' version='1'/>")
+
+
+def discover():
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    sock.bind(("", 42000))
+    sock.settimeout(10)
+    try:
+        while True:
+            match = BEACON_RE.search(sock.recv(2048))
+            if match:
+                return match.group(1).decode(), int(match.group(2))
+    except socket.timeout:
+        sys.exit("No adapter announced a multicast group. Is multicast_port set?")
+    finally:
+        sock.close()
+
+
+def subscribe(group, port):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    sock.bind(("", port))
+    membership = struct.pack("4s4s", socket.inet_aton(group), socket.inet_aton("0.0.0.0"))
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP, membership)
+    return sock
+
+
+def format_frame(rx_time_us, can_id, data):
+    if can_id & CAN_EFF_FLAG:
+        ident = f"{can_id & 0x1FFFFFFF:08X}"
+    else:
+        ident = f"{can_id & 0x7FF:03X}"
+    if can_id & CAN_ERR_FLAG:
+        ident = f"{can_id & 0x1FFFFFFF | CAN_ERR_FLAG:08X}"
+    payload = "R" if can_id & CAN_RTR_FLAG else data.hex().upper()
+    return f"({rx_time_us / 1e6:.6f}) can0 {ident}#{payload}"
+
+
+def main():
+    if len(sys.argv) == 3:
+        group, port = sys.argv[1], int(sys.argv[2])
+    elif len(sys.argv) == 1:
+        group, port = discover()
+    else:
+        sys.exit(__doc__)
+
+    sock = subscribe(group, port)
+    print(f"Listening on {group}:{port}.", file=sys.stderr)
+
+    expected_seq = None
+    last_dropped = None
+    while True:
+        datagram = sock.recv(2048)
+        if len(datagram) < HEADER.size:
+            continue
+        version, _, count, seq, dropped = HEADER.unpack_from(datagram)
+        if version != 1:
+            continue
+        if expected_seq is not None and seq != expected_seq:
+            print(f"# {(seq - expected_seq) % 2**32} datagrams lost", file=sys.stderr)
+        if last_dropped is not None and dropped != last_dropped:
+            print(f"# {(dropped - last_dropped) % 2**32} frames dropped by the adapter",
+                  file=sys.stderr)
+        expected_seq = (seq + 1) % 2**32
+        last_dropped = dropped
+
+        offset = HEADER.size
+        for _ in range(count):
+            rx_time_us, can_id, length = FRAME.unpack_from(datagram, offset)
+            offset += FRAME.size
+            data = datagram[offset : offset + length]
+            offset += length
+            print(format_frame(rx_time_us, can_id, data))
+
+
+if __name__ == "__main__":
+    main()
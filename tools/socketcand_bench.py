@@ -0,0 +1,139 @@
+#!/usr/bin/env python3
+"""Measures the adapter's frame throughput and jitter over socketcand.
+
+Usage:
+    python3 socketcand_bench.py 192.168.2.163 [frame_count] [frames_per_second]
+
+Opens two socketcand rawmode connections to the adapter.
+The first one sends `frame_count` frames, which the adapter transmits to
+the CAN bus and forwards to the second one, like any frame from a client.
+Run it once per task profile (the `task_profile` setting) to compare them.
+
+The CAN bus must be connected and have at least one other node that
+acknowledges frames, or transmission will time out.
+Frames use CAN ID 0x7E5, so pick a quiet bus.
+
+Reports:
+- throughput: frames received per second
+- latency: time from sending to receiving a frame, on this host's clock
+- jitter: standard deviation of that latency,
+  and of the gaps between the adapter's receive timestamps
+- lost: frames sent but never received
+"""
+
+import re
+import socket
+import statistics
+import struct
+import sys
+import threading
+import time
+
+PORT = 29536
+CAN_ID = 0x7E5
+FRAME_RE = re.compile(rb"< frame ([0-9A-Fa-f]+) (\d+)\.(\d+) ([0-9A-Fa-f]*) >")
+
+
+def open_rawmode(host):
+    sock = socket.create_connection((host, PORT), timeout=5)
+    sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+    expect(sock, b"< hi >")
+    sock.sendall(b"< open can0 >")
+    expect(sock, b"< ok >")
+    sock.sendall(b"< rawmode >")
+    expect(sock, b"< ok >")
+    return sock
+
+
+def expect(sock, message):
+    data = b""
+    while not data.endswith(b">"):
+        data += sock.recv(1)
+    if data.strip() != message:
+        sys.exit(f"Expected {message!r}, got {data!r}")
+
+
+def receive(sock, count, arrivals, device_times):
+    sock.settimeout(5)
+    buf = b""
+    try:
+        while len(arrivals) < count:
+            chunk = sock.recv(4096)
+            if not chunk:
+                return
+            now = time.perf_counter()
+            buf += chunk
+            for match in FRAME_RE.finditer(buf):
+                if int(match.group(1), 16) != CAN_ID:
+                    continue
+                data = bytes.fromhex(match.group(4).decode())
+                if len(data) != 8:
+                    continue
+                (seq,) = struct.unpack("<Q", data)
+                arrivals[seq] = now
+                device_times[seq] = int(match.group(2)) * 1e6 + int(match.group(3))
+            buf = buf[buf.rfind(b">") + 1 :]
+    except socket.timeout:
+        return
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit(__doc__)
+    host = sys.argv[1]
+    count = int(sys.argv[2]) if len(sys.argv) > 2 else 2000
+    rate = float(sys.argv[3]) if len(sys.argv) > 3 else 1000.0
+
+    receiver = open_rawmode(host)
+    sender = open_rawmode(host)
+
+    arrivals = {}
+    device_times = {}
+    thread = threading.Thread(
+        target=receive, args=(receiver, count, arrivals, device_times)
+    )
+    thread.start()
+
+    sent_at = {}
+    start = time.perf_counter()
+    for seq in range(count):
+        # Pace the frames evenly.
+        target = start + seq / rate
+        while time.perf_counter() < target:
+            pass
+        data = " ".join(f"{b:02X}" for b in struct.pack("<Q", seq))
+        sent_at[seq] = time.perf_counter()
+        sender.sendall(f"< send {CAN_ID:X} 8 {data} >".encode())
+    thread.join()
+    sender.close()
+    receiver.close()
+
+    received = sorted(arrivals)
+    if len(received) < 2:
+        sys.exit("Received fewer than 2 frames. Is the CAN bus connected?")
+
+    elapsed = arrivals[received[-1]] - arrivals[received[0]]
+    latencies = [(arrivals[s] - sent_at[s]) * 1e3 for s in received]
+    device_gaps = [
+        (device_times[b] - device_times[a]) / 1e3
+        for a, b in zip(received, received[1:])
+        if b == a + 1
+    ]
+
+    print(f"Sent {count} frames at {rate:.0f} frames/s.")
+    print(f"Received {len(received)}, lost {count - len(received)}.")
+    print(f"Throughput: {(len(received) - 1) / elapsed:.0f} frames/s")
+    print(
+        f"Latency (ms): mean {statistics.mean(latencies):.3f}, "
+        f"median {statistics.median(latencies):.3f}, "
+        f"max {max(latencies):.3f}, jitter {statistics.pstdev(latencies):.3f}"
+    )
+    if device_gaps:
+        print(
+            f"Adapter timestamp gaps (ms): mean {statistics.mean(device_gaps):.3f}, "
+            f"jitter {statistics.pstdev(device_gaps):.3f}"
+        )
+
+
+if __name__ == "__main__":
+    main()
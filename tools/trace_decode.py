@@ -0,0 +1,96 @@
+#!/usr/bin/env python3
+"""Decodes the adapter's binary flight-recorder trace into a timeline.
+
+Usage:
+    python3 trace_decode.py http://192.168.2.163/api/trace
+    python3 trace_decode.py trace.bin
+
+The format is described by `trace_record_t` and `trace_buffer_header_t`
+in `main/trace_buffer.h`.
+"""
+
+import socket
+import struct
+import sys
+import urllib.request
+
+HEADER = struct.Struct("<IHHIIq")
+RECORD = struct.Struct("<qIBBHII")
+MAGIC = 0x52544353
+
+TWAI_STATES = ["stopped", "running", "bus_off", "recovering"]
+OVERLOAD_POLICIES = ["none", "best_effort", "low_priority_ids", "throttle"]
+OVERLOAD_TRIGGERS = ["queue_fill", "twai_backlog", "twai_overrun", "cpu_load"]
+
+
+def ip(value):
+    return socket.inet_ntoa(struct.pack("<I", value))
+
+
+def describe(event, arg8, arg16, a, b):
+    if event == 1:
+        return f"client_accepted slot={arg8} ip={ip(a)}"
+    if event == 2:
+        return f"client_rejected ip={ip(a)}"
+    if event == 3:
+        return f"client_closed slot={arg8}"
+    if event == 4:
+        return f"handshake_failed slot={arg8} completed_phase={arg16}"
+    if event == 5:
+        return f"invalid_frame slot={arg8}"
+    if event == 6:
+        return f"rx_queue_full queue={arg8} id=0x{a:X}"
+    if event == 7:
+        return f"can_tx_failed slot={arg8} err=0x{a:X} id=0x{b:X}"
+    if event == 8:
+        state = TWAI_STATES[arg8] if arg8 < len(TWAI_STATES) else arg8
+        return f"can_state state={state} tec={a} rec={b}"
+    if event == 9:
+        return "can_recovery_started"
+    if event == 10:
+        return "can_restarted"
+    if event == 11:
+        policy = OVERLOAD_POLICIES[arg16] if arg16 < len(OVERLOAD_POLICIES) else arg16
+        triggers = [name for bit, name in enumerate(OVERLOAD_TRIGGERS) if a & (1 << bit)]
+        return (
+            f"overload_level level={arg8} policy={policy} "
+            f"triggers={','.join(triggers) or 'none'} "
+            f"cpu={b >> 8}% queues={b & 0xFF}%"
+        )
+    if event == 12:
+        return f"tx_rate_limited slot={arg8} id=0x{a:X}"
+    return f"unknown_event_{event} arg8={arg8} arg16={arg16} a=0x{a:X} b=0x{b:X}"
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit(__doc__)
+
+    source = sys.argv[1]
+    if source.startswith("http://"):
+        data = urllib.request.urlopen(source, timeout=10).read()
+    else:
+        with open(source, "rb") as f:
+            data = f.read()
+
+    magic, version, record_size, total, count, now_us = HEADER.unpack_from(data)
+    if magic != MAGIC or version != 1 or record_size != RECORD.size:
+        sys.exit("Not a version 1 adapter trace.")
+
+    print(f"{total} events recorded since boot, {count} in this trace.")
+    print(f"Trace taken at uptime {now_us / 1e6:.6f} s.")
+
+    last_seq = None
+    for offset in range(HEADER.size, HEADER.size + count * record_size, record_size):
+        ts, seq, event, arg8, arg16, a, b = RECORD.unpack_from(data, offset)
+        if event == 0:
+            # Overwritten while the trace was being downloaded.
+            continue
+        if last_seq is not None and seq != last_seq + 1:
+            print(f"{'':>16}  ... {seq - last_seq - 1} events lost ...")
+        last_seq = seq
+        print(f"{ts / 1e6:16.6f}  {describe(event, arg8, arg16, a, b)}")
+
+
+if __name__ == "__main__":
+    main()